@@ -35,10 +35,15 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <log.h>
 #include <linux/memfd.h>
 
 #include "vmmapi.h"
+#include "dm_string.h"
 
 extern char *vmname;
 
@@ -133,11 +138,40 @@ struct vm_mmap_mem_region {
 	vm_paddr_t fd_offset;
 	char *hva_base;
 	int fd;
+	size_t pg_size;
 };
 
 static struct vm_mmap_mem_region mmap_mem_regions[16];
 static int mem_idx;
 
+/* Guest memory is pre-faulted by up to PREFAULT_MAX_THREADS workers, each
+ * taking PREFAULT_CHUNK (or one huge page if larger) at a time. Workers run
+ * on the NUMA node(s) of the VM's pCPUs so that the huge pages get allocated
+ * there, see hugetlb_prefault_cpus().
+ */
+#define PREFAULT_MAX_THREADS	8
+#define PREFAULT_CHUNK		(64UL * 1024 * 1024)
+
+/* --prefault_threads, 0 to size it by the CPUs available */
+static int prefault_threads;
+/* --lazy_mem: prefault in the background, see vm_commit_memory() */
+static bool lazy_mem;
+
+struct prefault_work {
+	size_t chunk_len[ARRAY_SIZE(mmap_mem_regions)];
+	size_t chunk_end[ARRAY_SIZE(mmap_mem_regions)];	/* cumulative chunk count */
+	size_t nr_chunks;
+	size_t step;		/* report progress each step chunks */
+	size_t next;		/* next chunk to take */
+	size_t done;		/* chunks done */
+	uint64_t start_ms;
+	cpu_set_t cpus;
+};
+
+static struct prefault_work prefault;
+static pthread_t prefault_tids[PREFAULT_MAX_THREADS];
+static int prefault_nr_tids;
+
 static void *ptr;
 static size_t total_size;
 static int hugetlb_lv_max;
@@ -210,8 +244,7 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 		size_t offset, size_t skip, char **addr_out)
 {
 	char *addr;
-	size_t pagesz = 0;
-	int fd, i;
+	int fd;
 
 	if (level >= HUGETLB_LV_MAX) {
 		pr_err("exceed max hugetlb level");
@@ -237,22 +270,257 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 	mmap_mem_regions[mem_idx].fd = fd;
 	mmap_mem_regions[mem_idx].fd_offset = skip;
 	mmap_mem_regions[mem_idx].hva_base = addr;
+	mmap_mem_regions[mem_idx].pg_size = hugetlb_priv[level].pg_size;
 	mem_idx++;
 	pr_info("mmap 0x%lx@%p\n", len, addr);
 
-	/* pre-allocate hugepages by touch them */
-	pagesz = hugetlb_priv[level].pg_size;
+	/* hugepages are pre-allocated by hugetlb_prefault() */
+	return 0;
+}
+
+int hugetlb_parse_prefault(const char *opt)
+{
+	int threads;
+
+	if (dm_strtoi(opt, NULL, 10, &threads) || threads < 0 ||
+			threads > PREFAULT_MAX_THREADS) {
+		pr_err("prefault threads should be 0-%d\n", PREFAULT_MAX_THREADS);
+		return -1;
+	}
+
+	prefault_threads = threads;
+	return 0;
+}
+
+/* Add cpus in a sysfs cpulist like "0-3,8,10-11" to @set */
+static void parse_cpulist(const char *path, cpu_set_t *set)
+{
+	FILE *fp;
+	int first, last, cpu;
+	char sep;
 
-	pr_info("touch %ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	while (fscanf(fp, "%d", &first) == 1) {
+		last = first;
+		sep = (char)fgetc(fp);
+		if (sep == '-') {
+			if (fscanf(fp, "%d", &last) != 1)
+				break;
+			sep = (char)fgetc(fp);
+		}
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, set);
+		if (sep != ',')
+			break;
+	}
+
+	fclose(fp);
+}
+
+static int cpu_to_node(int cpu)
+{
+	char path[MAX_PATH_LEN];
+	struct dirent *entry;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir))) {
+		if (!strncmp(entry->d_name, "node", 4) &&
+				entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/*
+ * CPUs for the prefault workers: those of the DM that sit on the NUMA
+ * node(s) of the VM's pCPUs. The pCPUs of the VM themselves may be offline
+ * in the Service VM, but the node they belong to is still listed in sysfs.
+ * Fall back to all CPUs of the DM if the VM has no affinity or no CPU of
+ * the DM is on its node(s).
+ */
+static int hugetlb_prefault_cpus(cpu_set_t *cpus)
+{
+	uint64_t affinity = vm_get_cpu_affinity_dm();
+	cpu_set_t node_cpus, allowed;
+	char path[MAX_PATH_LEN];
+	uint64_t nodes = 0UL;
+	int cpu, node;
+
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+	*cpus = allowed;
+
+	for (cpu = 0; cpu < 64; cpu++) {
+		if (!(affinity & (1UL << cpu)))
+			continue;
+		node = cpu_to_node(cpu);
+		if (node >= 0 && node < 64)
+			nodes |= 1UL << node;
+	}
+	if (!nodes)
+		return 0;
+
+	CPU_ZERO(&node_cpus);
+	for (node = 0; node < 64; node++) {
+		if (!(nodes & (1UL << node)))
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		parse_cpulist(path, &node_cpus);
+	}
+
+	CPU_AND(&node_cpus, &node_cpus, &allowed);
+	if (CPU_COUNT(&node_cpus) > 0)
+		*cpus = node_cpus;
+	else
+		pr_info("prefault: no cpu on the vm's numa node(s), use any\n");
+
+	return 0;
+}
+
+static void prefault_chunk(struct prefault_work *work, size_t chunk)
+{
+	struct vm_mmap_mem_region *region;
+	volatile char *addr, *end;
+	size_t first = 0;
+	int i;
+
+	for (i = 0; i < mem_idx; i++) {
+		if (chunk < work->chunk_end[i])
+			break;
+		first = work->chunk_end[i];
+	}
+	if (i == mem_idx)
+		return;
+
+	region = &mmap_mem_regions[i];
+	addr = region->hva_base + (chunk - first) * work->chunk_len[i];
+	end = region->hva_base + (region->gpa_end - region->gpa_start);
+	if (end > addr + work->chunk_len[i])
+		end = addr + work->chunk_len[i];
 
 	/* Access to the address will trigger hugetlb_fault() in kernel,
 	 * it will allocate and clear the huge page.*/
-	for (i = 0; i < len/pagesz; i++) {
-		*(volatile char *)addr = *addr;
-		addr += pagesz;
+	for (; addr < end; addr += region->pg_size)
+		*addr = *addr;
+}
+
+static uint64_t prefault_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+static void prefault_chunk_done(struct prefault_work *work)
+{
+	size_t done = __atomic_add_fetch(&work->done, 1, __ATOMIC_RELAXED);
+
+	if (done == work->nr_chunks)
+		pr_info("prefault done in %lu ms\n", prefault_now_ms() - work->start_ms);
+	else if (done % work->step == 0)
+		pr_info("prefault: %lu%% done\n", done * 100 / work->nr_chunks);
+}
+
+static void *prefault_worker(void *arg)
+{
+	struct prefault_work *work = arg;
+	size_t chunk;
+
+	pthread_setaffinity_np(pthread_self(), sizeof(work->cpus), &work->cpus);
+
+	while ((chunk = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) <
+			work->nr_chunks) {
+		prefault_chunk(work, chunk);
+		prefault_chunk_done(work);
 	}
 
-	return 0;
+	return NULL;
+}
+
+/*
+ * Pre-allocate the huge pages of all mmaped regions. With @background, at
+ * least one worker is left running and hugetlb_prefault_wait() has to be
+ * called before the memory is mapped into the EPT or unmapped.
+ */
+static void hugetlb_prefault_start(bool background)
+{
+	struct prefault_work *work = &prefault;
+	size_t total = 0;
+	int i, nr_threads;
+
+	memset(work, 0, sizeof(*work));
+	for (i = 0; i < mem_idx; i++) {
+		size_t len = mmap_mem_regions[i].gpa_end - mmap_mem_regions[i].gpa_start;
+
+		work->chunk_len[i] = (mmap_mem_regions[i].pg_size > PREFAULT_CHUNK) ?
+					mmap_mem_regions[i].pg_size : PREFAULT_CHUNK;
+		work->nr_chunks += (len + work->chunk_len[i] - 1) / work->chunk_len[i];
+		work->chunk_end[i] = work->nr_chunks;
+		total += len;
+	}
+	work->step = (work->nr_chunks / 10) ? (work->nr_chunks / 10) : 1;
+
+	if (hugetlb_prefault_cpus(&work->cpus))
+		CPU_ZERO(&work->cpus);
+
+	nr_threads = prefault_threads;
+	if (nr_threads == 0)
+		nr_threads = CPU_COUNT(&work->cpus);
+	if (nr_threads > PREFAULT_MAX_THREADS)
+		nr_threads = PREFAULT_MAX_THREADS;
+	if (nr_threads > work->nr_chunks)
+		nr_threads = work->nr_chunks;
+	if (CPU_COUNT(&work->cpus) == 0)
+		nr_threads = 0;
+	else if (background && nr_threads < 1)
+		nr_threads = 1;
+	else if (!background && nr_threads < 2)
+		nr_threads = 0;
+
+	pr_info("prefault 0x%lx bytes in %lu chunks with %d threads%s\n",
+			total, work->nr_chunks, nr_threads,
+			background ? " in background" : "");
+	work->start_ms = prefault_now_ms();
+
+	prefault_nr_tids = 0;
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&prefault_tids[i], NULL, prefault_worker, work))
+			break;
+		pthread_setname_np(prefault_tids[i], "prefault");
+		prefault_nr_tids++;
+	}
+
+	/* no worker: fault them right here */
+	if (prefault_nr_tids == 0) {
+		for (; work->next < work->nr_chunks; work->next++) {
+			prefault_chunk(work, work->next);
+			prefault_chunk_done(work);
+		}
+	}
+}
+
+static void hugetlb_prefault_wait(void)
+{
+	int i;
+
+	for (i = 0; i < prefault_nr_tids; i++)
+		pthread_join(prefault_tids[i], NULL);
+	prefault_nr_tids = 0;
 }
 
 static int mmap_hugetlbfs(struct vmctx *ctx, size_t offset,
@@ -605,6 +873,37 @@ void uninit_hugetlb(void)
 	close(lock_fd);
 }
 
+static int hugetlb_map_ept(struct vmctx *ctx)
+{
+	/* map ept for lowmem */
+	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
+		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
+		return -1;
+
+	/* map ept for biosmem */
+	if (ctx->biosmem > 0) {
+		/*
+		 * The High BIOS region can behave as RAM and be
+		 * modified by the boot firmware itself (e.g. OVMF
+		 * NV data storage region).
+		 */
+		if (vm_map_memseg_vma(ctx, ctx->biosmem, 4 * GB - ctx->biosmem,
+			(uint64_t)(ctx->baseaddr + 4 * GB - ctx->biosmem),
+			PROT_ALL) < 0)
+		return -1;
+	}
+
+	/* map ept for highmem */
+	if (ctx->highmem > 0) {
+		if (vm_map_memseg_vma(ctx, ctx->highmem, ctx->highmem_gpa_base,
+			(uint64_t)(ctx->baseaddr + ctx->highmem_gpa_base),
+			PROT_ALL) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 int hugetlb_setup_memory(struct vmctx *ctx)
 {
 	int level;
@@ -766,6 +1065,12 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		goto err_lock;
 	}
 
+	/* pre-allocate hugepages by touching them, so the guest never waits
+	 * on a first-touch hugetlb fault. Pages are reserved by the mmaps
+	 * above already, so a background prefault can outlive the lock.
+	 */
+	hugetlb_prefault_start(lazy_mem);
+
 	/* resize the memfd to meet with the size requirement and add the
 	 * F_SEAL_SEAL flag
 	 */
@@ -803,37 +1108,16 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 			hugetlb_priv[level].highmem);
 	}
 
-	/* map ept for lowmem */
-	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
-		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
-		goto err;
-
-	/* map ept for biosmem */
-	if (ctx->biosmem > 0) {
-		/*
-		 * The High BIOS region can behave as RAM and be
-		 * modified by the boot firmware itself (e.g. OVMF
-		 * NV data storage region).
-		 */
-		if (vm_map_memseg_vma(ctx, ctx->biosmem, 4 * GB - ctx->biosmem,
-			(uint64_t)(ctx->baseaddr + 4 * GB - ctx->biosmem),
-			PROT_ALL) < 0)
+	/* with --lazy_mem, the memory is mapped by vm_commit_memory() */
+	if (!lazy_mem && hugetlb_map_ept(ctx) < 0)
 		goto err;
-	}
-
-	/* map ept for highmem */
-	if (ctx->highmem > 0) {
-		if (vm_map_memseg_vma(ctx, ctx->highmem, ctx->highmem_gpa_base,
-			(uint64_t)(ctx->baseaddr + ctx->highmem_gpa_base),
-			PROT_ALL) < 0)
-			goto err;
-	}
 
 	return 0;
 
 err_lock:
 	unlock_acrn_hugetlb();
 err:
+	hugetlb_prefault_wait();
 	if (ptr) {
 		munmap(ptr, total_size);
 		ptr = NULL;
@@ -845,10 +1129,27 @@ err:
 	return -ENOMEM;
 }
 
+/* Wait for a background prefault and map the guest memory into the EPT */
+int hugetlb_commit_memory(struct vmctx *ctx)
+{
+	if (!lazy_mem)
+		return 0;
+
+	hugetlb_prefault_wait();
+	return hugetlb_map_ept(ctx);
+}
+
+void hugetlb_enable_lazy_mem(void)
+{
+	lazy_mem = true;
+}
+
 void hugetlb_unsetup_memory(struct vmctx *ctx)
 {
 	int level;
 
+	hugetlb_prefault_wait();
+
 	if (total_size > 0) {
 		munmap(ptr, total_size);
 		total_size = 0;
@@ -860,6 +1161,24 @@ void hugetlb_unsetup_memory(struct vmctx *ctx)
 	}
 }
 
+static struct vm_mmap_mem_region *
+hugetlb_find_region(struct vmctx *ctx, vm_paddr_t gpa)
+{
+	int i;
+
+	/* only lowmem and highmem are handed to the guest as plain RAM */
+	if (gpa >= ctx->lowmem && (gpa < ctx->highmem_gpa_base ||
+			gpa >= ctx->highmem_gpa_base + ctx->highmem))
+		return NULL;
+
+	for (i = 0; i < mem_idx; i++) {
+		if ((gpa >= mmap_mem_regions[i].gpa_start) &&
+			(gpa < mmap_mem_regions[i].gpa_end))
+			return &mmap_mem_regions[i];
+	}
+	return NULL;
+}
+
 bool
 vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 			struct vm_mem_region *ret_region)
@@ -888,6 +1207,30 @@ vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 	return ret;
 }
 
+/*
+ * Copy out the memfd backed guest RAM regions, so that another process can
+ * map the guest memory. Returns the number of regions.
+ */
+int
+vm_get_memfd_regions(struct vmctx *ctx, struct vm_memfd_region *regions,
+			int nr)
+{
+	int i, n = 0;
+
+	for (i = 0; i < mem_idx && n < nr; i++) {
+		if (!hugetlb_find_region(ctx, mmap_mem_regions[i].gpa_start))
+			continue;
+		regions[n].gpa = mmap_mem_regions[i].gpa_start;
+		regions[n].len = mmap_mem_regions[i].gpa_end -
+				mmap_mem_regions[i].gpa_start;
+		regions[n].fd_offset = mmap_mem_regions[i].fd_offset;
+		regions[n].fd = mmap_mem_regions[i].fd;
+		n++;
+	}
+
+	return n;
+}
+
 bool vm_allow_dmabuf(struct vmctx *ctx)
 {
 	uint32_t mem_flags;
@@ -73,13 +73,15 @@ iothread_start(struct iothread_ctx *ioctx_x)
 		return 0;
 	}
 
+	/* io_thread() leaves its loop as soon as it sees started clear */
+	ioctx_x->started = true;
 	if (pthread_create(&ioctx_x->tid, NULL, io_thread, ioctx_x) != 0) {
+		ioctx_x->started = false;
 		pthread_mutex_unlock(&ioctx_x->mtx);
 		pr_err("%s", "iothread create failed\r\n");
 		return -1;
 	}
 
-	ioctx_x->started = true;
 	pthread_setname_np(ioctx_x->tid, ioctx_x->name);
 
 	if (CPU_COUNT(&(ioctx_x->cpuset)) != 0) {
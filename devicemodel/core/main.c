@@ -156,7 +156,7 @@ usage(int code)
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval]\n"
 		"       %*s [--cpu_affinity lapic_id] [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
-		"       %*s [--ssram] <vm>\n"
+		"       %*s [--ssram] [--prefault_threads threads] [--lazy_mem] <vm>\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
 		"       -h: help\n"
@@ -186,7 +186,11 @@ usage(int code)
 		"       --logger_setting: params like console,level=4;kmsg,level=3\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
 		"            for windows guest with secure boot\n"
-		"       --virtio_msi: force virtio to use single-vector MSI\n",
+		"       --virtio_msi: force virtio to use single-vector MSI\n"
+		"       --prefault_threads: threads to pre-allocate guest memory with, 0-8,\n"
+		"            0 (default) for the CPUs on the NUMA node(s) of the vm\n"
+		"       --lazy_mem: allocate guest memory in the background while devices\n"
+		"            are set up, and map it into the vm right before it runs\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
@@ -759,7 +763,9 @@ vm_suspend_resume(struct vmctx *ctx)
 
 	vm_clear_ioreq(ctx);
 	vm_stop_watchdog(ctx);
+	monitor_notify_state(VM_SUSPEND_SUSPEND);
 	wait_for_resume(ctx);
+	monitor_notify_state(VM_SUSPEND_NONE);
 
 	pm_backto_wakeup(ctx);
 	vm_reset_watchdog(ctx);
@@ -884,6 +890,8 @@ enum {
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
 	CMD_OPT_FORCE_VIRTIO_MSI,
+	CMD_OPT_PREFAULT_THREADS,
+	CMD_OPT_LAZY_MEM,
 };
 
 static struct option long_options[] = {
@@ -927,6 +935,8 @@ static struct option long_options[] = {
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
 	{"virtio_msi",		no_argument,		0, CMD_OPT_FORCE_VIRTIO_MSI},
+	{"prefault_threads",	required_argument,	0, CMD_OPT_PREFAULT_THREADS},
+	{"lazy_mem",		no_argument,		0, CMD_OPT_LAZY_MEM},
 	{0,			0,			0,  0  },
 };
 
@@ -1060,6 +1070,13 @@ main(int argc, char *argv[])
 		case CMD_OPT_TRUSTY_ENABLE:
 			trusty_enabled = 1;
 			break;
+		case CMD_OPT_PREFAULT_THREADS:
+			if (hugetlb_parse_prefault(optarg) != 0)
+				errx(EX_USAGE, "invalid prefault threads %s", optarg);
+			break;
+		case CMD_OPT_LAZY_MEM:
+			hugetlb_enable_lazy_mem();
+			break;
 		case CMD_OPT_VIRTIO_POLL_ENABLE:
 			if (acrn_parse_virtio_poll_interval(optarg) != 0) {
 				errx(EX_USAGE,
@@ -1267,6 +1284,13 @@ main(int argc, char *argv[])
 		 */
 		/*setproctitle("%s", vmname);*/
 
+		pr_notice("vm_commit_memory\n");
+		error = vm_commit_memory(ctx);
+		if (error) {
+			pr_err("Unable to map memory (%d)\n", errno);
+			goto vm_fail;
+		}
+
 		/*
 		 * Add CPU 0
 		 */
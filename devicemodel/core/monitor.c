@@ -271,6 +271,31 @@ int set_wakeup_timer(time_t t)
 	return ack.data.err;
 }
 
+/* Push our VM_SUSPEND_* mode to acrnd, so it needn't poll with DM_QUERY */
+void monitor_notify_state(int state)
+{
+	int acrnd_fd;
+	struct mngr_msg req;
+
+	acrnd_fd = mngr_open_un(ACRND_NAME, MNGR_CLIENT);
+	if (acrnd_fd < 0)
+		return;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_NOTIFY;
+	req.timestamp = time(NULL);
+
+	memset(req.data.dm_notify.name, 0, sizeof(req.data.dm_notify.name));
+	strncpy(req.data.dm_notify.name, vmname,
+			sizeof(req.data.dm_notify.name) - 1);
+	req.data.dm_notify.state = state;
+
+	/* no ack, acrnd may be busy talking to this very DM */
+	if (mngr_send_msg(acrnd_fd, &req, NULL, 2))
+		pr_err("%s: failed to notify acrnd\n", __func__);
+	mngr_close(acrnd_fd);
+}
+
 static LIST_HEAD(vm_ops_list, vm_ops) vm_ops_head;
 static pthread_mutex_t vm_ops_mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -450,6 +475,33 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_balloon(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->balloon) {
+			ret += ops->ops->balloon(ops->arg, msg->data.balloon_mb);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -490,6 +542,7 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_RESUME, handle_resume, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BALLOON, handle_balloon, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
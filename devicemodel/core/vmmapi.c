@@ -389,6 +389,17 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 	return hugetlb_setup_memory(ctx);
 }
 
+/*
+ * With --lazy_mem, vm_setup_memory() returns while guest memory is still
+ * being populated in the background, this waits for it and maps the memory
+ * into the EPT. Must be called before any vCPU runs.
+ */
+int
+vm_commit_memory(struct vmctx *ctx)
+{
+	return hugetlb_commit_memory(ctx);
+}
+
 void
 vm_unsetup_memory(struct vmctx *ctx)
 {
@@ -119,6 +119,7 @@ struct blockif_queue {
 	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
 
 	int			in_flight;
+	int			plugged;	/* hold off ops->request */
 	struct io_uring		ring;
 	struct iothread_mevent	iomvt;
 	struct iothread_ctx	*ioctx;
@@ -1039,9 +1040,8 @@ is_io_uring_supported_op(enum blockop op)
 }
 
 static int
-iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
+iou_prep_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 {
-	int ret;
 	struct io_uring *ring = &bq->ring;
 	struct io_uring_sqe *sqes = io_uring_get_sqe(ring);
 	struct blockif_req *br = be->req;
@@ -1087,25 +1087,27 @@ iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 
 	io_uring_sqe_set_data(sqes, be);
 	bq->in_flight++;
-	ret = io_uring_submit(ring);
-	if (ret < 0) {
-		pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-ret));
-	}
 
-	return ret;
+	return 0;
 }
 
+/*
+ * Prepare an SQE for every pending request and hand them all to the
+ * kernel with a single io_uring_submit().
+ */
 static void
 iou_submit(struct blockif_queue *bq)
 {
-	int err = 0;
+	int err = 0, nr_sqes = 0;
 	struct blockif_elem *be;
 	struct blockif_req *br;
 	struct blockif_ctxt *bc = bq->bc;
 
 	while (blockif_dequeue(bq, 0, &be)) {
 		if (is_io_uring_supported_op(be->op)) {
-			err = iou_submit_sqe(bq, be);
+			err = iou_prep_sqe(bq, be);
+			if (!err)
+				nr_sqes++;
 
 			/*
 			 * -1 means that there is NO available submission queue entry (SQE) in the submission queue.
@@ -1127,6 +1129,12 @@ iou_submit(struct blockif_queue *bq)
 			blockif_complete(bq, be);
 		}
 	}
+
+	if (nr_sqes > 0) {
+		err = io_uring_submit(&bq->ring);
+		if (err < 0)
+			pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-err));
+	}
 	return;
 }
 
@@ -1687,7 +1695,7 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * that there is work available
 		 */
 		if (blockif_enqueue(bq, breq, op)) {
-			if (bc->ops->request) {
+			if (bc->ops->request && !bq->plugged) {
 				bc->ops->request(bq);
 			}
 		}
@@ -1706,6 +1714,45 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return err;
 }
 
+/*
+ * Between blockif_plug() and blockif_unplug() requests on the queue are
+ * only queued, and then dispatched together, e.g. in a single
+ * io_uring_submit(), when the caller is done with its batch.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+
+	if (qidx >= bc->bq_num)
+		return;
+	bq = bc->bqs + qidx;
+
+	if (bc->ops->mutex_lock)
+		bc->ops->mutex_lock(&bq->mtx);
+	bq->plugged = 1;
+	if (bc->ops->mutex_unlock)
+		bc->ops->mutex_unlock(&bq->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+
+	if (qidx >= bc->bq_num)
+		return;
+	bq = bc->bqs + qidx;
+
+	if (bc->ops->mutex_lock)
+		bc->ops->mutex_lock(&bq->mtx);
+	bq->plugged = 0;
+	if (bc->ops->request && !TAILQ_EMPTY(&bq->pendq))
+		bc->ops->request(bq);
+	if (bc->ops->mutex_unlock)
+		bc->ops->mutex_unlock(&bq->mtx);
+}
+
 int
 blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
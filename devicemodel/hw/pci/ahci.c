@@ -113,6 +113,14 @@ struct ahci_ioreq {
 	uint32_t done;
 	int slot;
 	int more;
+
+	/*
+	 * Adjacent NCQ commands merged into this request: their slots, the
+	 * command FIS of each and the byte offset right after the last one.
+	 */
+	uint32_t merged;
+	uint8_t *mcfis[32];
+	uint64_t mend;
 };
 
 struct ahci_port {
@@ -132,6 +140,8 @@ struct ahci_port {
 	uint8_t asc;
 	u_int ccs;
 	uint32_t pending;
+	int merging;			/* inside the ahci_handle_port() scan */
+	struct ahci_ioreq *staged;	/* NCQ request waiting for merges */
 
 	uint32_t clb;
 	uint32_t clbu;
@@ -351,11 +361,17 @@ ahci_write_fis_piosetup(struct ahci_port *p)
 	ahci_write_fis(p, FIS_TYPE_PIOSETUP, fis);
 }
 
+/*
+ * Report the completion of the NCQ commands in 'slots' with one Set Device
+ * Bits FIS. On error 'slots' holds the single failed command.
+ */
 static void
-ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
+ahci_write_fis_sdb(struct ahci_port *p, uint32_t slots, uint8_t *cfis,
+		   uint32_t tfd)
 {
 	uint8_t fis[8];
 	uint8_t error;
+	int slot = ffs(slots) - 1;
 
 	error = (tfd >> 8) & 0xff;
 	tfd &= 0x77;
@@ -370,8 +386,8 @@ ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 		p->err_cfis[3] = error;
 		memcpy(&p->err_cfis[4], cfis + 4, 16);
 	} else {
-		*(uint32_t *)(fis + 4) = (1 << slot);
-		p->sact &= ~(1 << slot);
+		*(uint32_t *)(fis + 4) = slots;
+		p->sact &= ~slots;
 	}
 	p->tfd &= ~0x77;
 	p->tfd |= tfd;
@@ -485,14 +501,14 @@ ahci_port_stop(struct ahci_port *p)
 		if (cfis[2] == ATA_WRITE_FPDMA_QUEUED ||
 		    cfis[2] == ATA_READ_FPDMA_QUEUED ||
 		    cfis[2] == ATA_SEND_FPDMA_QUEUED)
-			p->sact &= ~(1 << slot);	/* NCQ */
+			p->sact &= ~((1 << slot) | aior->merged);	/* NCQ */
 		else
 			p->ci &= ~(1 << slot);
 
 		/*
 		 * This command is now done.
 		 */
-		p->pending &= ~(1 << slot);
+		p->pending &= ~((1 << slot) | aior->merged);
 
 		/*
 		 * Delete the blockif request from the busy list
@@ -641,6 +657,66 @@ ahci_build_iov(struct ahci_port *p, struct ahci_ioreq *aior,
 	aior->more = (aior->done < aior->len && i < prdtl);
 }
 
+static inline uint32_t
+ahci_ncq_len(struct ahci_port *p, uint8_t *cfis)
+{
+	uint32_t len;
+
+	len = cfis[11] << 8 | cfis[3];
+	if (!len)
+		len = 65536;
+	return len * blockif_sectsz(p->bctx);
+}
+
+/*
+ * Append NCQ request 'aior' to the staged one if it continues it on disk in
+ * the same direction, and give 'aior' back to the free list.
+ */
+static bool
+ahci_try_merge(struct ahci_port *p, struct ahci_ioreq *aior)
+{
+	struct ahci_ioreq *st = p->staged;
+	struct blockif_req *sbr, *br;
+
+	if (st == NULL || st->cfis[2] != aior->cfis[2])
+		return false;
+
+	sbr = &st->io_req;
+	br = &aior->io_req;
+	if (st->mend != br->offset ||
+	    sbr->iovcnt + br->iovcnt > BLOCKIF_IOV_MAX)
+		return false;
+
+	memcpy(&sbr->iov[sbr->iovcnt], br->iov, br->iovcnt * sizeof(br->iov[0]));
+	sbr->iovcnt += br->iovcnt;
+	sbr->resid += br->resid;
+	st->mend += br->resid;
+	st->merged |= 1 << aior->slot;
+	st->mcfis[aior->slot] = aior->cfis;
+
+	STAILQ_INSERT_TAIL(&p->iofhd, aior, io_flist);
+	return true;
+}
+
+static void
+ahci_submit_staged(struct ahci_port *p)
+{
+	struct ahci_ioreq *aior = p->staged;
+	int err;
+
+	if (aior == NULL)
+		return;
+	p->staged = NULL;
+
+	TAILQ_INSERT_HEAD(&p->iobhd, aior, io_blist);
+	if (aior->cfis[2] == ATA_READ_FPDMA_QUEUED)
+		err = blockif_read(p->bctx, &aior->io_req);
+	else
+		err = blockif_write(p->bctx, &aior->io_req);
+	if (err)
+		WPRINTF("%s: blockif read or write error\n", __func__);
+}
+
 static void
 ahci_handle_rw(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t done)
 {
@@ -705,6 +781,7 @@ ahci_handle_rw(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t done)
 		return;
 	}
 	STAILQ_REMOVE_HEAD(&p->iofhd, io_flist);
+	aior->merged = 0;
 
 	aior->cfis = cfis;
 	aior->slot = slot;
@@ -713,16 +790,29 @@ ahci_handle_rw(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t done)
 	breq = &aior->io_req;
 	breq->offset = lba + done;
 	ahci_build_iov(p, aior, prdt, hdr->prdtl);
+	aior->mend = breq->offset + breq->resid;
 
 	/* Mark this command in-flight. */
 	p->pending |= 1 << slot;
 
-	/* Stuff request onto busy list. */
-	TAILQ_INSERT_HEAD(&p->iobhd, aior, io_blist);
-
 	if (ncq && first)
 		ahci_write_fis_d2h_ncq(p, slot);
 
+	/*
+	 * While scanning the command list, hold back complete NCQ commands
+	 * so that the ones that follow them on disk can join the request.
+	 */
+	if (ncq && first && !aior->more && p->merging) {
+		if (ahci_try_merge(p, aior))
+			return;
+		ahci_submit_staged(p);
+		p->staged = aior;
+		return;
+	}
+
+	/* Stuff request onto busy list. */
+	TAILQ_INSERT_HEAD(&p->iobhd, aior, io_blist);
+
 	if (readop)
 		err = blockif_read(p->bctx, breq);
 	else
@@ -747,6 +837,7 @@ ahci_handle_flush(struct ahci_port *p, int slot, uint8_t *cfis)
 		return;
 	}
 	STAILQ_REMOVE_HEAD(&p->iofhd, io_flist);
+	aior->merged = 0;
 	aior->cfis = cfis;
 	aior->slot = slot;
 	aior->len = 0;
@@ -840,7 +931,7 @@ next:
 			if (ncq) {
 				if (first)
 					ahci_write_fis_d2h_ncq(p, slot);
-				ahci_write_fis_sdb(p, slot, cfis,
+				ahci_write_fis_sdb(p, 1 << slot, cfis,
 				    ATA_S_READY | ATA_S_DSC);
 			} else {
 				ahci_write_fis_d2h(p, slot, cfis,
@@ -864,6 +955,7 @@ next:
 		return;
 	}
 	STAILQ_REMOVE_HEAD(&p->iofhd, io_flist);
+	aior->merged = 0;
 	aior->cfis = cfis;
 	aior->slot = slot;
 	aior->len = len;
@@ -1424,6 +1516,7 @@ atapi_read(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t done)
 		return;
 	}
 	STAILQ_REMOVE_HEAD(&p->iofhd, io_flist);
+	aior->merged = 0;
 	aior->cfis = cfis;
 	aior->slot = slot;
 	aior->len = len;
@@ -1868,6 +1961,11 @@ ahci_handle_port(struct ahci_port *p)
 	if (!(p->cmd & AHCI_P_CMD_ST))
 		return;
 
+	/* Hand all newly issued commands to block_if as one batch */
+	if (p->bctx)
+		blockif_plug(p->bctx, 0);
+	p->merging = 1;
+
 	/*
 	 * Search for any new commands to issue ignoring those that
 	 * are already in-flight.  Stop if device is busy or in error.
@@ -1883,6 +1981,42 @@ ahci_handle_port(struct ahci_port *p)
 			ahci_handle_slot(p, p->ccs);
 		}
 	}
+
+	p->merging = 0;
+	ahci_submit_staged(p);
+	if (p->bctx)
+		blockif_unplug(p->bctx, 0);
+}
+
+/* Fill in the byte counts of the commands merged into 'aior' */
+static void
+ahci_complete_merged(struct ahci_port *p, struct ahci_ioreq *aior)
+{
+	struct ahci_cmd_hdr *hdr;
+	uint32_t merged = aior->merged;
+	int slot;
+
+	while (merged) {
+		slot = ffs(merged) - 1;
+		merged &= ~(1 << slot);
+		hdr = (struct ahci_cmd_hdr *)(p->cmd_lst + slot * AHCI_CL_SIZE);
+		hdr->prdbc = ahci_ncq_len(p, aior->mcfis[slot]);
+	}
+}
+
+/* Resubmit the commands of a failed merged request separately */
+static void
+ahci_split_merged(struct ahci_port *p, struct ahci_ioreq *aior)
+{
+	uint32_t merged = aior->merged;
+	int slot;
+
+	ahci_handle_rw(p, aior->slot, aior->cfis, 0);
+	while (merged) {
+		slot = ffs(merged) - 1;
+		merged &= ~(1 << slot);
+		ahci_handle_rw(p, slot, aior->mcfis[slot], 0);
+	}
 }
 
 /*
@@ -1931,6 +2065,15 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 	 */
 	STAILQ_INSERT_TAIL(&p->iofhd, aior, io_flist);
 
+	if (err && aior->merged) {
+		/*
+		 * Redo the merged commands one by one, so that the error is
+		 * reported for the command that actually failed.
+		 */
+		ahci_split_merged(p, aior);
+		goto out;
+	}
+
 	if (!err)
 		hdr->prdbc = aior->done;
 
@@ -1946,15 +2089,17 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 		tfd = ATA_S_READY | ATA_S_DSC;
 	else
 		tfd = (ATA_E_ABORT << 8) | ATA_S_READY | ATA_S_ERROR;
+	if (ncq && !err && aior->merged)
+		ahci_complete_merged(p, aior);
 	if (ncq)
-		ahci_write_fis_sdb(p, slot, cfis, tfd);
+		ahci_write_fis_sdb(p, (1 << slot) | aior->merged, cfis, tfd);
 	else
 		ahci_write_fis_d2h(p, slot, cfis, tfd);
 
 	/*
 	 * This command is now complete.
 	 */
-	p->pending &= ~(1 << slot);
+	p->pending &= ~((1 << slot) | aior->merged);
 
 	ahci_check_stopped(p);
 	ahci_handle_port(p);
@@ -27,6 +27,7 @@
  */
 
 #include <sys/user.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -35,6 +36,7 @@
 #include <strings.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 #include "dm.h"
 #include "vmmapi.h"
@@ -108,6 +110,8 @@ static void pci_lintr_update(struct pci_vdev *dev);
 static void pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot,
 		      int func, int coff, int bytes, uint32_t *val);
 static void pci_emul_free_msixcap(struct pci_vdev *pdi);
+static void pci_msix_irqfd_sync(struct pci_vdev *dev, int index);
+static void pci_msix_irqfd_sync_all(struct pci_vdev *dev);
 
 int compare_io_rgns(const void *data1, const void *data2)
 {
@@ -418,6 +422,8 @@ pci_emul_msix_twrite(struct pci_vdev *dev, uint64_t offset, int size,
 	else
 		*((uint64_t *)dest) = value;
 
+	pci_msix_irqfd_sync(dev, tab_index);
+
 	return 0;
 }
 
@@ -1271,6 +1277,26 @@ pci_emul_add_msixcap(struct pci_vdev *dev, int msgnum, int barnum)
 static void
 pci_emul_free_msixcap(struct pci_vdev *pdi)
 {
+	struct acrn_irqfd irqfd;
+	int i;
+
+	if (pdi->msix.irqfd) {
+		for (i = 0; i < pdi->msix.table_count; i++) {
+			if (pdi->msix.irqfd[i].assigned) {
+				irqfd.fd = pdi->msix.irqfd[i].fd;
+				irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
+				irqfd.msi.msi_addr = pdi->msix.irqfd[i].addr;
+				irqfd.msi.msi_data = pdi->msix.irqfd[i].data;
+				vm_irqfd(pdi->vmctx, &irqfd);
+			}
+			if (pdi->msix.irqfd[i].fd >= 0)
+				close(pdi->msix.irqfd[i].fd);
+		}
+		free(pdi->msix.irqfd);
+		pdi->msix.irqfd = NULL;
+		pthread_mutex_destroy(&pdi->msix.irqfd_mtx);
+	}
+
 	if (pdi->msix.table) {
 		free(pdi->msix.table);
 		pdi->msix.table = NULL;
@@ -1301,6 +1327,7 @@ msixcap_cfgwrite(struct pci_vdev *dev, int capoff, int offset,
 	}
 
 	CFGWRITE(dev, offset, val, bytes);
+	pci_msix_irqfd_sync_all(dev);
 }
 
 void
@@ -1338,6 +1365,8 @@ msicap_cfgwrite(struct pci_vdev *dev, int capoff, int offset,
 			dev->msi.maxmsgnum = 0;
 		}
 		pci_lintr_update(dev);
+		/* MSI takes precedence over MSI-X, see pci_msix_enabled() */
+		pci_msix_irqfd_sync_all(dev);
 	}
 
 	CFGWRITE(dev, offset, val, bytes);
@@ -2019,10 +2048,22 @@ pci_generate_msix(struct pci_vdev *dev, int index)
 	if (!pci_msix_enabled(dev))
 		return;
 
-	if (dev->msix.function_mask)
+	if (index >= dev->msix.table_count)
 		return;
 
-	if (index >= dev->msix.table_count)
+	/*
+	 * In irqfd mode the eventfd stays signaled while the vector or the
+	 * function is masked, and the hypervisor injects it as soon as the
+	 * irqfd is bound again on unmask. A vector whose irqfd couldn't be
+	 * bound is injected directly.
+	 */
+	if (dev->msix.irqfd &&
+	    !__atomic_load_n(&dev->msix.irqfd[index].fallback, __ATOMIC_ACQUIRE)) {
+		eventfd_write(dev->msix.irqfd[index].fd, 1);
+		return;
+	}
+
+	if (dev->msix.function_mask)
 		return;
 
 	mte = &dev->msix.table[index];
@@ -2032,6 +2073,137 @@ pci_generate_msix(struct pci_vdev *dev, int index)
 	}
 }
 
+/*
+ * Bring the irqfd of MSI-X entry 'index' in line with the current table,
+ * MSI-X enable and mask state. Must be called after any change to them.
+ */
+static void
+pci_msix_irqfd_sync(struct pci_vdev *dev, int index)
+{
+	struct msix_table_entry *mte;
+	struct msix_irqfd *mif;
+	struct acrn_irqfd irqfd;
+	eventfd_t cnt;
+	bool want, fallback = false;
+
+	if (!dev->msix.irqfd || index >= dev->msix.table_count)
+		return;
+
+	mte = &dev->msix.table[index];
+	mif = &dev->msix.irqfd[index];
+	want = pci_msix_enabled(dev) && !dev->msix.function_mask &&
+		!(mte->vector_control & PCIM_MSIX_VCTRL_MASK) &&
+		mte->addr != 0;
+
+	pthread_mutex_lock(&dev->msix.irqfd_mtx);
+	if (mif->assigned && (!want || mif->addr != mte->addr ||
+			mif->data != mte->msg_data)) {
+		irqfd.fd = mif->fd;
+		irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
+		irqfd.msi.msi_addr = mif->addr;
+		irqfd.msi.msi_data = mif->data;
+		vm_irqfd(dev->vmctx, &irqfd);
+		mif->assigned = false;
+		/*
+		 * Don't drain the eventfd: I/O threads may signal it right
+		 * now, and that interrupt would be lost. At worst it is
+		 * delivered twice once the irqfd is bound again.
+		 */
+	}
+
+	if (want && !mif->assigned) {
+		irqfd.fd = mif->fd;
+		irqfd.flags = 0;
+		irqfd.msi.msi_addr = mte->addr;
+		irqfd.msi.msi_data = mte->msg_data;
+		if (vm_irqfd(dev->vmctx, &irqfd) == 0) {
+			mif->addr = mte->addr;
+			mif->data = mte->msg_data;
+			mif->assigned = true;
+		} else {
+			pr_err("%s: vm_irqfd for vector %d failed, errno %d\n",
+				__func__, index, errno);
+			fallback = true;
+		}
+	}
+	__atomic_store_n(&mif->fallback, fallback, __ATOMIC_RELEASE);
+
+	/* an interrupt held back while unbound is not lost on fallback */
+	if (fallback && eventfd_read(mif->fd, &cnt) == 0)
+		vm_lapic_msi(dev->vmctx, mte->addr, mte->msg_data);
+	pthread_mutex_unlock(&dev->msix.irqfd_mtx);
+}
+
+static void
+pci_msix_irqfd_sync_all(struct pci_vdev *dev)
+{
+	int i;
+
+	if (!dev->msix.irqfd)
+		return;
+
+	for (i = 0; i < dev->msix.table_count; i++)
+		pci_msix_irqfd_sync(dev, i);
+}
+
+/**
+ * @brief Deliver MSI-X interrupts of a virtual PCI device through irqfds
+ *
+ * @param dev Pointer to struct pci_vdev representing virtual PCI device.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int
+pci_msix_irqfd_enable(struct pci_vdev *dev)
+{
+	struct msix_irqfd *mif;
+	struct acrn_irqfd irqfd;
+	int i, fd;
+
+	if (dev->msix.irqfd)
+		return 0;
+	if (!dev->msix.table || dev->msix.table_count <= 0)
+		return -1;
+
+	mif = calloc(dev->msix.table_count, sizeof(*mif));
+	if (!mif)
+		return -1;
+	for (i = 0; i < dev->msix.table_count; i++)
+		mif[i].fd = -1;
+
+	for (i = 0; i < dev->msix.table_count; i++) {
+		mif[i].fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mif[i].fd < 0)
+			goto fail;
+	}
+
+	/*
+	 * Probe once with a throwaway binding so that kernels without
+	 * irqfd support keep using the vm_lapic_msi() path.
+	 */
+	fd = mif[0].fd;
+	irqfd.fd = fd;
+	irqfd.flags = 0;
+	irqfd.msi.msi_addr = 0xfee00000UL;
+	irqfd.msi.msi_data = 0;
+	if (vm_irqfd(dev->vmctx, &irqfd) < 0)
+		goto fail;
+	irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
+	vm_irqfd(dev->vmctx, &irqfd);
+
+	pthread_mutex_init(&dev->msix.irqfd_mtx, NULL);
+	dev->msix.irqfd = mif;
+	pci_msix_irqfd_sync_all(dev);
+	return 0;
+
+fail:
+	for (i = 0; i < dev->msix.table_count; i++)
+		if (mif[i].fd >= 0)
+			close(mif[i].fd);
+	free(mif);
+	return -1;
+}
+
 /**
  * @brief Generate a MSI interrupt to guest
  *
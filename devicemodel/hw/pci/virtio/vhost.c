@@ -68,13 +68,6 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 	}
 }
 
-static int
-vhost_kernel_set_mem_table(struct vhost_dev *vdev,
-			   struct vhost_memory *mem)
-{
-	return vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
-}
-
 static int
 vhost_kernel_set_vring_addr(struct vhost_dev *vdev,
 			    struct vhost_vring_addr *addr)
@@ -324,7 +317,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_NUM */
 	ring.index = idx;
 	ring.num = vqi->qsize;
-	rc = vhost_kernel_set_vring_num(vdev, &ring);
+	rc = vdev->ops->set_vring_num(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_num failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -332,7 +325,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 
 	/* VHOST_SET_VRING_BASE */
 	ring.num = vqi->last_avail;
-	rc = vhost_kernel_set_vring_base(vdev, &ring);
+	rc = vdev->ops->set_vring_base(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_base failed: idx = %d, last_avail = %d\n",
 			idx, vqi->last_avail);
@@ -346,7 +339,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	addr.used_user_addr = (uintptr_t)vqi->used;
 	addr.log_guest_addr = (uintptr_t)NULL;
 	addr.flags = 0;
-	rc = vhost_kernel_set_vring_addr(vdev, &addr);
+	rc = vdev->ops->set_vring_addr(vdev, &addr);
 	if (rc < 0) {
 		WPRINTF("set_vring_addr failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -355,7 +348,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_CALL */
 	file.index = idx;
 	file.fd = vq->call_fd;
-	rc = vhost_kernel_set_vring_call(vdev, &file);
+	rc = vdev->ops->set_vring_call(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_call failed\n");
 		goto fail_vring;
@@ -364,18 +357,27 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_KICK */
 	file.index = idx;
 	file.fd = vq->kick_fd;
-	rc = vhost_kernel_set_vring_kick(vdev, &file);
+	rc = vdev->ops->set_vring_kick(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_kick failed: idx = %d", idx);
 		goto fail_vring_kick;
 	}
 
+	/* vhost-user rings start disabled once protocol features are used */
+	if (vdev->ops->set_vring_enable) {
+		rc = vdev->ops->set_vring_enable(vdev, idx, true);
+		if (rc < 0) {
+			WPRINTF("set_vring_enable failed: idx = %d\n", idx);
+			goto fail_vring_kick;
+		}
+	}
+
 	return 0;
 
 fail_vring_kick:
 	file.index = idx;
 	file.fd = -1;
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 fail_vring:
 	vhost_vq_register_eventfd(vdev, idx, false);
 fail:
@@ -405,18 +407,21 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	}
 	vqi = &vdev->base->queues[q_idx];
 
+	if (vdev->ops->set_vring_enable)
+		vdev->ops->set_vring_enable(vdev, idx, false);
+
 	file.index = idx;
 	file.fd = -1;
 
 	/* VHOST_SET_VRING_KICK */
-	vhost_kernel_set_vring_kick(vdev, &file);
+	vdev->ops->set_vring_kick(vdev, &file);
 
 	/* VHOST_SET_VRING_CALL */
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 
 	/* VHOST_GET_VRING_BASE */
 	ring.index = idx;
-	rc = vhost_kernel_get_vring_base(vdev, &ring);
+	rc = vdev->ops->get_vring_base(vdev, &ring);
 	if (rc < 0)
 		WPRINTF("get_vring_base failed: idx = %d", idx);
 	else
@@ -434,7 +439,7 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 }
 
 static int
-vhost_set_mem_table(struct vhost_dev *vdev)
+vhost_kernel_set_mem_table(struct vhost_dev *vdev)
 {
 	struct vmctx *ctx;
 	struct vhost_memory *mem;
@@ -483,7 +488,7 @@ vhost_set_mem_table(struct vhost_dev *vdev)
 
 	mem->nregions = nregions;
 	mem->padding = 0;
-	rc = vhost_kernel_set_mem_table(vdev, mem);
+	rc = vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
 	free(mem);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
@@ -493,30 +498,30 @@ vhost_set_mem_table(struct vhost_dev *vdev)
 	return 0;
 }
 
-/**
- * @brief vhost_dev initialization.
- *
- * This interface is called to initialize the vhost_dev. It must be called
- * before the actual feature negotiation with the guest OS starts.
- *
- * @param vdev Pointer to struct vhost_dev.
- * @param base Pointer to struct virtio_base.
- * @param fd fd of the vhost chardev.
- * @param vq_idx The first virtqueue which would be used by this vhost dev.
- * @param vhost_features Subset of vhost features which would be enabled.
- * @param vhost_ext_features Specific vhost internal features to be enabled.
- * @param busyloop_timeout Busy loop timeout in us.
- *
- * @return 0 on success and -1 on failure.
- */
-int
-vhost_dev_init(struct vhost_dev *vdev,
-	       struct virtio_base *base,
-	       int fd,
-	       int vq_idx,
-	       uint64_t vhost_features,
-	       uint64_t vhost_ext_features,
-	       uint32_t busyloop_timeout)
+static const struct vhost_ops vhost_kernel_ops = {
+	.set_mem_table			= vhost_kernel_set_mem_table,
+	.set_vring_addr			= vhost_kernel_set_vring_addr,
+	.set_vring_num			= vhost_kernel_set_vring_num,
+	.set_vring_base			= vhost_kernel_set_vring_base,
+	.get_vring_base			= vhost_kernel_get_vring_base,
+	.set_vring_kick			= vhost_kernel_set_vring_kick,
+	.set_vring_call			= vhost_kernel_set_vring_call,
+	.set_vring_busyloop_timeout	= vhost_kernel_set_vring_busyloop_timeout,
+	.set_features			= vhost_kernel_set_features,
+	.get_features			= vhost_kernel_get_features,
+	.set_owner			= vhost_kernel_set_owner,
+	.reset_device			= vhost_kernel_reset_device,
+};
+
+static int
+vhost_dev_setup(struct vhost_dev *vdev,
+		const struct vhost_ops *ops,
+		struct virtio_base *base,
+		int fd,
+		int vq_idx,
+		uint64_t vhost_features,
+		uint64_t vhost_ext_features,
+		uint32_t busyloop_timeout)
 {
 	uint64_t features;
 	int i, rc;
@@ -537,14 +542,23 @@ vhost_dev_init(struct vhost_dev *vdev,
 		goto fail;
 	}
 
+	vdev->ops = ops;
 	vhost_kernel_init(vdev, base, fd, vq_idx, busyloop_timeout);
 
-	rc = vhost_kernel_get_features(vdev, &features);
+	rc = vdev->ops->get_features(vdev, &features);
 	if (rc < 0) {
 		WPRINTF("vhost_get_features failed\n");
 		goto fail;
 	}
 
+	if (vdev->ops->init) {
+		rc = vdev->ops->init(vdev, features);
+		if (rc < 0) {
+			WPRINTF("backend init failed\n");
+			goto fail;
+		}
+	}
+
 	for (i = 0; i < vdev->nvqs; i++) {
 		rc = vhost_vq_init(vdev, i);
 		if (rc < 0)
@@ -573,6 +587,63 @@ fail:
 	return -1;
 }
 
+/**
+ * @brief vhost_dev initialization.
+ *
+ * This interface is called to initialize the vhost_dev. It must be called
+ * before the actual feature negotiation with the guest OS starts.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param base Pointer to struct virtio_base.
+ * @param fd fd of the vhost chardev.
+ * @param vq_idx The first virtqueue which would be used by this vhost dev.
+ * @param vhost_features Subset of vhost features which would be enabled.
+ * @param vhost_ext_features Specific vhost internal features to be enabled.
+ * @param busyloop_timeout Busy loop timeout in us.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_dev_init(struct vhost_dev *vdev,
+	       struct virtio_base *base,
+	       int fd,
+	       int vq_idx,
+	       uint64_t vhost_features,
+	       uint64_t vhost_ext_features,
+	       uint32_t busyloop_timeout)
+{
+	return vhost_dev_setup(vdev, &vhost_kernel_ops, base, fd, vq_idx,
+			       vhost_features, vhost_ext_features,
+			       busyloop_timeout);
+}
+
+/**
+ * @brief vhost-user vhost_dev initialization.
+ *
+ * Same as vhost_dev_init(), but the data plane is served by a vhost-user
+ * backend connected through vhost_user_connect(). Guest memory is shared
+ * with the backend, so it has to be backed by hugetlbfs.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param base Pointer to struct virtio_base.
+ * @param fd Socket connected to the vhost-user backend.
+ * @param vq_idx The first virtqueue which would be used by this vhost dev.
+ * @param vhost_features Subset of vhost features which would be enabled.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_user_dev_init(struct vhost_dev *vdev,
+		    struct virtio_base *base,
+		    int fd,
+		    int vq_idx,
+		    uint64_t vhost_features)
+{
+	return vhost_dev_setup(vdev, &vhost_user_ops, base, fd, vq_idx,
+			       vhost_features,
+			       1UL << VHOST_USER_F_PROTOCOL_FEATURES, 0);
+}
+
 /**
  * @brief vhost_dev cleanup.
  *
@@ -634,7 +705,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	rc = vhost_kernel_set_owner(vdev);
+	rc = vdev->ops->set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
@@ -643,7 +714,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
-	rc = vhost_kernel_set_features(vdev, features);
+	rc = vdev->ops->set_features(vdev, features);
 	if (rc < 0) {
 		WPRINTF("set_features failed\n");
 		goto fail;
@@ -651,18 +722,18 @@ vhost_dev_start(struct vhost_dev *vdev)
 	DPRINTF("set_features: 0x%lx\n", features);
 
 	/* set memory table */
-	rc = vhost_set_mem_table(vdev);
+	rc = vdev->ops->set_mem_table(vdev);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
 		goto fail;
 	}
 
 	/* config busyloop timeout */
-	if (vdev->busyloop_timeout) {
+	if (vdev->busyloop_timeout && vdev->ops->set_vring_busyloop_timeout) {
 		state.num = vdev->busyloop_timeout;
 		for (i = 0; i < vdev->nvqs; i++) {
 			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
+			rc = vdev->ops->set_vring_busyloop_timeout(vdev,
 				&state);
 			if (rc < 0) {
 				WPRINTF("set_busyloop_timeout failed\n");
@@ -709,7 +780,7 @@ vhost_dev_stop(struct vhost_dev *vdev)
 	 * 1) resources of the vhost dev are freed
 	 * 2) vhost virtqueues are reset
 	 */
-	rc = vhost_kernel_reset_device(vdev);
+	rc = vdev->ops->reset_device(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_reset_device failed\n");
 		rc = -1;
@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2018-2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * vhost-user frontend: the virtqueues of a device are served by a backend
+ * in another process. Guest memory and the vring addresses are shared with
+ * it over a Unix socket, kicks and interrupts go through the same ioeventfd
+ * and irqfd pair the kernel vhost uses.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "vhost.h"
+#include "vhost_user.h"
+
+static int vhost_user_debug;
+#define LOG_TAG "vhost-user: "
+#define DPRINTF(fmt, args...) \
+	do { if (vhost_user_debug) pr_dbg(LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) pr_err(LOG_TAG fmt, ##args)
+
+#define VHOST_USER_PROTOCOL_FEATURES	\
+	((1UL << VHOST_USER_PROTOCOL_F_MQ) | \
+	(1UL << VHOST_USER_PROTOCOL_F_CONFIG))
+
+static void
+vhost_user_msg_init(struct vhost_user_msg *msg, uint32_t request,
+		    uint32_t size)
+{
+	memset(msg, 0, VHOST_USER_HDR_SIZE + size);
+	msg->request = request;
+	msg->flags = VHOST_USER_VERSION;
+	msg->size = size;
+}
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	do {
+		rc = sendmsg(vdev->fd, &mh, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != (ssize_t)iov.iov_len) {
+		WPRINTF("send request %u failed, rc = %zd, errno = %d\n",
+			msg->request, rc, errno);
+		return -1;
+	}
+
+	DPRINTF("sent request %u, %u bytes\n", msg->request, msg->size);
+	return 0;
+}
+
+static int
+vhost_user_read(int fd, void *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = recv(fd, buf, len, MSG_WAITALL);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		buf = (char *)buf + rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	if (vhost_user_read(vdev->fd, msg, VHOST_USER_HDR_SIZE) < 0) {
+		WPRINTF("read reply header failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	if (msg->request != request ||
+	    (msg->flags & VHOST_USER_VERSION_MASK) != VHOST_USER_VERSION ||
+	    !(msg->flags & VHOST_USER_REPLY_MASK) ||
+	    msg->size > sizeof(msg->payload)) {
+		WPRINTF("bad reply to request %u: request %u, flags 0x%x, "
+			"size %u\n", request, msg->request, msg->flags,
+			msg->size);
+		return -1;
+	}
+
+	if (msg->size &&
+	    vhost_user_read(vdev->fd, &msg->payload, msg->size) < 0) {
+		WPRINTF("read reply payload failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, request, sizeof(msg.payload.u64));
+	msg.payload.u64 = val;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *val)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, request, 0);
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, request) < 0)
+		return -1;
+
+	if (msg.size != sizeof(msg.payload.u64)) {
+		WPRINTF("bad payload size %u for request %u\n",
+			msg.size, request);
+		return -1;
+	}
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_state(struct vhost_dev *vdev, uint32_t request,
+		     struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, request, sizeof(msg.payload.state));
+	msg.payload.state = *ring;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_file(struct vhost_dev *vdev, uint32_t request,
+		    struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg;
+
+	/*
+	 * The rings are stopped with GET_VRING_BASE, there is no need to
+	 * tell the backend that the eventfds are going away.
+	 */
+	if (file->fd < 0)
+		return 0;
+
+	vhost_user_msg_init(&msg, request, sizeof(msg.payload.u64));
+	msg.payload.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+	return vhost_user_send(vdev, &msg, &file->fd, 1);
+}
+
+static int
+vhost_user_init(struct vhost_dev *vdev, uint64_t features)
+{
+	uint64_t protocol_features;
+
+	vdev->protocol_features = 0;
+	if (!(features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+			       &protocol_features) < 0)
+		return -1;
+
+	protocol_features &= VHOST_USER_PROTOCOL_FEATURES;
+	if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+			       protocol_features) < 0)
+		return -1;
+
+	vdev->protocol_features = protocol_features;
+	DPRINTF("protocol features 0x%lx\n", protocol_features);
+	return 0;
+}
+
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vm_memfd_region regions[VHOST_USER_MAX_REGIONS + 1];
+	struct vhost_user_memory_region *reg;
+	struct vhost_user_msg msg;
+	struct vmctx *ctx;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, n;
+
+	ctx = vdev->base->dev->vmctx;
+	n = vm_get_memfd_regions(ctx, regions, ARRAY_SIZE(regions));
+	if (n <= 0) {
+		WPRINTF("guest memory can't be shared, hugetlbfs is needed\n");
+		return -1;
+	}
+	if (n > VHOST_USER_MAX_REGIONS) {
+		WPRINTF("guest memory has more than %d regions\n",
+			VHOST_USER_MAX_REGIONS);
+		return -1;
+	}
+
+	vhost_user_msg_init(&msg, VHOST_USER_SET_MEM_TABLE,
+		offsetof(struct vhost_user_memory, regions) +
+		n * sizeof(struct vhost_user_memory_region));
+	msg.payload.memory.nregions = n;
+	for (i = 0; i < n; i++) {
+		reg = &msg.payload.memory.regions[i];
+		reg->guest_phys_addr = regions[i].gpa;
+		reg->memory_size = regions[i].len;
+		reg->userspace_addr = (uintptr_t)(ctx->baseaddr + regions[i].gpa);
+		reg->mmap_offset = regions[i].fd_offset;
+		fds[i] = regions[i].fd;
+		DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx] offset 0x%lx\n", i,
+			reg->guest_phys_addr, reg->userspace_addr,
+			reg->memory_size, reg->mmap_offset);
+	}
+
+	return vhost_user_send(vdev, &msg, fds, n);
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, VHOST_USER_SET_VRING_ADDR,
+			    sizeof(msg.payload.addr));
+	msg.payload.addr = *addr;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_NUM, ring);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_BASE, ring);
+}
+
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	/* the backend stops the ring before it replies */
+	vhost_user_msg_init(&msg, VHOST_USER_GET_VRING_BASE,
+			    sizeof(msg.payload.state));
+	msg.payload.state = *ring;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_VRING_BASE) < 0)
+		return -1;
+
+	if (msg.size != sizeof(msg.payload.state)) {
+		WPRINTF("bad payload size %u for GET_VRING_BASE\n", msg.size);
+		return -1;
+	}
+
+	ring->num = msg.payload.state.num;
+	return 0;
+}
+
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_file(vdev, VHOST_USER_SET_VRING_KICK, file);
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_file(vdev, VHOST_USER_SET_VRING_CALL, file);
+}
+
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev, int idx, bool enable)
+{
+	struct vhost_vring_state ring;
+
+	/* without protocol features the rings are enabled on kick */
+	if (!(vdev->vhost_ext_features &
+	      (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	ring.index = idx;
+	ring.num = enable;
+	return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_ENABLE, &ring);
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	return vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, features);
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, VHOST_USER_SET_OWNER, 0);
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	vhost_user_msg_init(&msg, VHOST_USER_RESET_OWNER, 0);
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+const struct vhost_ops vhost_user_ops = {
+	.init			= vhost_user_init,
+	.set_mem_table		= vhost_user_set_mem_table,
+	.set_vring_addr		= vhost_user_set_vring_addr,
+	.set_vring_num		= vhost_user_set_vring_num,
+	.set_vring_base		= vhost_user_set_vring_base,
+	.get_vring_base		= vhost_user_get_vring_base,
+	.set_vring_kick		= vhost_user_set_vring_kick,
+	.set_vring_call		= vhost_user_set_vring_call,
+	.set_vring_enable	= vhost_user_set_vring_enable,
+	.set_features		= vhost_user_set_features,
+	.get_features		= vhost_user_get_features,
+	.set_owner		= vhost_user_set_owner,
+	.reset_device		= vhost_user_reset_device,
+};
+
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("socket path %s is too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF("connect to %s failed, errno = %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg;
+	uint32_t len;
+
+	if (!(vdev->protocol_features &
+	      (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) ||
+	    size > VHOST_USER_MAX_CONFIG_SIZE)
+		return -1;
+
+	len = offsetof(struct vhost_user_config, region) + size;
+	vhost_user_msg_init(&msg, VHOST_USER_GET_CONFIG, len);
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) < 0)
+		return -1;
+
+	if (msg.size != len || msg.payload.config.size != size) {
+		WPRINTF("bad GET_CONFIG reply, size %u\n", msg.size);
+		return -1;
+	}
+
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
+
+int
+vhost_user_set_config(struct vhost_dev *vdev, const void *config,
+		      uint32_t offset, uint32_t size)
+{
+	struct vhost_user_msg msg;
+
+	if (!(vdev->protocol_features &
+	      (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) ||
+	    size > VHOST_USER_MAX_CONFIG_SIZE)
+		return -1;
+
+	vhost_user_msg_init(&msg, VHOST_USER_SET_CONFIG,
+		offsetof(struct vhost_user_config, region) + size);
+	msg.payload.config.offset = offset;
+	msg.payload.config.size = size;
+	memcpy(msg.payload.config.region, config, size);
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+int
+vhost_user_get_queue_num(struct vhost_dev *vdev)
+{
+	uint64_t num;
+
+	if (!(vdev->protocol_features & (1UL << VHOST_USER_PROTOCOL_F_MQ)))
+		return -1;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_QUEUE_NUM, &num) < 0)
+		return -1;
+
+	return (int)num;
+}
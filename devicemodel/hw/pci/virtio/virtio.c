@@ -42,6 +42,7 @@
 #include "hsm_ioctl_defs.h"
 #include "iothread.h"
 #include "vmmapi.h"
+#include "dm_string.h"
 #include <errno.h>
 
 /*
@@ -167,7 +168,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(base, vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -266,6 +267,13 @@ virtio_reset_dev(struct virtio_base *base)
 
 	nvq = base->vops->nvq;
 	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
+		/* coalescing parameters are kept, pending interrupts dropped */
+		pthread_mutex_lock(&vq->mtx);
+		acrn_timer_deinit(&vq->coal_timer);
+		vq->coal_armed = false;
+		vq->coal_pending = 0;
+		pthread_mutex_unlock(&vq->mtx);
+
 		vq->flags = 0;
 		vq->last_avail = 0;
 		vq->save_used = 0;
@@ -278,6 +286,12 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->packed = false;
+		vq->pdesc = NULL;
+		vq->driver_event = NULL;
+		vq->device_event = NULL;
+		free(vq->chain_ndesc);
+		vq->chain_ndesc = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -338,6 +352,14 @@ virtio_intr_init(struct virtio_base *base, int barnum, int use_msix)
 		nvec = base->vops->nvq + 1;
 		if (pci_emul_add_msixcap(base->dev, nvec, barnum))
 			return -1;
+		/*
+		 * Signal vectors through irqfds so that vq_interrupt() from
+		 * the I/O threads costs an eventfd write rather than an
+		 * ioctl; stay on vm_lapic_msi() if the kernel can't do it.
+		 */
+		if (pci_msix_irqfd_enable(base->dev))
+			pr_info("%s: irqfd unavailable, using MSI ioctl\n",
+				base->vops->name);
 	} else
 		base->flags &= ~VIRTIO_USE_MSIX;
 
@@ -384,6 +406,7 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 
 	vq = &base->queues[base->curq];
 	vq->pfn = pfn;
+	vq->packed = false;
 	phys = (uint64_t)pfn << VRING_PAGE_BITS;
 	size = vring_size(vq->qsize, VIRTIO_PCI_VRING_ALIGN);
 	vb = paddr_guest2host(base->dev->vmctx, phys, size);
@@ -419,6 +442,64 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Map a packed virtqueue. The desc/avail/used addresses programmed by
+ * the guest are the descriptor ring, the driver event suppression area
+ * and the device event suppression area respectively.
+ */
+static int
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct vmctx *ctx = base->dev->vmctx;
+	uint64_t phys;
+	uint16_t *ndesc;
+	void *vb;
+
+	/* a packed ring needs not be a power of 2, but stays <= 32768 */
+	if (vq->qsize == 0 || vq->qsize > 32768)
+		return -1;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(ctx, phys,
+		vq->qsize * sizeof(struct vring_packed_desc));
+	if (!vb)
+		return -1;
+	vq->pdesc = vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(ctx, phys, sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->driver_event = vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(ctx, phys, sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->device_event = vb;
+
+	ndesc = realloc(vq->chain_ndesc, vq->qsize * sizeof(uint16_t));
+	if (!ndesc)
+		return -1;
+	vq->chain_ndesc = ndesc;
+
+	/* the split ring pointers must not be used from now on */
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used = NULL;
+
+	vq->packed = true;
+	vq->in_order = !!(base->negotiated_caps & (1UL << VIRTIO_F_IN_ORDER));
+	/* both wrap counters start at 1 */
+	vq->avail_wrap = true;
+	vq->used_wrap = true;
+	vq->save_used_wrap = true;
+	vq->used_idx = 0;
+	vq->batch_ndesc = 0;
+	vq->used_bufs = 0;
+	return 0;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -437,6 +518,13 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		if (virtio_vq_enable_packed(base, vq))
+			goto error;
+		goto done;
+	}
+	vq->packed = false;
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -462,6 +550,7 @@ virtio_vq_enable(struct virtio_base *base)
 		goto error;
 	vq->used = (struct vring_used *)vb;
 
+done:
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
@@ -478,6 +567,39 @@ virtio_vq_enable(struct virtio_base *base)
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Guest RAM is made of two fixed regions (below and above 4G), and the
+ * buffers of a virtqueue mostly land in the one the previous buffer did.
+ * Remember that region per virtqueue so that the translation is a single
+ * range check instead of a full vm_map_gpa() lookup.
+ *
+ * Like the rest of the virtqueue state, this assumes a virtqueue is only
+ * walked by one thread at a time.
+ */
+static inline void *
+vq_gpa2hva(struct virtio_vq_info *vq, uint64_t gpa, size_t len)
+{
+	struct vmctx *ctx = vq->base->dev->vmctx;
+	uint64_t off = gpa - vq->xlat_gpa;
+	void *hva;
+
+	if (off < vq->xlat_len && len <= vq->xlat_len - off)
+		return vq->xlat_hva + off;
+
+	hva = paddr_guest2host(ctx, gpa, len);
+	if (hva) {
+		if (gpa < ctx->lowmem) {
+			vq->xlat_gpa = 0;
+			vq->xlat_len = ctx->lowmem;
+		} else {
+			vq->xlat_gpa = ctx->highmem_gpa_base;
+			vq->xlat_len = ctx->highmem;
+		}
+		vq->xlat_hva = ctx->baseaddr + vq->xlat_gpa;
+	}
+	return hva;
+}
+
 /*
  * Helper inline for vq_getchain(): record the i'th "real"
  * descriptor.
@@ -485,114 +607,435 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
-	   struct iovec *iov, int n_iov, uint16_t *flags) {
+_vq_record(int i, uint64_t addr, uint32_t len, uint16_t dflags,
+	   struct virtio_vq_info *vq, struct iovec *iov, int n_iov,
+	   uint16_t *flags) {
 
 	void *host_addr;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	host_addr = vq_gpa2hva(vq, addr, len);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
-		flags[i] = vd->flags;
+		flags[i] = dflags;
 	return 0;
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+#define	VQ_PACKED_DESC_F_WRAP	\
+	((1 << VRING_PACKED_DESC_F_AVAIL) | (1 << VRING_PACKED_DESC_F_USED))
+
 /*
- * Examine the chain of descriptors starting at the "next one" to
- * make sure that they describe a sensible request.  If so, return
- * the number of "real" descriptors that would be needed/used in
- * acting on this request.  This may be smaller than the number of
- * available descriptors, e.g., if there are two available but
- * they are two separate requests, this just returns 1.  Or, it
- * may be larger: if there are indirect descriptors involved,
- * there may only be one descriptor available but it may be an
- * indirect pointing to eight more.  We return 8 in this case,
- * i.e., we do not count the indirect descriptors, only the "real"
- * ones.
+ * Packed ring version of vq_getchain(). The chain is a run of
+ * descriptors in the ring itself, linked by the NEXT flag, and the
+ * buffer id lives in its last descriptor. The guest publishes the head
+ * descriptor's flags last, so once the head is available the rest of
+ * the chain is as well; volatile accesses keep the flag load ahead of
+ * the descriptor loads, which x86 does not reorder.
  *
- * Basically, this vets the flags and vd_next field of each
- * descriptor and tells you how many are involved.  Since some may
- * be indirect, this also needs the vmctx (in the pci_vdev
- * at base->dev) so that it can find indirect descriptors.
+ * A broken chain is skipped like in the split ring, but as its id is
+ * unknown it cannot be handed back to the guest.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd, *vindir;
+	struct virtio_base *base;
+	const char *name;
+	uint16_t pos, ndesc, dflags;
+	u_int n_indir, j;
+	bool wrap;
+	int i = 0;
+
+	pos = vq->last_avail;
+	wrap = vq->avail_wrap;
+	if (!vq_packed_desc_avail(vq, pos, wrap))
+		return 0;
+
+	base = vq->base;
+	name = base->vops->name;
+	vq->prev_avail = pos;
+	vq->prev_avail_wrap = wrap;
+
+	for (ndesc = 1; ; ndesc++) {
+		vd = &vq->pdesc[pos];
+		dflags = vd->flags;
+		if (++pos == vq->qsize) {
+			pos = 0;
+			wrap = !wrap;
+		}
+
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vd->addr, vd->len,
+				       dflags & ~VQ_PACKED_DESC_F_WRAP,
+				       vq, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				goto fail;
+			}
+			i++;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0 ||
+		    (dflags & VRING_DESC_F_NEXT)) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n", name);
+			goto fail;
+		} else {
+			n_indir = vd->len / sizeof(struct vring_packed_desc);
+			if ((vd->len % sizeof(struct vring_packed_desc)) ||
+			    n_indir == 0 || i + n_indir > VQ_MAX_DESCRIPTORS) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vd->len);
+				goto fail;
+			}
+			vindir = vq_gpa2hva(vq, vd->addr, vd->len);
+			if (!vindir) {
+				pr_err("%s cannot get host memory\r\n", name);
+				goto fail;
+			}
+			/* an indirect table is used in order, NEXT is ignored */
+			for (j = 0; j < n_indir; j++) {
+				if (vindir[j].flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n", name);
+					goto fail;
+				}
+				if (_vq_record(i, vindir[j].addr, vindir[j].len,
+					       vindir[j].flags & VRING_DESC_F_WRITE,
+					       vq, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n",
+					    name);
+					goto fail;
+				}
+				i++;
+			}
+		}
+
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+		if (ndesc >= vq->qsize || i >= VQ_MAX_DESCRIPTORS ||
+		    !vq_packed_desc_avail(vq, pos, wrap)) {
+			pr_err("%s: bad descriptor chain, driver confused?\r\n",
+			    name);
+			goto fail;
+		}
+	}
+
+	if (vd->id >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range, driver confused?\r\n",
+		    name, (u_int)vd->id);
+		goto fail;
+	}
+	*pidx = vd->id;
+	vq->chain_ndesc[*pidx] = ndesc;
+	vq->last_avail = pos;
+	vq->avail_wrap = wrap;
+	return i;
+
+fail:
+	vq->last_avail = pos;
+	vq->avail_wrap = wrap;
+	return -1;
+}
+
+/*
+ * Hand a buffer back in the packed ring: the used descriptor goes into
+ * the next slot in ring order, whatever its id, and the device then
+ * skips as many slots as the buffer took. The flags store publishes
+ * the descriptor; stores are not reordered on x86 and volatile keeps
+ * the compiler from doing it.
+ */
+static void
+vq_packed_put_used(struct virtio_vq_info *vq, uint16_t id, uint32_t len,
+		   uint16_t ndesc)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t flags = 0;
+
+	vd = &vq->pdesc[vq->used_idx];
+	vd->id = id;
+	vd->len = len;
+	if (vq->used_wrap)
+		flags = VQ_PACKED_DESC_F_WRAP;
+	if (len)
+		flags |= VRING_DESC_F_WRITE;
+	vd->flags = flags;
+
+	vq->used_idx += ndesc;
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+}
+
+/*
+ * With VIRTIO_F_IN_ORDER, one used descriptor carrying the id of the
+ * last buffer completes a whole batch. Only that buffer gets a length,
+ * so a batch is closed as soon as it ends with a buffer that was
+ * written to.
+ */
+static void
+vq_relchain_packed(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	uint16_t ndesc;
+
+	if (idx >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range\r\n",
+		    vq->base->vops->name, (u_int)idx);
+		return;
+	}
+	ndesc = vq->chain_ndesc[idx];
+	vq->used_bufs++;
+
+	if (!vq->in_order) {
+		vq_packed_put_used(vq, idx, iolen, ndesc);
+		return;
+	}
+
+	if (vq->batch_ndesc && vq->batch_len) {
+		vq_packed_put_used(vq, vq->batch_id, vq->batch_len,
+				   vq->batch_ndesc);
+		vq->batch_ndesc = 0;
+	}
+	vq->batch_id = idx;
+	vq->batch_len = iolen;
+	vq->batch_ndesc += ndesc;
+}
+
+static uint64_t
+vq_coalesce_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+vq_coalesce_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_vq_info *vq = arg;
+	bool intr;
+
+	pthread_mutex_lock(&vq->mtx);
+	intr = vq->coal_armed && vq->coal_pending;
+	vq->coal_armed = false;
+	vq->coal_pending = 0;
+	if (intr)
+		vq->coal_last_ns = vq_coalesce_now_ns();
+	pthread_mutex_unlock(&vq->mtx);
+
+	if (intr && vq_ring_ready(vq))
+		vq_interrupt(vq->base, vq);
+}
+
+/*
+ * Account nused new used entries to a coalescing vq. Returns whether the
+ * interrupt is due now, otherwise the timer raises it later on.
+ */
+static bool
+vq_coalesce(struct virtio_vq_info *vq, uint16_t nused)
+{
+	struct virtio_coalesce *coal = &vq->coal;
+	uint64_t now;
+	bool intr = false;
+
+	pthread_mutex_lock(&vq->mtx);
+	now = vq_coalesce_now_ns();
+	vq->coal_pending += nused;
+	if (coal->adaptive && !vq->coal_armed &&
+	    now - vq->coal_last_ns >= coal->usecs * 1000UL) {
+		/* the queue was quiet, don't add latency */
+		intr = true;
+	} else if (coal->frames && vq->coal_pending >= coal->frames) {
+		intr = true;
+	} else if (!vq->coal_armed) {
+		if (!vq->coal_timer.mevp) {
+			vq->coal_timer.clockid = CLOCK_MONOTONIC;
+			if (acrn_timer_init(&vq->coal_timer,
+					    vq_coalesce_timer, vq) < 0)
+				intr = true;
+		}
+		if (!intr) {
+			virtio_start_timer(&vq->coal_timer, 0,
+					   coal->usecs * 1000UL);
+			vq->coal_armed = true;
+		}
+	}
+
+	if (intr) {
+		if (vq->coal_armed) {
+			virtio_start_timer(&vq->coal_timer, 0, 0);
+			vq->coal_armed = false;
+		}
+		vq->coal_pending = 0;
+		vq->coal_last_ns = now;
+	}
+	pthread_mutex_unlock(&vq->mtx);
+
+	return intr;
+}
+
+/*
+ * Raise the interrupt of a vq, or let coalescing defer it. A deferred
+ * interrupt also absorbs used entries which wouldn't interrupt on their
+ * own, e.g. because EVENT_IDX was already crossed.
+ */
+static void
+vq_signal(struct virtio_vq_info *vq, int intr, uint16_t nused)
+{
+	if (vq->coal.usecs && (intr || vq->coal_armed))
+		intr = vq_coalesce(vq, nused);
+
+	if (intr)
+		vq_interrupt(vq->base, vq);
+}
+
+/**
+ * @brief Set the interrupt coalescing of a virtqueue.
  *
- * As we process each descriptor, we copy and adjust it (guest to
- * host address wise, also using the vmtctx) into the given iov[]
- * array (of the given size).  If the array overflows, we stop
- * placing values into the array but keep processing descriptors,
- * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
- * So you, the caller, must not assume that iov[] is as big as the
- * return value (you can process the same thing twice to allocate
- * a larger iov array if needed, or supply a zero length to find
- * out how much space is needed).
+ * vq_endchains() then holds the interrupt back until coal->frames used
+ * entries are pending or coal->usecs have passed. In adaptive mode a
+ * queue which didn't interrupt for coal->usecs interrupts right away.
+ * A pending interrupt is raised when coalescing gets disabled.
  *
- * If you want to verify the WRITE flag on each descriptor, pass a
- * non-NULL "flags" pointer to an array of "uint16_t" of the same size
- * as n_iov and we'll copy each flags field after unwinding any
- * indirects.
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param coal New parameters, usecs 0 disables coalescing.
+ */
+void
+vq_set_coalesce(struct virtio_vq_info *vq, const struct virtio_coalesce *coal)
+{
+	bool intr = false;
+
+	pthread_mutex_lock(&vq->mtx);
+	vq->coal = *coal;
+	if (!coal->usecs && vq->coal_armed) {
+		virtio_start_timer(&vq->coal_timer, 0, 0);
+		intr = vq->coal_pending != 0;
+		vq->coal_armed = false;
+		vq->coal_pending = 0;
+	}
+	pthread_mutex_unlock(&vq->mtx);
+
+	if (intr && vq_ring_ready(vq))
+		vq_interrupt(vq->base, vq);
+}
+
+/**
+ * @brief Parse interrupt coalescing parameters.
  *
- * If some descriptor(s) are invalid, this prints a diagnostic message
- * and returns -1.  If no descriptors are ready now it simply returns 0.
+ * The format is "<usecs>[/<frames>][/adaptive]".
  *
- * You are assumed to have done a vq_ring_ready() if needed (note
- * that vq_has_descs() does one).
+ * @param opt Option string, without the "coalesce=" prefix.
+ * @param coal Pointer to struct virtio_coalesce to be filled in.
+ *
+ * @return 0 on success and -1 on invalid input.
  */
 int
-vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
-	    struct iovec *iov, int n_iov, uint16_t *flags)
+virtio_parse_coalesce(const char *opt, struct virtio_coalesce *coal)
 {
-	int i;
-	u_int ndesc, n_indir;
-	u_int idx, next;
+	char *str, *cp, *tok;
+	int rc = -1;
 
-	volatile struct vring_desc *vdir, *vindir, *vp;
-	struct vmctx *ctx;
-	struct virtio_base *base;
-	const char *name;
+	memset(coal, 0, sizeof(*coal));
+	str = cp = strdup(opt);
+	if (!str)
+		return -1;
 
-	base = vq->base;
-	name = base->vops->name;
+	tok = strsep(&cp, "/");
+	if (dm_strtoui(tok, NULL, 10, &coal->usecs))
+		goto done;
 
-	/*
-	 * Note: it's the responsibility of the guest not to
-	 * update vq->avail->idx until all of the descriptors
-	 * the guest has written are valid (including all their
-	 * next fields and vd_flags).
-	 *
-	 * Compute (last_avail - idx) in integers mod 2**16.  This is
-	 * the number of descriptors the device has made available
-	 * since the last time we updated vq->last_avail.
-	 *
-	 * We just need to do the subtraction as an unsigned int,
-	 * then trim off excess bits.
-	 */
-	idx = vq->last_avail;
-	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
-	if (ndesc == 0)
-		return 0;
-	if (ndesc > vq->qsize) {
-		/* XXX need better way to diagnose issues */
-		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
-		    name, (u_int)ndesc);
-		return -1;
+	while ((tok = strsep(&cp, "/")) != NULL) {
+		if (!strcmp(tok, "adaptive"))
+			coal->adaptive = true;
+		else if (dm_strtoui(tok, NULL, 10, &coal->frames))
+			goto done;
 	}
+	rc = 0;
+
+done:
+	free(str);
+	return rc;
+}
+
+/*
+ * Packed ring version of vq_endchains(). The driver event suppression
+ * area either enables or disables interrupts, or, with EVENT_IDX,
+ * names the ring position (and wrap counter) it wants one at.
+ */
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base = vq->base;
+	uint16_t old_idx, new_idx, off_wrap, off, flags, nused;
+	bool old_wrap;
+	int intr;
+
+	if (vq->batch_ndesc) {
+		vq_packed_put_used(vq, vq->batch_id, vq->batch_len,
+				   vq->batch_ndesc);
+		vq->batch_ndesc = 0;
+	}
+
+	atomic_thread_fence();
+
+	old_idx = vq->save_used;
+	old_wrap = vq->save_used_wrap;
+	vq->save_used = new_idx = vq->used_idx;
+	vq->save_used_wrap = vq->used_wrap;
+	/* used entries span several descriptors, coalescing counts buffers */
+	nused = vq->used_bufs;
+	vq->used_bufs = 0;
+
+	flags = vq->driver_event->flags;
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		intr = 1;
+	else if (new_idx == old_idx && vq->used_wrap == old_wrap)
+		intr = 0;
+	else if (flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		intr = 0;
+	else if (flags == VRING_PACKED_EVENT_FLAG_DESC &&
+	    (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX))) {
+		off_wrap = vq->driver_event->off_wrap;
+		off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		/* move both positions into the current lap before comparing */
+		if (new_idx <= old_idx)
+			old_idx -= vq->qsize;
+		if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+			off -= vq->qsize;
+		intr = (uint16_t)(new_idx - off - 1) <
+			(uint16_t)(new_idx - old_idx);
+	} else
+		intr = 1;
+
+	vq_signal(vq, intr, nused);
+}
+
+/*
+ * Now count/parse "involved" descriptors starting from
+ * the head of the chain at @next, see vq_getchain() below.
+ *
+ * To prevent loops, we could be more complicated and
+ * check whether we're re-visiting a previously visited
+ * index, but we just abort if the count gets excessive.
+ */
+static int
+vq_walk_chain(struct virtio_vq_info *vq, u_int next,
+	      struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_desc *vdir, *vindir, *vp;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	u_int n_indir;
+	int i;
 
-	/*
-	 * Now count/parse "involved" descriptors starting from
-	 * the head of the chain.
-	 *
-	 * To prevent loops, we could be more complicated and
-	 * check whether we're re-visiting a previously visited
-	 * index, but we just abort if the count gets excessive.
-	 */
-	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
-	vq->last_avail++;
 	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
 		if (next >= vq->qsize) {
 			pr_err("%s: descriptor index %u out of range, "
@@ -602,7 +1045,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		}
 		vdir = &vq->desc[next];
 		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+			if (_vq_record(i, vdir->addr, vdir->len, vdir->flags,
+				       vq, iov, n_iov, flags)) {
 				pr_err("%s: mapping to host failed\r\n", name);
 				return -1;
 			}
@@ -621,8 +1065,7 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				    name, (u_int)vdir->len);
 				return -1;
 			}
-			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+			vindir = vq_gpa2hva(vq, vdir->addr, vdir->len);
 
 			if (!vindir) {
 				pr_err("%s cannot get host memory\r\n", name);
@@ -644,7 +1087,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 					    name);
 					return -1;
 				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+				if (_vq_record(i, vp->addr, vp->len, vp->flags,
+					       vq, iov, n_iov, flags)) {
 					pr_err("%s: mapping to host failed\r\n", name);
 					return -1;
 				}
@@ -670,6 +1114,150 @@ loopy:
 	return -1;
 }
 
+/*
+ * Examine the chain of descriptors starting at the "next one" to
+ * make sure that they describe a sensible request.  If so, return
+ * the number of "real" descriptors that would be needed/used in
+ * acting on this request.  This may be smaller than the number of
+ * available descriptors, e.g., if there are two available but
+ * they are two separate requests, this just returns 1.  Or, it
+ * may be larger: if there are indirect descriptors involved,
+ * there may only be one descriptor available but it may be an
+ * indirect pointing to eight more.  We return 8 in this case,
+ * i.e., we do not count the indirect descriptors, only the "real"
+ * ones.
+ *
+ * Basically, this vets the flags and vd_next field of each
+ * descriptor and tells you how many are involved.  Since some may
+ * be indirect, this also needs the vmctx (in the pci_vdev
+ * at base->dev) so that it can find indirect descriptors.
+ *
+ * As we process each descriptor, we copy and adjust it (guest to
+ * host address wise, also using the vmtctx) into the given iov[]
+ * array (of the given size).  If the array overflows, we stop
+ * placing values into the array but keep processing descriptors,
+ * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
+ * So you, the caller, must not assume that iov[] is as big as the
+ * return value (you can process the same thing twice to allocate
+ * a larger iov array if needed, or supply a zero length to find
+ * out how much space is needed).
+ *
+ * If you want to verify the WRITE flag on each descriptor, pass a
+ * non-NULL "flags" pointer to an array of "uint16_t" of the same size
+ * as n_iov and we'll copy each flags field after unwinding any
+ * indirects.
+ *
+ * If some descriptor(s) are invalid, this prints a diagnostic message
+ * and returns -1.  If no descriptors are ready now it simply returns 0.
+ *
+ * You are assumed to have done a vq_ring_ready() if needed (note
+ * that vq_has_descs() does one).
+ */
+int
+vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	u_int ndesc;
+	u_int idx, next;
+	const char *name;
+
+	if (vq->packed)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
+	name = vq->base->vops->name;
+
+	/*
+	 * Note: it's the responsibility of the guest not to
+	 * update vq->avail->idx until all of the descriptors
+	 * the guest has written are valid (including all their
+	 * next fields and vd_flags).
+	 *
+	 * Compute (last_avail - idx) in integers mod 2**16.  This is
+	 * the number of descriptors the device has made available
+	 * since the last time we updated vq->last_avail.
+	 *
+	 * We just need to do the subtraction as an unsigned int,
+	 * then trim off excess bits.
+	 */
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	if (ndesc == 0)
+		return 0;
+	if (ndesc > vq->qsize) {
+		/* XXX need better way to diagnose issues */
+		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+		    name, (u_int)ndesc);
+		return -1;
+	}
+
+	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
+	vq->last_avail++;
+	return vq_walk_chain(vq, next, iov, n_iov, flags);
+}
+
+/*
+ * Harvest up to @nchains available chains in one pass, each into the
+ * iov[] and flags[] arrays the caller hung off its struct vq_chain.
+ * The avail index is read once for the whole batch, and the next
+ * chain's head descriptor as well as each chain's first buffer (most
+ * often a request header) are prefetched while the batch is walked.
+ *
+ * Returns the number of entries filled in, 0 if nothing was available
+ * and -1 if the ring itself is broken. A chain that could not be parsed
+ * ends the batch and is returned with n == -1, so the caller can hand
+ * it back with vq_relchain() like after a failed vq_getchain(); its idx
+ * is out of range if even that is not possible.
+ */
+int
+vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains, int nchains)
+{
+	struct vq_chain *c;
+	u_int ndesc, idx, mask;
+	int i;
+
+	if (vq->packed) {
+		for (i = 0; i < nchains; i++) {
+			c = &chains[i];
+			c->idx = vq->qsize;
+			c->n = vq_getchain_packed(vq, &c->idx, c->iov,
+						  c->n_iov, c->flags);
+			if (c->n == 0)
+				break;
+			if (c->n < 0)
+				return i + 1;
+			__builtin_prefetch(c->iov[0].iov_base);
+			__builtin_prefetch((const void *)
+				&vq->pdesc[vq->last_avail]);
+		}
+		return i;
+	}
+
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	if (ndesc > vq->qsize) {
+		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+		    vq->base->vops->name, (u_int)ndesc);
+		return -1;
+	}
+
+	mask = vq->qsize - 1;
+	nchains = MIN((u_int)nchains, ndesc);
+	for (i = 0; i < nchains; i++) {
+		c = &chains[i];
+		c->idx = vq->avail->ring[idx++ & mask];
+		vq->last_avail = idx;
+		if (i + 1 < nchains)
+			__builtin_prefetch((const void *)
+				&vq->desc[vq->avail->ring[idx & mask] & mask]);
+
+		c->n = vq_walk_chain(vq, c->idx, c->iov, c->n_iov, c->flags);
+		if (c->n < 0)
+			return i + 1;
+		__builtin_prefetch(c->iov[0].iov_base);
+	}
+	return i;
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -679,6 +1267,11 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
+	if (vq->packed) {
+		vq->last_avail = vq->prev_avail;
+		vq->avail_wrap = vq->prev_avail_wrap;
+		return;
+	}
 	vq->last_avail--;
 }
 
@@ -706,6 +1299,11 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->packed) {
+		vq_relchain_packed(vq, idx, iolen);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -738,6 +1336,11 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	uint16_t event_idx, new_idx, old_idx;
 	int intr;
 
+	if (vq && vq->packed && vq->driver_event) {
+		vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
+
 	if (!vq || !vq->used)
 		return;
 
@@ -771,8 +1374,7 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 		intr = new_idx != old_idx &&
 		    !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
 	}
-	if (intr)
-		vq_interrupt(base, vq);
+	vq_signal(vq, intr, new_idx - old_idx);
 }
 
 /**
@@ -794,7 +1396,35 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
-	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	/* the ring pointers are stale, or gone for packed, after a reset */
+	if (!vq_ring_ready(vq))
+		return;
+
+	if (vq->packed)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	else
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Ask the guest not to notify us about new available buffers, e.g.
+ * while the device is draining the virtqueue anyway. Works for both
+ * split and packed rings.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (!vq_ring_ready(vq))
+		return;
+
+	if (vq->packed)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
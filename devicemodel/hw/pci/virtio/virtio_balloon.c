@@ -0,0 +1,674 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio memory balloon device emulation.
+ *
+ * Pages inflated into the balloon are tracked at 4K granularity, they stay
+ * mapped and backed: HSM keeps the pages it maps into the EPT pinned until
+ * the VM is destroyed, so unmapping them would not give anything back to the
+ * hugetlbfs pool. The target size is set with inflate= at launch and can be
+ * changed at runtime through the monitor, see vm_monitor_balloon().
+ *
+ * Pages reported free by the guest are reused without telling the host, so
+ * they are only accounted. Guest memory statistics are collected through the
+ * stats queue and exported together with the device counters to
+ * BALLOON_STATS_DIR/<vmname>.balloon.
+ */
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vmmapi.h"
+#include "timer.h"
+#include "dm_string.h"
+#include "monitor.h"
+
+#define VIRTIO_BALLOON_RINGSZ	128
+#define VIRTIO_BALLOON_MAXSEGS	64
+#define VIRTIO_BALLOON_MAXQ	4
+
+/* Feature bits */
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST	0	/* Tell before reclaiming pages */
+#define VIRTIO_BALLOON_F_STATS_VQ	1	/* Memory stats virtqueue */
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	2	/* Deflate balloon on OOM */
+#define VIRTIO_BALLOON_F_REPORTING	5	/* Free page reporting */
+
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+
+/* Guest memory statistics tags */
+#define VIRTIO_BALLOON_S_SWAP_IN	0
+#define VIRTIO_BALLOON_S_SWAP_OUT	1
+#define VIRTIO_BALLOON_S_MAJFLT		2
+#define VIRTIO_BALLOON_S_MINFLT		3
+#define VIRTIO_BALLOON_S_MEMFREE	4
+#define VIRTIO_BALLOON_S_MEMTOT		5
+#define VIRTIO_BALLOON_S_AVAIL		6
+#define VIRTIO_BALLOON_S_CACHES		7
+#define VIRTIO_BALLOON_S_HTLB_PGALLOC	8
+#define VIRTIO_BALLOON_S_HTLB_PGFAIL	9
+#define VIRTIO_BALLOON_S_NR		10
+
+#define BALLOON_STATS_DIR	"/run/acrn"
+#define BALLOON_STATS_PERIOD	5	/* seconds */
+
+/*
+ * Queue roles. The guest only sets up the queues of negotiated features, in
+ * this order, so the index of the reporting queue depends on STATS_VQ.
+ */
+enum balloon_vq_role {
+	BALLOON_VQ_INFLATE,
+	BALLOON_VQ_DEFLATE,
+	BALLOON_VQ_STATS,
+	BALLOON_VQ_REPORTING,
+	BALLOON_VQ_NONE,
+};
+
+struct virtio_balloon_config {
+	uint32_t num_pages;	/* pages the host wants in the balloon */
+	uint32_t actual;	/* pages the guest has in the balloon */
+} __attribute__((packed));
+
+struct virtio_balloon_stat {
+	uint16_t tag;
+	uint64_t val;
+} __attribute__((packed));
+
+static const char *const balloon_stat_names[VIRTIO_BALLOON_S_NR] = {
+	"swap_in", "swap_out", "major_faults", "minor_faults", "free_memory",
+	"total_memory", "available_memory", "disk_caches",
+	"hugetlb_allocations", "hugetlb_failures",
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_balloon {
+	struct virtio_base base;
+	struct virtio_vq_info vqs[VIRTIO_BALLOON_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_balloon_config cfg;
+	struct vmctx *ctx;
+
+	/* 4K pages of guest RAM, lowmem first then highmem */
+	size_t nr_pages;
+	uint64_t *inflated;	/* in the balloon until deflated */
+	uint64_t inflated_pages;
+	uint64_t reported_size;
+
+	bool reporting;
+	int stats_period;
+	struct acrn_timer stats_timer;
+	bool stats_held;	/* a stats buffer is waiting to be returned */
+	uint16_t stats_idx;
+	uint64_t stats[VIRTIO_BALLOON_S_NR];
+	uint64_t prev_stats[VIRTIO_BALLOON_S_NR];
+	bool stats_valid;
+	char stats_path[PATH_MAX];
+};
+
+static int virtio_balloon_debug;
+#define DPRINTF(params) do { if (virtio_balloon_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+static void virtio_balloon_reset(void *);
+static void virtio_balloon_notify(void *, struct virtio_vq_info *);
+static int virtio_balloon_cfgread(void *, int, int, uint32_t *);
+static int virtio_balloon_cfgwrite(void *, int, int, uint32_t);
+static int vm_monitor_balloon(void *arg, unsigned long target_mb);
+
+static struct virtio_ops virtio_balloon_ops = {
+	"virtio_balloon",		/* our name */
+	VIRTIO_BALLOON_MAXQ,		/* we support 4 virtqueues */
+	sizeof(struct virtio_balloon_config), /* config reg size */
+	virtio_balloon_reset,		/* reset */
+	virtio_balloon_notify,		/* device-wide qnotify */
+	virtio_balloon_cfgread,		/* read virtio config */
+	virtio_balloon_cfgwrite,	/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
+/* The monitor sets the target of the first balloon only */
+static struct virtio_balloon *monitor_balloon;
+static pthread_mutex_t monitor_balloon_mtx = PTHREAD_MUTEX_INITIALIZER;
+static bool register_vm_monitor_balloon = false;
+
+static struct monitor_vm_ops virtio_balloon_monitor_ops = {
+	.balloon = vm_monitor_balloon,
+};
+
+static enum balloon_vq_role
+virtio_balloon_vq_role(struct virtio_balloon *balloon,
+		       struct virtio_vq_info *vq)
+{
+	int idx = vq - balloon->vqs;
+	bool stats = balloon->base.negotiated_caps &
+			(1UL << VIRTIO_BALLOON_F_STATS_VQ);
+	bool reporting = balloon->base.negotiated_caps &
+			(1UL << VIRTIO_BALLOON_F_REPORTING);
+
+	if (idx < BALLOON_VQ_STATS)
+		return idx;
+	if (stats && idx == BALLOON_VQ_STATS)
+		return BALLOON_VQ_STATS;
+	if (reporting && idx == BALLOON_VQ_STATS + (stats ? 1 : 0))
+		return BALLOON_VQ_REPORTING;
+	return BALLOON_VQ_NONE;
+}
+
+/* Index of the 4K page at @gpa in the page bitmaps, -1 if it is not RAM */
+static ssize_t
+virtio_balloon_page_idx(struct virtio_balloon *balloon, vm_paddr_t gpa)
+{
+	struct vmctx *ctx = balloon->ctx;
+
+	if (gpa < ctx->lowmem)
+		return gpa >> VIRTIO_BALLOON_PFN_SHIFT;
+	if (gpa >= ctx->highmem_gpa_base &&
+	    gpa < ctx->highmem_gpa_base + ctx->highmem)
+		return (ctx->lowmem + gpa - ctx->highmem_gpa_base) >>
+			VIRTIO_BALLOON_PFN_SHIFT;
+	return -1;
+}
+
+static inline bool
+page_test(uint64_t *map, size_t idx)
+{
+	return map[idx / 64] & (1UL << (idx % 64));
+}
+
+static inline void
+page_set(uint64_t *map, size_t idx)
+{
+	map[idx / 64] |= 1UL << (idx % 64);
+}
+
+static inline void
+page_clear(uint64_t *map, size_t idx)
+{
+	map[idx / 64] &= ~(1UL << (idx % 64));
+}
+
+static void
+virtio_balloon_inflate(struct virtio_balloon *balloon,
+		       struct iovec *iov, int n)
+{
+	uint32_t *pfns;
+	vm_paddr_t gpa;
+	ssize_t idx;
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		pfns = iov[i].iov_base;
+		for (j = 0; j < iov[i].iov_len / sizeof(uint32_t); j++) {
+			gpa = (vm_paddr_t)pfns[j] << VIRTIO_BALLOON_PFN_SHIFT;
+			idx = virtio_balloon_page_idx(balloon, gpa);
+			if (idx < 0 || idx >= balloon->nr_pages)
+				continue;
+
+			if (!page_test(balloon->inflated, idx)) {
+				page_set(balloon->inflated, idx);
+				balloon->inflated_pages++;
+			}
+		}
+	}
+}
+
+/* Take pages out of the balloon, they never stopped being backed */
+static void
+virtio_balloon_deflate(struct virtio_balloon *balloon,
+		       struct iovec *iov, int n)
+{
+	uint32_t *pfns;
+	vm_paddr_t gpa;
+	ssize_t idx;
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		pfns = iov[i].iov_base;
+		for (j = 0; j < iov[i].iov_len / sizeof(uint32_t); j++) {
+			gpa = (vm_paddr_t)pfns[j] << VIRTIO_BALLOON_PFN_SHIFT;
+			idx = virtio_balloon_page_idx(balloon, gpa);
+			if (idx < 0 || idx >= balloon->nr_pages ||
+			    !page_test(balloon->inflated, idx))
+				continue;
+
+			page_clear(balloon->inflated, idx);
+			balloon->inflated_pages--;
+		}
+	}
+}
+
+/* Reported pages stay with the guest, which reuses them at will */
+static void
+virtio_balloon_report(struct virtio_balloon *balloon,
+		      struct iovec *iov, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		balloon->reported_size += iov[i].iov_len;
+}
+
+static void
+virtio_balloon_write_stats(struct virtio_balloon *balloon)
+{
+	char tmp[PATH_MAX];
+	uint64_t delta;
+	FILE *fp;
+	int i;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", balloon->stats_path) >=
+			sizeof(tmp))
+		return;
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return;
+
+	fprintf(fp, "target_pages %u\n", balloon->cfg.num_pages);
+	fprintf(fp, "actual_pages %u\n", balloon->cfg.actual);
+	fprintf(fp, "inflated_pages %lu\n", balloon->inflated_pages);
+	fprintf(fp, "reported_bytes %lu\n", balloon->reported_size);
+
+	if (balloon->stats_valid) {
+		for (i = 0; i < VIRTIO_BALLOON_S_NR; i++)
+			fprintf(fp, "%s %lu\n", balloon_stat_names[i],
+				balloon->stats[i]);
+
+		/* swapping and major faults per second since the last
+		 * update are what tells the guest is short of memory
+		 */
+		delta = (balloon->stats[VIRTIO_BALLOON_S_SWAP_IN] -
+			 balloon->prev_stats[VIRTIO_BALLOON_S_SWAP_IN]) +
+			(balloon->stats[VIRTIO_BALLOON_S_SWAP_OUT] -
+			 balloon->prev_stats[VIRTIO_BALLOON_S_SWAP_OUT]) +
+			(balloon->stats[VIRTIO_BALLOON_S_MAJFLT] -
+			 balloon->prev_stats[VIRTIO_BALLOON_S_MAJFLT]);
+		fprintf(fp, "pressure %lu\n", delta / balloon->stats_period);
+	}
+	fclose(fp);
+
+	if (rename(tmp, balloon->stats_path) < 0)
+		unlink(tmp);
+}
+
+static void
+virtio_balloon_stats(struct virtio_balloon *balloon,
+		     struct virtio_vq_info *vq)
+{
+	struct virtio_balloon_stat *stat;
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	uint16_t idx;
+	size_t i;
+	int n, j;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n < 1 || n > VIRTIO_BALLOON_MAXSEGS) {
+			WPRINTF(("%s: fail to getchain!\n", __func__));
+			return;
+		}
+
+		/* only one buffer is in flight, it is kept until the next
+		 * stats update is wanted
+		 */
+		if (balloon->stats_held)
+			vq_relchain(vq, balloon->stats_idx, 0);
+
+		memcpy(balloon->prev_stats, balloon->stats,
+		       sizeof(balloon->stats));
+		for (j = 0; j < n; j++) {
+			stat = iov[j].iov_base;
+			for (i = 0; i < iov[j].iov_len / sizeof(*stat); i++) {
+				if (stat[i].tag < VIRTIO_BALLOON_S_NR)
+					balloon->stats[stat[i].tag] =
+						stat[i].val;
+			}
+		}
+		if (!balloon->stats_valid)
+			memcpy(balloon->prev_stats, balloon->stats,
+			       sizeof(balloon->stats));
+		balloon->stats_valid = true;
+		balloon->stats_held = true;
+		balloon->stats_idx = idx;
+	}
+	virtio_balloon_write_stats(balloon);
+}
+
+static void
+virtio_balloon_stats_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_balloon *balloon = arg;
+	struct virtio_vq_info *vq = &balloon->vqs[BALLOON_VQ_STATS];
+
+	pthread_mutex_lock(&balloon->mtx);
+	if (balloon->stats_held) {
+		/* returning the buffer asks the guest for new stats */
+		balloon->stats_held = false;
+		vq_relchain(vq, balloon->stats_idx, 0);
+		vq_endchains(vq, 0);
+	} else
+		virtio_balloon_write_stats(balloon);
+	pthread_mutex_unlock(&balloon->mtx);
+}
+
+static void
+virtio_balloon_notify(void *base, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *balloon = base;
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	enum balloon_vq_role role;
+	uint16_t idx;
+	int n;
+
+	role = virtio_balloon_vq_role(balloon, vq);
+	if (role == BALLOON_VQ_STATS) {
+		virtio_balloon_stats(balloon, vq);
+		return;
+	}
+	if (role == BALLOON_VQ_NONE) {
+		WPRINTF(("%s: unexpected queue %td\n", __func__,
+			 vq - balloon->vqs));
+		return;
+	}
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n < 1 || n > VIRTIO_BALLOON_MAXSEGS) {
+			WPRINTF(("%s: fail to getchain!\n", __func__));
+			return;
+		}
+
+		if (role == BALLOON_VQ_REPORTING)
+			virtio_balloon_report(balloon, iov, n);
+		else if (role == BALLOON_VQ_INFLATE)
+			virtio_balloon_inflate(balloon, iov, n);
+		else
+			virtio_balloon_deflate(balloon, iov, n);
+		vq_relchain(vq, idx, 0);
+	}
+	vq_endchains(vq, 1);
+}
+
+static int
+virtio_balloon_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_balloon *balloon = vdev;
+	void *ptr;
+
+	/* our caller has already verified offset and size */
+	ptr = (uint8_t *)&balloon->cfg + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+virtio_balloon_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	struct virtio_balloon *balloon = vdev;
+	void *ptr;
+
+	/* only the actual size of the balloon is written by the guest */
+	if (offset < offsetof(struct virtio_balloon_config, actual)) {
+		DPRINTF(("virtio_balloon: write to readonly reg %d\n", offset));
+		return -1;
+	}
+
+	ptr = (uint8_t *)&balloon->cfg + offset;
+	memcpy(ptr, &value, size);
+	return 0;
+}
+
+static void
+virtio_balloon_reset(void *base)
+{
+	struct virtio_balloon *balloon = base;
+
+	DPRINTF(("virtio_balloon: device reset requested !\n"));
+	virtio_reset_dev(&balloon->base);
+
+	/* the guest takes all its memory back without deflating */
+	memset(balloon->inflated, 0, (balloon->nr_pages + 63) / 64 * 8);
+	balloon->inflated_pages = 0;
+	balloon->cfg.actual = 0;
+	balloon->stats_held = false;
+	balloon->stats_valid = false;
+}
+
+static void
+virtio_balloon_set_target(struct virtio_balloon *balloon, unsigned long mb)
+{
+	uint64_t pages;
+
+	pages = (mb > (balloon->nr_pages >> (20 - VIRTIO_BALLOON_PFN_SHIFT))) ?
+		balloon->nr_pages : (mb << 20) >> VIRTIO_BALLOON_PFN_SHIFT;
+	balloon->cfg.num_pages = pages;
+}
+
+/*
+ * Change the size of memory the guest is asked to give back, the guest is
+ * told through a config change interrupt.
+ */
+static int
+vm_monitor_balloon(void *arg, unsigned long target_mb)
+{
+	struct virtio_balloon *balloon;
+
+	pthread_mutex_lock(&monitor_balloon_mtx);
+	balloon = monitor_balloon;
+	if (!balloon) {
+		pthread_mutex_unlock(&monitor_balloon_mtx);
+		return -1;
+	}
+
+	pthread_mutex_lock(&balloon->mtx);
+	virtio_balloon_set_target(balloon, target_mb);
+	DPRINTF(("virtio_balloon: target %u pages\n", balloon->cfg.num_pages));
+	pthread_mutex_unlock(&balloon->mtx);
+
+	virtio_config_changed(&balloon->base);
+	pthread_mutex_unlock(&monitor_balloon_mtx);
+	return 0;
+}
+
+static int
+virtio_balloon_parse(struct virtio_balloon *balloon, char *opts,
+		     unsigned long *inflate_mb)
+{
+	char *opt, *val;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		val = opt;
+		opt = strsep(&val, "=");
+		if (val == NULL)
+			goto bad;
+
+		if (!strcmp(opt, "reporting")) {
+			if (!strcmp(val, "on"))
+				balloon->reporting = true;
+			else if (!strcmp(val, "off"))
+				balloon->reporting = false;
+			else
+				goto bad;
+		} else if (!strcmp(opt, "stats")) {
+			if (dm_strtoi(val, NULL, 10, &balloon->stats_period) ||
+			    balloon->stats_period < 0)
+				goto bad;
+		} else if (!strcmp(opt, "inflate")) {
+			if (dm_strtoul(val, NULL, 10, inflate_mb))
+				goto bad;
+		} else
+			goto bad;
+	}
+	return 0;
+
+bad:
+	WPRINTF(("virtio_balloon: invalid option %s\n", opt));
+	return -1;
+}
+
+static int
+virtio_balloon_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *balloon;
+	pthread_mutexattr_t attr;
+	struct itimerspec ts;
+	unsigned long inflate_mb = 0;
+	size_t words;
+	int rc;
+
+	balloon = calloc(1, sizeof(struct virtio_balloon));
+	if (!balloon) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		return -1;
+	}
+
+	balloon->ctx = ctx;
+	balloon->stats_period = BALLOON_STATS_PERIOD;
+	if (opts && virtio_balloon_parse(balloon, opts, &inflate_mb) < 0)
+		goto fail;
+
+	balloon->nr_pages = (ctx->lowmem + ctx->highmem) >>
+				VIRTIO_BALLOON_PFN_SHIFT;
+	words = (balloon->nr_pages + 63) / 64;
+	balloon->inflated = calloc(words, sizeof(uint64_t));
+	if (!balloon->inflated) {
+		WPRINTF(("virtio_balloon: fail to alloc page bitmap\n"));
+		goto fail;
+	}
+
+	virtio_balloon_set_target(balloon, inflate_mb);
+
+	/* init mutex attribute properly */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	if (virtio_uses_msix()) {
+		rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_DEFAULT);
+		if (rc)
+			DPRINTF(("virtio_msix: mutexattr_settype failed with "
+				"error %d!\n", rc));
+	} else {
+		rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		if (rc)
+			DPRINTF(("virtio_intx: mutexattr_settype failed with "
+				"error %d!\n", rc));
+	}
+	rc = pthread_mutex_init(&balloon->mtx, &attr);
+	if (rc)
+		DPRINTF(("mutex init failed with error %d!\n", rc));
+
+	virtio_linkup(&balloon->base, &virtio_balloon_ops, balloon, dev,
+		      balloon->vqs, BACKEND_VBSU);
+	balloon->base.mtx = &balloon->mtx;
+	balloon->base.device_caps = (1UL << VIRTIO_BALLOON_F_MUST_TELL_HOST);
+	if (balloon->stats_period)
+		balloon->base.device_caps |= (1UL << VIRTIO_BALLOON_F_STATS_VQ);
+	if (balloon->reporting)
+		balloon->base.device_caps |= (1UL << VIRTIO_BALLOON_F_REPORTING);
+	for (rc = 0; rc < VIRTIO_BALLOON_MAXQ; rc++)
+		balloon->vqs[rc].qsize = VIRTIO_BALLOON_RINGSZ;
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+
+	if (virtio_interrupt_init(&balloon->base, virtio_uses_msix()))
+		goto fail;
+
+	virtio_set_io_bar(&balloon->base, 0);
+
+	if (balloon->stats_period) {
+		snprintf(balloon->stats_path, sizeof(balloon->stats_path),
+			 "%s/%s.balloon", BALLOON_STATS_DIR, vmname);
+		if (mkdir(BALLOON_STATS_DIR, 0755) < 0 && errno != EEXIST)
+			WPRINTF(("virtio_balloon: fail to create %s\n",
+				 BALLOON_STATS_DIR));
+
+		if (acrn_timer_init(&balloon->stats_timer,
+				virtio_balloon_stats_timer, balloon) < 0) {
+			WPRINTF(("virtio_balloon: fail to init stats timer\n"));
+			goto fail;
+		}
+		ts.it_value.tv_sec = balloon->stats_period;
+		ts.it_value.tv_nsec = 0;
+		ts.it_interval = ts.it_value;
+		acrn_timer_settime(&balloon->stats_timer, &ts);
+	}
+
+	pthread_mutex_lock(&monitor_balloon_mtx);
+	if (!monitor_balloon)
+		monitor_balloon = balloon;
+	pthread_mutex_unlock(&monitor_balloon_mtx);
+
+	if (register_vm_monitor_balloon == false) {
+		register_vm_monitor_balloon = true;
+		if (monitor_register_vm_ops(&virtio_balloon_monitor_ops, NULL,
+					    "virtio_balloon") < 0)
+			pr_err("Balloon registration to VM monitor failed\n");
+	}
+
+	return 0;
+
+fail:
+	free(balloon->inflated);
+	free(balloon);
+	dev->arg = NULL;
+	return -1;
+}
+
+static void
+virtio_balloon_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *balloon;
+
+	balloon = dev->arg;
+	if (balloon == NULL) {
+		DPRINTF(("%s: balloon is NULL\n", __func__));
+		return;
+	}
+
+	pthread_mutex_lock(&monitor_balloon_mtx);
+	if (monitor_balloon == balloon)
+		monitor_balloon = NULL;
+	pthread_mutex_unlock(&monitor_balloon_mtx);
+
+	if (balloon->stats_period) {
+		acrn_timer_deinit(&balloon->stats_timer);
+		unlink(balloon->stats_path);
+	}
+
+	virtio_balloon_reset(balloon);
+	DPRINTF(("%s: free struct virtio_balloon!\n", __func__));
+	free(balloon->inflated);
+	free(balloon);
+}
+
+struct pci_vdev_ops pci_ops_virtio_balloon = {
+	.class_name	= "virtio-balloon",
+	.vdev_init	= virtio_balloon_init,
+	.vdev_deinit	= virtio_balloon_deinit,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_balloon);
@@ -40,10 +40,12 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vhost.h"
 #include "block_if.h"
 #include "monitor.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_BATCH	16	/* chains harvested per pass */
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -80,6 +82,16 @@
 	(VIRTIO_BLK_F_FLUSH |	\
 	VIRTIO_BLK_F_CONFIG_WCE)
 
+/*
+ * Capabilities a vhost-user backend may offer to the guest
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS      \
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_WB_BITS |		\
+	VIRTIO_BLK_F_RO |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	(1 << VIRTIO_RING_F_EVENT_IDX))
+
 /*
  * Config space "registers"
  */
@@ -150,6 +162,16 @@ struct virtio_blk_ioreq {
 	uint16_t idx;
 };
 
+/*
+ * Per-vq scratch space for a batch of chains, only touched by whoever
+ * is processing the vq
+ */
+struct virtio_blk_batch {
+	struct vq_chain chains[VIRTIO_BLK_BATCH];
+	struct iovec iov[VIRTIO_BLK_BATCH][BLOCKIF_IOV_MAX + 2];
+	uint16_t flags[VIRTIO_BLK_BATCH][BLOCKIF_IOV_MAX + 2];
+};
+
 /*
  * Per-device struct
  */
@@ -162,14 +184,18 @@ struct virtio_blk {
 	struct blockif_ctxt *bc;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
 	struct virtio_blk_ioreq *ios;
+	struct virtio_blk_batch *batches;
 	uint8_t original_wce;
 	int num_vqs;
+	bool packed;	/* transitional device offering packed rings */
+	struct vhost_dev *vhost;	/* vhost-user data plane, no bctxt */
 	struct iothreads_info iothrds_info;
 	struct virtio_ops ops;
 };
 
 static void virtio_blk_reset(void *);
 static void virtio_blk_notify(void *, struct virtio_vq_info *);
+static void virtio_blk_set_status(void *, uint64_t);
 static int virtio_blk_cfgread(void *, int, int, uint32_t *);
 static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
 
@@ -223,7 +249,8 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc_chain(struct virtio_blk *blk, struct virtio_vq_info *vq,
+		      struct vq_chain *chain)
 {
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
@@ -231,12 +258,11 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	int err;
 	ssize_t iolen;
 	int writeop, type;
-	struct iovec iov[BLOCKIF_IOV_MAX + 2];
-	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct iovec *iov = chain->iov;
+	uint16_t idx = chain->idx, *flags = chain->flags;
 
 	qidx = vq - blk->vqs;
-	idx = vq->qsize;
-	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
+	n = chain->n;
 
 	/*
 	 * The first descriptor will be the read-only fixed header,
@@ -252,6 +278,13 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
+	/* a virtio 1.0 driver picks the queue size, keep ids in our range */
+	if (idx >= VIRTIO_BLK_RINGSZ) {
+		WPRINTF(("%s: request index %u out of range\n", __func__, idx));
+		virtio_blk_abort(vq, idx);
+		return;
+	}
+
 	io = &blk->ios[qidx * VIRTIO_BLK_RINGSZ + idx];
 	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
 		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
@@ -368,6 +401,29 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		WPRINTF(("%s: request process failed\n", __func__));
 }
 
+/*
+ * Take whatever the guest queued in one pass and let blockif dispatch
+ * the whole batch at once.
+ */
+static void
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+{
+	int qidx = vq - blk->vqs;
+	struct virtio_blk_batch *batch = &blk->batches[qidx];
+	int i, n;
+
+	n = vq_getchains(vq, batch->chains, VIRTIO_BLK_BATCH);
+	if (n <= 0)
+		return;
+
+	if (!blk->dummy_bctxt)
+		blockif_plug(blk->bc, qidx);
+	for (i = 0; i < n; i++)
+		virtio_blk_proc_chain(blk, vq, &batch->chains[i]);
+	if (!blk->dummy_bctxt)
+		blockif_unplug(blk->bc, qidx);
+}
+
 static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
@@ -387,7 +443,7 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 	 * requests in virtqueue.
 	 * */
 	do {
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&blk->base, vq);
 		mb();
 		do {
 			virtio_blk_proc(blk, vq);
@@ -416,6 +472,10 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blk->num_vqs > 1)
 		caps |= VIRTIO_BLK_F_MQ;
 
+	if (blk->packed)
+		caps |= (1UL << VIRTIO_F_VERSION_1) |
+			(1UL << VIRTIO_F_RING_PACKED);
+
 	return caps;
 }
 
@@ -455,7 +515,7 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 }
 
 static void
-virtio_blk_init_ops(struct virtio_blk *blk, int num_vqs)
+virtio_blk_init_ops(struct virtio_blk *blk, int num_vqs, bool vhost)
 {
 	blk->ops.name = "virtio_blk";
 	blk->ops.nvq = num_vqs;
@@ -463,6 +523,96 @@ virtio_blk_init_ops(struct virtio_blk *blk, int num_vqs)
 	blk->ops.reset = virtio_blk_reset;
 	blk->ops.cfgread = virtio_blk_cfgread;
 	blk->ops.cfgwrite = virtio_blk_cfgwrite;
+	if (vhost)
+		blk->ops.set_status = virtio_blk_set_status;
+}
+
+static void
+virtio_blk_vhost_free(struct vhost_dev *vdev)
+{
+	free(vdev->vqs);
+	free(vdev);
+}
+
+/*
+ * Hand the virtqueues to a vhost-user backend. The backend does the I/O
+ * and owns the disk, so the config space is read from it once here.
+ */
+static int
+virtio_blk_vhost_user_init(struct virtio_blk *blk, const char *path)
+{
+	struct vhost_dev *vdev;
+	uint64_t caps;
+	int fd, num;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("virtio_blk: vhost-user backend %s unavailable\n",
+			 path));
+		return -1;
+	}
+
+	vdev = calloc(1, sizeof(struct vhost_dev));
+	if (vdev)
+		vdev->vqs = calloc(blk->num_vqs, sizeof(struct vhost_vq));
+	if (!vdev || !vdev->vqs) {
+		WPRINTF(("virtio_blk: vhost calloc returns NULL\n"));
+		free(vdev);
+		close(fd);
+		return -1;
+	}
+	vdev->nvqs = blk->num_vqs;
+
+	caps = VIRTIO_BLK_S_VHOSTCAPS;
+	if (blk->num_vqs > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+	blk->base.device_caps = caps;
+
+	/* the socket is closed by vhost_dev_deinit on failure */
+	if (vhost_user_dev_init(vdev, &blk->base, fd, 0, caps) < 0) {
+		WPRINTF(("virtio_blk: vhost_user_dev_init failed\n"));
+		virtio_blk_vhost_free(vdev);
+		return -1;
+	}
+
+	num = vhost_user_get_queue_num(vdev);
+	if (num >= 0 && num < blk->num_vqs) {
+		WPRINTF(("virtio_blk: backend only serves %d queues\n", num));
+		goto fail;
+	}
+
+	if (vhost_user_get_config(vdev, &blk->cfg, sizeof(blk->cfg)) < 0) {
+		WPRINTF(("virtio_blk: backend has no config space\n"));
+		goto fail;
+	}
+	blk->cfg.num_queues = (uint16_t)blk->num_vqs;
+	blk->original_wce = blk->cfg.writeback;
+
+	blk->vhost = vdev;
+	return 0;
+
+fail:
+	vhost_dev_deinit(vdev);
+	virtio_blk_vhost_free(vdev);
+	return -1;
+}
+
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+
+	if (!blk->vhost)
+		return;
+
+	if (!blk->vhost->started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(blk->vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_start failed\n"));
+	} else if (blk->vhost->started &&
+		   ((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
+		if (vhost_dev_stop(blk->vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_stop failed\n"));
+	}
 }
 
 static int
@@ -477,6 +627,9 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	u_char digest[16];
 	struct virtio_blk *blk;
 	bool use_iothread;
+	bool use_packed = false;
+	char *vhost_user_path = NULL;
+	struct virtio_coalesce coal;
 	struct iothread_ctx *ioctx_base = NULL;
 	struct iothreads_info iothrds_info;
 	int num_vqs;
@@ -486,6 +639,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	struct iothreads_option iot_opt;
 
 	memset(&iot_opt, 0, sizeof(iot_opt));
+	memset(&coal, 0, sizeof(coal));
 
 	bctxt = NULL;
 	/* Assume the bctxt is valid, until identified otherwise */
@@ -518,9 +672,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 	if (strstr(opts, "nodisk") == NULL) {
 		/*
-		 * both ",iothread" and ",mq=int" are consumed by virtio-blk
-		 * and must be specified before any other opts which will
-		 * be used by blockif_open.
+		 * ",iothread", ",mq=int", ",packed", ",vhost-user=path" and
+		 * ",coalesce=..." are consumed by virtio-blk and must be
+		 * specified before any other opts which will be used by
+		 * blockif_open.
 		 */
 		char *p = opts_start;
 		while (opts_tmp != NULL) {
@@ -551,6 +706,29 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 						num_vqs = guest_cpu_num();
 				}
 				p = opts_tmp;
+			} else if (!strcmp(opt, "packed")) {
+				use_packed = true;
+				p = opts_tmp;
+			} else if (!strncmp(opt, "coalesce=",
+					    strlen("coalesce="))) {
+				if (virtio_parse_coalesce(opt + strlen("coalesce="),
+							  &coal) < 0) {
+					WPRINTF(("%s: invalid %s\n", __func__, opt));
+					free(vhost_user_path);
+					free(opts_start);
+					return -1;
+				}
+				p = opts_tmp;
+			} else if (!strncmp(opt, "vhost-user=",
+					    strlen("vhost-user="))) {
+				free(vhost_user_path);
+				vhost_user_path =
+					strdup(opt + strlen("vhost-user="));
+				if (!vhost_user_path) {
+					free(opts_start);
+					return -1;
+				}
+				p = opts_tmp;
 			} else {
 				/* The opts_start is truncated by strsep, opts_tmp is also
 				 * changed by strsetp, so use opts which points to the
@@ -561,6 +739,14 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			}
 		}
 
+		if (vhost_user_path && use_iothread) {
+			/* the backend serves the queues, not an iothread */
+			pr_warn("virtio_blk: iothread ignored with vhost-user\n");
+			iothread_free_options(&iot_opt);
+			memset(&iot_opt, 0, sizeof(iot_opt));
+			use_iothread = false;
+		}
+
 		if (use_iothread) {
 			/*
 			 * Creating more iothread instances than the number of virtqueues is not necessary.
@@ -585,11 +771,16 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		iothrds_info.ioctx_base = ioctx_base;
 		iothrds_info.num = iot_opt.num;
 
-		bctxt = blockif_open(p, bident, num_vqs, &iothrds_info);
-		if (bctxt == NULL) {
-			pr_err("Could not open backing file");
-			free(opts_start);
-			return -1;
+		/* a vhost-user disk has no bctxt in the device model */
+		if (vhost_user_path) {
+			dummy_bctxt = true;
+		} else {
+			bctxt = blockif_open(p, bident, num_vqs, &iothrds_info);
+			if (bctxt == NULL) {
+				pr_err("Could not open backing file");
+				free(opts_start);
+				return -1;
+			}
 		}
 	} else {
 		dummy_bctxt = true;
@@ -612,6 +803,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk->dummy_bctxt = dummy_bctxt;
 
 	blk->num_vqs = num_vqs;
+	blk->packed = use_packed && !dummy_bctxt;
 	blk->vqs = calloc(blk->num_vqs, sizeof(struct virtio_vq_info));
 	if (!blk->vqs) {
 		WPRINTF(("virtio_blk: calloc vqs returns NULL\n"));
@@ -627,6 +819,24 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	blk->batches = calloc(blk->num_vqs, sizeof(struct virtio_blk_batch));
+	if (!blk->batches) {
+		WPRINTF(("virtio_blk: calloc batches returns NULL\n"));
+		free(blk->ios);
+		free(blk->vqs);
+		free(blk);
+		return -1;
+	}
+	for (j = 0; j < num_vqs; j++) {
+		for (i = 0; i < VIRTIO_BLK_BATCH; i++) {
+			struct vq_chain *chain = &blk->batches[j].chains[i];
+
+			chain->iov = blk->batches[j].iov[i];
+			chain->flags = blk->batches[j].flags[i];
+			chain->n_iov = BLOCKIF_IOV_MAX + 2;
+		}
+	}
+
 	for (j = 0; j < num_vqs; j++) {
 		for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
 			struct virtio_blk_ioreq *io = &blk->ios[j * VIRTIO_BLK_RINGSZ + i];
@@ -653,10 +863,11 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
-	virtio_blk_init_ops(blk, num_vqs);
+	virtio_blk_init_ops(blk, num_vqs, vhost_user_path != NULL);
 
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &(blk->ops), blk, dev, blk->vqs, BACKEND_VBSU);
+	virtio_linkup(&blk->base, &(blk->ops), blk, dev, blk->vqs,
+		      vhost_user_path ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.iothread = use_iothread;
 	blk->base.mtx = &blk->mtx;
 
@@ -666,6 +877,9 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		if (use_iothread) {
 			blk->vqs[j].viothrd.ioctx = ioctx_base + j % (iot_opt.num);
 		}
+		/* completions of a vhost-user disk don't pass through here */
+		if (!vhost_user_path)
+			vq_set_coalesce(&blk->vqs[j], &coal);
 	}
 
 	/*
@@ -694,6 +908,18 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (!blk->dummy_bctxt)
 		virtio_blk_update_config_space(blk);
 
+	if (vhost_user_path) {
+		rc = virtio_blk_vhost_user_init(blk, vhost_user_path);
+		free(vhost_user_path);
+		if (rc < 0) {
+			free(blk->batches);
+			free(blk->ios);
+			free(blk->vqs);
+			free(blk);
+			return -1;
+		}
+	}
+
 	/*
 	 * Should we move some of this into virtio.c?  Could
 	 * have the device, class, and subdev_0 as fields in
@@ -717,6 +943,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 	virtio_set_io_bar(&blk->base, 0);
 
+	/* packed rings need the virtio 1.0 transport next to the legacy one */
+	if (blk->packed && virtio_set_modern_bar(&blk->base, false))
+		pr_err("virtio_blk: failed to set modern bar, legacy only\n");
+
 	/*
 	 * Register ops for virtio-blk Rescan
 	 */
@@ -747,9 +977,18 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
 			blockif_close(bctxt);
 		}
+		if (blk->vhost) {
+			if (blk->vhost->started)
+				vhost_dev_stop(blk->vhost);
+			vhost_dev_deinit(blk->vhost);
+			virtio_blk_vhost_free(blk->vhost);
+			blk->vhost = NULL;
+		}
 		virtio_reset_dev(&blk->base);
 		if (blk->ios)
 			free(blk->ios);
+		if (blk->batches)
+			free(blk->batches);
 		if (blk->vqs)
 			free(blk->vqs);
 		free(blk);
@@ -771,6 +1010,8 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 		/* Update write cache enable only on valid bctxt*/
 		if (!blk->dummy_bctxt)
 			blockif_set_wce(blk->bc, blkcfg->writeback);
+		else if (blk->vhost)
+			vhost_user_set_config(blk->vhost, ptr, offset, size);
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -844,7 +1085,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	 * user has passed empty file during VM launch and wants to update it.
 	 * If this is the case, blk->bc would be null.
 	 */
-	if (blk->bc) {
+	if (blk->bc || blk->vhost) {
 		pr_err("Replacing valid backend file not supported!\n");
 		goto end;
 	}
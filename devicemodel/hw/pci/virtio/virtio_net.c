@@ -43,6 +43,12 @@
 #include <net/if.h>
 #include <linux/if_tun.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
 #include <linux/vhost.h>
 
 #include "dm.h"
@@ -50,10 +56,13 @@
 #include "mevent.h"
 #include "virtio.h"
 #include "vhost.h"
+#include "vmmapi.h"
+#include "atomic.h"
 #include "dm_string.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_TX_BATCH	8	/* tx chains harvested per pass */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -77,6 +86,7 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_NOTF_COAL	(1UL << 53) /* notification coalescing */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
@@ -103,10 +113,30 @@ struct virtio_net_config {
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_CTLQ	2	/* only with packed, for NOTF_COAL */
 
 #define VIRTIO_NET_MAXQ	3
 
+/*
+ * Control virtqueue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_NOTF_COAL		6
+#define VIRTIO_NET_CTRL_NOTF_COAL_TX_SET	0
+#define VIRTIO_NET_CTRL_NOTF_COAL_RX_SET	1
+
+struct virtio_net_ctrl_coal {
+	uint32_t	max_packets;
+	uint32_t	max_usecs;
+} __attribute__((packed));
+
 /*
  * Fixed network header size
  */
@@ -127,6 +157,111 @@ static int virtio_net_debug;
 #define DPRINTF(params) do { if (virtio_net_debug) pr_dbg params; } while (0)
 #define WPRINTF(params) (pr_err params)
 
+/*
+ * Peer backend: the virtio-net of another DM on this host is connected over
+ * a unix socket, through which both sides share their guest memory and the
+ * ring their RX buffers are posted on. The sending side copies each packet
+ * from its guest TX buffers straight into a posted RX buffer of the other
+ * guest, and both sides poll the rings for an adaptive window before they
+ * fall back to eventfd doorbells.
+ */
+#define PEER_MAGIC		0x52454550	/* "PEER" */
+#define PEER_VERSION		1
+#define PEER_RING_SZ		256
+#define PEER_MAX_SEGS		4
+#define PEER_MAX_REGIONS	16
+#define PEER_POLL_US		50	/* default max polling window */
+#define PEER_WAIT_MS		100
+
+struct peer_buf {
+	uint16_t id;		/* head of the rx chain */
+	uint16_t nseg;
+	uint32_t hdr_len;	/* virtio-net header in front of the packet */
+	struct {
+		uint64_t gpa;
+		uint32_t len;
+		uint32_t pad;
+	} seg[PEER_MAX_SEGS];
+};
+
+struct peer_used {
+	uint16_t id;
+	uint16_t pad;
+	uint32_t len;
+};
+
+/*
+ * Ring of one direction, in memory of the receiving side. The first cache
+ * line is written by the receiver, the second one by the sender.
+ */
+struct peer_ring {
+	uint32_t post_prod;
+	uint32_t used_cons;
+	uint32_t rx_sleeping;	/* receiver waits on its rx doorbell */
+	uint32_t stopped;	/* posted buffers are being revoked */
+	uint8_t pad0[48];
+	uint32_t post_cons;
+	uint32_t used_prod;
+	uint32_t tx_sleeping;	/* sender waits on its tx doorbell */
+	uint32_t tx_busy;	/* sender is copying into posted buffers */
+	uint8_t pad1[48];
+	struct peer_buf post[PEER_RING_SZ];
+	struct peer_used used[PEER_RING_SZ];
+};
+
+/*
+ * Sent by both sides on connection, along with the memfds of the regions,
+ * the ring memfd, and the rx and tx doorbells.
+ */
+struct peer_hello {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_regions;
+	uint32_t pad;
+	struct {
+		uint64_t gpa;
+		uint64_t len;
+		uint64_t fd_offset;
+	} regions[PEER_MAX_REGIONS];
+};
+
+struct peer_region {
+	vm_paddr_t gpa;
+	size_t len;
+	char *hva;
+};
+
+struct virtio_net_peer {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	ino_t listen_ino;		/* of path, while we listen on it */
+	int sock;
+	pthread_t tid;
+	pthread_rwlock_t lock;		/* tx against session teardown */
+	bool connected;
+
+	/* peer to us, posted with our rx buffers */
+	struct peer_ring *rx_ring;
+	int ring_fd;
+	int rx_evt;
+	int tx_evt;
+	uint16_t rx_ids[PEER_RING_SZ];	/* private copy of what was posted */
+	uint32_t rx_lens[PEER_RING_SZ];
+
+	/* us to peer, valid while connected */
+	struct peer_ring *tx_ring;
+	int peer_rx_evt;
+	int peer_tx_evt;
+	struct peer_region regions[PEER_MAX_REGIONS];
+	int nr_regions;
+	struct peer_region *last;
+
+	uint32_t max_poll_us;
+	uint32_t rx_poll_us;
+	uint32_t tx_poll_us;
+	uint64_t tx_drops;
+};
+
 /*
  * vhost device struct
  */
@@ -142,7 +277,7 @@ struct vhost_net {
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
 	pthread_mutex_t mtx;
 	struct mevent	*mevp;
 
@@ -172,6 +307,10 @@ struct virtio_net {
 
 	struct vhost_net *vhost_net;
 	bool		use_vhost;
+
+	struct virtio_net_peer *peer;
+
+	struct virtio_coalesce coal;	/* interrupt coalescing after reset */
 };
 
 static void virtio_net_reset(void *vdev);
@@ -183,15 +322,18 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
+static void virtio_net_peer_kick(int fd);
+static void virtio_net_peer_revoke(struct virtio_net *net);
+static void virtio_net_peer_deinit(struct virtio_net *net);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
-	int tapfd, int vq_idx);
+	int tapfd, int vq_idx, bool user);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	VIRTIO_NET_MAXQ,		/* rx, tx and control virtqueues */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -309,6 +451,8 @@ virtio_net_reset(void *vdev)
 	 */
 	virtio_net_txwait(net);
 	virtio_net_rxwait(net);
+	if (net->peer)
+		virtio_net_peer_revoke(net);
 
 	net->rx_ready = 0;
 	net->rx_merge = 1;
@@ -317,6 +461,10 @@ virtio_net_reset(void *vdev)
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
+	/* drop what the driver set through VIRTIO_NET_CTRL_NOTF_COAL */
+	vq_set_coalesce(&net->queues[VIRTIO_NET_RXQ], &net->coal);
+	vq_set_coalesce(&net->queues[VIRTIO_NET_TXQ], &net->coal);
+
 	net->resetting = 0;
 	net->closing = 0;
 }
@@ -522,44 +670,58 @@ virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
+	if (net->peer) {
+		/* the peer rx thread needs each refill to be kicked */
+		net->rx_ready = 1;
+		virtio_net_peer_kick(net->peer->rx_evt);
+		return;
+	}
 	if (net->rx_ready == 0) {
 		net->rx_ready = 1;
-		if (vq->used != NULL) {
-			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		}
+		vq_set_used_ring_flags(&net->base, vq);
 	}
 }
 
 static void
 virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
-	int plen, tlen;
-	uint16_t idx;
+	struct iovec iov[VIRTIO_NET_TX_BATCH][VIRTIO_NET_MAXSEGS + 1];
+	struct vq_chain chains[VIRTIO_NET_TX_BATCH];
+	int i, j, n, nchains;
+	int plen;
+
+	for (j = 0; j < VIRTIO_NET_TX_BATCH; j++) {
+		chains[j].iov = iov[j];
+		chains[j].flags = NULL;
+		chains[j].n_iov = VIRTIO_NET_MAXSEGS;
+	}
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
+	 * Obtain a batch of descriptor chains.  The first descriptor
+	 * of each is really the header, the rest is the packet.
 	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
-		return;
-	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
-	}
+	nchains = vq_getchains(vq, chains, VIRTIO_NET_TX_BATCH);
+	for (j = 0; j < nchains; j++) {
+		n = chains[j].n;
+		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n",
+				 n));
+			return;
+		}
+		plen = 0;
+		for (i = 1; i < n; i++)
+			plen += iov[j][i].iov_len;
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r",
+			 plen, n));
+		net->virtio_net_tx(net, &iov[j][1], n - 1, plen);
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+		/*
+		 * chain is processed, release it. Nothing was written to
+		 * it, which lets in-order packed rings batch tx completions
+		 */
+		vq_relchain(vq, chains[j].idx, 0);
+	}
 }
 
 static void
@@ -575,7 +737,7 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 
 	/* Signal the tx thread for processing */
 	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	vq_set_used_ring_flags(&net->base, vq);
 	if (net->tx_in_progress == 0)
 		pthread_cond_signal(&net->tx_cond);
 	pthread_mutex_unlock(&net->tx_mtx);
@@ -630,7 +792,7 @@ virtio_net_tx_thread(void *param)
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&net->base, vq);
 		net->tx_in_progress = 1;
 		pthread_mutex_unlock(&net->tx_mtx);
 
@@ -652,13 +814,74 @@ virtio_net_tx_thread(void *param)
 	}
 }
 
-#ifdef notyet
+static uint8_t
+virtio_net_ctrl_coal(struct virtio_net *net, uint8_t cmd, struct iovec *iov)
+{
+	struct virtio_net_ctrl_coal *ctrl;
+	struct virtio_coalesce coal;
+
+	if (iov->iov_len < sizeof(*ctrl))
+		return VIRTIO_NET_ERR;
+
+	/* coalescing needs a time bound, max_packets alone turns it off */
+	ctrl = iov->iov_base;
+	coal.usecs = ctrl->max_usecs;
+	coal.frames = ctrl->max_packets;
+	coal.adaptive = net->coal.adaptive;
+
+	switch (cmd) {
+	case VIRTIO_NET_CTRL_NOTF_COAL_TX_SET:
+		vq_set_coalesce(&net->queues[VIRTIO_NET_TXQ], &coal);
+		break;
+	case VIRTIO_NET_CTRL_NOTF_COAL_RX_SET:
+		vq_set_coalesce(&net->queues[VIRTIO_NET_RXQ], &coal);
+		break;
+	default:
+		return VIRTIO_NET_ERR;
+	}
+
+	DPRINTF(("vtnet: %s coalescing %u us, %u packets\n\r",
+		 cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET ? "tx" : "rx",
+		 coal.usecs, coal.frames));
+	return VIRTIO_NET_OK;
+}
+
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct virtio_net_ctrl_hdr *hdr;
+	struct iovec iov[3];
+	uint16_t flags[3];
+	uint16_t idx;
+	uint8_t *ack;
+	int n;
+
+	while (vq_has_descs(vq)) {
+		/* header, command data and the ack byte */
+		n = vq_getchain(vq, &idx, iov, 3, flags);
+		if (n <= 0)
+			break;
+		if (n < 2 || iov[0].iov_len < sizeof(*hdr) ||
+		    (flags[n - 1] & VRING_DESC_F_WRITE) == 0 ||
+		    iov[n - 1].iov_len < 1) {
+			WPRINTF(("vtnet: malformed control command\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = iov[0].iov_base;
+		ack = iov[n - 1].iov_base;
+		if (hdr->class == VIRTIO_NET_CTRL_NOTF_COAL && n == 3)
+			*ack = virtio_net_ctrl_coal(net, hdr->cmd, &iov[1]);
+		else
+			*ack = VIRTIO_NET_ERR;
+
+		vq_relchain(vq, idx, 1);
+	}
+
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -821,7 +1044,7 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->tapfd, 0, false);
 			if (!net->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
@@ -843,6 +1066,855 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	}
 }
 
+/*
+ * The data plane is served by a vhost-user backend process, the device
+ * model only relays the control path.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, char *path)
+{
+	int fd;
+
+	/* nothing is forwarded by the device model itself */
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("vhost-user backend %s unavailable\n", path));
+		return;
+	}
+
+	/* the socket is closed by vhost_dev_deinit on failure */
+	net->vhost_net = vhost_net_init(&net->base, fd, -1, 0, true);
+	if (!net->vhost_net)
+		WPRINTF(("vhost-user init failed, link stays down\n"));
+}
+
+static uint64_t
+virtio_net_peer_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * The polling window grows while work keeps showing up in it and shrinks
+ * each time it runs out, so an idle link goes to sleep quickly.
+ */
+static inline void
+virtio_net_peer_adapt(uint32_t *poll_us, uint32_t max_poll_us, bool hit)
+{
+	if (hit)
+		*poll_us = MIN(max_poll_us, *poll_us ? *poll_us * 2 : 1);
+	else
+		*poll_us /= 2;
+}
+
+static inline void
+virtio_net_peer_kick(int fd)
+{
+	uint64_t val = 1;
+	ssize_t ret;
+
+	ret = write(fd, &val, sizeof(val));
+	(void)ret; /*avoid compiler warning*/
+}
+
+static inline void
+virtio_net_peer_drain(int fd)
+{
+	uint64_t val;
+	ssize_t ret;
+
+	ret = read(fd, &val, sizeof(val));
+	(void)ret; /*avoid compiler warning*/
+}
+
+/* Translate a gpa of the peer guest, NULL if [gpa, gpa + len) isn't its RAM */
+static void *
+virtio_net_peer_gpa2hva(struct virtio_net_peer *peer, uint64_t gpa,
+			uint32_t len)
+{
+	struct peer_region *r = peer->last;
+	int i;
+
+	if (r && gpa >= r->gpa && gpa + len <= r->gpa + r->len && gpa + len >= gpa)
+		return r->hva + (gpa - r->gpa);
+
+	for (i = 0; i < peer->nr_regions; i++) {
+		r = &peer->regions[i];
+		if (gpa >= r->gpa && gpa + len <= r->gpa + r->len &&
+		    gpa + len >= gpa) {
+			peer->last = r;
+			return r->hva + (gpa - r->gpa);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Copy one packet into the next buffer posted by the peer. The buffer
+ * description lives in memory the peer can write, so it is read only once.
+ */
+static void
+virtio_net_peer_copy(struct virtio_net_peer *peer, struct peer_ring *ring,
+		     uint32_t cons, struct iovec *iov, int iovcnt, int len)
+{
+	struct peer_buf buf;
+	struct peer_used *used;
+	struct virtio_net_rxhdr *vrxh;
+	char *dst[PEER_MAX_SEGS];
+	size_t off, seg_off, n;
+	uint32_t total = 0;
+	int i, s;
+
+	memcpy(&buf, &ring->post[cons % PEER_RING_SZ], sizeof(buf));
+	if (buf.nseg == 0 || buf.nseg > PEER_MAX_SEGS ||
+	    buf.hdr_len > sizeof(struct virtio_net_rxhdr) ||
+	    buf.seg[0].len < buf.hdr_len)
+		goto done;
+
+	for (s = 0; s < buf.nseg; s++) {
+		dst[s] = virtio_net_peer_gpa2hva(peer, buf.seg[s].gpa,
+						 buf.seg[s].len);
+		if (dst[s] == NULL)
+			goto done;
+		total += buf.seg[s].len;
+	}
+	if (total < buf.hdr_len + len) {
+		peer->tx_drops++;
+		total = 0;
+		goto done;
+	}
+
+	/* as with tap, only the number of buffers is valid in the header */
+	memset(dst[0], 0, buf.hdr_len);
+	if (buf.hdr_len == sizeof(struct virtio_net_rxhdr)) {
+		vrxh = (struct virtio_net_rxhdr *)dst[0];
+		vrxh->vrh_bufs = 1;
+	}
+
+	s = 0;
+	seg_off = buf.hdr_len;
+	for (i = 0; i < iovcnt; i++) {
+		for (off = 0; off < iov[i].iov_len; off += n) {
+			if (seg_off == buf.seg[s].len) {
+				s++;
+				seg_off = 0;
+			}
+			n = iov[i].iov_len - off;
+			if (n > buf.seg[s].len - seg_off)
+				n = buf.seg[s].len - seg_off;
+			memcpy(dst[s] + seg_off, (char *)iov[i].iov_base + off, n);
+			seg_off += n;
+		}
+	}
+	total = buf.hdr_len + len;
+
+done:
+	used = &ring->used[ring->used_prod % PEER_RING_SZ];
+	used->id = buf.id;
+	used->len = total;
+	atomic_store(&ring->used_prod, ring->used_prod + 1);
+	atomic_store(&ring->post_cons, cons + 1);
+}
+
+/*
+ * Called by the tx thread to send a packet to the peer. If the peer has no
+ * buffer posted, wait for one for up to PEER_WAIT_MS before dropping it.
+ */
+static void
+virtio_net_peer_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+		   int len)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct peer_ring *ring;
+	struct pollfd pfd;
+	uint64_t start = 0;
+	uint32_t cons;
+	bool slept = false;
+
+	for (;;) {
+		pthread_rwlock_rdlock(&peer->lock);
+		if (!peer->connected) {
+			pthread_rwlock_unlock(&peer->lock);
+			return;
+		}
+
+		ring = peer->tx_ring;
+		atomic_store(&ring->tx_busy, 1);
+		if (atomic_load(&ring->stopped)) {
+			atomic_store(&ring->tx_busy, 0);
+			pthread_rwlock_unlock(&peer->lock);
+			peer->tx_drops++;
+			return;
+		}
+
+		cons = ring->post_cons;
+		if (cons != atomic_load(&ring->post_prod)) {
+			virtio_net_peer_copy(peer, ring, cons, iov, iovcnt, len);
+			atomic_store(&ring->tx_busy, 0);
+			if (atomic_load(&ring->rx_sleeping))
+				virtio_net_peer_kick(peer->peer_rx_evt);
+			pthread_rwlock_unlock(&peer->lock);
+
+			if (start && !slept)
+				virtio_net_peer_adapt(&peer->tx_poll_us,
+						peer->max_poll_us, true);
+			return;
+		}
+		atomic_store(&ring->tx_busy, 0);
+
+		if (slept || net->closing || net->resetting) {
+			pthread_rwlock_unlock(&peer->lock);
+			peer->tx_drops++;
+			return;
+		}
+
+		if (start == 0)
+			start = virtio_net_peer_now_us();
+		if (virtio_net_peer_now_us() - start < peer->tx_poll_us) {
+			pthread_rwlock_unlock(&peer->lock);
+			continue;
+		}
+
+		/* recheck after announcing the sleep, the peer kicks us when
+		 * it posts and sees the flag
+		 */
+		atomic_store(&ring->tx_sleeping, 1);
+		if (atomic_load(&ring->post_prod) != cons) {
+			atomic_store(&ring->tx_sleeping, 0);
+			pthread_rwlock_unlock(&peer->lock);
+			continue;
+		}
+		pthread_rwlock_unlock(&peer->lock);
+
+		virtio_net_peer_adapt(&peer->tx_poll_us, peer->max_poll_us,
+				      false);
+		pfd.fd = peer->tx_evt;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, PEER_WAIT_MS) > 0)
+			virtio_net_peer_drain(peer->tx_evt);
+		slept = true;
+
+		pthread_rwlock_rdlock(&peer->lock);
+		if (peer->connected)
+			atomic_store(&peer->tx_ring->tx_sleeping, 0);
+		pthread_rwlock_unlock(&peer->lock);
+	}
+}
+
+/*
+ * Complete the packets the peer copied in and, if @post, post more guest rx
+ * buffers to it. Returns the amount of work done.
+ */
+static int
+virtio_net_peer_rx(struct virtio_net *net, bool post)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct peer_ring *ring = peer->rx_ring;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_RXQ];
+	struct iovec iov[PEER_MAX_SEGS];
+	struct peer_used *used;
+	struct peer_buf *buf;
+	uint32_t prod, posted = 0, done = 0;
+	uint16_t idx;
+	int i, n;
+
+	pthread_mutex_lock(&net->rx_mtx);
+	if (!net->rx_ready || net->resetting) {
+		pthread_mutex_unlock(&net->rx_mtx);
+		return 0;
+	}
+	net->rx_in_progress = 1;
+	pthread_mutex_unlock(&net->rx_mtx);
+
+	/* the guest is ready again after a reset */
+	if (post && ring->stopped)
+		atomic_store(&ring->stopped, 0);
+
+	/* buffers are filled in the order they were posted */
+	prod = atomic_load(&ring->used_prod);
+	if (prod - ring->used_cons > ring->post_prod - ring->used_cons)
+		prod = ring->post_prod;
+	while (ring->used_cons != prod) {
+		i = ring->used_cons % PEER_RING_SZ;
+		used = &ring->used[i];
+		vq_relchain(vq, peer->rx_ids[i],
+			    MIN(used->len, peer->rx_lens[i]));
+		ring->used_cons++;
+		done++;
+	}
+	if (done) {
+		atomic_store(&ring->used_cons, ring->used_cons);
+		vq_endchains(vq, 0);
+	}
+
+	prod = ring->post_prod;
+	while (post && prod - ring->used_cons < PEER_RING_SZ &&
+	       vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, PEER_MAX_SEGS, NULL);
+		if (n < 1)
+			break;
+		if (n > PEER_MAX_SEGS) {
+			WPRINTF(("vtnet: peer rx chain of %d segs\n", n));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		buf = &ring->post[prod % PEER_RING_SZ];
+		buf->id = idx;
+		buf->nseg = n;
+		buf->hdr_len = net->rx_vhdrlen;
+		peer->rx_ids[prod % PEER_RING_SZ] = idx;
+		peer->rx_lens[prod % PEER_RING_SZ] = 0;
+		for (i = 0; i < n; i++) {
+			buf->seg[i].gpa = (char *)iov[i].iov_base -
+					  net->base.dev->vmctx->baseaddr;
+			buf->seg[i].len = iov[i].iov_len;
+			peer->rx_lens[prod % PEER_RING_SZ] += iov[i].iov_len;
+		}
+		prod++;
+		posted++;
+	}
+	if (posted) {
+		atomic_store(&ring->post_prod, prod);
+		if (atomic_load(&ring->tx_sleeping))
+			virtio_net_peer_kick(peer->peer_tx_evt);
+	}
+
+	pthread_mutex_lock(&net->rx_mtx);
+	net->rx_in_progress = 0;
+	pthread_mutex_unlock(&net->rx_mtx);
+
+	return done + posted;
+}
+
+static bool
+virtio_net_peer_rx_pending(struct virtio_net *net)
+{
+	struct peer_ring *ring = net->peer->rx_ring;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_RXQ];
+
+	if (!net->rx_ready || net->resetting)
+		return false;
+	return atomic_load(&ring->used_prod) != ring->used_cons ||
+	       (ring->post_prod - ring->used_cons < PEER_RING_SZ &&
+		vq_has_descs(vq));
+}
+
+/* Stop the peer from filling the posted buffers */
+static void
+virtio_net_peer_stop(struct peer_ring *ring)
+{
+	int i;
+
+	atomic_store(&ring->stopped, 1);
+	for (i = 0; i < PEER_WAIT_MS * 100 && atomic_load(&ring->tx_busy); i++)
+		usleep(10);
+	if (atomic_load(&ring->tx_busy))
+		WPRINTF(("vtnet: peer still busy on the rx ring\n"));
+}
+
+/*
+ * Revoke the posted buffers on device reset. The rx thread is idle at this
+ * point, see virtio_net_reset().
+ */
+static void
+virtio_net_peer_revoke(struct virtio_net *net)
+{
+	struct peer_ring *ring = net->peer->rx_ring;
+
+	virtio_net_peer_stop(ring);
+	ring->post_prod = atomic_load(&ring->post_cons);
+	ring->used_cons = atomic_load(&ring->used_prod);
+}
+
+/*
+ * Give the guest back the rx buffers still posted when the peer goes away,
+ * the packets already copied in are delivered.
+ */
+static void
+virtio_net_peer_flush(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct peer_ring *ring = peer->rx_ring;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_RXQ];
+	uint32_t i;
+
+	virtio_net_peer_rx(net, false);
+
+	pthread_mutex_lock(&net->rx_mtx);
+	if (net->rx_ready && !net->resetting &&
+	    ring->used_cons != ring->post_prod) {
+		for (i = ring->used_cons; i != ring->post_prod; i++)
+			vq_relchain(vq, peer->rx_ids[i % PEER_RING_SZ], 0);
+		vq_endchains(vq, 0);
+	}
+	ring->used_cons = ring->post_prod;
+	pthread_mutex_unlock(&net->rx_mtx);
+}
+
+static void
+virtio_net_peer_set_link(struct virtio_net *net, bool up)
+{
+	pthread_mutex_lock(&net->mtx);
+	net->config.status = up ? 1 : 0;
+	virtio_config_changed(&net->base);
+	pthread_mutex_unlock(&net->mtx);
+	pr_info("vtnet: peer %s link %s, %lu packets dropped\n",
+		net->peer->path, up ? "up" : "down", net->peer->tx_drops);
+}
+
+static int
+virtio_net_peer_send_hello(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct vm_memfd_region regions[PEER_MAX_REGIONS];
+	struct peer_hello hello;
+	int fds[PEER_MAX_REGIONS + 3];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int i, nr;
+
+	nr = vm_get_memfd_regions(net->base.dev->vmctx, regions,
+				  PEER_MAX_REGIONS);
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = PEER_MAGIC;
+	hello.version = PEER_VERSION;
+	hello.nr_regions = nr;
+	for (i = 0; i < nr; i++) {
+		hello.regions[i].gpa = regions[i].gpa;
+		hello.regions[i].len = regions[i].len;
+		hello.regions[i].fd_offset = regions[i].fd_offset;
+		fds[i] = regions[i].fd;
+	}
+	fds[nr] = peer->ring_fd;
+	fds[nr + 1] = peer->rx_evt;
+	fds[nr + 2] = peer->tx_evt;
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(hello);
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE((nr + 3) * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN((nr + 3) * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, (nr + 3) * sizeof(int));
+
+	return (sendmsg(peer->sock, &msg, MSG_NOSIGNAL) == sizeof(hello)) ? 0 : -1;
+}
+
+/* Check [@offset, @offset + @len) lies within the file behind @fd */
+static bool
+virtio_net_peer_fd_fits(int fd, uint64_t offset, uint64_t len)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || len == 0 || offset + len < offset)
+		return false;
+	return offset + len <= (uint64_t)st.st_size;
+}
+
+static int
+virtio_net_peer_recv_hello(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct peer_hello hello;
+	int fds[PEER_MAX_REGIONS + 3];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	struct pollfd pfd;
+	int i, nfds = 0, ret = -1;
+	void *addr;
+
+	/* the peer sends its hello right after connecting */
+	pfd.fd = peer->sock;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, PEER_WAIT_MS * 10) <= 0)
+		return -1;
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(hello);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(peer->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS) {
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+	}
+
+	if (hello.magic != PEER_MAGIC || hello.version != PEER_VERSION ||
+	    hello.nr_regions > PEER_MAX_REGIONS ||
+	    nfds != hello.nr_regions + 3) {
+		WPRINTF(("vtnet: bad hello from peer %s\n", peer->path));
+		goto out;
+	}
+
+	/* a mapping beyond the end of the file would SIGBUS on access */
+	for (i = 0; i < hello.nr_regions; i++) {
+		if (!virtio_net_peer_fd_fits(fds[i], hello.regions[i].fd_offset,
+					     hello.regions[i].len)) {
+			WPRINTF(("vtnet: bad memory region from peer %s\n",
+				 peer->path));
+			goto out;
+		}
+	}
+	if (!virtio_net_peer_fd_fits(fds[i], 0, sizeof(struct peer_ring))) {
+		WPRINTF(("vtnet: bad ring from peer %s\n", peer->path));
+		goto out;
+	}
+
+	for (i = 0; i < hello.nr_regions; i++) {
+		addr = mmap(NULL, hello.regions[i].len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fds[i], hello.regions[i].fd_offset);
+		if (addr == MAP_FAILED) {
+			WPRINTF(("vtnet: fail to map peer memory\n"));
+			goto out;
+		}
+		peer->regions[i].gpa = hello.regions[i].gpa;
+		peer->regions[i].len = hello.regions[i].len;
+		peer->regions[i].hva = addr;
+		peer->nr_regions++;
+	}
+
+	addr = mmap(NULL, sizeof(struct peer_ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fds[i], 0);
+	if (addr == MAP_FAILED) {
+		WPRINTF(("vtnet: fail to map peer ring\n"));
+		goto out;
+	}
+	peer->tx_ring = addr;
+	peer->peer_rx_evt = fds[i + 1];
+	peer->peer_tx_evt = fds[i + 2];
+	fds[i + 1] = fds[i + 2] = -1;
+	ret = 0;
+
+out:
+	for (i = 0; i < nfds; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+	return ret;
+}
+
+static void
+virtio_net_peer_close(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+	int i;
+
+	pthread_rwlock_wrlock(&peer->lock);
+	peer->connected = false;
+	for (i = 0; i < peer->nr_regions; i++)
+		munmap(peer->regions[i].hva, peer->regions[i].len);
+	peer->nr_regions = 0;
+	peer->last = NULL;
+	if (peer->tx_ring) {
+		munmap(peer->tx_ring, sizeof(struct peer_ring));
+		peer->tx_ring = NULL;
+	}
+	if (peer->peer_rx_evt >= 0) {
+		close(peer->peer_rx_evt);
+		peer->peer_rx_evt = -1;
+	}
+	if (peer->peer_tx_evt >= 0) {
+		close(peer->peer_tx_evt);
+		peer->peer_tx_evt = -1;
+	}
+	if (peer->sock >= 0) {
+		close(peer->sock);
+		peer->sock = -1;
+	}
+	pthread_rwlock_unlock(&peer->lock);
+}
+
+/*
+ * Is path still the socket we listen on? Whoever renames its socket there
+ * last wins, the other side has to connect to it instead.
+ */
+static bool
+virtio_net_peer_listening(struct virtio_net_peer *peer)
+{
+	struct stat st;
+
+	return stat(peer->path, &st) == 0 && st.st_ino == peer->listen_ino;
+}
+
+/*
+ * Listen on a temporary socket and rename it over path, so that path never
+ * names a socket nobody listens on yet, and a stale one is replaced.
+ */
+static int
+virtio_net_peer_listen(struct virtio_net_peer *peer)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd, len;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d.%d",
+		       peer->path, getpid(), fd);
+	if (len < 0 || len >= sizeof(addr.sun_path)) {
+		WPRINTF(("vtnet: peer path %s too long\n", peer->path));
+		close(fd);
+		return -1;
+	}
+
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto fail;
+	if (listen(fd, 1) < 0 || stat(addr.sun_path, &st) < 0 ||
+	    rename(addr.sun_path, peer->path) < 0) {
+		unlink(addr.sun_path);
+		goto fail;
+	}
+
+	peer->listen_fd = fd;
+	peer->listen_ino = st.st_ino;
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+/*
+ * Connect to the peer, or wait for it to connect if it isn't there yet.
+ * Whoever comes first listens on the socket.
+ */
+static int
+virtio_net_peer_connect(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, peer->path, sizeof(addr.sun_path) - 1);
+
+	while (!net->closing) {
+		if (peer->listen_fd < 0) {
+			fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return -1;
+			if (connect(fd, (struct sockaddr *)&addr,
+				    sizeof(addr)) == 0)
+				return fd;
+			close(fd);
+
+			if (virtio_net_peer_listen(peer) < 0) {
+				usleep(PEER_WAIT_MS * 1000);
+				continue;
+			}
+		}
+
+		pfd.fd = peer->listen_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, PEER_WAIT_MS * 5) > 0) {
+			fd = accept4(peer->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd >= 0)
+				return fd;
+		} else if (!virtio_net_peer_listening(peer)) {
+			/* the peer listens on the path now, connect to it */
+			close(peer->listen_fd);
+			peer->listen_fd = -1;
+		}
+	}
+	return -1;
+}
+
+static void *
+virtio_net_peer_thread(void *param)
+{
+	struct virtio_net *net = param;
+	struct virtio_net_peer *peer = net->peer;
+	struct pollfd pfd[2];
+	uint64_t start;
+	int work;
+
+	while (!net->closing) {
+		peer->sock = virtio_net_peer_connect(net);
+		if (peer->sock < 0)
+			break;
+
+		/* a new session starts with a clean ring */
+		memset(peer->rx_ring, 0, sizeof(struct peer_ring));
+		if (virtio_net_peer_send_hello(net) < 0 ||
+		    virtio_net_peer_recv_hello(net) < 0) {
+			virtio_net_peer_close(net);
+			usleep(PEER_WAIT_MS * 1000);
+			continue;
+		}
+
+		pthread_rwlock_wrlock(&peer->lock);
+		peer->connected = true;
+		pthread_rwlock_unlock(&peer->lock);
+		virtio_net_peer_set_link(net, true);
+
+		start = 0;
+		while (!net->closing) {
+			work = virtio_net_peer_rx(net, true);
+			if (work) {
+				if (start)
+					virtio_net_peer_adapt(&peer->rx_poll_us,
+						peer->max_poll_us, true);
+				start = 0;
+				continue;
+			}
+
+			if (start == 0)
+				start = virtio_net_peer_now_us();
+			if (virtio_net_peer_now_us() - start < peer->rx_poll_us)
+				continue;
+
+			virtio_net_peer_adapt(&peer->rx_poll_us,
+					      peer->max_poll_us, false);
+			start = 0;
+			atomic_store(&peer->rx_ring->rx_sleeping, 1);
+			if (virtio_net_peer_rx_pending(net)) {
+				atomic_store(&peer->rx_ring->rx_sleeping, 0);
+				continue;
+			}
+
+			pfd[0].fd = peer->rx_evt;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = peer->sock;
+			pfd[1].events = POLLIN;
+			poll(pfd, 2, PEER_WAIT_MS);
+			atomic_store(&peer->rx_ring->rx_sleeping, 0);
+			if (pfd[0].revents & POLLIN)
+				virtio_net_peer_drain(peer->rx_evt);
+			/* nothing more is sent on the socket after hello */
+			if (pfd[1].revents)
+				break;
+		}
+
+		/* stop the peer before taking the buffers back */
+		virtio_net_peer_stop(peer->rx_ring);
+		virtio_net_peer_close(net);
+		virtio_net_peer_flush(net);
+		virtio_net_peer_set_link(net, false);
+	}
+
+	return NULL;
+}
+
+static int
+virtio_net_peer_setup(struct virtio_net *net, char *path, uint32_t poll_us)
+{
+	struct virtio_net_peer *peer;
+	char tname[MAXCOMLEN + 1];
+	void *ring;
+
+	peer = calloc(1, sizeof(struct virtio_net_peer));
+	if (!peer)
+		return -1;
+
+	if (strnlen(path, sizeof(peer->path)) >= sizeof(peer->path)) {
+		WPRINTF(("vtnet: peer path %s too long\n", path));
+		free(peer);
+		return -1;
+	}
+	strncpy(peer->path, path, sizeof(peer->path) - 1);
+	peer->listen_fd = -1;
+	peer->sock = -1;
+	peer->peer_rx_evt = -1;
+	peer->peer_tx_evt = -1;
+	peer->max_poll_us = poll_us;
+	peer->rx_poll_us = poll_us;
+	peer->tx_poll_us = poll_us;
+	pthread_rwlock_init(&peer->lock, NULL);
+
+	/* the ring is sealed so that the peer can't shrink it under us */
+	peer->ring_fd = memfd_create("vtnet-peer",
+				     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	peer->rx_evt = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	peer->tx_evt = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (peer->ring_fd < 0 || peer->rx_evt < 0 || peer->tx_evt < 0 ||
+	    ftruncate(peer->ring_fd, sizeof(struct peer_ring)) < 0 ||
+	    fcntl(peer->ring_fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+		goto fail;
+
+	ring = mmap(NULL, sizeof(struct peer_ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, peer->ring_fd, 0);
+	if (ring == MAP_FAILED)
+		goto fail;
+	peer->rx_ring = ring;
+
+	net->peer = peer;
+	net->virtio_net_tx = virtio_net_peer_tx;
+	if (pthread_create(&peer->tid, NULL, virtio_net_peer_thread, net)) {
+		net->peer = NULL;
+		munmap(ring, sizeof(struct peer_ring));
+		goto fail;
+	}
+	snprintf(tname, sizeof(tname), "vtnet-peer");
+	pthread_setname_np(peer->tid, tname);
+	return 0;
+
+fail:
+	WPRINTF(("vtnet: fail to set up peer %s\n", path));
+	if (peer->ring_fd >= 0)
+		close(peer->ring_fd);
+	if (peer->rx_evt >= 0)
+		close(peer->rx_evt);
+	if (peer->tx_evt >= 0)
+		close(peer->tx_evt);
+	free(peer);
+	return -1;
+}
+
+static void
+virtio_net_peer_deinit(struct virtio_net *net)
+{
+	struct virtio_net_peer *peer = net->peer;
+
+	/* closing is set already, see virtio_net_tx_stop() */
+	virtio_net_peer_kick(peer->rx_evt);
+	pthread_join(peer->tid, NULL);
+
+	if (peer->listen_fd >= 0) {
+		if (virtio_net_peer_listening(peer))
+			unlink(peer->path);
+		close(peer->listen_fd);
+	}
+	munmap(peer->rx_ring, sizeof(struct peer_ring));
+	close(peer->ring_fd);
+	close(peer->rx_evt);
+	close(peer->tx_evt);
+	pthread_rwlock_destroy(&peer->lock);
+	free(peer);
+	net->peer = NULL;
+}
+
 static int
 virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -859,6 +1931,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *vtopts = NULL;
 	char *opt = NULL;
 	int mac_provided;
+	uint32_t poll_us = PEER_POLL_US;
+	bool packed = false;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -902,6 +1976,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
+			else if (strcmp("packed", opt) == 0)
+				packed = true;
 			else if (!strncmp(opt, "mac=", 4)) {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
@@ -911,10 +1987,27 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					return err;
 				}
 				mac_provided = 1;
+			} else if (!strncmp(opt, "coalesce=", 9)) {
+				if (virtio_parse_coalesce(opt + 9, &net->coal)) {
+					WPRINTF(("virtio_net: invalid %s\n", opt));
+					free(devopts);
+					free(net);
+					return -1;
+				}
+			} else if (!strncmp(opt, "poll=", 5)) {
+				if (dm_strtoui(opt + 5, NULL, 10, &poll_us)) {
+					WPRINTF(("virtio_net: invalid %s\n", opt));
+					free(devopts);
+					free(net);
+					return -1;
+				}
 			}
 		}
 	}
 
+	if (opts != NULL && strncmp(opts, "vhost-user=", 11) == 0)
+		net->use_vhost = true;
+
 	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
@@ -924,10 +2017,10 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
 	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
 	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
 	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
 	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	vq_set_coalesce(&net->queues[VIRTIO_NET_RXQ], &net->coal);
+	vq_set_coalesce(&net->queues[VIRTIO_NET_TXQ], &net->coal);
 
 	/*
 	 * Attempt to open the tap device
@@ -944,7 +2037,9 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		vtopts = tmp = strdup(opts);
 	}
 
-	if ((tmp != NULL) && (strncmp(tmp, "tap", 3) == 0)) {
+	if ((tmp != NULL) && ((strncmp(tmp, "tap", 3) == 0) ||
+			      (strncmp(tmp, "peer=", 5) == 0) ||
+			      (strncmp(tmp, "vhost-user=", 11) == 0))) {
 		type = strsep(&tmp, "=");
 		name = strsep(&tmp, ",");
 	}
@@ -958,6 +2053,12 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 		if (strcmp(type, "tap") == 0) {
 			virtio_net_tap_setup(net, name);
+		} else if (strcmp(type, "peer") == 0 && !net->use_vhost) {
+			/* keep the link down and drop tx if the peer is unusable */
+			if (virtio_net_peer_setup(net, name, poll_us) < 0)
+				net->virtio_net_tx = virtio_net_tap_tx;
+		} else if (strcmp(type, "vhost-user") == 0) {
+			virtio_net_vhost_user_setup(net, name);
 		}
 	}
 
@@ -1007,8 +2108,15 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	else
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
-	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	/* Link is up if we managed to open tap device or reach a vhost-user
+	 * backend, a peer link comes up once the peer is connected, which
+	 * the peer thread may have done already
+	 */
+	pthread_mutex_lock(&net->mtx);
+	net->config.status = (opts == NULL || net->tapfd >= 0 ||
+			      net->vhost_net != NULL ||
+			      (net->peer && net->peer->connected));
+	pthread_mutex_unlock(&net->mtx);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -1020,6 +2128,22 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* use BAR 0 to map config regs in IO space */
 	virtio_set_io_bar(&net->base, 0);
 
+	/*
+	 * Packed rings need the virtio 1.0 transport next to the legacy
+	 * one. Both queues are served strictly in order, so IN_ORDER lets
+	 * tx completions be batched. vhost-net only knows split rings.
+	 * The 64-bit feature space also lets the driver tune interrupt
+	 * coalescing through the control queue.
+	 */
+	if (packed && !net->vhost_net) {
+		net->base.device_caps |= (1UL << VIRTIO_F_VERSION_1) |
+			(1UL << VIRTIO_F_RING_PACKED) |
+			(1UL << VIRTIO_F_IN_ORDER) |
+			VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_NOTF_COAL;
+		if (virtio_set_modern_bar(&net->base, false))
+			pr_err("vtnet: failed to set modern bar, legacy only\n");
+	}
+
 	net->resetting = 0;
 	net->closing = 0;
 
@@ -1087,7 +2211,15 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 
 	net->features = negotiated_features;
 
-	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF)) {
+	/*
+	 * A virtio 1.0 driver writes the features in two halves, so work
+	 * out the header from scratch each time. With VERSION_1 the rx
+	 * header always carries num_buffers.
+	 */
+	net->rx_merge = 1;
+	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF) &&
+	    !(net->features & (1UL << VIRTIO_F_VERSION_1))) {
 		net->rx_merge = 0;
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
@@ -1130,7 +2262,9 @@ virtio_net_teardown(void *param)
 	if (!net)
 		return;
 
-	if (net->tapfd >= 0) {
+	if (net->peer)
+		virtio_net_peer_deinit(net);
+	else if (net->tapfd >= 0) {
 		close(net->tapfd);
 		net->tapfd = -1;
 	} else
@@ -1168,7 +2302,8 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 }
 
 static struct vhost_net *
-vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
+vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx,
+	       bool user)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
@@ -1187,8 +2322,12 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 	vhost_net->vdev.vqs = vhost_net->vqs;
 	vhost_net->tapfd = tapfd;
 
-	rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
-		vhost_features, vhost_ext_features, busyloop_timeout);
+	if (user)
+		rc = vhost_user_dev_init(&vhost_net->vdev, base, vhostfd,
+			vq_idx, vhost_features);
+	else
+		rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
+			vhost_features, vhost_ext_features, busyloop_timeout);
 	if (rc < 0) {
 		WPRINTF(("vhost_dev_init failed\n"));
 		goto fail;
@@ -36,15 +36,29 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/random.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "virtio_kernel.h"
 #include "vmmapi.h"			/* for vmctx */
+#include "iothread.h"
 
 #define VIRTIO_RND_RINGSZ	64
 
+/*
+ * Entropy is pulled from the host in VIRTIO_RND_CHUNK sized pieces into a
+ * per-device pool, which is topped up again once it drains below
+ * VIRTIO_RND_LOWAT. Guest requests are copied out of the pool, up to
+ * VIRTIO_RND_BATCH chains at a time.
+ */
+#define VIRTIO_RND_POOLSZ	(64 * 1024)
+#define VIRTIO_RND_CHUNK	(16 * 1024)
+#define VIRTIO_RND_LOWAT	(VIRTIO_RND_POOLSZ / 2)
+#define VIRTIO_RND_BATCH	16
+#define VIRTIO_RND_MAXSEGS	4
+
 /*
  * Per-device struct
  */
@@ -55,10 +69,14 @@ struct virtio_rnd {
 	pthread_mutex_t mtx;
 	uint64_t cfg;
 	int fd;
-	int in_progress;
-	pthread_t rx_tid;
-	pthread_mutex_t	rx_mtx;
-	pthread_cond_t rx_cond;
+	/* entropy pool, protected by vq.mtx */
+	uint8_t pool[VIRTIO_RND_POOLSZ];
+	uint32_t pool_head;		/* first byte not handed out yet */
+	uint32_t pool_cnt;		/* bytes available from pool_head */
+	bool starved;			/* chains wait for the refiller */
+	bool closing;
+	pthread_t refill_tid;
+	pthread_cond_t refill_cond;
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS status;
@@ -287,7 +305,11 @@ virtio_rnd_reset(void *base)
 	rnd = base;
 
 	DPRINTF(("virtio_rnd: device reset requested !\n"));
+	/* keep the refiller off the ring while it goes away */
+	pthread_mutex_lock(&rnd->vq.mtx);
+	rnd->starved = false;
 	virtio_reset_dev(&rnd->base);
+	pthread_mutex_unlock(&rnd->vq.mtx);
 	DPRINTF(("virtio_rnd: kstatus %d\n", rnd->vbs_k.status));
 	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
 		DPRINTF(("virtio_rnd: VBS-K reset requested!\n"));
@@ -297,53 +319,143 @@ virtio_rnd_reset(void *base)
 	}
 }
 
-static void *
-virtio_rnd_get_entropy(void *param)
+/*
+ * Copy up to len bytes out of the pool into iov, returns the length copied.
+ * Called with vq.mtx held.
+ */
+static uint32_t
+virtio_rnd_pool_read(struct virtio_rnd *rnd, struct iovec *iov, int n,
+		     uint32_t len)
+{
+	uint32_t done = 0, part;
+	size_t off;
+	int i;
+
+	for (i = 0; i < n && done < len; i++) {
+		off = 0;
+		while (off < iov[i].iov_len && done < len) {
+			part = MIN(iov[i].iov_len - off, len - done);
+			part = MIN(part, VIRTIO_RND_POOLSZ - rnd->pool_head);
+			memcpy((uint8_t *)iov[i].iov_base + off,
+			       rnd->pool + rnd->pool_head, part);
+			rnd->pool_head = (rnd->pool_head + part) %
+					 VIRTIO_RND_POOLSZ;
+			rnd->pool_cnt -= part;
+			off += part;
+			done += part;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Serve the avail ring from the pool. Chains which can't get any entropy
+ * are left in the ring and the refiller completes them once it caught up.
+ * Called with vq.mtx held.
+ */
+static void
+virtio_rnd_serve(struct virtio_rnd *rnd)
 {
-	struct virtio_rnd *rnd = param;
 	struct virtio_vq_info *vq = &rnd->vq;
-	struct iovec iov;
-	uint16_t idx;
-	ssize_t len;
+	struct iovec iov[VIRTIO_RND_BATCH][VIRTIO_RND_MAXSEGS];
+	struct vq_chain chains[VIRTIO_RND_BATCH];
+	uint32_t len;
+	int i, n, nchains, served = 0;
+
+	for (i = 0; i < VIRTIO_RND_BATCH; i++) {
+		chains[i].iov = iov[i];
+		chains[i].flags = NULL;
+		chains[i].n_iov = VIRTIO_RND_MAXSEGS;
+	}
 
-	for (;;) {
-		pthread_mutex_lock(&rnd->rx_mtx);
-		rnd->in_progress = 0;
-
-		/*
-		 * Checking the avail ring here serves two purposes:
-		 *  - avoid vring processing due to spurious wakeups
-		 *  - catch missing notifications before acquiring rx_mtx
-		 */
-		while (!vq_has_descs(vq))
-			pthread_cond_wait(&rnd->rx_cond, &rnd->rx_mtx);
-
-		rnd->in_progress = 1;
-		pthread_mutex_unlock(&rnd->rx_mtx);
-
-		do {
-			if (vq_getchain(vq, &idx, &iov, 1, NULL) < 1) {
-				pr_err("%s: fail to getchain!\n", __func__);
-				break;
-			}
-			len = read(rnd->fd, iov.iov_base, iov.iov_len);
-			if (len <= 0) {
-				vq_retchain(vq);
-				vq_endchains(vq, 0);
-
-				/* no data available */
-				if (len == -1 && errno == EAGAIN)
-					return NULL;
+	while (vq_has_descs(vq)) {
+		if (rnd->pool_cnt == 0) {
+			rnd->starved = true;
+			break;
+		}
+
+		/* every chain of the batch gets at least one byte */
+		nchains = vq_getchains(vq, chains,
+				       MIN(VIRTIO_RND_BATCH, rnd->pool_cnt));
+		if (nchains <= 0)
+			break;
+
+		for (i = 0; i < nchains; i++) {
+			n = chains[i].n;
+			if (n < 1) {
+				WPRINTF(("%s: fail to getchain!\n", __func__));
+				if (chains[i].idx < vq->qsize)
+					vq_relchain(vq, chains[i].idx, 0);
+				nchains = -1;
 				break;
 			}
+			len = virtio_rnd_pool_read(rnd, iov[i], n,
+					rnd->pool_cnt - (nchains - 1 - i));
+			vq_relchain(vq, chains[i].idx, len);
+			served++;
+		}
+		if (nchains < 0)
+			break;
+	}
 
-			/* release this chain and handle more */
-			vq_relchain(vq, idx, len);
-		} while (vq_has_descs(vq));
+	if (rnd->pool_cnt < VIRTIO_RND_LOWAT)
+		pthread_cond_signal(&rnd->refill_cond);
 
-		/* at least one avail ring element has been processed */
-		vq_endchains(vq, 1);
+	if (served)
+		vq_endchains(vq, !rnd->starved);
+}
+
+/*
+ * Fill the pool from the host, taking it off the path of the guest
+ * requests. getrandom() doesn't need a file and only blocks until the
+ * host pool is initialized, /dev/random is read on kernels without it.
+ */
+static void *
+virtio_rnd_refill(void *param)
+{
+	struct virtio_rnd *rnd = param;
+	uint32_t tail, len;
+	ssize_t got;
+	int err;
+
+	pthread_mutex_lock(&rnd->vq.mtx);
+	for (;;) {
+		while (rnd->pool_cnt == VIRTIO_RND_POOLSZ && !rnd->closing)
+			pthread_cond_wait(&rnd->refill_cond, &rnd->vq.mtx);
+		if (rnd->closing)
+			break;
+
+		/* only the refiller writes to the free part of the pool */
+		tail = (rnd->pool_head + rnd->pool_cnt) % VIRTIO_RND_POOLSZ;
+		len = MIN(VIRTIO_RND_POOLSZ - rnd->pool_cnt,
+			  VIRTIO_RND_POOLSZ - tail);
+		len = MIN(len, VIRTIO_RND_CHUNK);
+		pthread_mutex_unlock(&rnd->vq.mtx);
+
+		got = getrandom(rnd->pool + tail, len, 0);
+		if (got < 0 && errno == ENOSYS)
+			got = read(rnd->fd, rnd->pool + tail, len);
+		err = errno;
+
+		pthread_mutex_lock(&rnd->vq.mtx);
+		if (got <= 0) {
+			if (got < 0 && err == EINTR)
+				continue;
+			WPRINTF(("%s: no entropy from host, errno %d\n",
+				 __func__, err));
+			break;
+		}
+		rnd->pool_cnt += got;
+
+		if (rnd->starved) {
+			rnd->starved = false;
+			virtio_rnd_serve(rnd);
+		}
 	}
+	pthread_mutex_unlock(&rnd->vq.mtx);
+
+	return NULL;
 }
 
 static void
@@ -351,15 +463,15 @@ virtio_rnd_notify(void *base, struct virtio_vq_info *vq)
 {
 	struct virtio_rnd *rnd = base;
 
-	/* Any ring entries to process */
-	if (!vq_has_descs(vq))
-		return;
-
-	/* Signal the thread for processing */
-	pthread_mutex_lock(&rnd->rx_mtx);
-	if (rnd->in_progress == 0)
-		pthread_cond_signal(&rnd->rx_cond);
-	pthread_mutex_unlock(&rnd->rx_mtx);
+	/*
+	 * Runs on the iothread if there is one, which holds vq.mtx already.
+	 * Copying from the pool doesn't block, so the chains are completed
+	 * right here.
+	 */
+	pthread_mutex_lock(&rnd->vq.mtx);
+	if (!rnd->starved)
+		virtio_rnd_serve(rnd);
+	pthread_mutex_unlock(&rnd->vq.mtx);
 }
 
 static int
@@ -373,8 +485,21 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *vbs_k_opt = NULL;
 	enum VBS_K_STATUS kstat = VIRTIO_DEV_INITIAL;
 	char tname[MAXCOMLEN + 1];
+	struct iothreads_option iot_opt;
+	struct iothread_ctx *ioctx = NULL;
+	bool use_iothread = false;
+
+	memset(&iot_opt, 0, sizeof(iot_opt));
 
 	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(opt, "iothread", strlen("iothread"))) {
+			use_iothread = true;
+			strsep(&opt, "=");
+			if (iothread_parse_options(opt, &iot_opt) < 0)
+				return -1;
+			continue;
+		}
+
 		/* vbs_k_opt should be kernel=on */
 		vbs_k_opt = strsep(&opt, "=");
 		DPRINTF(("vbs_k_opt is %s\n", vbs_k_opt));
@@ -385,6 +510,19 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
+	if (use_iothread) {
+		/* there is a single virtqueue to serve */
+		iot_opt.num = 1;
+		snprintf(iot_opt.tag, sizeof(iot_opt.tag), "rnd%d", dev->slot);
+		ioctx = iothread_create(&iot_opt);
+		iothread_free_options(&iot_opt);
+		if (ioctx == NULL) {
+			pr_err("%s: Fails to create iothread context instance \n",
+			       __func__);
+			return -1;
+		}
+	}
+
 	/*
 	 * Should always be able to open /dev/random.
 	 */
@@ -443,6 +581,10 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	rnd->base.mtx = &rnd->mtx;
 
 	rnd->vq.qsize = VIRTIO_RND_RINGSZ;
+	if (ioctx && rnd->base.backend_type == BACKEND_VBSU) {
+		rnd->base.iothread = true;
+		rnd->vq.viothrd.ioctx = ioctx;
+	}
 
 	/* keep /dev/random opened while emulating */
 	rnd->fd = fd;
@@ -460,14 +602,12 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	virtio_set_io_bar(&rnd->base, 0);
 
-	rnd->in_progress = 0;
-	pthread_mutex_init(&rnd->rx_mtx, NULL);
-	pthread_cond_init(&rnd->rx_cond, NULL);
-	pthread_create(&rnd->rx_tid, NULL, virtio_rnd_get_entropy,
+	pthread_cond_init(&rnd->refill_cond, NULL);
+	pthread_create(&rnd->refill_tid, NULL, virtio_rnd_refill,
 		       (void *)rnd);
-	snprintf(tname, sizeof(tname), "vtrnd-%d:%d tx", dev->slot,
+	snprintf(tname, sizeof(tname), "vtrnd-%d:%d fill", dev->slot,
 		 dev->func);
-	pthread_setname_np(rnd->rx_tid, tname);
+	pthread_setname_np(rnd->refill_tid, tname);
 
 	return 0;
 
@@ -495,8 +635,12 @@ virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return;
 	}
 
-	pthread_cancel(rnd->rx_tid);
-	pthread_join(rnd->rx_tid, &jval);
+	pthread_mutex_lock(&rnd->vq.mtx);
+	rnd->closing = true;
+	pthread_cond_signal(&rnd->refill_cond);
+	pthread_mutex_unlock(&rnd->vq.mtx);
+	pthread_join(rnd->refill_tid, &jval);
+	pthread_cond_destroy(&rnd->refill_cond);
 
 	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
 		DPRINTF(("%s: deinit virtio_rnd_k!\n", __func__));
@@ -1682,7 +1682,8 @@ pci_xhci_free_usb_xfer(struct pci_xhci_dev_emu *dev, struct usb_xfer *xfer)
 		if(xfer->reqs[i]) {
 			if (dev && dev->dev_ue->ue_free_req)
 				dev->dev_ue->ue_free_req(xfer->reqs[i]->trn);
-			free(xfer->reqs[i]->buffer);
+			if (!xfer->reqs[i]->zcopy)
+				free(xfer->reqs[i]->buffer);
 			free(xfer->reqs[i]);
 		}
 		if (xfer->data)
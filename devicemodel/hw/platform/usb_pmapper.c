@@ -19,6 +19,7 @@
 
 static struct usb_dev_sys_ctx_info g_ctx;
 static uint16_t usb_dev_get_ep_maxp(struct usb_dev *udev, int pid, int epnum);
+static void usb_dev_free_req(struct usb_dev_req *req);
 
 static bool
 usb_get_native_devinfo(struct libusb_device *ldev,
@@ -275,7 +276,7 @@ usb_dev_comp_cb(struct libusb_transfer *trn)
 
 			if (block->type == USB_DATA_PART ||
 					block->type == USB_DATA_FULL) {
-				if (r->in == TOKEN_IN) {
+				if (r->in == TOKEN_IN && !r->zcopy) {
 					memcpy(block->buf, buf + buf_idx, d);
 					buf_idx += d;
 				}
@@ -317,7 +318,7 @@ cancel_out:
 	/* unlock and release memory */
 	g_ctx.unlock_ep_cb(xfer->dev, &xfer->epid);
 
-	if (r && r->buffer)
+	if (r->buffer && !r->zcopy)
 		free(r->buffer);
 
 	xfer->reqs[r->blk_head] = NULL;
@@ -326,9 +327,23 @@ free_transfer:
 	libusb_free_transfer(trn);
 }
 
+static void
+usb_dev_free_req(struct usb_dev_req *req)
+{
+	if (req->buffer && !req->zcopy)
+		free(req->buffer);
+	if (req->trn)
+		libusb_free_transfer(req->trn);
+	free(req);
+}
+
+/*
+ * Allocate a request for 'size' bytes. If 'buf' is given the transfer
+ * works on it directly, otherwise a bounce buffer is allocated.
+ */
 static struct usb_dev_req *
 usb_dev_alloc_req(struct usb_dev *udev, struct usb_xfer *xfer, int in,
-		size_t size, size_t count)
+		size_t size, size_t count, uint8_t *buf)
 {
 	struct usb_dev_req *req;
 	static int seq = 1;
@@ -348,7 +363,10 @@ usb_dev_alloc_req(struct usb_dev *udev, struct usb_xfer *xfer, int in,
 	if (!req->trn)
 		goto errout;
 
-	if (size)
+	if (buf) {
+		req->buffer = buf;
+		req->zcopy = true;
+	} else if (size)
 		req->buffer = malloc(size);
 
 	if (!req->buffer)
@@ -357,12 +375,7 @@ usb_dev_alloc_req(struct usb_dev *udev, struct usb_xfer *xfer, int in,
 	return req;
 
 errout:
-	if (req && req->buffer)
-		free(req->buffer);
-	if (req && req->trn)
-		libusb_free_transfer(req->trn);
-	if (req)
-		free(req);
+	usb_dev_free_req(req);
 	return NULL;
 }
 
@@ -746,86 +759,70 @@ usb_dev_reset(void *pdata)
 	return rc;
 }
 
-int
-usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+/*
+ * Return the guest buffer backing blocks [head, tail) if their data is laid
+ * out back to back, so the transfer can use it in place instead of a bounce
+ * buffer. Each block maps one TRB buffer of guest memory.
+ */
+static uint8_t *
+usb_dev_contig_buf(struct usb_xfer *xfer, int head, int tail)
+{
+	struct usb_block *b;
+	uint8_t *start = NULL, *end = NULL;
+	int idx;
+
+	for (idx = head; index_valid(head, tail, xfer->max_blk_cnt, idx);
+			idx = index_inc(idx, xfer->max_blk_cnt)) {
+		b = &xfer->data[idx];
+		if (b->type != USB_DATA_PART && b->type != USB_DATA_FULL)
+			continue;
+		if (!start)
+			start = end = b->buf;
+		else if ((uint8_t *)b->buf != end)
+			return NULL;
+		end += b->blen;
+	}
+	return start;
+}
+
+static int
+usb_dev_submit_req(struct usb_dev *udev, struct usb_xfer *xfer, int dir,
+		uint8_t type, int epid, int head, int tail, int size,
+		int framecnt)
 {
-	struct usb_dev *udev;
 	struct usb_dev_req *r;
 	struct usb_native_devinfo *info;
-	int rc = 0, epid;
-	uint8_t type;
-	int i, idx, buf_idx, head, tail, size;
 	struct usb_block *b;
+	uint8_t *zbuf = NULL;
+	int i, idx, buf_idx, rc;
 	static const char * const type_str[] = {"CTRL", "ISO", "BULK", "INT"};
 	static const char * const dir_str[] = {"OUT", "IN"};
-	int framelen = 0, framecnt = 0;
-	uint16_t maxp;
 
-	udev = pdata;
+	/*
+	 * Only OUT data is used in place. A cancelled IN transfer is reaped
+	 * after Stop/Reset Endpoint has completed, and usbfs would then copy
+	 * into guest memory the guest may already have reused.
+	 */
 	info = &udev->info;
-	xfer->status = USB_ERR_NORMAL_COMPLETION;
-	size = usb_dev_prepare_xfer(xfer, &head, &tail);
-	if (size <= 0)
-		goto done;
-
-	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
-	if (type > USB_ENDPOINT_INT) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
-	epid = dir ? (0x80 | epctx) : epctx;
-	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
-	maxp = usb_dev_get_ep_maxp(udev, dir, epctx);
-	if (type == USB_ENDPOINT_ISOC) {
-		/* need to double check it, there might be some non-spec
-		 * compatible usb devices in the market.
-		 */
-		framelen = USB_EP_MAXP_SZ(maxp) * (1 + USB_EP_MAXP_MT(maxp));
-		UPRINTF(LDBG, "iso maxp %u framelen %d\r\n", maxp, framelen);
-
-		for (idx = head;
-			index_valid(head, tail, xfer->max_blk_cnt, idx);
-			idx = index_inc(idx, xfer->max_blk_cnt)) {
-
-			if (xfer->data[idx].blen > framelen)
-				UPRINTF(LFTL, "err framelen %d\r\n", framelen);
-
-			if (xfer->data[idx].type == USB_DATA_NONE ||
-					xfer->data[idx].type == USB_DATA_PART)
-				continue;
-			else if (xfer->data[idx].type == USB_DATA_FULL)
-				framecnt++;
-			else
-				UPRINTF(LFTL, "%s:%d error\r\n", __func__, __LINE__);
-		}
-		UPRINTF(LDBG, "iso maxp %u framelen %d, framecnt %d\r\n", maxp,
-				framelen, framecnt);
-	}
+	if (!dir && (type == USB_ENDPOINT_BULK || type == USB_ENDPOINT_INT))
+		zbuf = usb_dev_contig_buf(xfer, head, tail);
 
 	r = usb_dev_alloc_req(udev, xfer, dir, size, type ==
-			USB_ENDPOINT_ISOC ? framecnt : 0);
-	if (!r) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
+			USB_ENDPOINT_ISOC ? framecnt : 0, zbuf);
+	if (!r)
+		return USB_ERR_IOERROR;
 
 	r->buf_size = size;
 	r->blk_head = head;
 	r->blk_tail = tail;
-	xfer->reqs[head] = r;
 	UPRINTF(LDBG, "%s: %d-%s: explen %d ep%d-xfr [%d-%d %d] rq-%d "
-			"[%d-%d %d] dir %s type %s\r\n", __func__,
-			info->path.bus, usb_dev_path(&info->path), size, epctx,
-			xfer->head, xfer->tail, xfer->ndata, r->seq,
+			"[%d-%d %d] dir %s type %s%s\r\n", __func__,
+			info->path.bus, usb_dev_path(&info->path), size,
+			epid & 0x7f, xfer->head, xfer->tail, xfer->ndata, r->seq,
 			r->blk_head, r->blk_tail, r->buf_size, dir_str[dir],
-			type_str[type]);
+			type_str[type], r->zcopy ? " zcopy" : "");
 
-	if (!dir) {
+	if (!dir && !r->zcopy) {
 		for (idx = head, buf_idx = 0;
 				index_valid(head, tail, xfer->max_blk_cnt, idx);
 				idx = index_inc(idx, xfer->max_blk_cnt)) {
@@ -877,19 +874,78 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 
 	} else {
 		UPRINTF(LFTL, "%s: wrong endpoint type %d\r\n", __func__, type);
-		if (r->buffer)
-			free(r->buffer);
-		if (r->trn)
-			libusb_free_transfer(r->trn);
-		free(r);
-		xfer->status = USB_ERR_INVAL;
+		usb_dev_free_req(r);
+		return USB_ERR_INVAL;
 	}
 
+	xfer->reqs[head] = r;
 	rc = libusb_submit_transfer(r->trn);
 	if (rc) {
-		xfer->status = USB_ERR_IOERROR;
 		UPRINTF(LDBG, "libusb_submit_transfer fail: %d\n", rc);
+		xfer->reqs[head] = NULL;
+		usb_dev_free_req(r);
+		return USB_ERR_IOERROR;
+	}
+	return USB_ERR_NORMAL_COMPLETION;
+}
+
+int
+usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+{
+	struct usb_dev *udev;
+	int epid;
+	uint8_t type;
+	int idx, head, tail, size;
+	int framelen = 0, framecnt = 0;
+	uint16_t maxp;
+
+	udev = pdata;
+	xfer->status = USB_ERR_NORMAL_COMPLETION;
+	size = usb_dev_prepare_xfer(xfer, &head, &tail);
+	if (size <= 0)
+		goto done;
+
+	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
+	if (type > USB_ENDPOINT_INT) {
+		xfer->status = USB_ERR_IOERROR;
+		goto done;
 	}
+
+	epid = dir ? (0x80 | epctx) : epctx;
+	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
+		xfer->status = USB_ERR_IOERROR;
+		goto done;
+	}
+
+	maxp = usb_dev_get_ep_maxp(udev, dir, epctx);
+	if (type == USB_ENDPOINT_ISOC) {
+		/* need to double check it, there might be some non-spec
+		 * compatible usb devices in the market.
+		 */
+		framelen = USB_EP_MAXP_SZ(maxp) * (1 + USB_EP_MAXP_MT(maxp));
+		UPRINTF(LDBG, "iso maxp %u framelen %d\r\n", maxp, framelen);
+
+		for (idx = head;
+			index_valid(head, tail, xfer->max_blk_cnt, idx);
+			idx = index_inc(idx, xfer->max_blk_cnt)) {
+
+			if (xfer->data[idx].blen > framelen)
+				UPRINTF(LFTL, "err framelen %d\r\n", framelen);
+
+			if (xfer->data[idx].type == USB_DATA_NONE ||
+					xfer->data[idx].type == USB_DATA_PART)
+				continue;
+			else if (xfer->data[idx].type == USB_DATA_FULL)
+				framecnt++;
+			else
+				UPRINTF(LFTL, "%s:%d error\r\n", __func__, __LINE__);
+		}
+		UPRINTF(LDBG, "iso maxp %u framelen %d, framecnt %d\r\n", maxp,
+				framelen, framecnt);
+	}
+
+	xfer->status = usb_dev_submit_req(udev, xfer, dir, type, epid, head,
+			tail, size, framecnt);
 done:
 	return xfer->status;
 }
@@ -109,6 +109,8 @@ void	blockif_psectsz(struct blockif_ctxt *bc, int *size, int *off);
 int	blockif_queuesz(struct blockif_ctxt *bc);
 int	blockif_is_ro(struct blockif_ctxt *bc);
 int	blockif_candiscard(struct blockif_ctxt *bc);
+void	blockif_plug(struct blockif_ctxt *bc, int qidx);
+void	blockif_unplug(struct blockif_ctxt *bc, int qidx);
 int	blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_write(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_flush(struct blockif_ctxt *bc, struct blockif_req *breq);
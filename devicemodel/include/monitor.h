@@ -26,6 +26,7 @@ struct monitor_vm_ops {
 	int (*unpause) (void *arg);
 	int (*query) (void *arg);
 	int (*rescan)(void *arg, char *devargs);
+	int (*balloon)(void *arg, unsigned long target_mb);
 };
 
 int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
@@ -34,6 +35,7 @@ int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
 /* helper functions for vm_ops callback developer */
 unsigned get_wakeup_reason(void);
 int set_wakeup_timer(time_t t);
+void monitor_notify_state(int state);
 int acrn_parse_intr_monitor(const char *opt);
 int vm_monitor_blkrescan(void *arg, char *devargs);
 
@@ -123,6 +123,19 @@ struct msix_table_entry {
 	uint32_t	vector_control;
 } __attribute__((packed));
 
+/*
+ * Per-vector irqfd binding used by pci_generate_msix() when the device
+ * opted in with pci_msix_irqfd_enable(). 'addr'/'data' record the message
+ * last handed to the hypervisor so that a table rewrite can rebind it.
+ */
+struct msix_irqfd {
+	int		fd;
+	bool		assigned;
+	bool		fallback;	/* binding failed, use vm_lapic_msi() */
+	uint64_t	addr;
+	uint32_t	data;
+};
+
 /*
  * In case the structure is modified to hold extra information, use a define
  * for the size that should be emulated.
@@ -174,6 +187,8 @@ struct pci_vdev {
 		struct msix_table_entry *table;	/* allocated at runtime */
 		void	*pba_page;
 		int	pba_page_offset;
+		struct msix_irqfd *irqfd;	/* NULL unless irqfd mode */
+		pthread_mutex_t	irqfd_mtx;
 	} msix;
 
 	void	*arg;		/* devemu-private data */
@@ -360,6 +375,20 @@ void	pci_generate_msi(struct pci_vdev *dev, int index);
  */
 void	pci_generate_msix(struct pci_vdev *dev, int index);
 
+/**
+ * @brief Deliver MSI-X interrupts of a virtual PCI device through irqfds
+ *
+ * Allocates one eventfd per MSI-X table entry. Each eventfd is bound to
+ * the guest message of its entry while MSI-X is enabled and the vector is
+ * unmasked, and rebound whenever the guest reprograms the entry, so that
+ * pci_generate_msix() only needs an eventfd write instead of an ioctl.
+ *
+ * @param dev Pointer to struct pci_vdev representing virtual PCI device.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int	pci_msix_irqfd_enable(struct pci_vdev *dev);
+
 /**
  * @brief Assert INTx pin of virtual PCI device
  *
@@ -73,6 +73,7 @@ struct usb_dev_req {
 	 * so here need some data to record it.
 	 */
 	uint8_t	*buffer;
+	bool	zcopy;		/* buffer is guest memory, not owned */
 	int     buf_size;
 	int     blk_head;
 	int     blk_tail;
@@ -14,7 +14,9 @@
 #ifndef __VHOST_H__
 #define __VHOST_H__
 
+#include <linux/vhost.h>
 #include "virtio.h"
+#include "vhost_user.h"
 
 /**
  * @brief vhost APIs
@@ -23,6 +25,42 @@
  *
  */
 
+struct vhost_dev;
+
+/**
+ * @brief vhost backend operations
+ *
+ * Kernel vhost is driven through ioctls on the vhost chardev, vhost-user
+ * through messages on a Unix socket to a backend in another process.
+ * Operations a backend does not need are left NULL.
+ */
+struct vhost_ops {
+	int (*init)(struct vhost_dev *vdev, uint64_t features);
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+	int (*set_vring_enable)(struct vhost_dev *vdev, int idx, bool enable);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+};
+
+/** vhost-user backend operations, implemented in vhost_user.c */
+extern const struct vhost_ops vhost_user_ops;
+
 struct vhost_vq {
 	int kick_fd;		/**< fd of kick eventfd */
 	int call_fd;		/**< fd of call eventfd */
@@ -47,10 +85,15 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or the vhost-user socket
 	 */
 	int fd;
 
+	/**
+	 * backend operations
+	 */
+	const struct vhost_ops *ops;
+
 	/**
 	 * first vq's index in virtio_vq_info
 	 */
@@ -67,6 +110,11 @@ struct vhost_dev {
 	 */
 	uint64_t vhost_ext_features;
 
+	/**
+	 * vhost-user protocol features negotiated with the backend
+	 */
+	uint64_t protocol_features;
+
 	/**
 	 * vq busyloop timeout in us
 	 */
@@ -98,6 +146,68 @@ int vhost_dev_init(struct vhost_dev *vdev, struct virtio_base *base, int fd,
 		   int vq_idx, uint64_t vhost_features,
 		   uint64_t vhost_ext_features, uint32_t busyloop_timeout);
 
+/**
+ * @brief vhost-user vhost_dev initialization.
+ *
+ * Same as vhost_dev_init(), but the data plane is served by a vhost-user
+ * backend connected through vhost_user_connect(). Guest memory is shared
+ * with the backend, so it has to be backed by hugetlbfs.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param base Pointer to struct virtio_base.
+ * @param fd Socket connected to the vhost-user backend.
+ * @param vq_idx The first virtqueue which would be used by this vhost dev.
+ * @param vhost_features Subset of vhost features which would be enabled.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_dev_init(struct vhost_dev *vdev, struct virtio_base *base,
+			int fd, int vq_idx, uint64_t vhost_features);
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * @param path Path of the Unix socket the backend listens on.
+ *
+ * @return the connected socket on success and -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
+/**
+ * @brief read the device config space from a vhost-user backend.
+ *
+ * Requires VHOST_USER_PROTOCOL_F_CONFIG to have been negotiated.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer the config space is copied to.
+ * @param size Number of bytes to read from offset 0.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size);
+
+/**
+ * @brief write part of the device config space of a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Data to write.
+ * @param offset Offset in the config space.
+ * @param size Number of bytes to write.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_set_config(struct vhost_dev *vdev, const void *config,
+			  uint32_t offset, uint32_t size);
+
+/**
+ * @brief query the number of queues a vhost-user backend supports.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ *
+ * @return number of queues, or -1 if the backend cannot tell.
+ */
+int vhost_user_get_queue_num(struct vhost_dev *vdev);
+
 /**
  * @brief vhost_dev cleanup.
  *
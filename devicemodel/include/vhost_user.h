@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @file vhost_user.h
+ *
+ * @brief vhost-user messages, as exchanged between the frontend in
+ * vhost_user.c and a backend process such as test/vhost_user_blk.c
+ */
+
+#ifndef __VHOST_USER_H__
+#define __VHOST_USER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/vhost.h>
+
+/**
+ * Feature bit offered by a vhost-user backend which understands the
+ * GET/SET_PROTOCOL_FEATURES messages.
+ */
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+
+/**
+ * vhost-user protocol features the device model can use.
+ */
+#define VHOST_USER_PROTOCOL_F_MQ	0
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_VERSION_MASK		0x3
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+
+#define VHOST_USER_MAX_REGIONS		8
+#define VHOST_USER_MAX_CONFIG_SIZE	256
+
+enum vhost_user_request {
+	VHOST_USER_GET_FEATURES = 1,
+	VHOST_USER_SET_FEATURES = 2,
+	VHOST_USER_SET_OWNER = 3,
+	VHOST_USER_RESET_OWNER = 4,
+	VHOST_USER_SET_MEM_TABLE = 5,
+	VHOST_USER_SET_VRING_NUM = 8,
+	VHOST_USER_SET_VRING_ADDR = 9,
+	VHOST_USER_SET_VRING_BASE = 10,
+	VHOST_USER_GET_VRING_BASE = 11,
+	VHOST_USER_SET_VRING_KICK = 12,
+	VHOST_USER_SET_VRING_CALL = 13,
+	VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+	VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+	VHOST_USER_GET_QUEUE_NUM = 17,
+	VHOST_USER_SET_VRING_ENABLE = 18,
+	VHOST_USER_GET_CONFIG = 24,
+	VHOST_USER_SET_CONFIG = 25,
+};
+
+struct vhost_user_memory_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_memory_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+};
+
+/* vhost_vring_state and vhost_vring_addr match the wire format */
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+#endif /* __VHOST_USER_H__ */
@@ -219,6 +219,7 @@ enum {
 #define	VIRTIO_VENDOR		0x1AF4
 #define	VIRTIO_DEV_NET		0x1000
 #define	VIRTIO_DEV_BLOCK	0x1001
+#define	VIRTIO_DEV_BALLOON	0x1002
 #define	VIRTIO_DEV_CONSOLE	0x1003
 #define	VIRTIO_DEV_RANDOM	0x1005
 #define	VIRTIO_DEV_GPU		0x1050
@@ -422,6 +423,15 @@ struct virtio_ops {
  * (but more easily) computable, and this time we'll compute them:
  * they're just XX_ring[N].
  */
+/**
+ * @brief Interrupt coalescing parameters of a virtqueue
+ */
+struct virtio_coalesce {
+	uint32_t usecs;		/**< max interrupt delay, 0 to disable */
+	uint32_t frames;	/**< max used entries per interrupt, 0: no limit */
+	bool	adaptive;	/**< don't delay interrupts of a quiet queue */
+};
+
 struct virtio_iothread {
 	struct virtio_base *base;
 	int idx;
@@ -461,6 +471,52 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	bool	packed;		/**< packed ring layout is in use */
+	bool	in_order;	/**< packed: used descriptors may be batched */
+	bool	avail_wrap;	/**< packed: driver ring wrap counter */
+	bool	used_wrap;	/**< packed: device ring wrap counter */
+	bool	save_used_wrap;	/**< packed: used_wrap at save_used */
+	bool	prev_avail_wrap;
+				/**< packed: avail_wrap before vq_getchain */
+	uint16_t prev_avail;	/**< packed: last_avail before vq_getchain */
+	uint16_t used_idx;	/**< packed: next descriptor to mark used */
+	uint16_t batch_id;	/**< packed: buffer id of the pending batch */
+	uint16_t batch_ndesc;	/**< packed: descriptors in the pending batch */
+	uint32_t batch_len;	/**< packed: length of the pending batch */
+	uint16_t used_bufs;	/**< packed: buffers used since vq_endchains */
+	uint16_t *chain_ndesc;	/**< packed: ring slots taken per buffer id */
+
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< packed: driver event suppression */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< packed: device event suppression */
+
+	uint64_t xlat_gpa;	/**< guest memory region last translated */
+	uint64_t xlat_len;	/**< size of that region */
+	char	*xlat_hva;	/**< host address of that region */
+
+	struct virtio_coalesce coal;	/**< interrupt coalescing */
+	uint32_t coal_pending;	/**< used entries the guest wasn't told of */
+	bool	coal_armed;	/**< coal_timer will raise the interrupt */
+	uint64_t coal_last_ns;	/**< time of the last interrupt */
+	struct acrn_timer coal_timer;	/**< bounds the interrupt delay */
+};
+
+/**
+ * @brief A descriptor chain harvested by vq_getchains()
+ *
+ * The caller provides iov (and optionally flags) arrays of n_iov
+ * entries for each chain, vq_getchains() fills in n and idx.
+ */
+struct vq_chain {
+	struct iovec *iov;	/**< iov[] array prepared by caller */
+	uint16_t *flags;	/**< flags[] array of n_iov entries, or NULL */
+	int	n_iov;		/**< size of iov[] array */
+	int	n;		/**< number of descriptors, -1 if invalid */
+	uint16_t idx;		/**< chain to pass to vq_relchain() */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -482,6 +538,28 @@ vq_ring_ready(struct virtio_vq_info *vq)
 	return ((vq->flags & VQ_ALLOC) == VQ_ALLOC);
 }
 
+/**
+ * @brief Is the packed descriptor at a given position available?
+ *
+ * In a packed ring, the driver makes a descriptor available by setting
+ * its AVAIL flag to its wrap counter and its USED flag to the inverse.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param pos Descriptor position in the ring.
+ * @param wrap Expected driver wrap counter at that position.
+ *
+ * @return true if the descriptor is available to the device.
+ */
+static inline bool
+vq_packed_desc_avail(struct virtio_vq_info *vq, uint16_t pos, bool wrap)
+{
+	uint16_t flags = vq->pdesc[pos].flags;
+	bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return (avail != used) && (avail == wrap);
+}
+
 /**
  * @brief Are there "available" descriptors?
  *
@@ -495,6 +573,10 @@ static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
 	bool ret = false;
+
+	if (vq_ring_ready(vq) && vq->packed)
+		return vq_packed_desc_avail(vq, vq->last_avail, vq->avail_wrap);
+
 	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
 		if ((uint16_t)((u_int)vq->avail->idx - vq->last_avail) > vq->qsize)
 			pr_err ("%s: no valid descriptor\n", vq->base->vops->name);
@@ -636,7 +718,8 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
  * and put them into a given iov[] array.
  *
  * @param vq Pointer to struct virtio_vq_info.
- * @param pidx Pointer to available ring position.
+ * @param pidx Pointer to available ring position (the buffer id for
+ * packed rings).
  * @param iov Pointer to iov[] array prepared by caller.
  * @param n_iov Size of iov[] array.
  * @param flags Pointer to a uint16_t array which will contain flag of
@@ -647,6 +730,21 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
 int vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		struct iovec *iov, int n_iov, uint16_t *flags);
 
+/**
+ * @brief Walk through up to nchains available descriptor chains at once.
+ *
+ * Like calling vq_getchain() in a loop, but the available index is read
+ * once and the next descriptors are prefetched along the way.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Array of struct vq_chain prepared by caller.
+ * @param nchains Size of chains[] array.
+ *
+ * @return number of chains filled in, -1 if the ring is invalid.
+ */
+int vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains,
+		 int nchains);
+
 /**
  * @brief Return the currently-first request chain back to the
  * available ring.
@@ -676,6 +774,44 @@ void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
  */
 void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
 
+/**
+ * @brief Set the interrupt coalescing of a virtqueue.
+ *
+ * vq_endchains() then holds the interrupt back until coal->frames used
+ * entries are pending or coal->usecs have passed. In adaptive mode a
+ * queue which didn't interrupt for coal->usecs interrupts right away.
+ * A pending interrupt is raised when coalescing gets disabled.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param coal New parameters, usecs 0 disables coalescing.
+ */
+void vq_set_coalesce(struct virtio_vq_info *vq,
+		     const struct virtio_coalesce *coal);
+
+/**
+ * @brief Parse interrupt coalescing parameters.
+ *
+ * The format is "<usecs>[/<frames>][/adaptive]".
+ *
+ * @param opt Option string, without the "coalesce=" prefix.
+ * @param coal Pointer to struct virtio_coalesce to be filled in.
+ *
+ * @return 0 on success and -1 on invalid input.
+ */
+int virtio_parse_coalesce(const char *opt, struct virtio_coalesce *coal);
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Ask the guest not to notify us about new available buffers, e.g.
+ * while the device is draining the virtqueue anyway. Works for both
+ * split and packed rings.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Helper function for clearing used ring flags.
  *
@@ -94,6 +94,15 @@ struct vm_mem_region {
 };
 bool	vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 			     struct vm_mem_region *ret_region);
+
+struct vm_memfd_region {
+	vm_paddr_t gpa;
+	size_t len;
+	uint64_t fd_offset;
+	int fd;
+};
+int	vm_get_memfd_regions(struct vmctx *ctx, struct vm_memfd_region *regions,
+			     int nr);
 bool    vm_allow_dmabuf(struct vmctx *ctx);
 /*
  * Create a device memory segment identified by 'segid'.
@@ -120,10 +129,14 @@ int	vm_parse_memsize(const char *optarg, size_t *memsize);
 int	vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	uint64_t vma, int prot);
 int	vm_setup_memory(struct vmctx *ctx, size_t len);
+int	vm_commit_memory(struct vmctx *ctx);
 void	vm_unsetup_memory(struct vmctx *ctx);
 bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
+int	hugetlb_parse_prefault(const char *opt);
+void	hugetlb_enable_lazy_mem(void);
+int	hugetlb_commit_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
@@ -0,0 +1,1090 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Host-side harness for the virtio device emulation, see harness.h.
+ *
+ * This file stands in for the parts of the device model which talk to the
+ * hypervisor: guest memory, PCI BAR and capability setup, MSI/MSI-X, the
+ * ioeventfd/irqfd ioctls and logging. The virtio core, the backends and
+ * mevent, timers and iothreads are linked in as they are in acrn-dm.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "dm.h"
+#include "log.h"
+#include "mevent.h"
+#include "monitor.h"
+#include "harness.h"
+
+#define TH_GPA_START		0x100000UL	/* keep gpa 0 invalid */
+#define TH_IO_BASE		0x1000UL
+#define TH_MMIO_BASE		0xc0000000UL
+#define TH_MAX_FDS		64
+#define CAP_START_OFFSET	0x40
+
+/* an ioeventfd or irqfd the devices registered with the "hypervisor" */
+struct th_fd {
+	struct vmctx *ctx;
+	int fd;
+	uint32_t flags;
+	uint64_t addr;
+	uint64_t data;
+	bool irqfd;
+};
+
+static struct th_fd th_fds[TH_MAX_FDS];
+static pthread_mutex_t th_fds_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t th_log_level = LOG_WARNING;
+
+bool is_winvm;
+
+/*
+ * Device model services
+ */
+void
+output_log(uint8_t level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (level > th_log_level)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+int
+guest_cpu_num(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+int
+virtio_uses_msix(void)
+{
+	return 1;
+}
+
+void
+set_thread_priority(int priority, bool reset_on_fork)
+{
+}
+
+int
+monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
+			const char *name)
+{
+	return 0;
+}
+
+int
+vm_get_suspend_mode(void)
+{
+	return VM_SUSPEND_NONE;
+}
+
+/*
+ * Guest memory: one region below 4G, backed by a memfd so that it can be
+ * shared like hugetlb memory is
+ */
+void *
+paddr_guest2host(struct vmctx *ctx, uintptr_t gaddr, size_t len)
+{
+	if (gaddr >= ctx->lowmem || len > ctx->lowmem - gaddr)
+		return NULL;
+	return ctx->baseaddr + gaddr;
+}
+
+int
+vm_get_memfd_regions(struct vmctx *ctx, struct vm_memfd_region *regions,
+		     int nr)
+{
+	if (nr < 1)
+		return 0;
+	regions[0].gpa = 0;
+	regions[0].len = ctx->lowmem;
+	regions[0].fd_offset = 0;
+	regions[0].fd = th_vm_of(ctx)->memfd;
+	return 1;
+}
+
+/*
+ * PCI: BARs get addresses in allocation order, capabilities are laid out
+ * like hw/pci/core.c does, MSI-X is always enabled and every vector ends
+ * up on the VM's interrupt eventfd.
+ */
+int
+pci_emul_alloc_bar(struct pci_vdev *pdi, int idx, enum pcibar_type type,
+		   uint64_t size)
+{
+	struct th_vm *vm = th_vm_of(pdi->vmctx);
+	uint64_t *next;
+
+	if (idx < 0 || idx > PCI_BARMAX)
+		return -1;
+
+	size = size < 16 ? 16 : size;
+	while (size & (size - 1))
+		size += size & -size;
+
+	next = (type == PCIBAR_IO) ? &vm->io_next : &vm->mem_next;
+	*next = roundup2(*next, size);
+	pdi->bar[idx].type = type;
+	pdi->bar[idx].size = size;
+	pdi->bar[idx].addr = *next;
+	*next += size;
+	if (type == PCIBAR_MEM64 && idx < PCI_BARMAX)
+		pdi->bar[idx + 1].type = PCIBAR_MEMHI64;
+	return 0;
+}
+
+int
+pci_emul_add_capability(struct pci_vdev *dev, u_char *capdata, int caplen)
+{
+	int i, capoff, reallen;
+	uint16_t sts;
+
+	reallen = roundup2(caplen, 4);
+
+	sts = pci_get_cfgdata16(dev, PCIR_STATUS);
+	if ((sts & PCIM_STATUS_CAPPRESENT) == 0)
+		capoff = CAP_START_OFFSET;
+	else
+		capoff = dev->capend + 1;
+
+	if (capoff + reallen > PCI_REGMAX + 1)
+		return -1;
+
+	if ((sts & PCIM_STATUS_CAPPRESENT) == 0) {
+		pci_set_cfgdata8(dev, PCIR_CAP_PTR, capoff);
+		pci_set_cfgdata16(dev, PCIR_STATUS, sts|PCIM_STATUS_CAPPRESENT);
+	} else
+		pci_set_cfgdata8(dev, dev->prevcap + 1, capoff);
+
+	for (i = 0; i < caplen; i++)
+		pci_set_cfgdata8(dev, capoff + i, capdata[i]);
+	pci_set_cfgdata8(dev, capoff + 1, 0);
+
+	dev->prevcap = capoff;
+	dev->capend = capoff + reallen - 1;
+	return 0;
+}
+
+int
+pci_emul_find_capability(struct pci_vdev *dev, uint8_t capid, int *p_capoff)
+{
+	int coff = 0;
+	uint16_t sts;
+
+	sts = pci_get_cfgdata16(dev, PCIR_STATUS);
+	if ((sts & PCIM_STATUS_CAPPRESENT) == 0 || !p_capoff)
+		return -1;
+
+	if (*p_capoff == 0)
+		coff = pci_get_cfgdata8(dev, PCIR_CAP_PTR);
+	else if (*p_capoff >= CAP_START_OFFSET && *p_capoff <= dev->prevcap)
+		coff = pci_get_cfgdata8(dev, *p_capoff + 1);
+	else
+		return -1;
+
+	while (coff >= CAP_START_OFFSET && coff <= dev->prevcap) {
+		if (pci_get_cfgdata8(dev, coff) == capid) {
+			*p_capoff = coff;
+			return 0;
+		}
+		coff = pci_get_cfgdata8(dev, coff + 1);
+	}
+	return -1;
+}
+
+int
+pci_emul_add_msicap(struct pci_vdev *pi, int msgnum)
+{
+	return 0;
+}
+
+int
+pci_emul_add_msixcap(struct pci_vdev *pi, int msgnum, int barnum)
+{
+	int i;
+
+	pi->msix.table = calloc(msgnum, sizeof(struct msix_table_entry));
+	if (!pi->msix.table)
+		return -1;
+	for (i = 0; i < msgnum; i++) {
+		pi->msix.table[i].addr = 0xfee00000UL;
+		pi->msix.table[i].msg_data = (pi->slot << 8) | i;
+	}
+	pi->msix.table_count = msgnum;
+	pi->msix.table_bar = barnum;
+	pi->msix.pba_bar = barnum;
+	pi->msix.enabled = 1;
+	return pci_emul_alloc_bar(pi, barnum, PCIBAR_MEM32,
+				  msgnum * MSIX_TABLE_ENTRY_SIZE);
+}
+
+int
+pci_emul_msix_twrite(struct pci_vdev *pi, uint64_t offset, int size,
+		     uint64_t value)
+{
+	return 0;
+}
+
+uint64_t
+pci_emul_msix_tread(struct pci_vdev *pi, uint64_t offset, int size)
+{
+	return 0;
+}
+
+int
+pci_msix_enabled(struct pci_vdev *pi)
+{
+	return pi->msix.enabled;
+}
+
+int
+pci_msix_table_bar(struct pci_vdev *pi)
+{
+	return pi->msix.table ? pi->msix.table_bar : -1;
+}
+
+int
+pci_msix_pba_bar(struct pci_vdev *pi)
+{
+	return pi->msix.table ? pi->msix.pba_bar : -1;
+}
+
+int
+pci_msix_irqfd_enable(struct pci_vdev *dev)
+{
+	return 0;
+}
+
+static void
+th_raise(struct th_vm *vm)
+{
+	__atomic_add_fetch(&vm->irqs, 1, __ATOMIC_RELAXED);
+	eventfd_write(vm->irq_evt, 1);
+}
+
+void
+pci_generate_msix(struct pci_vdev *dev, int index)
+{
+	th_raise(th_vm_of(dev->vmctx));
+}
+
+void
+pci_generate_msi(struct pci_vdev *dev, int index)
+{
+	th_raise(th_vm_of(dev->vmctx));
+}
+
+void
+pci_lintr_request(struct pci_vdev *pi)
+{
+}
+
+void
+pci_lintr_assert(struct pci_vdev *dev)
+{
+}
+
+void
+pci_lintr_deassert(struct pci_vdev *dev)
+{
+}
+
+struct pci_vdev *
+pci_get_vdev_info(int slot)
+{
+	return NULL;
+}
+
+/*
+ * Hypervisor: ioeventfds are matched by th_notify(), irqfds are waited on
+ * by th_wait_irq()
+ */
+static int
+th_fd_update(struct vmctx *ctx, const struct th_fd *new, bool deassign)
+{
+	struct th_fd *f, *slot = NULL;
+	int i, ret = 0;
+
+	pthread_mutex_lock(&th_fds_mtx);
+	for (i = 0; i < TH_MAX_FDS; i++) {
+		f = &th_fds[i];
+		if (f->ctx == ctx && f->fd == new->fd && f->irqfd == new->irqfd) {
+			slot = f;
+			break;
+		}
+		if (!f->ctx && !slot)
+			slot = f;
+	}
+
+	if (deassign) {
+		if (slot && slot->ctx)
+			memset(slot, 0, sizeof(*slot));
+	} else if (slot)
+		*slot = *new;
+	else
+		ret = -ENOSPC;
+	pthread_mutex_unlock(&th_fds_mtx);
+	return ret;
+}
+
+int
+vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args)
+{
+	struct th_fd f = {
+		.ctx = ctx,
+		.fd = args->fd,
+		.flags = args->flags,
+		.addr = args->addr,
+		.data = args->data,
+	};
+
+	return th_fd_update(ctx, &f,
+			    args->flags & ACRN_IOEVENTFD_FLAG_DEASSIGN);
+}
+
+int
+vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args)
+{
+	struct th_fd f = {
+		.ctx = ctx,
+		.fd = args->fd,
+		.addr = args->msi.msi_addr,
+		.data = args->msi.msi_data,
+		.irqfd = true,
+	};
+
+	return th_fd_update(ctx, &f, args->flags & ACRN_IRQFD_FLAG_DEASSIGN);
+}
+
+/*
+ * Wait for an interrupt of @vm, for up to @timeout_ms. Returns 1 if there
+ * was one, 0 on timeout.
+ */
+int
+th_wait_irq(struct th_vm *vm, int timeout_ms)
+{
+	struct pollfd pfd[TH_MAX_FDS + 1];
+	eventfd_t val;
+	int i, n = 1, ret;
+
+	pfd[0].fd = vm->irq_evt;
+	pfd[0].events = POLLIN;
+	pthread_mutex_lock(&th_fds_mtx);
+	for (i = 0; i < TH_MAX_FDS; i++) {
+		if (th_fds[i].ctx == &vm->ctx && th_fds[i].irqfd) {
+			pfd[n].fd = th_fds[i].fd;
+			pfd[n].events = POLLIN;
+			n++;
+		}
+	}
+	pthread_mutex_unlock(&th_fds_mtx);
+
+	ret = poll(pfd, n, timeout_ms);
+	if (ret <= 0)
+		return 0;
+	for (i = 0; i < n; i++) {
+		if (!(pfd[i].revents & POLLIN))
+			continue;
+		eventfd_read(pfd[i].fd, &val);
+		if (i > 0)
+			__atomic_add_fetch(&vm->irqs, val, __ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+static void *
+th_mevent_thread(void *arg)
+{
+	mevent_dispatch();
+	return NULL;
+}
+
+/*
+ * Set up the harness, the mevent loop runs on a thread of its own like
+ * it does on the main thread of acrn-dm.
+ */
+void
+th_init(int log_level)
+{
+	pthread_t tid;
+
+	th_log_level = log_level;
+	if (mevent_init() < 0 ||
+	    pthread_create(&tid, NULL, th_mevent_thread, NULL)) {
+		fprintf(stderr, "cannot start the mevent loop\n");
+		exit(1);
+	}
+	pthread_detach(tid);
+}
+
+int
+th_vm_init(struct th_vm *vm, const char *name, size_t memsize)
+{
+	void *base;
+
+	memset(vm, 0, sizeof(*vm));
+	vm->memfd = memfd_create(name, MFD_CLOEXEC);
+	if (vm->memfd < 0 || ftruncate(vm->memfd, memsize) < 0)
+		return -1;
+	base = mmap(NULL, memsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    vm->memfd, 0);
+	if (base == MAP_FAILED)
+		return -1;
+
+	vm->irq_evt = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (vm->irq_evt < 0)
+		return -1;
+
+	vm->ctx.fd = -1;
+	vm->ctx.name = strdup(name);
+	vm->ctx.baseaddr = base;
+	vm->ctx.lowmem = memsize;
+	vm->ctx.lowmem_limit = memsize;
+	vm->ctx.highmem_gpa_base = PCI_EMUL_MEMBASE64;
+	vm->brk = TH_GPA_START;
+	vm->io_next = TH_IO_BASE;
+	vm->mem_next = TH_MMIO_BASE;
+	return 0;
+}
+
+/* Allocate guest memory, never freed */
+void *
+th_alloc(struct th_vm *vm, size_t len, size_t align, uint64_t *gpa)
+{
+	uint64_t start = roundup2(vm->brk, align);
+
+	if (start + len > vm->ctx.lowmem)
+		return NULL;
+	vm->brk = start + len;
+	memset(vm->ctx.baseaddr + start, 0, len);
+	if (gpa)
+		*gpa = start;
+	return vm->ctx.baseaddr + start;
+}
+
+void *
+th_gpa2hva(struct th_vm *vm, uint64_t gpa)
+{
+	return vm->ctx.baseaddr + gpa;
+}
+
+/*
+ * Devices
+ */
+void
+th_dev_prepare(struct th_dev *dev, struct th_vm *vm, int slot)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->vm = vm;
+	dev->pdev.vmctx = &vm->ctx;
+	dev->pdev.slot = slot;
+	snprintf(dev->pdev.name, PI_NAMESZ, "th-%d", slot);
+	pthread_mutex_init(&dev->pdev.lintr.lock, NULL);
+	pthread_mutex_init(&dev->pdev.msix.irqfd_mtx, NULL);
+}
+
+/* Create a device of the given class like acrn-dm -s slot,class,opts does */
+int
+th_dev_init(struct th_dev *dev, struct th_vm *vm, int slot,
+	    struct pci_vdev_ops *ops, const char *opts)
+{
+	th_dev_prepare(dev, vm, slot);
+	dev->ops = ops;
+	dev->pdev.dev_ops = ops;
+	dev->opts = opts ? strdup(opts) : NULL;
+	if (ops->vdev_init(&vm->ctx, &dev->pdev, dev->opts) < 0)
+		return -1;
+	return dev->pdev.arg ? 0 : -1;
+}
+
+/* Guest memory of the rings is not reclaimed, th_alloc() only grows */
+static void
+th_vqs_free(struct th_dev *dev)
+{
+	struct th_vq *vq;
+	int i;
+
+	for (i = 0; i < dev->nvq; i++) {
+		vq = &dev->vqs[i];
+		free(vq->ndesc);
+		free(vq->cookie);
+		free(vq->free_ids);
+		free(vq->order);
+	}
+	free(dev->vqs);
+	dev->vqs = NULL;
+	dev->nvq = 0;
+}
+
+void
+th_dev_deinit(struct th_dev *dev)
+{
+	if (dev->ops && dev->ops->vdev_deinit)
+		dev->ops->vdev_deinit(&dev->vm->ctx, &dev->pdev, dev->opts);
+	free(dev->pdev.msix.table);
+	free(dev->opts);
+	th_vqs_free(dev);
+}
+
+static struct virtio_base *
+th_base(struct th_dev *dev)
+{
+	return dev->pdev.arg;
+}
+
+static void
+th_write(struct th_dev *dev, int bar, uint64_t off, int size, uint64_t val)
+{
+	virtio_pci_write(&dev->vm->ctx, 0, &dev->pdev, bar, off, size, val);
+}
+
+static uint64_t
+th_read(struct th_dev *dev, int bar, uint64_t off, int size)
+{
+	return virtio_pci_read(&dev->vm->ctx, 0, &dev->pdev, bar, off, size);
+}
+
+/* Virtio 1.0 common configuration, legacy registers otherwise */
+static void
+th_common_write(struct th_dev *dev, uint64_t off, int size, uint64_t val)
+{
+	th_write(dev, th_base(dev)->modern_mmio_bar_idx,
+		 VIRTIO_CAP_COMMON_OFFSET + off, size, val);
+}
+
+static uint64_t
+th_common_read(struct th_dev *dev, uint64_t off, int size)
+{
+	return th_read(dev, th_base(dev)->modern_mmio_bar_idx,
+		       VIRTIO_CAP_COMMON_OFFSET + off, size);
+}
+
+static void
+th_legacy_write(struct th_dev *dev, uint64_t off, int size, uint64_t val)
+{
+	th_write(dev, th_base(dev)->legacy_pio_bar_idx, off, size, val);
+}
+
+static uint64_t
+th_legacy_read(struct th_dev *dev, uint64_t off, int size)
+{
+	return th_read(dev, th_base(dev)->legacy_pio_bar_idx, off, size);
+}
+
+static void
+th_set_status(struct th_dev *dev, uint8_t status)
+{
+	if (dev->modern)
+		th_common_write(dev, VIRTIO_PCI_COMMON_STATUS, 1, status);
+	else
+		th_legacy_write(dev, VIRTIO_PCI_STATUS, 1, status);
+}
+
+uint32_t
+th_cfg_read(struct th_dev *dev, int offset, int size)
+{
+	if (dev->modern)
+		return th_read(dev, th_base(dev)->modern_mmio_bar_idx,
+			       VIRTIO_CAP_DEVICE_OFFSET + offset, size);
+	return th_legacy_read(dev, VIRTIO_PCI_CONFIG_OFF(1) + offset, size);
+}
+
+static int
+th_vq_alloc(struct th_dev *dev, struct th_vq *vq, uint64_t *desc,
+	    uint64_t *avail, uint64_t *used)
+{
+	struct th_vm *vm = dev->vm;
+	uint16_t qsize = vq->qsize;
+	size_t len;
+	void *p;
+	int i;
+
+	vq->ndesc = calloc(qsize, sizeof(uint16_t));
+	vq->cookie = calloc(qsize, sizeof(void *));
+	vq->free_ids = calloc(qsize, sizeof(uint16_t));
+	vq->order = calloc(qsize, sizeof(uint16_t));
+	if (!vq->ndesc || !vq->cookie || !vq->free_ids || !vq->order)
+		return -1;
+
+	len = (size_t)qsize * TH_MAX_SEGS * sizeof(struct vring_desc);
+	vq->indir = th_alloc(vm, len, 16, &vq->indir_gpa);
+	if (!vq->indir)
+		return -1;
+
+	vq->nfree = qsize;
+	if (vq->packed) {
+		len = qsize * sizeof(struct vring_packed_desc);
+		vq->pdesc = th_alloc(vm, len, 16, desc);
+		vq->driver_event = th_alloc(vm,
+			sizeof(struct vring_packed_desc_event), 4, avail);
+		vq->device_event = th_alloc(vm,
+			sizeof(struct vring_packed_desc_event), 4, used);
+		if (!vq->pdesc || !vq->driver_event || !vq->device_event)
+			return -1;
+		for (i = 0; i < qsize; i++)
+			vq->free_ids[i] = qsize - 1 - i;
+		vq->nfree_ids = qsize;
+		vq->avail_wrap = true;
+		vq->used_wrap = true;
+		return 0;
+	}
+
+	/* the legacy layout, which virtio 1.0 accepts as well */
+	len = vring_size(qsize, VIRTIO_PCI_VRING_ALIGN);
+	p = th_alloc(vm, len, VIRTIO_PCI_VRING_ALIGN, desc);
+	if (!p)
+		return -1;
+	vring_init(&vq->vr, qsize, p, VIRTIO_PCI_VRING_ALIGN);
+	*avail = *desc + ((char *)vq->vr.avail - (char *)p);
+	*used = *desc + ((char *)vq->vr.used - (char *)p);
+	for (i = 0; i < qsize - 1; i++)
+		vq->vr.desc[i].next = i + 1;
+	return 0;
+}
+
+/*
+ * Bring the device up like a guest driver would: negotiate @features out
+ * of what the device offers, set up @nvq queues of @qsize entries, or of
+ * the device's size if 0, and set DRIVER_OK. The virtio 1.0 transport is
+ * used if VERSION_1 is negotiated, packed rings if RING_PACKED is.
+ */
+int
+th_dev_setup(struct th_dev *dev, uint64_t features, int nvq, uint16_t qsize)
+{
+	struct virtio_base *base = th_base(dev);
+	uint64_t desc = 0, avail = 0, used = 0, offer;
+	uint8_t status;
+	struct th_vq *vq;
+	int i;
+
+	dev->modern = (base->device_caps & features &
+		       (1UL << VIRTIO_F_VERSION_1)) &&
+		      base->modern_mmio_bar_idx;
+
+	th_dev_reset(dev);
+	status = VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER;
+	th_set_status(dev, status);
+
+	if (dev->modern) {
+		th_common_write(dev, VIRTIO_PCI_COMMON_DFSELECT, 4, 0);
+		offer = th_common_read(dev, VIRTIO_PCI_COMMON_DF, 4);
+		th_common_write(dev, VIRTIO_PCI_COMMON_DFSELECT, 4, 1);
+		offer |= th_common_read(dev, VIRTIO_PCI_COMMON_DF, 4) << 32;
+		dev->features = offer & features;
+		th_common_write(dev, VIRTIO_PCI_COMMON_GFSELECT, 4, 0);
+		th_common_write(dev, VIRTIO_PCI_COMMON_GF, 4,
+				dev->features & 0xffffffff);
+		th_common_write(dev, VIRTIO_PCI_COMMON_GFSELECT, 4, 1);
+		th_common_write(dev, VIRTIO_PCI_COMMON_GF, 4,
+				dev->features >> 32);
+		status |= VIRTIO_CONFIG_S_FEATURES_OK;
+		th_set_status(dev, status);
+	} else {
+		offer = th_legacy_read(dev, VIRTIO_PCI_HOST_FEATURES, 4);
+		dev->features = offer & features & 0xffffffff;
+		th_legacy_write(dev, VIRTIO_PCI_GUEST_FEATURES, 4,
+				dev->features);
+	}
+
+	dev->vqs = calloc(nvq, sizeof(struct th_vq));
+	if (!dev->vqs)
+		return -1;
+	dev->nvq = nvq;
+
+	for (i = 0; i < nvq; i++) {
+		vq = &dev->vqs[i];
+		vq->dev = dev;
+		vq->idx = i;
+		vq->packed = !!(dev->features & (1UL << VIRTIO_F_RING_PACKED));
+		vq->in_order = !!(dev->features & (1UL << VIRTIO_F_IN_ORDER));
+		vq->indirect = !!(dev->features &
+				  (1UL << VIRTIO_RING_F_INDIRECT_DESC));
+		vq->event_idx = !!(dev->features &
+				   (1UL << VIRTIO_RING_F_EVENT_IDX));
+
+		if (dev->modern) {
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_SELECT, 2, i);
+			vq->qsize = th_common_read(dev,
+					VIRTIO_PCI_COMMON_Q_SIZE, 2);
+			if (qsize && qsize < vq->qsize)
+				vq->qsize = qsize;
+		} else {
+			th_legacy_write(dev, VIRTIO_PCI_QUEUE_SEL, 2, i);
+			vq->qsize = th_legacy_read(dev,
+					VIRTIO_PCI_QUEUE_NUM, 2);
+		}
+		if (vq->qsize == 0 || th_vq_alloc(dev, vq, &desc, &avail, &used))
+			return -1;
+
+		if (dev->modern) {
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_SIZE, 2,
+					vq->qsize);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_DESCLO, 4,
+					desc & 0xffffffff);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_DESCHI, 4,
+					desc >> 32);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_AVAILLO, 4,
+					avail & 0xffffffff);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_AVAILHI, 4,
+					avail >> 32);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_USEDLO, 4,
+					used & 0xffffffff);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_USEDHI, 4,
+					used >> 32);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_MSIX, 2, i);
+			th_common_write(dev, VIRTIO_PCI_COMMON_Q_ENABLE, 2, 1);
+		} else {
+			th_legacy_write(dev, VIRTIO_MSI_QUEUE_VECTOR, 2, i);
+			th_legacy_write(dev, VIRTIO_PCI_QUEUE_PFN, 4,
+					desc >> VRING_PAGE_BITS);
+		}
+		if (!vq_ring_ready(&base->queues[i]))
+			return -1;
+	}
+
+	if (dev->modern)
+		th_common_write(dev, VIRTIO_PCI_COMMON_MSIX, 2, nvq);
+	else
+		th_legacy_write(dev, VIRTIO_MSI_CONFIG_VECTOR, 2, nvq);
+
+	th_set_status(dev, status | VIRTIO_CONFIG_S_DRIVER_OK);
+	return 0;
+}
+
+/* Reset the device and forget the guest side of its queues */
+void
+th_dev_reset(struct th_dev *dev)
+{
+	th_set_status(dev, 0);
+	th_vqs_free(dev);
+}
+
+/*
+ * Notify queue @idx the way the guest would, through the notify register
+ * of the transport in use. If the device registered an ioeventfd for it,
+ * the "hypervisor" signals that, otherwise the access is handled on this
+ * thread as an IOREQ would be.
+ */
+void
+th_notify(struct th_dev *dev, int idx)
+{
+	struct virtio_base *base = th_base(dev);
+	struct th_fd *f;
+	uint64_t addr, off;
+	bool pio;
+	int bar, fd = -1, i;
+
+	if (dev->modern) {
+		bar = base->modern_mmio_bar_idx;
+		off = VIRTIO_CAP_NOTIFY_OFFSET +
+		      idx * VIRTIO_MODERN_NOTIFY_OFF_MULT;
+		pio = false;
+	} else {
+		bar = base->legacy_pio_bar_idx;
+		off = VIRTIO_PCI_QUEUE_NOTIFY;
+		pio = true;
+	}
+	addr = dev->pdev.bar[bar].addr + off;
+
+	pthread_mutex_lock(&th_fds_mtx);
+	for (i = 0; i < TH_MAX_FDS; i++) {
+		f = &th_fds[i];
+		if (f->ctx != &dev->vm->ctx || f->irqfd || f->addr != addr ||
+		    !!(f->flags & ACRN_IOEVENTFD_FLAG_PIO) != pio)
+			continue;
+		if ((f->flags & ACRN_IOEVENTFD_FLAG_DATAMATCH) &&
+		    f->data != idx)
+			continue;
+		fd = f->fd;
+		break;
+	}
+	pthread_mutex_unlock(&th_fds_mtx);
+
+	if (fd >= 0)
+		eventfd_write(fd, 1);
+	else
+		th_write(dev, bar, off, 2, idx);
+}
+
+/*
+ * Guest driver
+ */
+#define TH_PACKED_AVAIL(wrap)	((wrap) ? (1 << VRING_PACKED_DESC_F_AVAIL) : \
+					  (1 << VRING_PACKED_DESC_F_USED))
+
+static int
+th_vq_add_packed(struct th_vq *vq, const struct th_buf *bufs, int n,
+		 void *cookie)
+{
+	struct vring_packed_desc *d, *indir;
+	uint16_t id, pos, head_flags = 0, flags, slots;
+	bool wrap;
+	int i;
+
+	slots = (vq->indirect && n > 1) ? 1 : n;
+	if (slots > vq->nfree || vq->nfree_ids == 0)
+		return -1;
+	id = vq->free_ids[--vq->nfree_ids];
+
+	pos = vq->next_avail;
+	wrap = vq->avail_wrap;
+	if (slots == 1 && n > 1) {
+		indir = (struct vring_packed_desc *)vq->indir +
+			id * TH_MAX_SEGS;
+		for (i = 0; i < n; i++) {
+			indir[i].addr = bufs[i].gpa;
+			indir[i].len = bufs[i].len;
+			indir[i].id = 0;
+			indir[i].flags = bufs[i].write ? VRING_DESC_F_WRITE : 0;
+		}
+		d = &vq->pdesc[pos];
+		d->addr = vq->indir_gpa +
+			  id * TH_MAX_SEGS * sizeof(struct vring_packed_desc);
+		d->len = n * sizeof(struct vring_packed_desc);
+		d->id = id;
+		head_flags = VRING_DESC_F_INDIRECT | TH_PACKED_AVAIL(wrap);
+	} else {
+		for (i = 0; i < n; i++) {
+			d = &vq->pdesc[pos];
+			d->addr = bufs[i].gpa;
+			d->len = bufs[i].len;
+			d->id = id;
+			flags = TH_PACKED_AVAIL(wrap);
+			if (bufs[i].write)
+				flags |= VRING_DESC_F_WRITE;
+			if (i < n - 1)
+				flags |= VRING_DESC_F_NEXT;
+			/* the head is made available last */
+			if (i == 0)
+				head_flags = flags;
+			else
+				__atomic_store_n(&d->flags, flags,
+						 __ATOMIC_RELEASE);
+			if (++pos == vq->qsize) {
+				pos = 0;
+				wrap = !wrap;
+			}
+		}
+	}
+	__atomic_store_n(&vq->pdesc[vq->next_avail].flags, head_flags,
+			 __ATOMIC_RELEASE);
+
+	vq->next_avail += slots;
+	if (vq->next_avail >= vq->qsize) {
+		vq->next_avail -= vq->qsize;
+		vq->avail_wrap = !vq->avail_wrap;
+	}
+	vq->ndesc[id] = slots;
+	vq->cookie[id] = cookie;
+	vq->order[vq->order_tail++ % vq->qsize] = id;
+	vq->nfree -= slots;
+	vq->added++;
+	return id;
+}
+
+static int
+th_vq_add_split(struct th_vq *vq, const struct th_buf *bufs, int n,
+		void *cookie)
+{
+	struct vring_desc *d, *indir;
+	uint16_t head, idx, slots;
+	int i;
+
+	slots = (vq->indirect && n > 1) ? 1 : n;
+	if (slots > vq->nfree)
+		return -1;
+
+	head = idx = vq->free_head;
+	if (slots == 1 && n > 1) {
+		indir = (struct vring_desc *)vq->indir + head * TH_MAX_SEGS;
+		for (i = 0; i < n; i++) {
+			indir[i].addr = bufs[i].gpa;
+			indir[i].len = bufs[i].len;
+			indir[i].flags = bufs[i].write ? VRING_DESC_F_WRITE : 0;
+			if (i < n - 1) {
+				indir[i].flags |= VRING_DESC_F_NEXT;
+				indir[i].next = i + 1;
+			}
+		}
+		d = &vq->vr.desc[idx];
+		d->addr = vq->indir_gpa +
+			  head * TH_MAX_SEGS * sizeof(struct vring_desc);
+		d->len = n * sizeof(struct vring_desc);
+		d->flags = VRING_DESC_F_INDIRECT;
+		vq->free_head = d->next;
+	} else {
+		for (i = 0; i < n; i++) {
+			d = &vq->vr.desc[idx];
+			d->addr = bufs[i].gpa;
+			d->len = bufs[i].len;
+			d->flags = bufs[i].write ? VRING_DESC_F_WRITE : 0;
+			if (i < n - 1)
+				d->flags |= VRING_DESC_F_NEXT;
+			idx = d->next;
+		}
+		vq->free_head = idx;
+	}
+
+	vq->ndesc[head] = slots;
+	vq->cookie[head] = cookie;
+	vq->vr.avail->ring[vq->avail_idx++ & (vq->qsize - 1)] = head;
+	vq->nfree -= slots;
+	vq->added++;
+	return head;
+}
+
+/*
+ * Add a chain of @n buffers, the device sees it after th_vq_kick().
+ * Returns the buffer id, or -1 if the ring is full.
+ */
+int
+th_vq_add(struct th_vq *vq, const struct th_buf *bufs, int n, void *cookie)
+{
+	if (n < 1 || n > TH_MAX_SEGS)
+		return -1;
+	if (vq->packed)
+		return th_vq_add_packed(vq, bufs, n, cookie);
+	return th_vq_add_split(vq, bufs, n, cookie);
+}
+
+/* Publish the added chains and notify the device unless it opted out */
+void
+th_vq_kick(struct th_vq *vq)
+{
+	uint16_t old, flags;
+	bool kick;
+
+	if (vq->packed) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		flags = __atomic_load_n(&vq->device_event->flags,
+					__ATOMIC_ACQUIRE);
+		kick = flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+	} else {
+		old = vq->avail_idx - vq->added;
+		__atomic_store_n(&vq->vr.avail->idx, vq->avail_idx,
+				 __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (vq->event_idx)
+			kick = vring_need_event(vring_avail_event(&vq->vr),
+						vq->avail_idx, old);
+		else
+			kick = !(__atomic_load_n(&vq->vr.used->flags,
+				 __ATOMIC_ACQUIRE) & VRING_USED_F_NO_NOTIFY);
+	}
+	vq->added = 0;
+
+	if (kick) {
+		vq->kicks++;
+		th_notify(vq->dev, vq->idx);
+	}
+}
+
+static int
+th_vq_get_packed(struct th_vq *vq, uint32_t *len, void **cookie)
+{
+	struct vring_packed_desc *d;
+	uint16_t flags, id;
+	bool avail, used;
+
+	if (!vq->batch_pending) {
+		d = &vq->pdesc[vq->next_used];
+		flags = __atomic_load_n(&d->flags, __ATOMIC_ACQUIRE);
+		avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+		used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+		if (avail != used || used != vq->used_wrap)
+			return 0;
+		vq->batch_last = d->id;
+		vq->batch_len = d->len;
+		vq->batch_pending = true;
+	}
+
+	/* with IN_ORDER, one used descriptor completes all buffers up to it */
+	if (vq->in_order)
+		id = vq->order[vq->order_head++ % vq->qsize];
+	else
+		id = vq->batch_last;
+	if (id >= vq->qsize)
+		return -1;
+
+	if (id == vq->batch_last) {
+		*len = vq->batch_len;
+		vq->batch_pending = false;
+	} else
+		*len = 0;
+	if (cookie)
+		*cookie = vq->cookie[id];
+
+	vq->next_used += vq->ndesc[id];
+	if (vq->next_used >= vq->qsize) {
+		vq->next_used -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+	vq->nfree += vq->ndesc[id];
+	vq->free_ids[vq->nfree_ids++] = id;
+	return 1;
+}
+
+static int
+th_vq_get_split(struct th_vq *vq, uint32_t *len, void **cookie)
+{
+	struct vring_used_elem *e;
+	uint16_t id, idx, n;
+
+	if (vq->last_used == __atomic_load_n(&vq->vr.used->idx,
+					     __ATOMIC_ACQUIRE))
+		return 0;
+
+	e = &vq->vr.used->ring[vq->last_used & (vq->qsize - 1)];
+	id = e->id;
+	*len = e->len;
+	if (id >= vq->qsize)
+		return -1;
+	if (cookie)
+		*cookie = vq->cookie[id];
+
+	/* put the chain back on the free list */
+	idx = id;
+	for (n = 1; n < vq->ndesc[id]; n++)
+		idx = vq->vr.desc[idx].next;
+	vq->vr.desc[idx].next = vq->free_head;
+	vq->free_head = id;
+	vq->nfree += vq->ndesc[id];
+
+	vq->last_used++;
+	if (vq->event_idx)
+		__atomic_store_n(&vring_used_event(&vq->vr), vq->last_used,
+				 __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * Reap one used buffer: returns 1 and its length and cookie, 0 if there
+ * is none, -1 if the device returned a bogus id.
+ */
+int
+th_vq_get(struct th_vq *vq, uint32_t *len, void **cookie)
+{
+	if (vq->packed)
+		return th_vq_get_packed(vq, len, cookie);
+	return th_vq_get_split(vq, len, cookie);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Host-side harness for the virtio device emulation of the device model.
+ *
+ * The devices run unmodified, against a fake vmctx whose guest memory is
+ * anonymous shared memory, and a mock of the PCI, MSI and IOREQ layers:
+ * BARs get fixed addresses, interrupts end up on an eventfd per VM, and a
+ * notify either hits a registered ioeventfd or is dispatched to the BAR
+ * handler on the calling thread like an IOREQ would be on a vCPU thread.
+ * The th_vq_*() functions then play the guest driver on split and packed
+ * virtqueues.
+ */
+
+#ifndef _TEST_HARNESS_H_
+#define _TEST_HARNESS_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "virtio.h"
+
+#define TH_MAX_SEGS	8	/* buffers in one chain */
+
+struct th_dev;
+
+/* A guest VM: memory and the interrupts of all its devices */
+struct th_vm {
+	struct vmctx ctx;	/* first, devices only see this */
+	int memfd;
+	uint64_t brk;		/* next free gpa */
+	int irq_evt;		/* written by every MSI */
+	uint64_t irqs;		/* interrupts raised */
+	uint64_t io_next;	/* next free I/O port */
+	uint64_t mem_next;	/* next free MMIO address */
+};
+
+/* One buffer of a chain, as the guest driver sees it */
+struct th_buf {
+	uint64_t gpa;
+	uint32_t len;
+	bool write;		/* device writable */
+};
+
+/* Guest side of a virtqueue */
+struct th_vq {
+	struct th_dev *dev;
+	uint16_t idx;
+	uint16_t qsize;
+	bool packed;
+	bool in_order;
+	bool indirect;		/* chains go into indirect tables */
+	bool event_idx;
+
+	/* split ring */
+	struct vring vr;
+	uint16_t free_head;
+	uint16_t avail_idx;
+	uint16_t last_used;
+
+	/* packed ring */
+	struct vring_packed_desc *pdesc;
+	struct vring_packed_desc_event *driver_event;
+	struct vring_packed_desc_event *device_event;
+	uint16_t next_avail;
+	bool avail_wrap;
+	uint16_t next_used;
+	bool used_wrap;
+	uint16_t *free_ids;	/* stack of unused buffer ids */
+	uint16_t nfree_ids;
+	uint16_t *order;	/* buffer ids in the order they were added */
+	uint16_t order_head;
+	uint16_t order_tail;
+	bool batch_pending;	/* a used descriptor is being reaped */
+	uint16_t batch_last;	/* id in that used descriptor */
+	uint32_t batch_len;
+
+	/* per buffer id */
+	uint16_t *ndesc;	/* ring slots taken */
+	void **cookie;
+	uint64_t indir_gpa;	/* TH_MAX_SEGS descriptors per id */
+	void *indir;
+
+	uint16_t nfree;		/* free ring slots */
+	uint16_t added;		/* added since the last kick */
+	uint64_t kicks;
+};
+
+struct th_dev {
+	struct th_vm *vm;
+	struct pci_vdev pdev;
+	struct pci_vdev_ops *ops;
+	char *opts;
+	bool modern;		/* driven through the virtio 1.0 transport */
+	uint64_t features;	/* negotiated */
+	int nvq;
+	struct th_vq *vqs;
+};
+
+void th_init(int log_level);
+int th_vm_init(struct th_vm *vm, const char *name, size_t memsize);
+void *th_alloc(struct th_vm *vm, size_t len, size_t align, uint64_t *gpa);
+void *th_gpa2hva(struct th_vm *vm, uint64_t gpa);
+int th_wait_irq(struct th_vm *vm, int timeout_ms);
+
+void th_dev_prepare(struct th_dev *dev, struct th_vm *vm, int slot);
+int th_dev_init(struct th_dev *dev, struct th_vm *vm, int slot,
+		struct pci_vdev_ops *ops, const char *opts);
+void th_dev_deinit(struct th_dev *dev);
+int th_dev_setup(struct th_dev *dev, uint64_t features, int nvq,
+		 uint16_t qsize);
+void th_dev_reset(struct th_dev *dev);
+uint32_t th_cfg_read(struct th_dev *dev, int offset, int size);
+void th_notify(struct th_dev *dev, int idx);
+
+int th_vq_add(struct th_vq *vq, const struct th_buf *bufs, int n,
+	      void *cookie);
+void th_vq_kick(struct th_vq *vq);
+int th_vq_get(struct th_vq *vq, uint32_t *len, void **cookie);
+
+static inline struct th_vm *
+th_vm_of(struct vmctx *ctx)
+{
+	return (struct th_vm *)ctx;
+}
+
+#endif /* _TEST_HARNESS_H_ */
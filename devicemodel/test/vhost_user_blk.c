@@ -0,0 +1,895 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Reference vhost-user-blk backend, see README.rst.
+ *
+ * Serves a disk image to one frontend at a time, e.g. acrn-dm with
+ * "virtio-blk,vhost-user=<socket>". Every virtqueue gets a thread which
+ * polls the avail ring and does the I/O synchronously on the image, and
+ * only waits for a kick after finding the ring empty for a while. It is
+ * meant for testing the frontend and as a base for a dedicated-core
+ * backend, so it keeps to split rings and the messages acrn-dm sends.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <linux/virtio_blk.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ring.h>
+
+#include "atomic.h"
+#include "vhost_user.h"
+
+#define VUB_MAX_QUEUES		16
+#define VUB_MAX_QSIZE		32768
+#define VUB_MAX_SEGS		130	/* header and status included */
+#define VUB_SECTOR_SIZE		512
+#define VUB_POLL_US		100
+#define VUB_ID			"vhost-user-blk"
+
+#define VUB_FEATURES	\
+	((1UL << VIRTIO_BLK_F_SEG_MAX) |	\
+	(1UL << VIRTIO_BLK_F_BLK_SIZE) |	\
+	(1UL << VIRTIO_BLK_F_FLUSH) |		\
+	(1UL << VIRTIO_RING_F_INDIRECT_DESC) |	\
+	(1UL << VIRTIO_F_VERSION_1) |		\
+	(1UL << VHOST_USER_F_PROTOCOL_FEATURES))
+
+#define VUB_PROTOCOL_FEATURES	\
+	((1UL << VHOST_USER_PROTOCOL_F_MQ) |	\
+	(1UL << VHOST_USER_PROTOCOL_F_CONFIG))
+
+static int vub_debug;
+#define LOG_TAG "vhost_user_blk: "
+#define DPRINTF(fmt, args...) \
+	do { if (vub_debug) fprintf(stderr, LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) fprintf(stderr, LOG_TAG fmt, ##args)
+
+/* guest memory as the frontend described it in SET_MEM_TABLE */
+struct vub_region {
+	uint64_t gpa;
+	uint64_t uva;		/* frontend address, vrings are given in it */
+	uint64_t len;
+	void *hva;
+};
+
+struct vub;
+
+struct vub_vq {
+	struct vub *vub;
+	int idx;
+	uint16_t num;
+	uint64_t desc_uva;
+	uint64_t avail_uva;
+	uint64_t used_uva;
+	struct vring_desc *desc;
+	struct vring_avail *avail;
+	struct vring_used *used;
+	uint16_t last_avail;
+	uint16_t used_idx;
+	int kick_fd;
+	int call_fd;
+	bool has_kick;		/* kick_fd or VHOST_USER_VRING_NOFD_MASK */
+	bool enabled;
+	bool started;
+	int stop;
+	int stop_evt;
+	pthread_t tid;
+	struct iovec iov[VUB_MAX_SEGS];
+	bool writable[VUB_MAX_SEGS];
+};
+
+struct vub {
+	int img_fd;
+	bool readonly;
+	int64_t poll_us;	/* < 0: never wait for a kick */
+	int nvq;
+	struct vub_vq vqs[VUB_MAX_QUEUES];
+	struct virtio_blk_config cfg;
+	uint64_t features;
+	uint64_t protocol_features;
+	struct vub_region regions[VHOST_USER_MAX_REGIONS];
+	int nregions;
+	int sock;
+};
+
+static uint64_t
+vub_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void *
+vub_gpa2hva(struct vub *vub, uint64_t gpa, uint64_t len)
+{
+	struct vub_region *r;
+	int i;
+
+	for (i = 0; i < vub->nregions; i++) {
+		r = &vub->regions[i];
+		if (gpa >= r->gpa && len <= r->len && gpa - r->gpa <= r->len - len)
+			return (char *)r->hva + (gpa - r->gpa);
+	}
+	return NULL;
+}
+
+static void *
+vub_uva2hva(struct vub *vub, uint64_t uva, uint64_t len)
+{
+	struct vub_region *r;
+	int i;
+
+	for (i = 0; i < vub->nregions; i++) {
+		r = &vub->regions[i];
+		if (uva >= r->uva && len <= r->len && uva - r->uva <= r->len - len)
+			return (char *)r->hva + (uva - r->uva);
+	}
+	return NULL;
+}
+
+/*
+ * Request processing
+ */
+
+/* Gather the buffers of the chain at @head, returns their number */
+static int
+vub_vq_getchain(struct vub_vq *vq, uint16_t head)
+{
+	struct vring_desc *table = vq->desc;
+	struct vring_desc *d;
+	uint32_t size = vq->num;
+	uint16_t next = head;
+	int n = 0, hops = 0;
+	bool indirect = false;
+
+	for (;;) {
+		if (next >= size || ++hops > size + VUB_MAX_SEGS) {
+			WPRINTF("vq %d: bad descriptor %u\n", vq->idx, next);
+			return -1;
+		}
+		d = &table[next];
+		if (d->flags & VRING_DESC_F_INDIRECT) {
+			if (indirect || d->len % sizeof(struct vring_desc) ||
+			    d->len == 0) {
+				WPRINTF("vq %d: bad indirect table\n", vq->idx);
+				return -1;
+			}
+			table = vub_gpa2hva(vq->vub, d->addr, d->len);
+			if (!table) {
+				WPRINTF("vq %d: indirect table outside guest "
+					"memory\n", vq->idx);
+				return -1;
+			}
+			size = d->len / sizeof(struct vring_desc);
+			indirect = true;
+			next = 0;
+			continue;
+		}
+
+		if (n == VUB_MAX_SEGS) {
+			WPRINTF("vq %d: chain too long\n", vq->idx);
+			return -1;
+		}
+		vq->iov[n].iov_base = vub_gpa2hva(vq->vub, d->addr, d->len);
+		vq->iov[n].iov_len = d->len;
+		vq->writable[n] = d->flags & VRING_DESC_F_WRITE;
+		if (!vq->iov[n].iov_base) {
+			WPRINTF("vq %d: buffer outside guest memory\n",
+				vq->idx);
+			return -1;
+		}
+		n++;
+
+		if (!(d->flags & VRING_DESC_F_NEXT))
+			return n;
+		next = d->next;
+	}
+}
+
+/* Do the I/O of one request, returns the bytes written to the chain */
+static uint32_t
+vub_blk_request(struct vub_vq *vq, int n)
+{
+	struct vub *vub = vq->vub;
+	static const char id[VIRTIO_BLK_ID_BYTES] = VUB_ID;
+	struct virtio_blk_outhdr hdr;
+	struct iovec *data = &vq->iov[1];
+	uint8_t *status;
+	uint64_t offset, len = 0;
+	uint32_t written = 0;
+	ssize_t rc;
+	int i, ndata = n - 2;
+
+	if (n < 2 || vq->iov[0].iov_len < sizeof(hdr) || vq->writable[0] ||
+	    !vq->writable[n - 1] || vq->iov[n - 1].iov_len < 1) {
+		WPRINTF("vq %d: bad request layout\n", vq->idx);
+		return 0;
+	}
+	memcpy(&hdr, vq->iov[0].iov_base, sizeof(hdr));
+	status = (uint8_t *)vq->iov[n - 1].iov_base +
+		vq->iov[n - 1].iov_len - 1;
+
+	for (i = 0; i < ndata; i++) {
+		/* the device writes what it reads, and only that */
+		if (vq->writable[i + 1] != (hdr.type != VIRTIO_BLK_T_OUT)) {
+			*status = VIRTIO_BLK_S_IOERR;
+			return 1;
+		}
+		len += data[i].iov_len;
+	}
+
+	*status = VIRTIO_BLK_S_OK;
+	switch (hdr.type) {
+	case VIRTIO_BLK_T_IN:
+	case VIRTIO_BLK_T_OUT:
+		offset = hdr.sector * VUB_SECTOR_SIZE;
+		if (hdr.sector > vub->cfg.capacity ||
+		    len > (vub->cfg.capacity - hdr.sector) * VUB_SECTOR_SIZE ||
+		    (hdr.type == VIRTIO_BLK_T_OUT && vub->readonly)) {
+			*status = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		/* preadv()/pwritev() may be short, carry on from there */
+		while (len > 0) {
+			if (hdr.type == VIRTIO_BLK_T_IN)
+				rc = preadv(vub->img_fd, data, ndata, offset);
+			else
+				rc = pwritev(vub->img_fd, data, ndata, offset);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0) {
+				*status = VIRTIO_BLK_S_IOERR;
+				break;
+			}
+			if (hdr.type == VIRTIO_BLK_T_IN)
+				written += rc;
+			offset += rc;
+			len -= rc;
+			while (ndata > 0 && rc >= (ssize_t)data->iov_len) {
+				rc -= data->iov_len;
+				data++;
+				ndata--;
+			}
+			if (rc) {
+				data->iov_base = (char *)data->iov_base + rc;
+				data->iov_len -= rc;
+			}
+		}
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		if (fdatasync(vub->img_fd) < 0)
+			*status = VIRTIO_BLK_S_IOERR;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		for (i = 0; i < ndata && written < VIRTIO_BLK_ID_BYTES; i++) {
+			len = data[i].iov_len;
+			if (len > VIRTIO_BLK_ID_BYTES - written)
+				len = VIRTIO_BLK_ID_BYTES - written;
+			memcpy(data[i].iov_base, id + written, len);
+			written += len;
+		}
+		break;
+	default:
+		*status = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+
+	return written + 1;
+}
+
+/* Serve what is in the avail ring, returns the requests completed */
+static int
+vub_vq_process(struct vub_vq *vq)
+{
+	struct vring_used_elem *ue;
+	uint16_t avail_idx, head;
+	uint32_t len;
+	int n, done = 0;
+
+	avail_idx = atomic_load(&vq->avail->idx);
+	if (avail_idx == vq->last_avail)
+		return 0;
+	/* the descriptors are read after the index */
+	atomic_thread_fence();
+
+	while (vq->last_avail != avail_idx) {
+		head = vq->avail->ring[vq->last_avail % vq->num];
+		n = vub_vq_getchain(vq, head);
+		len = n < 0 ? 0 : vub_blk_request(vq, n);
+
+		ue = &vq->used->ring[vq->used_idx % vq->num];
+		ue->id = head;
+		ue->len = len;
+		vq->used_idx++;
+		vq->last_avail++;
+		done++;
+	}
+
+	/* the used elements are visible before the index */
+	atomic_thread_fence();
+	atomic_store(&vq->used->idx, vq->used_idx);
+	atomic_thread_fence();
+	if (!(atomic_load(&vq->avail->flags) & VRING_AVAIL_F_NO_INTERRUPT) &&
+	    vq->call_fd >= 0)
+		eventfd_write(vq->call_fd, 1);
+
+	return done;
+}
+
+static void
+vub_vq_set_notify(struct vub_vq *vq, bool notify)
+{
+	if (notify)
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	atomic_thread_fence();
+}
+
+/*
+ * Poll the avail ring, and only after poll_us without requests ask the
+ * driver to kick and wait for it.
+ */
+static void *
+vub_vq_thread(void *param)
+{
+	struct vub_vq *vq = param;
+	struct vub *vub = vq->vub;
+	struct pollfd pfd[2];
+	eventfd_t val;
+	uint64_t idle = 0;
+
+	vub_vq_set_notify(vq, vub->poll_us == 0);
+	while (!atomic_load(&vq->stop)) {
+		if (vub_vq_process(vq)) {
+			idle = 0;
+			continue;
+		}
+
+		if (vub->poll_us < 0 || !vq->has_kick || vq->kick_fd < 0)
+			continue;
+		if (vub->poll_us > 0) {
+			if (idle == 0)
+				idle = vub_now_us();
+			if (vub_now_us() - idle < (uint64_t)vub->poll_us)
+				continue;
+			idle = 0;
+
+			/* recheck after asking for kicks, or one is lost */
+			vub_vq_set_notify(vq, true);
+			if (atomic_load(&vq->avail->idx) != vq->last_avail) {
+				vub_vq_set_notify(vq, false);
+				continue;
+			}
+		}
+
+		pfd[0].fd = vq->kick_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = vq->stop_evt;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) > 0 && (pfd[0].revents & POLLIN))
+			eventfd_read(vq->kick_fd, &val);
+		if (vub->poll_us > 0)
+			vub_vq_set_notify(vq, false);
+	}
+
+	return NULL;
+}
+
+/*
+ * Virtqueue state
+ */
+static void
+vub_vq_stop(struct vub_vq *vq)
+{
+	if (!vq->started)
+		return;
+
+	atomic_store(&vq->stop, 1);
+	eventfd_write(vq->stop_evt, 1);
+	pthread_join(vq->tid, NULL);
+	vq->started = false;
+	DPRINTF("vq %d stopped at %u\n", vq->idx, vq->last_avail);
+}
+
+static void
+vub_vq_start(struct vub_vq *vq)
+{
+	struct vub *vub = vq->vub;
+	eventfd_t val;
+
+	if (vq->started || !vq->enabled || !vq->has_kick || !vq->num)
+		return;
+
+	vq->desc = vub_uva2hva(vub, vq->desc_uva,
+			       vq->num * sizeof(struct vring_desc));
+	vq->avail = vub_uva2hva(vub, vq->avail_uva,
+				sizeof(struct vring_avail) + vq->num * 2);
+	vq->used = vub_uva2hva(vub, vq->used_uva, sizeof(struct vring_used) +
+			       vq->num * sizeof(struct vring_used_elem));
+	if (!vq->desc || !vq->avail || !vq->used) {
+		WPRINTF("vq %d: ring outside guest memory\n", vq->idx);
+		return;
+	}
+
+	/* the driver may have used the ring before, as kernel vhost does */
+	vq->used_idx = vq->used->idx;
+	atomic_store(&vq->stop, 0);
+	eventfd_read(vq->stop_evt, &val);
+	if (pthread_create(&vq->tid, NULL, vub_vq_thread, vq)) {
+		WPRINTF("vq %d: cannot create thread\n", vq->idx);
+		return;
+	}
+	vq->started = true;
+	DPRINTF("vq %d started at %u, size %u\n", vq->idx, vq->last_avail,
+		vq->num);
+}
+
+static void
+vub_vq_reset(struct vub_vq *vq)
+{
+	vub_vq_stop(vq);
+	if (vq->kick_fd >= 0)
+		close(vq->kick_fd);
+	if (vq->call_fd >= 0)
+		close(vq->call_fd);
+	vq->kick_fd = -1;
+	vq->call_fd = -1;
+	vq->has_kick = false;
+	vq->enabled = false;
+	vq->num = 0;
+	vq->last_avail = 0;
+	vq->desc_uva = vq->avail_uva = vq->used_uva = 0;
+}
+
+static void
+vub_unmap(struct vub *vub)
+{
+	int i;
+
+	for (i = 0; i < vub->nregions; i++)
+		munmap(vub->regions[i].hva, vub->regions[i].len);
+	vub->nregions = 0;
+}
+
+static void
+vub_reset(struct vub *vub)
+{
+	int i;
+
+	for (i = 0; i < vub->nvq; i++)
+		vub_vq_reset(&vub->vqs[i]);
+	vub_unmap(vub);
+	vub->features = 0;
+	vub->protocol_features = 0;
+}
+
+/*
+ * Messages
+ */
+static int
+vub_reply(struct vub *vub, struct vhost_user_msg *msg)
+{
+	size_t len = VHOST_USER_HDR_SIZE + msg->size;
+
+	msg->flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+	if (send(vub->sock, msg, len, MSG_NOSIGNAL) != (ssize_t)len) {
+		WPRINTF("reply to request %u failed, errno = %d\n",
+			msg->request, errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+vub_reply_u64(struct vub *vub, struct vhost_user_msg *msg, uint64_t val)
+{
+	msg->size = sizeof(msg->payload.u64);
+	msg->payload.u64 = val;
+	return vub_reply(vub, msg);
+}
+
+static int
+vub_set_mem_table(struct vub *vub, struct vhost_user_msg *msg, int *fds,
+		  int nfds)
+{
+	struct vhost_user_memory *mem = &msg->payload.memory;
+	struct vhost_user_memory_region *reg;
+	void *addr;
+	int i;
+
+	if (mem->nregions > VHOST_USER_MAX_REGIONS ||
+	    (int)mem->nregions != nfds) {
+		WPRINTF("bad memory table, %u regions, %d fds\n",
+			mem->nregions, nfds);
+		return -1;
+	}
+
+	for (i = 0; i < vub->nvq; i++)
+		vub_vq_stop(&vub->vqs[i]);
+	vub_unmap(vub);
+	for (i = 0; i < (int)mem->nregions; i++) {
+		reg = &mem->regions[i];
+		addr = mmap(NULL, reg->memory_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fds[i], reg->mmap_offset);
+		if (addr == MAP_FAILED) {
+			WPRINTF("cannot map region %d, errno = %d\n", i, errno);
+			vub_unmap(vub);
+			return -1;
+		}
+		vub->regions[i].gpa = reg->guest_phys_addr;
+		vub->regions[i].uva = reg->userspace_addr;
+		vub->regions[i].len = reg->memory_size;
+		vub->regions[i].hva = addr;
+		vub->nregions++;
+		DPRINTF("region %d: gpa 0x%lx, len 0x%lx\n", i,
+			reg->guest_phys_addr, reg->memory_size);
+	}
+	return 0;
+}
+
+static struct vub_vq *
+vub_msg_vq(struct vub *vub, uint32_t idx)
+{
+	if (idx >= (uint32_t)vub->nvq) {
+		WPRINTF("no virtqueue %u\n", idx);
+		return NULL;
+	}
+	return &vub->vqs[idx];
+}
+
+/* Handle one message, < 0 drops the connection */
+static int
+vub_handle(struct vub *vub, struct vhost_user_msg *msg, int *fds, int nfds)
+{
+	struct vhost_user_config *config = &msg->payload.config;
+	struct vub_vq *vq;
+	uint32_t len;
+	int fd = nfds > 0 ? fds[0] : -1;
+
+	DPRINTF("request %u, %u bytes, %d fds\n", msg->request, msg->size,
+		nfds);
+
+	switch (msg->request) {
+	case VHOST_USER_GET_FEATURES:
+		return vub_reply_u64(vub, msg, VUB_FEATURES |
+			(vub->nvq > 1 ? 1UL << VIRTIO_BLK_F_MQ : 0) |
+			(vub->readonly ? 1UL << VIRTIO_BLK_F_RO : 0));
+	case VHOST_USER_SET_FEATURES:
+		vub->features = msg->payload.u64;
+		return 0;
+	case VHOST_USER_GET_PROTOCOL_FEATURES:
+		return vub_reply_u64(vub, msg, VUB_PROTOCOL_FEATURES);
+	case VHOST_USER_SET_PROTOCOL_FEATURES:
+		vub->protocol_features = msg->payload.u64;
+		return 0;
+	case VHOST_USER_GET_QUEUE_NUM:
+		return vub_reply_u64(vub, msg, vub->nvq);
+	case VHOST_USER_SET_OWNER:
+		return 0;
+	case VHOST_USER_RESET_OWNER:
+		vub_reset(vub);
+		return 0;
+	case VHOST_USER_SET_MEM_TABLE:
+		return vub_set_mem_table(vub, msg, fds, nfds);
+	case VHOST_USER_GET_CONFIG:
+		if (config->offset > sizeof(vub->cfg) ||
+		    config->size > VHOST_USER_MAX_CONFIG_SIZE)
+			return -1;
+		memset(config->region, 0, config->size);
+		len = sizeof(vub->cfg) - config->offset;
+		memcpy(config->region, (uint8_t *)&vub->cfg + config->offset,
+		       len < config->size ? len : config->size);
+		return vub_reply(vub, msg);
+	case VHOST_USER_SET_CONFIG:
+		/* only the cache mode is writable, and it is write-through */
+		return 0;
+	default:
+		break;
+	}
+
+	/* the rest is about one virtqueue */
+	vq = vub_msg_vq(vub, msg->request == VHOST_USER_SET_VRING_KICK ||
+			msg->request == VHOST_USER_SET_VRING_CALL ?
+			msg->payload.u64 & VHOST_USER_VRING_IDX_MASK :
+			msg->payload.state.index);
+	if (!vq)
+		return -1;
+
+	switch (msg->request) {
+	case VHOST_USER_SET_VRING_NUM:
+		if (msg->payload.state.num == 0 ||
+		    msg->payload.state.num > VUB_MAX_QSIZE)
+			return -1;
+		vq->num = msg->payload.state.num;
+		return 0;
+	case VHOST_USER_SET_VRING_ADDR:
+		vq->desc_uva = msg->payload.addr.desc_user_addr;
+		vq->avail_uva = msg->payload.addr.avail_user_addr;
+		vq->used_uva = msg->payload.addr.used_user_addr;
+		return 0;
+	case VHOST_USER_SET_VRING_BASE:
+		vq->last_avail = msg->payload.state.num;
+		return 0;
+	case VHOST_USER_GET_VRING_BASE:
+		/* the ring stays stopped until it is kicked again */
+		vub_vq_stop(vq);
+		vq->has_kick = false;
+		vq->enabled = false;
+		msg->payload.state.num = vq->last_avail;
+		msg->size = sizeof(msg->payload.state);
+		return vub_reply(vub, msg);
+	case VHOST_USER_SET_VRING_KICK:
+		vub_vq_stop(vq);
+		if (vq->kick_fd >= 0)
+			close(vq->kick_fd);
+		vq->kick_fd = -1;
+		if (!(msg->payload.u64 & VHOST_USER_VRING_NOFD_MASK)) {
+			if (fd < 0)
+				return -1;
+			vq->kick_fd = fd;
+			fds[0] = -1;
+		}
+		vq->has_kick = true;
+		/* without protocol features a kick enables the ring */
+		if (!(vub->features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+			vq->enabled = true;
+		vub_vq_start(vq);
+		return 0;
+	case VHOST_USER_SET_VRING_CALL:
+		vub_vq_stop(vq);
+		if (vq->call_fd >= 0)
+			close(vq->call_fd);
+		vq->call_fd = -1;
+		if (!(msg->payload.u64 & VHOST_USER_VRING_NOFD_MASK)) {
+			vq->call_fd = fd;
+			fds[0] = -1;
+		}
+		vub_vq_start(vq);
+		return 0;
+	case VHOST_USER_SET_VRING_ENABLE:
+		vq->enabled = msg->payload.state.num;
+		if (vq->enabled)
+			vub_vq_start(vq);
+		else
+			vub_vq_stop(vq);
+		return 0;
+	default:
+		WPRINTF("unsupported request %u\n", msg->request);
+		return -1;
+	}
+}
+
+static int
+vub_read(int fd, void *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = recv(fd, buf, len, MSG_WAITALL);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		buf = (char *)buf + rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Receive a message and the fds sent along with it */
+static int
+vub_recv(struct vub *vub, struct vhost_user_msg *msg, int *fds, int *nfds)
+{
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	ssize_t rc;
+
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+	do {
+		rc = recvmsg(vub->sock, &mh, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != VHOST_USER_HDR_SIZE)
+		return -1;
+
+	*nfds = 0;
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS) {
+		*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+	}
+
+	if ((msg->flags & VHOST_USER_VERSION_MASK) != VHOST_USER_VERSION ||
+	    msg->size > sizeof(msg->payload)) {
+		WPRINTF("bad message: request %u, flags 0x%x, size %u\n",
+			msg->request, msg->flags, msg->size);
+		return -1;
+	}
+	if (msg->size && vub_read(vub->sock, &msg->payload, msg->size) < 0)
+		return -1;
+	return 0;
+}
+
+/* Serve one frontend until it goes away */
+static void
+vub_serve(struct vub *vub)
+{
+	struct vhost_user_msg msg;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, nfds, rc;
+
+	for (;;) {
+		nfds = 0;
+		rc = vub_recv(vub, &msg, fds, &nfds);
+		if (rc == 0)
+			rc = vub_handle(vub, &msg, fds, nfds);
+		/* eventfds kept are taken out, mappings don't need theirs */
+		for (i = 0; i < nfds; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+		}
+		if (rc < 0)
+			break;
+	}
+	vub_reset(vub);
+}
+
+static int
+vub_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("socket path %s is too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 1) < 0) {
+		WPRINTF("cannot listen on %s, errno = %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <socket> <image>\n"
+		"options:\n"
+		"  -q <queues>          virtqueues served (1, at most %d)\n"
+		"  -p <us>              poll an empty ring this long before\n"
+		"                       waiting for a kick (%d), -1 forever\n"
+		"  -r                   read-only\n"
+		"  -v                   log the messages\n",
+		prog, VUB_MAX_QUEUES, VUB_POLL_US);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct vub vub;
+	struct stat st;
+	off_t size;
+	int c, i, listen_fd;
+
+	vub.nvq = 1;
+	vub.poll_us = VUB_POLL_US;
+	while ((c = getopt(argc, argv, "q:p:rvh")) != -1) {
+		switch (c) {
+		case 'q':
+			vub.nvq = atoi(optarg);
+			break;
+		case 'p':
+			vub.poll_us = atoll(optarg);
+			break;
+		case 'r':
+			vub.readonly = true;
+			break;
+		case 'v':
+			vub_debug = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (argc - optind != 2 || vub.nvq <= 0 || vub.nvq > VUB_MAX_QUEUES) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	vub.img_fd = open(argv[optind + 1],
+			  (vub.readonly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+	if (vub.img_fd < 0 || fstat(vub.img_fd, &st) < 0) {
+		WPRINTF("cannot open %s: %s\n", argv[optind + 1],
+			strerror(errno));
+		return 1;
+	}
+	/* works for block devices too, unlike st_size */
+	size = lseek(vub.img_fd, 0, SEEK_END);
+	if (size < VUB_SECTOR_SIZE) {
+		WPRINTF("%s is too small\n", argv[optind + 1]);
+		return 1;
+	}
+
+	vub.cfg.capacity = size / VUB_SECTOR_SIZE;
+	vub.cfg.seg_max = VUB_MAX_SEGS - 2;
+	vub.cfg.blk_size = VUB_SECTOR_SIZE;
+	vub.cfg.num_queues = vub.nvq;
+	for (i = 0; i < vub.nvq; i++) {
+		vub.vqs[i].vub = &vub;
+		vub.vqs[i].idx = i;
+		vub.vqs[i].kick_fd = -1;
+		vub.vqs[i].call_fd = -1;
+		vub.vqs[i].stop_evt = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (vub.vqs[i].stop_evt < 0) {
+			WPRINTF("eventfd failed, errno = %d\n", errno);
+			return 1;
+		}
+	}
+
+	listen_fd = vub_listen(argv[optind]);
+	if (listen_fd < 0)
+		return 1;
+
+	for (;;) {
+		vub.sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (vub.sock < 0) {
+			if (errno == EINTR)
+				continue;
+			WPRINTF("accept failed, errno = %d\n", errno);
+			break;
+		}
+		DPRINTF("frontend connected\n");
+		vub_serve(&vub);
+		close(vub.sock);
+		DPRINTF("frontend gone\n");
+	}
+
+	close(listen_fd);
+	unlink(argv[optind]);
+	return 1;
+}
@@ -0,0 +1,801 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Host-side benchmark of the virtio device emulation, see README.rst.
+ *
+ * The devices run in this process on top of the harness in harness.c, and
+ * each guest is a thread which drives the virtqueues, keeping a number of
+ * requests in flight. Reported are the operations and bytes per second
+ * and the latency distribution, from adding a chain to reaping it (or for
+ * networking, from adding a packet on one side to receiving it on the
+ * other).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <linux/virtio_blk.h>
+#include <linux/virtio_net.h>
+
+#include "dm.h"
+#include "log.h"
+#include "harness.h"
+
+#define BENCH_MEMSIZE		(256UL << 20)
+#define BENCH_MAX_SAMPLES	(1UL << 22)
+#define BENCH_NULL_RINGSZ	256
+#define BENCH_NULL_BATCH	16
+#define BENCH_NET_HDRLEN	sizeof(struct virtio_net_hdr_mrg_rxbuf)
+#define BENCH_NET_BUFSZ		2048
+#define BENCH_NET_RXQ		0
+#define BENCH_NET_TXQ		1
+#define BENCH_NET_RXBUFS	256
+#define BENCH_NET_FRAMESZ	1514
+#define BENCH_REQ_SIZE		4096
+#define BENCH_ETHERTYPE		0x88b5	/* local experimental */
+#define BENCH_LINK_WAIT_MS	5000
+
+SET_DECLARE(pci_vdev_ops_set, struct pci_vdev_ops);
+
+static struct {
+	int seconds;
+	int depth;
+	uint32_t size;
+	bool packed;
+	bool write;
+	bool indirect;
+	int log_level;
+} opt = {
+	.seconds = 5,
+	.depth = 16,
+	.log_level = LOG_WARNING,
+};
+
+struct bench_stats {
+	const char *name;
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t *lat;		/* ns, a uniform sample if there were more */
+	size_t nlat;
+	uint64_t seen;
+	unsigned int seed;
+};
+
+/* one request in flight */
+struct bench_req {
+	uint64_t start;
+	int slot;
+	struct th_buf bufs[3];
+	int nbufs;
+	void *hva[3];
+};
+
+static inline uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+bench_stats_init(struct bench_stats *st, const char *name)
+{
+	memset(st, 0, sizeof(*st));
+	st->name = name;
+	st->seed = 1;
+	st->lat = malloc(BENCH_MAX_SAMPLES * sizeof(uint64_t));
+	if (!st->lat) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+}
+
+static void
+bench_stats_add(struct bench_stats *st, uint64_t bytes, uint64_t lat)
+{
+	size_t i;
+
+	st->ops++;
+	st->bytes += bytes;
+	st->seen++;
+	if (st->nlat < BENCH_MAX_SAMPLES)
+		st->lat[st->nlat++] = lat;
+	else if ((i = rand_r(&st->seed) % st->seen) < BENCH_MAX_SAMPLES)
+		st->lat[i] = lat;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+bench_pct(struct bench_stats *st, double pct)
+{
+	size_t i;
+
+	if (st->nlat == 0)
+		return 0;
+	i = (size_t)(pct / 100 * (st->nlat - 1) + 0.5);
+	return st->lat[i] / 1000.0;
+}
+
+static void
+bench_report(struct bench_stats *st, double secs, uint64_t kicks,
+	     uint64_t irqs)
+{
+	qsort(st->lat, st->nlat, sizeof(uint64_t), bench_cmp);
+	printf("%-14s %10.0f ops/s %9.1f MB/s  lat(us) p50 %.1f p90 %.1f "
+	       "p99 %.1f p99.9 %.1f max %.1f  kicks/op %.3f irqs/op %.3f\n",
+	       st->name, st->ops / secs, st->bytes / secs / 1e6,
+	       bench_pct(st, 50), bench_pct(st, 90), bench_pct(st, 99),
+	       bench_pct(st, 99.9), bench_pct(st, 100),
+	       st->ops ? (double)kicks / st->ops : 0,
+	       st->ops ? (double)irqs / st->ops : 0);
+}
+
+static struct pci_vdev_ops *
+bench_find_ops(const char *name)
+{
+	struct pci_vdev_ops **pdpp;
+
+	SET_FOREACH(pdpp, pci_vdev_ops_set) {
+		if (!strcmp((*pdpp)->class_name, name))
+			return *pdpp;
+	}
+	return NULL;
+}
+
+static int
+bench_dev_init(struct th_dev *dev, struct th_vm *vm, int slot,
+	       const char *class, const char *opts)
+{
+	struct pci_vdev_ops *ops = bench_find_ops(class);
+
+	if (!ops || th_dev_init(dev, vm, slot, ops, opts) < 0) {
+		fprintf(stderr, "cannot create %s,%s\n", class, opts);
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t
+bench_ring_features(void)
+{
+	uint64_t f = 0;
+
+	if (opt.packed)
+		f |= (1UL << VIRTIO_F_VERSION_1) |
+		     (1UL << VIRTIO_F_RING_PACKED) |
+		     (1UL << VIRTIO_F_IN_ORDER);
+	if (opt.indirect)
+		f |= 1UL << VIRTIO_RING_F_INDIRECT_DESC;
+	return f | (1UL << VIRTIO_F_NOTIFY_ON_EMPTY);
+}
+
+static const char *
+bench_ring_name(struct th_vq *vq)
+{
+	if (vq->packed)
+		return vq->in_order ? "packed,in_order" : "packed";
+	return vq->dev->modern ? "split" : "split,legacy";
+}
+
+static struct bench_req *
+bench_reqs_alloc(struct th_vm *vm, int n, const uint32_t *lens,
+		 const bool *write, int nbufs)
+{
+	struct bench_req *reqs;
+	int i, j;
+
+	reqs = calloc(n, sizeof(*reqs));
+	if (!reqs)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		reqs[i].slot = i;
+		reqs[i].nbufs = nbufs;
+		for (j = 0; j < nbufs; j++) {
+			reqs[i].hva[j] = th_alloc(vm, lens[j], 64,
+						  &reqs[i].bufs[j].gpa);
+			if (!reqs[i].hva[j])
+				return NULL;
+			reqs[i].bufs[j].len = lens[j];
+			reqs[i].bufs[j].write = write[j];
+		}
+	}
+	return reqs;
+}
+
+/*
+ * Keep opt.depth requests in flight on @vq for opt.seconds, @prep fills a
+ * request in before it is added and @done, if given, checks the result.
+ * The loop is what a guest vCPU with a polling-free driver does: add,
+ * kick, and sleep until the interrupt.
+ */
+static int
+bench_run_queue(struct th_vq *vq, struct bench_req *reqs,
+		void (*prep)(struct bench_req *, void *),
+		int (*done)(struct bench_req *, void *), void *arg,
+		struct bench_stats *st, double *secs)
+{
+	struct th_vm *vm = vq->dev->vm;
+	struct bench_req **free_reqs, *req;
+	uint64_t start, end, now, kicks, irqs;
+	int nfree = opt.depth, inflight = 0, i, ret;
+	uint64_t errors = 0;
+	uint32_t len;
+
+	free_reqs = calloc(opt.depth, sizeof(*free_reqs));
+	if (!free_reqs)
+		return -1;
+	for (i = 0; i < opt.depth; i++)
+		free_reqs[i] = &reqs[i];
+
+	kicks = vq->kicks;
+	irqs = vm->irqs;
+	start = bench_now();
+	end = start + opt.seconds * 1000000000UL;
+	for (;;) {
+		now = bench_now();
+		while (now < end && nfree > 0) {
+			req = free_reqs[nfree - 1];
+			prep(req, arg);
+			req->start = bench_now();
+			if (th_vq_add(vq, req->bufs, req->nbufs, req) < 0)
+				break;
+			nfree--;
+			inflight++;
+		}
+		if (vq->added)
+			th_vq_kick(vq);
+
+		ret = 0;
+		while ((i = th_vq_get(vq, &len, (void **)&req)) > 0) {
+			now = bench_now();
+			if (done && done(req, arg) < 0)
+				errors++;
+			else
+				bench_stats_add(st, req->bufs[1].len,
+						now - req->start);
+			free_reqs[nfree++] = req;
+			inflight--;
+			ret++;
+		}
+		if (i < 0) {
+			fprintf(stderr, "%s: bogus used buffer\n", st->name);
+			free(free_reqs);
+			return -1;
+		}
+		if (bench_now() >= end && inflight == 0)
+			break;
+		if (ret == 0 && !th_wait_irq(vm, 1000) && inflight) {
+			fprintf(stderr, "%s: %d requests stuck\n", st->name,
+				inflight);
+			free(free_reqs);
+			return -1;
+		}
+	}
+	*secs = (bench_now() - start) / 1e9;
+	bench_report(st, *secs, vq->kicks - kicks, vm->irqs - irqs);
+	free(free_reqs);
+	if (errors) {
+		fprintf(stderr, "%s: %lu requests failed\n", st->name, errors);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * core: a device which completes each chain right away, on the thread
+ * which notified it, so only the transport and the vq_getchains(),
+ * vq_relchain() and vq_endchains() are measured.
+ */
+struct bench_null {
+	struct virtio_base base;
+	struct virtio_vq_info vq;
+	struct virtio_ops ops;
+	struct vq_chain chains[BENCH_NULL_BATCH];
+	struct iovec iov[BENCH_NULL_BATCH][TH_MAX_SEGS];
+	uint16_t flags[BENCH_NULL_BATCH][TH_MAX_SEGS];
+};
+
+static void
+bench_null_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	struct bench_null *null = vdev;
+	struct vq_chain *c;
+	uint32_t len;
+	int i, j, n;
+
+	do {
+		n = vq_getchains(vq, null->chains, BENCH_NULL_BATCH);
+		for (i = 0; i < n; i++) {
+			c = &null->chains[i];
+			len = 0;
+			for (j = 0; j < c->n; j++) {
+				if (c->flags[j] & VRING_DESC_F_WRITE)
+					len += c->iov[j].iov_len;
+			}
+			vq_relchain(vq, c->idx, len);
+		}
+		vq_endchains(vq, 1);
+	} while (n > 0 && vq_has_descs(vq));
+}
+
+static int
+bench_null_init(struct th_dev *dev, struct th_vm *vm, int slot,
+		struct bench_null *null)
+{
+	int i;
+
+	th_dev_prepare(dev, vm, slot);
+	memset(null, 0, sizeof(*null));
+	null->ops.name = "null";
+	null->ops.nvq = 1;
+	virtio_linkup(&null->base, &null->ops, null, &dev->pdev, &null->vq,
+		      BACKEND_VBSU);
+	null->base.device_caps = (1UL << VIRTIO_F_NOTIFY_ON_EMPTY) |
+				 (1UL << VIRTIO_RING_F_INDIRECT_DESC) |
+				 (1UL << VIRTIO_F_VERSION_1) |
+				 (1UL << VIRTIO_F_RING_PACKED) |
+				 (1UL << VIRTIO_F_IN_ORDER);
+	null->vq.qsize = BENCH_NULL_RINGSZ;
+	null->vq.notify = bench_null_notify;
+	for (i = 0; i < BENCH_NULL_BATCH; i++) {
+		null->chains[i].iov = null->iov[i];
+		null->chains[i].flags = null->flags[i];
+		null->chains[i].n_iov = TH_MAX_SEGS;
+	}
+
+	if (virtio_interrupt_init(&null->base, virtio_uses_msix()))
+		return -1;
+	virtio_set_io_bar(&null->base, 0);
+	return virtio_set_modern_bar(&null->base, false);
+}
+
+static void
+bench_null_prep(struct bench_req *req, void *arg)
+{
+}
+
+static int
+bench_core(int argc, char **argv)
+{
+	static const uint32_t lens_tmpl[2] = {16, 0};
+	static const bool write[2] = {false, true};
+	struct bench_null null;
+	struct bench_stats st;
+	struct bench_req *reqs;
+	struct th_vm vm;
+	struct th_dev dev;
+	uint32_t lens[2];
+	double secs;
+
+	lens[0] = lens_tmpl[0];
+	lens[1] = opt.size;
+	if (th_vm_init(&vm, "core", BENCH_MEMSIZE) < 0 ||
+	    bench_null_init(&dev, &vm, 3, &null) < 0 ||
+	    th_dev_setup(&dev, bench_ring_features(), 1, 0) < 0) {
+		fprintf(stderr, "cannot set up the null device\n");
+		return 1;
+	}
+	if (opt.depth > dev.vqs[0].qsize)
+		opt.depth = dev.vqs[0].qsize;
+	reqs = bench_reqs_alloc(&vm, opt.depth, lens, write, 2);
+	if (!reqs)
+		return 1;
+
+	printf("core: %s ring, depth %d, %u bytes\n",
+	       bench_ring_name(&dev.vqs[0]), opt.depth, opt.size);
+	bench_stats_init(&st, "vq core");
+	return bench_run_queue(&dev.vqs[0], reqs, bench_null_prep, NULL, NULL,
+			       &st, &secs) ? 1 : 0;
+}
+
+/*
+ * blk: virtio-blk on a backing file, random reads or writes of opt.size
+ */
+struct bench_blk {
+	uint64_t sectors;	/* request size in sectors */
+	uint64_t slots;		/* request-sized slots on the disk */
+	unsigned int seed;
+};
+
+static void
+bench_blk_prep(struct bench_req *req, void *arg)
+{
+	struct bench_blk *blk = arg;
+	struct virtio_blk_outhdr *hdr = req->hva[0];
+
+	hdr->type = opt.write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	hdr->ioprio = 0;
+	hdr->sector = (rand_r(&blk->seed) % blk->slots) * blk->sectors;
+	*(uint8_t *)req->hva[2] = 0xff;
+}
+
+static int
+bench_blk_done(struct bench_req *req, void *arg)
+{
+	return *(uint8_t *)req->hva[2] == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+static int
+bench_blk(int argc, char **argv)
+{
+	uint32_t lens[3] = {sizeof(struct virtio_blk_outhdr), opt.size, 1};
+	bool write[3] = {false, !opt.write, true};
+	struct bench_blk blk = { .seed = 1 };
+	struct bench_stats st;
+	struct bench_req *reqs;
+	struct th_vm vm;
+	struct th_dev dev;
+	uint64_t capacity;
+	double secs;
+	int ret;
+
+	if (argc < 1) {
+		fprintf(stderr, "blk: virtio-blk options required\n");
+		return 1;
+	}
+	if (opt.size == 0 || opt.size % 512) {
+		fprintf(stderr, "blk: size must be a multiple of 512\n");
+		return 1;
+	}
+
+	if (th_vm_init(&vm, "blk", BENCH_MEMSIZE) < 0 ||
+	    bench_dev_init(&dev, &vm, 3, "virtio-blk", argv[0]) < 0 ||
+	    th_dev_setup(&dev, bench_ring_features(), 1, 0) < 0) {
+		fprintf(stderr, "cannot set up virtio-blk\n");
+		return 1;
+	}
+
+	capacity = th_cfg_read(&dev, 0, 4) |
+		   ((uint64_t)th_cfg_read(&dev, 4, 4) << 32);
+	blk.sectors = opt.size / 512;
+	blk.slots = capacity / blk.sectors;
+	if (blk.slots == 0) {
+		fprintf(stderr, "blk: disk smaller than one request\n");
+		return 1;
+	}
+	if (opt.depth > dev.vqs[0].qsize)
+		opt.depth = dev.vqs[0].qsize;
+	reqs = bench_reqs_alloc(&vm, opt.depth, lens, write, 3);
+	if (!reqs)
+		return 1;
+
+	printf("blk: %s ring, depth %d, random %s of %u bytes, %lu MB disk\n",
+	       bench_ring_name(&dev.vqs[0]), opt.depth,
+	       opt.write ? "writes" : "reads", opt.size, capacity >> 11);
+	bench_stats_init(&st, "virtio_blk");
+	ret = bench_run_queue(&dev.vqs[0], reqs, bench_blk_prep, bench_blk_done,
+			      &blk, &st, &secs);
+	th_dev_deinit(&dev);
+	return ret ? 1 : 0;
+}
+
+/*
+ * net-peer and net-tap: two VMs in this process, A sends Ethernet frames
+ * of opt.size to B. The frames carry their send time, so the latency is
+ * from adding a frame to A's tx queue to reaping it from B's rx queue.
+ */
+struct bench_pkt {
+	uint64_t magic;
+	uint64_t seq;
+	uint64_t sent;		/* bench_now() */
+};
+
+#define BENCH_PKT_MAGIC	0x7672746e62656e63UL
+
+struct bench_net {
+	struct th_vm vm[2];
+	struct th_dev dev[2];
+	uint8_t mac[2][6];
+	uint64_t seq;
+	volatile bool stop;
+	struct bench_stats tx, rx;
+	uint64_t foreign;	/* frames which weren't ours */
+	double rx_secs;
+	uint64_t rx_kicks, rx_irqs;
+};
+
+static void
+bench_net_prep(struct bench_req *req, void *arg)
+{
+	struct bench_net *net = arg;
+	uint8_t *frame = req->hva[1];
+	struct bench_pkt *pkt = (struct bench_pkt *)(frame + 14);
+
+	memcpy(frame, net->mac[1], 6);
+	memcpy(frame + 6, net->mac[0], 6);
+	frame[12] = BENCH_ETHERTYPE >> 8;
+	frame[13] = BENCH_ETHERTYPE & 0xff;
+	pkt->magic = BENCH_PKT_MAGIC;
+	pkt->seq = net->seq++;
+	pkt->sent = bench_now();
+}
+
+/* B: keep rx buffers posted and account what arrives */
+static void *
+bench_net_rx(void *arg)
+{
+	struct bench_net *net = arg;
+	struct th_dev *dev = &net->dev[1];
+	struct th_vq *vq = &dev->vqs[BENCH_NET_RXQ];
+	struct th_buf buf = { .len = BENCH_NET_HDRLEN + BENCH_NET_BUFSZ,
+			      .write = true };
+	uint64_t start, last = 0, kicks, irqs;
+	struct bench_pkt *pkt;
+	uint8_t *frame;
+	void *bufs[BENCH_NET_RXBUFS];
+	uint32_t len;
+	int i, n;
+
+	for (i = 0; i < BENCH_NET_RXBUFS; i++)
+		bufs[i] = th_alloc(dev->vm, buf.len, 64, &buf.gpa);
+
+	kicks = vq->kicks;
+	irqs = dev->vm->irqs;
+	start = bench_now();
+	for (i = 0; i < BENCH_NET_RXBUFS; i++) {
+		buf.gpa = (char *)bufs[i] - (char *)dev->vm->ctx.baseaddr;
+		if (th_vq_add(vq, &buf, 1, bufs[i]) < 0)
+			break;
+	}
+	th_vq_kick(vq);
+
+	while (!net->stop) {
+		n = 0;
+		while (th_vq_get(vq, &len, (void **)&frame) > 0) {
+			pkt = (struct bench_pkt *)(frame + BENCH_NET_HDRLEN + 14);
+			if (len >= BENCH_NET_HDRLEN + 14 + sizeof(*pkt) &&
+			    frame[BENCH_NET_HDRLEN + 12] == BENCH_ETHERTYPE >> 8 &&
+			    frame[BENCH_NET_HDRLEN + 13] ==
+				(BENCH_ETHERTYPE & 0xff) &&
+			    pkt->magic == BENCH_PKT_MAGIC) {
+				last = bench_now();
+				bench_stats_add(&net->rx, len - BENCH_NET_HDRLEN,
+						last - pkt->sent);
+			} else
+				net->foreign++;
+
+			buf.gpa = frame - (uint8_t *)dev->vm->ctx.baseaddr;
+			th_vq_add(vq, &buf, 1, frame);
+			n++;
+		}
+		if (vq->added)
+			th_vq_kick(vq);
+		if (n == 0)
+			th_wait_irq(dev->vm, 100);
+	}
+
+	net->rx_secs = ((last ? last : bench_now()) - start) / 1e9;
+	net->rx_kicks = vq->kicks - kicks;
+	net->rx_irqs = dev->vm->irqs - irqs;
+	return NULL;
+}
+
+static int
+bench_net(const char *opts_a, const char *opts_b)
+{
+	static const char *names[2] = {"netA", "netB"};
+	uint64_t features = (1UL << VIRTIO_NET_F_MAC) |
+			    (1UL << VIRTIO_NET_F_STATUS) |
+			    (1UL << VIRTIO_NET_F_MRG_RXBUF);
+	uint32_t lens[2] = {BENCH_NET_HDRLEN, opt.size};
+	bool write[2] = {false, false};
+	struct bench_net *net;
+	struct bench_req *reqs;
+	pthread_t rx_tid;
+	double secs;
+	int i, j, ret;
+
+	if (opt.size < 14 + sizeof(struct bench_pkt) ||
+	    opt.size > BENCH_NET_BUFSZ) {
+		fprintf(stderr, "net: size must be from %zu to %d\n",
+			14 + sizeof(struct bench_pkt), BENCH_NET_BUFSZ);
+		return 1;
+	}
+	net = calloc(1, sizeof(*net));
+	if (!net)
+		return 1;
+
+	/* the MAC is derived from the slot, give A and B different ones */
+	for (i = 0; i < 2; i++) {
+		if (th_vm_init(&net->vm[i], names[i], BENCH_MEMSIZE) < 0 ||
+		    bench_dev_init(&net->dev[i], &net->vm[i], 3 + i,
+				   "virtio-net", i ? opts_b : opts_a) < 0 ||
+		    th_dev_setup(&net->dev[i], features | bench_ring_features(),
+				 2, 0) < 0) {
+			fprintf(stderr, "cannot set up virtio-net\n");
+			return 1;
+		}
+		for (j = 0; j < 6; j++)
+			net->mac[i][j] = th_cfg_read(&net->dev[i], j, 1);
+	}
+
+	/* a peer link comes up once both sides are connected */
+	for (i = 0; i < BENCH_LINK_WAIT_MS; i++) {
+		if ((th_cfg_read(&net->dev[0], 6, 2) & VIRTIO_NET_S_LINK_UP) &&
+		    (th_cfg_read(&net->dev[1], 6, 2) & VIRTIO_NET_S_LINK_UP))
+			break;
+		usleep(1000);
+	}
+	if (i == BENCH_LINK_WAIT_MS) {
+		fprintf(stderr, "net: link did not come up\n");
+		return 1;
+	}
+
+	if (opt.depth > net->dev[0].vqs[BENCH_NET_TXQ].qsize)
+		opt.depth = net->dev[0].vqs[BENCH_NET_TXQ].qsize;
+	reqs = bench_reqs_alloc(&net->vm[0], opt.depth, lens, write, 2);
+	if (!reqs)
+		return 1;
+
+	printf("net: %s ring, depth %d, %u byte frames\n",
+	       bench_ring_name(&net->dev[0].vqs[BENCH_NET_TXQ]), opt.depth,
+	       opt.size);
+	bench_stats_init(&net->tx, "virtio_net tx");
+	bench_stats_init(&net->rx, "virtio_net rx");
+	if (pthread_create(&rx_tid, NULL, bench_net_rx, net)) {
+		fprintf(stderr, "net: cannot start the receiver\n");
+		return 1;
+	}
+
+	ret = bench_run_queue(&net->dev[0].vqs[BENCH_NET_TXQ], reqs,
+			      bench_net_prep, NULL, net, &net->tx, &secs);
+
+	/* let the frames still on their way arrive */
+	usleep(200000);
+	net->stop = true;
+	pthread_join(rx_tid, NULL);
+	bench_report(&net->rx, net->rx_secs, net->rx_kicks, net->rx_irqs);
+	printf("sent %lu received %lu lost %lu foreign %lu\n", net->tx.ops,
+	       net->rx.ops, net->tx.ops - net->rx.ops, net->foreign);
+
+	for (i = 0; i < 2; i++)
+		th_dev_deinit(&net->dev[i]);
+	return ret ? 1 : 0;
+}
+
+static int
+bench_net_peer(int argc, char **argv)
+{
+	char opts[256];
+
+	snprintf(opts, sizeof(opts), "peer=/tmp/virtio_bench.%d.sock%s%s",
+		 getpid(), argc > 0 ? "," : "", argc > 0 ? argv[0] : "");
+	return bench_net(opts, opts);
+}
+
+static int
+bench_net_tap(int argc, char **argv)
+{
+	char opts[2][256];
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "net-tap: two tap interfaces required\n");
+		return 1;
+	}
+	for (i = 0; i < 2; i++)
+		snprintf(opts[i], sizeof(opts[i]), "tap=%s%s%s", argv[i],
+			 argc > 2 ? "," : "", argc > 2 ? argv[2] : "");
+	return bench_net(opts[0], opts[1]);
+}
+
+static int
+bench_parse_size(const char *s, uint32_t *size)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(s, &end, 0);
+	if (errno || end == s)
+		return -1;
+	if (*end == 'k' || *end == 'K') {
+		v <<= 10;
+		end++;
+	}
+	if (*end || v > (1UL << 20))
+		return -1;
+	*size = v;
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <mode> [args]\n"
+		"modes:\n"
+		"  core                 null device, virtqueue core only\n"
+		"  blk <opts>           virtio-blk, <opts> as given to acrn-dm\n"
+		"  net-peer [opts]      virtio-net to virtio-net over peer=\n"
+		"  net-tap <A> <B> [opts] the same over taps, bridged by you\n"
+		"options:\n"
+		"  -t <secs>            run time (%d)\n"
+		"  -d <depth>           requests in flight (%d)\n"
+		"  -s <bytes>           request size (4096), or frame size (%d)\n"
+		"  -w                   blk: write instead of read\n"
+		"  -p                   negotiate packed rings (VERSION_1)\n"
+		"  -i                   use indirect descriptors\n"
+		"  -v                   device model log, repeat for more\n",
+		prog, opt.seconds, opt.depth, BENCH_NET_FRAMESZ);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *mode;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:d:s:wpivh")) != -1) {
+		switch (c) {
+		case 't':
+			opt.seconds = atoi(optarg);
+			break;
+		case 'd':
+			opt.depth = atoi(optarg);
+			break;
+		case 's':
+			if (bench_parse_size(optarg, &opt.size) < 0) {
+				fprintf(stderr, "invalid size %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'w':
+			opt.write = true;
+			break;
+		case 'p':
+			opt.packed = true;
+			break;
+		case 'i':
+			opt.indirect = true;
+			break;
+		case 'v':
+			opt.log_level++;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc || opt.seconds <= 0 || opt.depth <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	th_init(opt.log_level);
+	mode = argv[optind];
+	if (!opt.size && (!strcmp(mode, "core") || !strcmp(mode, "blk")))
+		opt.size = BENCH_REQ_SIZE;
+	if (!strcmp(mode, "core"))
+		return bench_core(argc - optind - 1, argv + optind + 1);
+	if (!strcmp(mode, "blk"))
+		return bench_blk(argc - optind - 1, argv + optind + 1);
+	if (!opt.size)
+		opt.size = BENCH_NET_FRAMESZ;
+	if (!strcmp(mode, "net-peer"))
+		return bench_net_peer(argc - optind - 1, argv + optind + 1);
+	if (!strcmp(mode, "net-tap"))
+		return bench_net_tap(argc - optind - 1, argv + optind + 1);
+
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,594 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Unit test of the virtqueue core, see README.rst.
+ *
+ * A device without a backend exposes one queue, the test adds chains on
+ * the guest side with the harness and then calls vq_getchain(),
+ * vq_relchain() and vq_endchains() itself, checking what the device saw
+ * and what the guest gets back, and when kicks and interrupts happen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "dm.h"
+#include "log.h"
+#include "harness.h"
+
+#define RING_MEMSIZE	(64UL << 20)
+#define RING_QSIZE	64
+
+#define F_PACKED	((1UL << VIRTIO_F_VERSION_1) | \
+			 (1UL << VIRTIO_F_RING_PACKED))
+#define F_IN_ORDER	(1UL << VIRTIO_F_IN_ORDER)
+#define F_INDIRECT	(1UL << VIRTIO_RING_F_INDIRECT_DESC)
+#define F_EVENT_IDX	(1UL << VIRTIO_RING_F_EVENT_IDX)
+#define F_NOTIFY_EMPTY	(1UL << VIRTIO_F_NOTIFY_ON_EMPTY)
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: %s: %s failed\n",	\
+				__FILE__, __LINE__, __func__, #cond);	\
+			return -1;					\
+		}							\
+	} while (0)
+
+static struct {
+	struct virtio_base base;
+	struct virtio_vq_info vq;
+	struct virtio_ops ops;
+	int notified;
+} ring;
+
+static struct th_vm vm;
+static struct th_dev dev;
+static struct virtio_vq_info *dvq = &ring.vq;
+
+static void
+ring_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	ring.notified++;
+}
+
+static int
+ring_init(void)
+{
+	th_dev_prepare(&dev, &vm, 3);
+	ring.ops.name = "ring";
+	ring.ops.nvq = 1;
+	virtio_linkup(&ring.base, &ring.ops, &ring, &dev.pdev, &ring.vq,
+		      BACKEND_VBSU);
+	ring.base.device_caps = F_PACKED | F_IN_ORDER | F_INDIRECT |
+				F_EVENT_IDX | F_NOTIFY_EMPTY;
+	ring.vq.qsize = RING_QSIZE;
+	ring.vq.notify = ring_notify;
+
+	if (virtio_interrupt_init(&ring.base, virtio_uses_msix()))
+		return -1;
+	virtio_set_io_bar(&ring.base, 0);
+	return virtio_set_modern_bar(&ring.base, false);
+}
+
+/* Bring the queue up with @features and a ring of @qsize */
+static struct th_vq *
+ring_setup(uint64_t features, uint16_t qsize)
+{
+	static const struct virtio_coalesce nocoal;
+
+	/* a reset leaves both as the last driver set them */
+	ring.vq.qsize = RING_QSIZE;
+	vq_set_coalesce(dvq, &nocoal);
+	if (th_dev_setup(&dev, features, 1, qsize) < 0 ||
+	    dev.features != features)
+		return NULL;
+	ring.notified = 0;
+	return &dev.vqs[0];
+}
+
+/* Guest buffers of the given sizes, odd ones device writable */
+static void
+ring_bufs(struct th_buf *bufs, int n, uint32_t len)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		th_alloc(&vm, len, 8, &bufs[i].gpa);
+		bufs[i].len = len;
+		bufs[i].write = i & 1;
+	}
+}
+
+/* Is the descriptor at @pos marked used for the @wrap lap? */
+static bool
+ring_desc_used(struct th_vq *vq, uint16_t pos, bool wrap)
+{
+	uint16_t flags = vq->pdesc[pos].flags;
+	bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return avail == used && used == wrap;
+}
+
+static int
+test_split_chain(void)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	uint16_t flags[TH_MAX_SEGS], idx;
+	struct th_buf bufs[3];
+	struct th_vq *vq;
+	uint64_t irqs;
+	uint32_t len;
+	void *cookie;
+	int id, i;
+
+	vq = ring_setup(0, 0);
+	CHECK(vq && !vq->packed && !dvq->packed);
+	ring_bufs(bufs, 3, 256);
+	id = th_vq_add(vq, bufs, 3, bufs);
+	CHECK(id >= 0);
+	th_vq_kick(vq);
+	CHECK(ring.notified == 1);
+
+	CHECK(vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, flags) == 3);
+	CHECK(idx == id);
+	for (i = 0; i < 3; i++) {
+		CHECK(iov[i].iov_base == th_gpa2hva(&vm, bufs[i].gpa));
+		CHECK(iov[i].iov_len == 256);
+		CHECK(!!(flags[i] & VRING_DESC_F_WRITE) == bufs[i].write);
+	}
+	CHECK(!vq_has_descs(dvq));
+
+	irqs = vm.irqs;
+	vq_relchain(dvq, idx, 100);
+	vq_endchains(dvq, 0);
+	CHECK(vm.irqs == irqs + 1);
+	CHECK(th_vq_get(vq, &len, &cookie) == 1);
+	CHECK(len == 100 && cookie == bufs);
+	CHECK(th_vq_get(vq, &len, &cookie) == 0);
+	return 0;
+}
+
+static int
+test_packed_chain(void)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	uint16_t flags[TH_MAX_SEGS], idx;
+	struct th_buf bufs[3];
+	struct th_vq *vq;
+	uint64_t irqs;
+	uint32_t len;
+	void *cookie;
+	int id, i;
+
+	vq = ring_setup(F_PACKED, 0);
+	CHECK(vq && vq->packed && dvq->packed && !dvq->in_order);
+	CHECK(vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, flags) == 0);
+
+	ring_bufs(bufs, 3, 512);
+	id = th_vq_add(vq, bufs, 3, bufs);
+	CHECK(id >= 0);
+	CHECK(vq_has_descs(dvq));
+	th_vq_kick(vq);
+	CHECK(ring.notified == 1);
+
+	CHECK(vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, flags) == 3);
+	CHECK(idx == id);
+	for (i = 0; i < 3; i++) {
+		CHECK(iov[i].iov_base == th_gpa2hva(&vm, bufs[i].gpa));
+		CHECK(iov[i].iov_len == 512);
+		/* the ring's wrap bits must not leak to the device */
+		CHECK(flags[i] == (bufs[i].write ? VRING_DESC_F_WRITE : 0) ||
+		      flags[i] == ((bufs[i].write ? VRING_DESC_F_WRITE : 0) |
+				   VRING_DESC_F_NEXT));
+	}
+	CHECK(dvq->last_avail == 3 && !vq_has_descs(dvq));
+
+	/* not used until the device says so */
+	irqs = vm.irqs;
+	vq_relchain(dvq, idx, 513);
+	CHECK(dvq->used_bufs == 1);
+	vq_endchains(dvq, 0);
+	CHECK(dvq->used_bufs == 0);
+	CHECK(vm.irqs == irqs + 1);
+	CHECK(dvq->used_idx == 3);
+
+	CHECK(th_vq_get(vq, &len, &cookie) == 1);
+	CHECK(len == 513 && cookie == bufs);
+	CHECK(th_vq_get(vq, &len, &cookie) == 0);
+	CHECK(vq->nfree == vq->qsize);
+
+	/* nothing new, no interrupt */
+	vq_endchains(dvq, 0);
+	CHECK(vm.irqs == irqs + 1);
+	return 0;
+}
+
+static int
+test_packed_indirect(void)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	uint16_t flags[TH_MAX_SEGS], idx;
+	struct th_buf bufs[5];
+	struct th_vq *vq;
+	uint32_t len;
+	void *cookie;
+	int id, i;
+
+	vq = ring_setup(F_PACKED | F_INDIRECT, 0);
+	CHECK(vq && vq->indirect);
+	ring_bufs(bufs, 5, 64);
+	id = th_vq_add(vq, bufs, 5, bufs);
+	CHECK(id >= 0 && vq->nfree == vq->qsize - 1);
+	th_vq_kick(vq);
+
+	CHECK(vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, flags) == 5);
+	CHECK(idx == id && dvq->last_avail == 1);
+	for (i = 0; i < 5; i++) {
+		CHECK(iov[i].iov_base == th_gpa2hva(&vm, bufs[i].gpa));
+		CHECK(flags[i] == (bufs[i].write ? VRING_DESC_F_WRITE : 0));
+	}
+
+	/* too small an iov[] fails the chain but moves past it */
+	id = th_vq_add(vq, bufs, 5, NULL);
+	CHECK(id >= 0);
+	CHECK(vq_getchain(dvq, &idx, iov, 4, flags) == -1);
+	CHECK(dvq->last_avail == 2 && !vq_has_descs(dvq));
+
+	vq_relchain(dvq, idx, 0);
+	vq_endchains(dvq, 0);
+	CHECK(th_vq_get(vq, &len, &cookie) == 1);
+	CHECK(len == 0 && cookie == bufs);
+	CHECK(dvq->used_idx == 1);
+	return 0;
+}
+
+static int
+test_packed_bad_id(void)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	struct th_buf buf;
+	struct th_vq *vq;
+	uint16_t idx;
+
+	vq = ring_setup(F_PACKED, 8);
+	CHECK(vq && vq->qsize == 8);
+	ring_bufs(&buf, 1, 64);
+	CHECK(th_vq_add(vq, &buf, 1, NULL) == 0);
+	vq->pdesc[0].id = 8;
+	CHECK(vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, NULL) == -1);
+	CHECK(dvq->last_avail == 1 && dvq->avail_wrap);
+	return 0;
+}
+
+/*
+ * Fill a small ring with chains of 1 to 3 descriptors, complete them in
+ * reverse order, and go around the ring many times so both wrap
+ * counters flip at every position.
+ */
+static int
+test_packed_wrap(void)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	uint16_t ids[8];
+	uint32_t lens[8], len;
+	struct th_buf bufs[3];
+	struct th_vq *vq;
+	int round, n, k, got, wraps = 0;
+	bool wrap;
+	void *cookie;
+
+	vq = ring_setup(F_PACKED, 7);
+	CHECK(vq && vq->qsize == 7);
+	ring_bufs(bufs, 3, 128);
+
+	wrap = vq->avail_wrap;
+	for (round = 0, k = 0; round < 100; round++) {
+		for (n = 0; ; n++, k++) {
+			lens[n] = k;
+			if (th_vq_add(vq, bufs, 1 + k % 3, &lens[n]) < 0)
+				break;
+		}
+		CHECK(n > 0);
+		th_vq_kick(vq);
+
+		for (got = 0; got < n; got++)
+			CHECK(vq_getchain(dvq, &ids[got], iov, TH_MAX_SEGS,
+					  NULL) == 1 + (lens[got] % 3));
+		CHECK(!vq_has_descs(dvq));
+		CHECK(dvq->last_avail == vq->next_avail);
+		CHECK(dvq->avail_wrap == vq->avail_wrap);
+
+		for (got = n - 1; got >= 0; got--)
+			vq_relchain(dvq, ids[got], lens[got]);
+		vq_endchains(dvq, 0);
+		CHECK(dvq->used_idx == vq->next_avail);
+		CHECK(dvq->used_wrap == vq->avail_wrap);
+
+		for (got = n - 1; got >= 0; got--) {
+			CHECK(th_vq_get(vq, &len, &cookie) == 1);
+			CHECK(cookie == &lens[got] && len == lens[got]);
+		}
+		CHECK(th_vq_get(vq, &len, &cookie) == 0);
+		CHECK(vq->nfree == vq->qsize);
+
+		if (vq->avail_wrap != wrap) {
+			wrap = vq->avail_wrap;
+			wraps++;
+		}
+	}
+	CHECK(wraps > 20);
+	return 0;
+}
+
+/*
+ * With IN_ORDER a used descriptor completes every buffer up to its id,
+ * and only the last of them gets a length.
+ */
+static int
+test_packed_in_order(void)
+{
+	static const uint32_t lens[5] = {0, 0, 50, 0, 70};
+	struct iovec iov[TH_MAX_SEGS];
+	uint16_t ids[5];
+	struct th_buf bufs[2];
+	struct th_vq *vq;
+	uint32_t len;
+	void *cookie;
+	int i;
+
+	vq = ring_setup(F_PACKED | F_IN_ORDER, 16);
+	CHECK(vq && dvq->in_order);
+	ring_bufs(bufs, 2, 64);
+
+	/* rx: every buffer is written to, each gets its own descriptor */
+	for (i = 0; i < 4; i++)
+		CHECK(th_vq_add(vq, bufs, 1, &ids[i]) >= 0);
+	for (i = 0; i < 4; i++)
+		CHECK(vq_getchain(dvq, &ids[i], iov, TH_MAX_SEGS, NULL) == 1);
+	for (i = 0; i < 4; i++)
+		vq_relchain(dvq, ids[i], 100 + i);
+	vq_endchains(dvq, 0);
+	for (i = 0; i < 4; i++)
+		CHECK(ring_desc_used(vq, i, true));
+	for (i = 0; i < 4; i++) {
+		CHECK(th_vq_get(vq, &len, &cookie) == 1);
+		CHECK(len == 100 + i);
+	}
+
+	/* tx: nothing written, one descriptor for the whole batch */
+	for (i = 0; i < 4; i++)
+		CHECK(th_vq_add(vq, bufs, 2, NULL) >= 0);
+	for (i = 0; i < 4; i++)
+		CHECK(vq_getchain(dvq, &ids[i], iov, TH_MAX_SEGS, NULL) == 2);
+	for (i = 0; i < 4; i++)
+		vq_relchain(dvq, ids[i], 0);
+	CHECK(dvq->used_bufs == 4);
+	CHECK(!ring_desc_used(vq, 4, true));
+	vq_endchains(dvq, 0);
+	CHECK(ring_desc_used(vq, 4, true) && vq->pdesc[4].id == ids[3]);
+	for (i = 1; i < 4; i++)
+		CHECK(!ring_desc_used(vq, 4 + 2 * i, true));
+	CHECK(dvq->used_idx == 12);
+	for (i = 0; i < 4; i++) {
+		CHECK(th_vq_get(vq, &len, &cookie) == 1);
+		CHECK(len == 0);
+	}
+	CHECK(th_vq_get(vq, &len, &cookie) == 0);
+
+	/* mixed, and around the end of the ring: batches end at a length */
+	for (i = 0; i < 5; i++)
+		CHECK(th_vq_add(vq, bufs, 1, (void *)&lens[i]) >= 0);
+	for (i = 0; i < 5; i++)
+		CHECK(vq_getchain(dvq, &ids[i], iov, TH_MAX_SEGS, NULL) == 1);
+	for (i = 0; i < 5; i++)
+		vq_relchain(dvq, ids[i], lens[i]);
+	vq_endchains(dvq, 0);
+	CHECK(ring_desc_used(vq, 12, true) && vq->pdesc[12].id == ids[2]);
+	CHECK(ring_desc_used(vq, 15, true) && vq->pdesc[15].id == ids[4]);
+	CHECK(dvq->used_idx == 1 && !dvq->used_wrap);
+	for (i = 0; i < 5; i++) {
+		CHECK(th_vq_get(vq, &len, &cookie) == 1);
+		CHECK(cookie == &lens[i] && len == lens[i]);
+	}
+	CHECK(th_vq_get(vq, &len, &cookie) == 0);
+	CHECK(vq->nfree == vq->qsize);
+	return 0;
+}
+
+/* The device turns kicks off while it is busy anyway */
+static int
+test_device_event(uint64_t features)
+{
+	struct th_buf buf;
+	struct th_vq *vq;
+	uint64_t kicks;
+
+	vq = ring_setup(features, 0);
+	CHECK(vq);
+	ring_bufs(&buf, 1, 64);
+
+	vq_set_used_ring_flags(&ring.base, dvq);
+	if (vq->packed)
+		CHECK(vq->device_event->flags ==
+		      VRING_PACKED_EVENT_FLAG_DISABLE);
+	kicks = vq->kicks;
+	CHECK(th_vq_add(vq, &buf, 1, NULL) >= 0);
+	th_vq_kick(vq);
+	CHECK(vq->kicks == kicks && ring.notified == 0);
+
+	vq_clear_used_ring_flags(&ring.base, dvq);
+	CHECK(th_vq_add(vq, &buf, 1, NULL) >= 0);
+	th_vq_kick(vq);
+	CHECK(vq->kicks == kicks + 1 && ring.notified == 1);
+	return 0;
+}
+
+static int
+test_split_device_event(void)
+{
+	return test_device_event(0);
+}
+
+static int
+test_packed_device_event(void)
+{
+	return test_device_event(F_PACKED);
+}
+
+/* Complete one buffer, return the interrupts it caused */
+static int
+ring_complete_one(struct th_vq *vq, int used_all_avail)
+{
+	struct iovec iov[TH_MAX_SEGS];
+	uint64_t irqs = vm.irqs;
+	struct th_buf buf;
+	uint16_t idx;
+
+	ring_bufs(&buf, 1, 64);
+	if (th_vq_add(vq, &buf, 1, NULL) < 0 ||
+	    vq_getchain(dvq, &idx, iov, TH_MAX_SEGS, NULL) != 1)
+		return -1;
+	vq_relchain(dvq, idx, 0);
+	vq_endchains(dvq, used_all_avail);
+	return vm.irqs - irqs;
+}
+
+/* The driver turns interrupts off, unless the queue ran empty */
+static int
+test_packed_driver_event(void)
+{
+	struct th_vq *vq;
+	uint32_t len;
+
+	vq = ring_setup(F_PACKED, 0);
+	CHECK(vq);
+	vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	CHECK(ring_complete_one(vq, 0) == 0);
+	CHECK(ring_complete_one(vq, 1) == 0);
+	CHECK(th_vq_get(vq, &len, NULL) == 1);
+	vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	CHECK(ring_complete_one(vq, 0) == 1);
+
+	vq = ring_setup(F_PACKED | F_NOTIFY_EMPTY, 0);
+	CHECK(vq);
+	vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	CHECK(ring_complete_one(vq, 0) == 0);
+	CHECK(ring_complete_one(vq, 1) == 1);
+	return 0;
+}
+
+/* With EVENT_IDX the driver asks for an interrupt at a ring position */
+static int
+test_packed_event_idx(void)
+{
+	struct th_vq *vq;
+	uint32_t len;
+	int i;
+
+	vq = ring_setup(F_PACKED | F_EVENT_IDX, 8);
+	CHECK(vq && vq->qsize == 8);
+	vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+
+	/* position 3 of the first lap */
+	vq->driver_event->off_wrap = 3 | (1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	for (i = 0; i < 3; i++)
+		CHECK(ring_complete_one(vq, 0) == 0);
+	CHECK(ring_complete_one(vq, 0) == 1);
+	CHECK(ring_complete_one(vq, 0) == 0);
+	for (i = 0; i < 5; i++)
+		CHECK(th_vq_get(vq, &len, NULL) == 1);
+
+	/* position 1 of the next lap, past the end of the ring */
+	vq->driver_event->off_wrap = 1;
+	for (i = 0; i < 4; i++)
+		CHECK(ring_complete_one(vq, 0) == 0);
+	CHECK(dvq->used_idx == 1 && !dvq->used_wrap);
+	CHECK(ring_complete_one(vq, 0) == 1);
+	CHECK(ring_complete_one(vq, 0) == 0);
+	return 0;
+}
+
+/*
+ * Interrupt coalescing counts buffers, not used descriptors, which an
+ * IN_ORDER batch has only one of.
+ */
+static int
+test_packed_used_bufs(void)
+{
+	struct virtio_coalesce coal = { .usecs = 1000000, .frames = 3 };
+	struct iovec iov[TH_MAX_SEGS];
+	struct th_buf buf;
+	struct th_vq *vq;
+	uint16_t idx[3];
+	uint64_t irqs;
+	int i;
+
+	vq = ring_setup(F_PACKED | F_IN_ORDER, 0);
+	CHECK(vq);
+	ring_bufs(&buf, 1, 64);
+	vq_set_coalesce(dvq, &coal);
+
+	for (i = 0; i < 3; i++)
+		CHECK(th_vq_add(vq, &buf, 1, NULL) >= 0);
+	for (i = 0; i < 3; i++)
+		CHECK(vq_getchain(dvq, &idx[i], iov, TH_MAX_SEGS, NULL) == 1);
+	irqs = vm.irqs;
+	for (i = 0; i < 3; i++)
+		vq_relchain(dvq, idx[i], 0);
+	CHECK(dvq->used_bufs == 3);
+	vq_endchains(dvq, 0);
+	CHECK(dvq->used_bufs == 0);
+	CHECK(vm.irqs == irqs + 1);
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(void);
+} tests[] = {
+	{ "split_chain", test_split_chain },
+	{ "split_device_event", test_split_device_event },
+	{ "packed_chain", test_packed_chain },
+	{ "packed_indirect", test_packed_indirect },
+	{ "packed_bad_id", test_packed_bad_id },
+	{ "packed_wrap", test_packed_wrap },
+	{ "packed_in_order", test_packed_in_order },
+	{ "packed_device_event", test_packed_device_event },
+	{ "packed_driver_event", test_packed_driver_event },
+	{ "packed_event_idx", test_packed_event_idx },
+	{ "packed_used_bufs", test_packed_used_bufs },
+};
+
+int
+main(int argc, char **argv)
+{
+	int i, failed = 0;
+
+	th_init(argc > 1 && !strcmp(argv[1], "-v") ? LOG_DEBUG : 0);
+	if (th_vm_init(&vm, "ring", RING_MEMSIZE) < 0 || ring_init() < 0) {
+		fprintf(stderr, "cannot set up the test device\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		if (tests[i].run() < 0) {
+			printf("FAIL %s\n", tests[i].name);
+			failed++;
+		} else
+			printf("ok   %s\n", tests[i].name);
+	}
+	th_dev_reset(&dev);
+
+	printf("%d of %zu tests failed\n", failed,
+	       sizeof(tests) / sizeof(tests[0]));
+	return failed ? 1 : 0;
+}
@@ -2233,6 +2233,57 @@ static int32_t local_decode_instruction(enum vm_cpu_mode cpu_mode,
 	return ret;
 }
 
+static inline struct instr_emul_vie_cache_entry *vie_cache_entry(struct instr_emul_ctxt *emul_ctxt, uint64_t rip)
+{
+	return &emul_ctxt->vie_cache.entries[(rip ^ (rip >> 6U)) & (VIE_CACHE_ENTRIES - 1U)];
+}
+
+/*
+ * Look up the decoded instruction at 'rip' in the per-vCPU decode cache.
+ * On hit, the cached decoding is copied to emul_ctxt->vie, which holds the
+ * freshly fetched instruction bytes on entry.
+ */
+static bool vie_cache_lookup(struct instr_emul_ctxt *emul_ctxt, uint64_t rip,
+		enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	struct instr_emul_vie_cache_entry *entry = vie_cache_entry(emul_ctxt, rip);
+	const struct instr_emul_vie *vie = &emul_ctxt->vie;
+	bool hit = false;
+	uint8_t i;
+
+	if ((entry->vie.decoded != 0U) && (entry->rip == rip)) {
+		hit = (entry->cpu_mode == (uint8_t)cpu_mode) && (entry->cs_d == cs_d) &&
+			(entry->vie.num_valid == vie->num_valid);
+		for (i = 0U; hit && (i < vie->num_valid); i++) {
+			hit = (entry->vie.inst[i] == vie->inst[i]);
+		}
+
+		if (!hit) {
+			emul_ctxt->vie_cache.invalidated++;
+		}
+	}
+
+	if (hit) {
+		emul_ctxt->vie = entry->vie;
+		emul_ctxt->vie_cache.hit++;
+	} else {
+		emul_ctxt->vie_cache.miss++;
+	}
+
+	return hit;
+}
+
+static void vie_cache_insert(struct instr_emul_ctxt *emul_ctxt, uint64_t rip,
+		enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	struct instr_emul_vie_cache_entry *entry = vie_cache_entry(emul_ctxt, rip);
+
+	entry->rip = rip;
+	entry->cpu_mode = (uint8_t)cpu_mode;
+	entry->cs_d = cs_d;
+	entry->vie = emul_ctxt->vie;
+}
+
 /* for instruction MOVS/STO, check the gva gotten from DI/SI. */
 static int32_t instr_check_di(struct acrn_vcpu *vcpu)
 {
@@ -2349,6 +2400,8 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu, bool full_decode)
 	uint32_t csar;
 	int32_t retval;
 	enum vm_cpu_mode cpu_mode;
+	uint64_t rip;
+	bool cs_d;
 
 	emul_ctxt = &vcpu->inst_ctxt;
 	retval = vie_init(&emul_ctxt->vie, vcpu);
@@ -2360,8 +2413,21 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu, bool full_decode)
 	} else {
 		csar = exec_vmread32(VMX_GUEST_CS_ATTR);
 		cpu_mode = get_vcpu_mode(vcpu);
+		cs_d = seg_desc_def32(csar);
+		rip = vcpu_get_rip(vcpu);
 
-		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie);
+		/*
+		 * The instruction bytes are always fetched from the guest, the cache
+		 * only saves the decoding of them.
+		 */
+		if (vie_cache_lookup(emul_ctxt, rip, cpu_mode, cs_d)) {
+			retval = 0;
+		} else {
+			retval = local_decode_instruction(cpu_mode, cs_d, &emul_ctxt->vie);
+			if (retval == 0) {
+				vie_cache_insert(emul_ctxt, rip, cpu_mode, cs_d);
+			}
+		}
 
 		if (retval != 0) {
 			if (full_decode) {
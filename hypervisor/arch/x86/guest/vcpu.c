@@ -824,6 +824,28 @@ void kick_vcpu(struct acrn_vcpu *vcpu)
 	}
 }
 
+void kick_vcpus(struct acrn_vm *vm, uint64_t vdmask)
+{
+	uint16_t vcpu_id, pcpu_id;
+	uint64_t mask = vdmask, pdmask = 0UL;
+	struct acrn_vcpu *vcpu;
+
+	vcpu_id = ffs64(mask);
+	while (vcpu_id != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(vcpu_id, &mask);
+		vcpu = vcpu_from_vid(vm, vcpu_id);
+		pcpu_id = pcpuid_from_vcpu(vcpu);
+		if ((get_pcpu_id() != pcpu_id) && (per_cpu(vmcs_run, pcpu_id) == vcpu->arch.vmcs)) {
+			bitmap_set_nolock(pcpu_id, &pdmask);
+		}
+		vcpu_id = ffs64(mask);
+	}
+
+	if (pdmask != 0UL) {
+		kick_pcpus(pdmask);
+	}
+}
+
 /*
  * @pre (&vcpu->stack[CONFIG_STACK_SIZE] & (CPU_STACK_ALIGN - 1UL)) == 0
  */
@@ -146,6 +146,53 @@ static uint16_t vm_apicid2vcpu_id(struct acrn_vm *vm, uint32_t lapicid)
 
 }
 
+/*
+ * Decode the logical destination of the vLAPIC from LDR and DFR, so that
+ * is_dest_field_matched() does not need to evaluate the logical model for
+ * each interrupt. It shall be called whenever LDR, DFR or the vLAPIC mode
+ * change.
+ */
+static void vlapic_update_ldest(struct acrn_vlapic *vlapic)
+{
+	const struct lapic_regs *lapic = &(vlapic->apic_page);
+	struct vlapic_ldest *ldest = &(vlapic->ldest);
+	uint32_t ldr = lapic->ldr.v;
+	uint32_t dfr = lapic->dfr.v;
+
+	if (is_x2apic_enabled(vlapic)) {
+		/* x2APIC only supports the "Cluster Model" */
+		ldest->logical_id = ldr & 0xFFFFU;
+		ldest->logical_mask = 0xFFFFU;
+		ldest->cluster_id = (ldr >> 16U) & 0xFFFFU;
+		ldest->cluster_mask = 0xFFFFU;
+		ldest->cluster_shift = 16U;
+	} else if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_FLAT) {
+		/*
+		 * In the "Flat Model" the MDA is interpreted as an 8-bit wide
+		 * bitmask. There is no cluster to compare against.
+		 */
+		ldest->logical_id = ldr >> 24U;
+		ldest->logical_mask = 0xffU;
+		ldest->cluster_id = 0U;
+		ldest->cluster_mask = 0U;
+		ldest->cluster_shift = 0U;
+	} else if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_CLUSTER) {
+		/*
+		 * In the "Cluster Model" the MDA is used to identify a
+		 * specific cluster and a set of APICs in that cluster.
+		 */
+		ldest->logical_id = (ldr >> 24U) & 0xfU;
+		ldest->logical_mask = 0xfU;
+		ldest->cluster_id = ldr >> 28U;
+		ldest->cluster_mask = 0xfU;
+		ldest->cluster_shift = 4U;
+	} else {
+		/* Guest has configured a bad logical model, never match it. */
+		dev_dbg(DBG_LEVEL_VLAPIC, "vlapic has bad logical model %x", dfr);
+		(void)memset(ldest, 0U, sizeof(struct vlapic_ldest));
+	}
+}
+
 static inline void vlapic_build_x2apic_id(struct acrn_vlapic *vlapic)
 {
 	struct lapic_regs *lapic;
@@ -156,6 +203,7 @@ static inline void vlapic_build_x2apic_id(struct acrn_vlapic *vlapic)
 	logical_id = lapic->id.v & LOGICAL_ID_MASK;
 	cluster_id = (lapic->id.v & CLUSTER_ID_MASK) >> 4U;
 	lapic->ldr.v = (cluster_id << 16U) | (1U << logical_id);
+	vlapic_update_ldest(vlapic);
 }
 
 static inline uint32_t vlapic_find_isrv(const struct acrn_vlapic *vlapic)
@@ -196,6 +244,8 @@ vlapic_write_dfr(struct acrn_vlapic *vlapic)
 	} else {
 		dev_dbg(DBG_LEVEL_VLAPIC, "DFR in Unknown Model %#x", lapic->dfr);
 	}
+
+	vlapic_update_ldest(vlapic);
 }
 
 static void
@@ -206,6 +256,8 @@ vlapic_write_ldr(struct acrn_vlapic *vlapic)
 	lapic = &(vlapic->apic_page);
 	lapic->ldr.v &= ~APIC_LDR_RESERVED;
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic LDR set to %#x", lapic->ldr);
+
+	vlapic_update_ldest(vlapic);
 }
 
 static inline uint32_t
@@ -477,11 +529,12 @@ vlapic_reset_tmr(struct acrn_vlapic *vlapic)
 	vcpu_reset_eoi_exit_bitmaps(vlapic2vcpu(vlapic));
 }
 
-static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+static bool apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
 	struct lapic_regs *lapic;
 	struct lapic_reg *irrptr;
 	uint32_t idx;
+	bool notify = false;
 
 	lapic = &(vlapic->apic_page);
 	idx = vector >> 5U;
@@ -491,12 +544,26 @@ static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector,
 	if (!bitmap32_test_and_set_lock((uint16_t)(vector & 0x1fU), &irrptr[idx].v)) {
 		/* update TMR if interrupt trigger mode has changed */
 		vlapic_set_tmr(vlapic, vector, level);
-		vcpu_make_request(vlapic2vcpu(vlapic), ACRN_REQUEST_EVENT);
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vlapic2vcpu(vlapic)->arch.pending_req);
+		notify = true;
 	}
+
+	return notify;
+}
+
+/*
+ * The kick is deferred to apicv_basic_notify_intr() so that the vCPUs
+ * targeted by one IPI/MSI are kicked together.
+ */
+static void apicv_basic_notify_intr(struct acrn_vm *vm, uint64_t vdmask)
+{
+	kick_vcpus(vm, vdmask);
 }
 
-static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+static bool apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
+	bool notify = false;
+
 	/* update TMR if interrupt trigger mode has changed */
 	vlapic_set_tmr(vlapic, vector, level);
 
@@ -511,30 +578,90 @@ static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vect
 		 * 2. If target vCPU is in non-root mode(running),
 		 *    send PI notification to vCPU and hardware will
 		 *    sync PIR to vIRR automatically.
+		 *    The notification is sent by apicv_advanced_notify_intr().
 		 */
 		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
+		notify = true;
+	}
 
-		if (get_pcpu_id() != pcpuid_from_vcpu(vcpu)) {
-			apicv_trigger_pi_anv(pcpuid_from_vcpu(vcpu), (uint32_t)vcpu->arch.pid.control.bits.nv);
-		}
+	return notify;
+}
+
+/*
+ * All the vCPUs of a VM share the same posted interrupt notification vector
+ * and never share a pCPU, so the notification can be sent to all the target
+ * pCPUs at once.
+ *
+ * @pre vdmask != 0UL
+ */
+static void apicv_advanced_notify_intr(struct acrn_vm *vm, uint64_t vdmask)
+{
+	struct acrn_vcpu *vcpu = vcpu_from_vid(vm, ffs64(vdmask));
+	uint64_t pdmask = vcpumask2pcpumask(vm, vdmask);
+
+	bitmap_clear_nolock(get_pcpu_id(), &pdmask);
+	if (pdmask != 0UL) {
+		send_dest_ipi_mask(pdmask, (uint32_t)vcpu->arch.pid.control.bits.nv);
 	}
 }
 
 /*
  * @pre vector >= 16
+ *
+ * @retval true if the pCPU hosting the vCPU has to be notified.
  */
-static void vlapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+static bool vlapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
 	struct lapic_regs *lapic;
+	bool notify = false;
 	ASSERT(vector <= NR_MAX_VECTOR, "invalid vector %u", vector);
 
 	lapic = &(vlapic->apic_page);
 	if ((lapic->svr.v & APIC_SVR_ENABLE) == 0U) {
 		dev_dbg(DBG_LEVEL_VLAPIC, "vlapic is software disabled, ignoring interrupt %u", vector);
 	} else {
-		vlapic->ops->accept_intr(vlapic, vector, level);
+		notify = vlapic->ops->accept_intr(vlapic, vector, level);
 		signal_event(&vlapic2vcpu(vlapic)->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
 	}
+
+	return notify;
+}
+
+/*
+ * Record 'vector' in the vLAPICs of all the vCPUs in 'vdmask' first, then
+ * notify the pCPUs hosting them in one go. So a multicast IPI or MSI costs
+ * at most one notification per pCPU cluster instead of one per vCPU.
+ *
+ * @pre vm != NULL
+ * @pre vector <= 255U
+ */
+static void vlapic_set_intr_mask(struct acrn_vm *vm, uint64_t vdmask, uint32_t vector, bool level)
+{
+	struct acrn_vlapic *vlapic;
+	const struct acrn_apicv_ops *ops = NULL;
+	uint64_t mask = vdmask, notify_mask = 0UL;
+	uint16_t vcpu_id;
+
+	vcpu_id = ffs64(mask);
+	while (vcpu_id != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(vcpu_id, &mask);
+		vlapic = vm_lapic_from_vcpu_id(vm, vcpu_id);
+		if (vector < 16U) {
+			vlapic_set_error(vlapic, APIC_ESR_RECEIVE_ILLEGAL_VECTOR);
+			dev_dbg(DBG_LEVEL_VLAPIC,
+			    "vlapic ignoring interrupt to vector %u", vector);
+		} else if (vlapic_accept_intr(vlapic, vector, level)) {
+			bitmap_set_nolock(vcpu_id, &notify_mask);
+			ops = vlapic->ops;
+		} else {
+			/* No notification needed */
+		}
+		vcpu_id = ffs64(mask);
+	}
+
+	if (ops != NULL) {
+		ops->notify_intr(vm, notify_mask);
+	}
 }
 
 /**
@@ -846,7 +973,7 @@ vlapic_set_error(struct acrn_vlapic *vlapic, uint32_t mask)
 		if ((lvt & APIC_LVT_M) == 0U) {
 			vec = lvt & APIC_LVT_VECTOR;
 			if (vec >= 16U) {
-				vlapic_accept_intr(vlapic, vec, LAPIC_TRIG_EDGE);
+				vlapic_set_intr(vlapic2vcpu(vlapic), vec, LAPIC_TRIG_EDGE);
 			}
 		}
 		vlapic->esr_firing = 0;
@@ -945,49 +1072,10 @@ static inline void set_dest_mask_phys(struct acrn_vm *vm, uint64_t *dmask, uint3
  */
 static inline bool is_dest_field_matched(const struct acrn_vlapic *vlapic, uint32_t dest)
 {
-	uint32_t logical_id, cluster_id, dest_logical_id, dest_cluster_id;
-	uint32_t ldr = vlapic->apic_page.ldr.v;
-	bool ret = false;
+	const struct vlapic_ldest *ldest = &(vlapic->ldest);
 
-	if (is_x2apic_enabled(vlapic)) {
-		logical_id = ldr & 0xFFFFU;
-		cluster_id = (ldr >> 16U) & 0xFFFFU;
-		dest_logical_id = dest & 0xFFFFU;
-		dest_cluster_id = (dest >> 16U) & 0xFFFFU;
-		if ((cluster_id == dest_cluster_id) && ((logical_id & dest_logical_id) != 0U)) {
-			ret = true;
-		}
-	} else {
-		uint32_t dfr = vlapic->apic_page.dfr.v;
-		if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_FLAT) {
-			/*
-			 * In the "Flat Model" the MDA is interpreted as an 8-bit wide
-			 * bitmask. This model is available in the xAPIC mode only.
-			 */
-			logical_id = ldr >> 24U;
-			dest_logical_id = dest & 0xffU;
-			if ((logical_id & dest_logical_id) != 0U) {
-				ret = true;
-			}
-		} else if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_CLUSTER) {
-			/*
-			 * In the "Cluster Model" the MDA is used to identify a
-			 * specific cluster and a set of APICs in that cluster.
-			 */
-			logical_id = (ldr >> 24U) & 0xfU;
-			cluster_id = ldr >> 28U;
-			dest_logical_id = dest & 0xfU;
-			dest_cluster_id = (dest >> 4U) & 0xfU;
-			if ((cluster_id == dest_cluster_id) && ((logical_id & dest_logical_id) != 0U)) {
-				ret = true;
-			}
-		} else {
-			/* Guest has configured a bad logical model for this vcpu. */
-			dev_dbg(DBG_LEVEL_VLAPIC, "vlapic has bad logical model %x", dfr);
-		}
-	}
-
-	return ret;
+	return ((((dest >> ldest->cluster_shift) & ldest->cluster_mask) == ldest->cluster_id) &&
+			((dest & ldest->logical_mask & ldest->logical_id) != 0U));
 }
 
 /*
@@ -1170,16 +1258,20 @@ static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 
 		dmask = vlapic_calc_dest(vcpu, shorthand, is_broadcast, dest, phys, false);
 
-		for (vcpu_id = 0U; vcpu_id < vcpu->vm->hw.created_vcpus; vcpu_id++) {
-			if ((dmask & (1UL << vcpu_id)) != 0UL) {
+		if (mode == APIC_DELMODE_FIXED) {
+			/* deliver to all the destinations at once, see vlapic_set_intr_mask() */
+			if (dmask != 0UL) {
+				vlapic_set_intr_mask(vcpu->vm, dmask, vec, LAPIC_TRIG_EDGE);
+			}
+			dev_dbg(DBG_LEVEL_VLAPIC,
+				"vlapic sending ipi %u to vcpu mask 0x%lx", vec, dmask);
+		} else {
+			vcpu_id = ffs64(dmask);
+			while (vcpu_id != INVALID_BIT_INDEX) {
+				bitmap_clear_nolock(vcpu_id, &dmask);
 				target_vcpu = vcpu_from_vid(vcpu->vm, vcpu_id);
 
-				if (mode == APIC_DELMODE_FIXED) {
-					vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
-					dev_dbg(DBG_LEVEL_VLAPIC,
-						"vlapic sending ipi %u to vcpu_id %hu",
-						vec, vcpu_id);
-				} else if (mode == APIC_DELMODE_NMI) {
+				if (mode == APIC_DELMODE_NMI) {
 					vcpu_inject_nmi(target_vcpu);
 					dev_dbg(DBG_LEVEL_VLAPIC,
 						"vlapic send ipi nmi to vcpu_id %hu", vcpu_id);
@@ -1192,6 +1284,7 @@ static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 				} else {
 					pr_err("Unhandled icrlo write with mode %u\n", mode);
 				}
+				vcpu_id = ffs64(dmask);
 			}
 		}
 	}
@@ -1585,6 +1678,7 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	lapic->version.v = VLAPIC_VERSION;
 	lapic->version.v |= (VLAPIC_MAXLVT_INDEX << MAXLVTSHIFT);
 	lapic->dfr.v = 0xffffffffU;
+	vlapic_update_ldest(vlapic);
 	lapic->svr.v = APIC_SVR_VECTOR;
 	vlapic_mask_lvts(vlapic);
 	vlapic_reset_tmr(vlapic);
@@ -1613,6 +1707,7 @@ void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
 	lapic->ppr = regs->ppr;
 	lapic->ldr = regs->ldr;
 	lapic->dfr = regs->dfr;
+	vlapic_update_ldest(vlapic);
 	for (i = 0; i < 8; i++) {
 		lapic->tmr[i].v = regs->tmr[i].v;
 	}
@@ -1633,10 +1728,16 @@ uint64_t vlapic_get_apicbase(const struct acrn_vlapic *vlapic)
 	return vlapic->msr_apicbase;
 }
 
-static void ptapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, __unused bool level)
+static bool ptapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, __unused bool level)
 {
 	pr_err("Invalid op %s, VM%u, vCPU%u, vector %u", __func__,
 			vlapic2vcpu(vlapic)->vm->vm_id, vlapic2vcpu(vlapic)->vcpu_id, vector);
+	return false;
+}
+
+static void ptapic_notify_intr(struct acrn_vm *vm, __unused uint64_t vdmask)
+{
+	pr_err("Invalid op %s, VM%u", __func__, vm->vm_id);
 }
 
 static void ptapic_inject_intr(struct acrn_vlapic *vlapic,
@@ -1662,6 +1763,7 @@ static bool ptapic_invalid(__unused uint32_t offset)
 
 static const struct acrn_apicv_ops ptapic_ops = {
 	.accept_intr = ptapic_accept_intr,
+	.notify_intr = ptapic_notify_intr,
 	.inject_intr = ptapic_inject_intr,
 	.has_pending_delivery_intr = ptapic_has_pending_delivery_intr,
 	.has_pending_intr = ptapic_has_pending_intr,
@@ -1725,7 +1827,7 @@ vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest, bool phys,
 {
 	bool lowprio;
 	uint16_t vcpu_id;
-	uint64_t dmask;
+	uint64_t dmask, intr_mask = 0UL;
 	struct acrn_vcpu *target_vcpu;
 
 	if ((delmode != IOAPIC_RTE_DELMODE_FIXED) &&
@@ -1743,21 +1845,24 @@ vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest, bool phys,
 		 */
 		dmask = vlapic_calc_dest_noshort(vm, false, dest, phys, lowprio);
 
-		for (vcpu_id = 0U; vcpu_id < vm->hw.created_vcpus; vcpu_id++) {
-			struct acrn_vlapic *vlapic;
-			if ((dmask & (1UL << vcpu_id)) != 0UL) {
-				target_vcpu = vcpu_from_vid(vm, vcpu_id);
-
-				/* only make request when vlapic enabled */
-				vlapic = vcpu_vlapic(target_vcpu);
-				if (vlapic_enabled(vlapic)) {
-					if (delmode == IOAPIC_RTE_DELMODE_EXINT) {
-						vcpu_inject_extint(target_vcpu);
-					} else {
-						vlapic_set_intr(target_vcpu, vec, level);
-					}
+		vcpu_id = ffs64(dmask);
+		while (vcpu_id != INVALID_BIT_INDEX) {
+			bitmap_clear_nolock(vcpu_id, &dmask);
+			target_vcpu = vcpu_from_vid(vm, vcpu_id);
+
+			/* only make request when vlapic enabled */
+			if (vlapic_enabled(vcpu_vlapic(target_vcpu))) {
+				if (delmode == IOAPIC_RTE_DELMODE_EXINT) {
+					vcpu_inject_extint(target_vcpu);
+				} else {
+					bitmap_set_nolock(vcpu_id, &intr_mask);
 				}
 			}
+			vcpu_id = ffs64(dmask);
+		}
+
+		if (intr_mask != 0UL) {
+			vlapic_set_intr_mask(vm, intr_mask, vec, level);
 		}
 	}
 }
@@ -1769,16 +1874,7 @@ vlapic_receive_intr(struct acrn_vm *vm, bool level, uint32_t dest, bool phys,
 void
 vlapic_set_intr(struct acrn_vcpu *vcpu, uint32_t vector, bool level)
 {
-	struct acrn_vlapic *vlapic;
-
-	vlapic = vcpu_vlapic(vcpu);
-	if (vector < 16U) {
-		vlapic_set_error(vlapic, APIC_ESR_RECEIVE_ILLEGAL_VECTOR);
-		dev_dbg(DBG_LEVEL_VLAPIC,
-		    "vlapic ignoring interrupt to vector %u", vector);
-	} else {
-		vlapic_accept_intr(vlapic, vector, level);
-	}
+	vlapic_set_intr_mask(vcpu->vm, 1UL << vcpu->vcpu_id, vector, level);
 }
 
 /**
@@ -2583,6 +2679,7 @@ int32_t tpr_below_threshold_vmexit_handler(struct acrn_vcpu *vcpu)
 
 static const struct acrn_apicv_ops apicv_basic_ops = {
 	.accept_intr = apicv_basic_accept_intr,
+	.notify_intr = apicv_basic_notify_intr,
 	.inject_intr = apicv_basic_inject_intr,
 	.has_pending_delivery_intr = apicv_basic_has_pending_delivery_intr,
 	.has_pending_intr = apicv_basic_has_pending_intr,
@@ -2594,6 +2691,7 @@ static const struct acrn_apicv_ops apicv_basic_ops = {
 
 static const struct acrn_apicv_ops apicv_advanced_ops = {
 	.accept_intr = apicv_advanced_accept_intr,
+	.notify_intr = apicv_advanced_notify_intr,
 	.inject_intr = apicv_advanced_inject_intr,
 	.has_pending_delivery_intr = apicv_advanced_has_pending_delivery_intr,
 	.has_pending_intr = apicv_advanced_has_pending_intr,
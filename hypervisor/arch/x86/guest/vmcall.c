@@ -98,6 +98,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_profiling_ops},
 	[HC_IDX(HC_GET_HW_INFO)] = {
 		.handler = hcall_get_hw_info},
+	[HC_IDX(HC_VMEXIT_STAT_OPS)] = {
+		.handler = hcall_vmexit_stat_ops},
 	[HC_IDX(HC_INITIALIZE_TRUSTY)] = {
 		.handler = hcall_initialize_trusty,
 		.permission_flags = GUEST_FLAG_SECURE_WORLD_ENABLED},
@@ -188,6 +190,7 @@ struct acrn_vm *parse_target_vm(struct acrn_vm *service_vm, uint64_t hcall_id, u
 	case HC_SETUP_HV_NPK_LOG:
 	case HC_PROFILING_OPS:
 	case HC_GET_HW_INFO:
+	case HC_VMEXIT_STAT_OPS:
 		target_vm = service_vm;
 		break;
 	default:
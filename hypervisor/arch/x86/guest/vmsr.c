@@ -368,6 +368,84 @@ static void intercept_x2apic_msrs(uint8_t *msr_bitmap_arg, uint32_t mode)
 	}
 }
 
+/*
+ * MSRs whose read interception is dropped at runtime once a vCPU has read them
+ * MSR_RELAX_THRESHOLD times. rdmsr_vmexit_handler() emulates these reads by
+ * reading the physical MSR on the same pCPU, so a direct guest read is
+ * equivalent as long as is_safe() holds for the VM. Writes stay intercepted.
+ */
+#define MSR_RELAX_THRESHOLD	256UL
+
+struct msr_relax_policy {
+	uint32_t msr;
+	bool (*is_safe)(const struct acrn_vm *vm);
+};
+
+static const struct msr_relax_policy msr_relax_policies[] = {
+	{ MSR_IA32_MPERF, is_vhwp_configured },
+	{ MSR_IA32_APERF, is_vhwp_configured },
+	{ MSR_IA32_PERF_STATUS, is_vhwp_configured },
+	{ MSR_IA32_HWP_STATUS, is_vhwp_configured },
+	{ MSR_IA32_HWP_REQUEST, is_vhwp_configured },
+	{ MSR_IA32_THERM_STATUS, is_vtm_configured },
+	{ MSR_IA32_PACKAGE_THERM_STATUS, is_vtm_configured },
+};
+
+static void relax_msr_interception(struct acrn_vcpu *vcpu, struct msr_exit_stat *stat)
+{
+	uint32_t i;
+
+	for (i = 0U; i < ARRAY_SIZE(msr_relax_policies); i++) {
+		if (msr_relax_policies[i].msr == stat->msr) {
+			if (msr_relax_policies[i].is_safe(vcpu->vm)) {
+				enable_msr_interception(vcpu->arch.msr_bitmap, stat->msr, INTERCEPT_WRITE);
+				stat->read_relaxed = true;
+				pr_dbg("vm%u vcpu%u: stop intercepting reads of MSR 0x%x",
+					vcpu->vm->vm_id, vcpu->vcpu_id, stat->msr);
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Count one RDMSR/WRMSR VM exit of msr in the per-vCPU profile, an open
+ * addressing table looked up with a short linear probe.
+ */
+static void profile_msr_exit(struct acrn_vcpu *vcpu, uint32_t msr, bool is_write)
+{
+	struct msr_exit_profile *prof = &vcpu->arch.msr_prof;
+	struct msr_exit_stat *stat = NULL;
+	uint32_t i, idx = (msr * 0x9E3779B9U) >> 27U;
+
+	for (i = 0U; i < 4U; i++) {
+		struct msr_exit_stat *entry = &prof->entries[(idx + i) & (MSR_EXIT_STAT_ENTRIES - 1U)];
+
+		if (!entry->used) {
+			entry->used = true;
+			entry->msr = msr;
+			stat = entry;
+			break;
+		} else if (entry->msr == msr) {
+			stat = entry;
+			break;
+		} else {
+			/* entry used by another MSR, probe the next one */
+		}
+	}
+
+	if (stat == NULL) {
+		prof->untracked++;
+	} else if (is_write) {
+		stat->wr_cnt++;
+	} else {
+		stat->rd_cnt++;
+		if ((stat->rd_cnt == MSR_RELAX_THRESHOLD) && !stat->read_relaxed) {
+			relax_msr_interception(vcpu, stat);
+		}
+	}
+}
+
 /**
  * @pre vcpu != NULL && vcpu->vm != NULL && vcpu->vm->vm_id < CONFIG_MAX_VM_NUM
  * @pre (is_platform_rdt_capable() == false()) || (is_platform_rdt_capable() && get_vm_config(vcpu->vm->vm_id)->pclosids != NULL)
@@ -520,6 +598,8 @@ void init_msr_emulation(struct acrn_vcpu *vcpu)
 	uint32_t msr, i;
 	uint64_t value64;
 
+	(void)memset((void *)&vcpu->arch.msr_prof, 0U, sizeof(vcpu->arch.msr_prof));
+
 	for (i = 0U; i < NUM_EMULATED_MSRS; i++) {
 		enable_msr_interception(msr_bitmap, emulated_guest_msrs[i], INTERCEPT_READ_WRITE);
 	}
@@ -637,18 +717,80 @@ bool is_ecmd_supported(struct acrn_vcpu *vcpu)
 	return (eax & CPUID_EAX_ECMD) == CPUID_EAX_ECMD;
 }
 
+/*
+ * The hottest intercepted MSRs are dispatched through a small perfect hash
+ * table before falling back to the switch statements of emulate_rdmsr() and
+ * emulate_wrmsr(). HOT_MSR_HASH() maps every MSR below to a distinct slot; a
+ * collision would override an initializer of hot_msrs[], which the build
+ * rejects (-Woverride-init).
+ */
+#define HOT_MSR_SLOTS		8U
+#define HOT_MSR_HASH(msr)	((((msr) >> 4U) ^ ((msr) >> 28U)) & (HOT_MSR_SLOTS - 1U))
+
+struct hot_msr_dispatch {
+	uint32_t msr;
+	int32_t (*read)(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val);
+	int32_t (*write)(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
+};
+
+static int32_t read_tsc_deadline(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t *val)
+{
+	*val = vlapic_get_tsc_deadline_msr(vcpu_vlapic(vcpu));
+	return 0;
+}
+
+static int32_t write_tsc_deadline(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t val)
+{
+	vlapic_set_tsc_deadline_msr(vcpu_vlapic(vcpu), val);
+	return 0;
+}
+
+static int32_t read_efer(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t *val)
+{
+	*val = vcpu_get_efer(vcpu);
+	return 0;
+}
+
+static int32_t write_efer(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t val)
+{
+	vcpu_set_efer(vcpu, val);
+	return 0;
+}
+
+static const struct hot_msr_dispatch hot_msrs[HOT_MSR_SLOTS] = {
+	[HOT_MSR_HASH(MSR_IA32_TSC_DEADLINE)] = {
+		.msr = MSR_IA32_TSC_DEADLINE,
+		.read = read_tsc_deadline,
+		.write = write_tsc_deadline},
+	[HOT_MSR_HASH(MSR_IA32_EXT_APIC_ICR)] = {
+		.msr = MSR_IA32_EXT_APIC_ICR,
+		.read = vlapic_x2apic_read,
+		.write = vlapic_x2apic_write},
+	[HOT_MSR_HASH(MSR_IA32_EXT_APIC_EOI)] = {
+		.msr = MSR_IA32_EXT_APIC_EOI,
+		.read = vlapic_x2apic_read,
+		.write = vlapic_x2apic_write},
+	[HOT_MSR_HASH(MSR_IA32_EFER)] = {
+		.msr = MSR_IA32_EFER,
+		.read = read_efer,
+		.write = write_efer},
+};
+
+static inline const struct hot_msr_dispatch *find_hot_msr(uint32_t msr)
+{
+	const struct hot_msr_dispatch *hot = &hot_msrs[HOT_MSR_HASH(msr)];
+
+	return ((hot->read != NULL) && (hot->msr == msr)) ? hot : NULL;
+}
+
 /**
  * @pre vcpu != NULL
  */
-int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+static int32_t emulate_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
 {
 	int32_t err = 0;
-	uint32_t msr;
 	uint64_t v = 0UL;
 
-	/* Read the msr value */
-	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
-
 	/* Do the required processing for each msr case */
 	switch (msr) {
 #ifdef CONFIG_HYPERV_ENABLED
@@ -878,6 +1020,31 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	}
 	}
 
+	*val = v;
+	return err;
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	const struct hot_msr_dispatch *hot;
+	int32_t err;
+	uint32_t msr;
+	uint64_t v = 0UL;
+
+	/* Read the msr value */
+	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	profile_msr_exit(vcpu, msr, false);
+
+	hot = find_hot_msr(msr);
+	if (hot != NULL) {
+		err = hot->read(vcpu, msr, &v);
+	} else {
+		err = emulate_rdmsr(vcpu, msr, &v);
+	}
+
 	if (err == 0) {
 		/* Store the MSR contents in RAX and RDX */
 		vcpu_set_gpreg(vcpu, CPU_REG_RAX, v & 0xffffffffU);
@@ -1034,18 +1201,9 @@ static void set_guest_ia32_misc_enalbe(struct acrn_vcpu *vcpu, uint64_t v)
 /**
  * @pre vcpu != NULL
  */
-int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+static int32_t emulate_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t v)
 {
 	int32_t err = 0;
-	uint32_t msr;
-	uint64_t v;
-
-	/* Read the MSR ID */
-	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
-
-	/* Get the MSR contents */
-	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
-		vcpu_get_gpreg(vcpu, CPU_REG_RAX);
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
@@ -1354,6 +1512,34 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	}
 	}
 
+	return err;
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	const struct hot_msr_dispatch *hot;
+	int32_t err;
+	uint32_t msr;
+	uint64_t v;
+
+	/* Read the MSR ID */
+	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	profile_msr_exit(vcpu, msr, true);
+
+	/* Get the MSR contents */
+	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
+		vcpu_get_gpreg(vcpu, CPU_REG_RAX);
+
+	hot = find_hot_msr(msr);
+	if (hot != NULL) {
+		err = hot->write(vcpu, msr, v);
+	} else {
+		err = emulate_wrmsr(vcpu, msr, v);
+	}
+
 	TRACE_2L(TRACE_VMEXIT_WRMSR, msr, v);
 
 	return err;
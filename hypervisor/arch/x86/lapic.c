@@ -240,15 +240,38 @@ send_startup_ipi(uint16_t dest_pcpu_id, uint64_t cpu_startup_start_address)
 	msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
 }
 
-void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector)
+void send_dest_ipi_mask(uint64_t dest_mask, uint32_t vector)
 {
-	uint16_t pcpu_id;
-	uint32_t mask = dest_mask;
+	union apic_icr icr;
+	uint16_t pcpu_id, i;
+	uint32_t cluster_id;
+	uint64_t mask = dest_mask;
 
 	pcpu_id = ffs64(mask);
 	while (pcpu_id < MAX_PCPU_NUM) {
-		bitmap32_clear_nolock(pcpu_id, &mask);
-		send_single_ipi(pcpu_id, vector);
+		cluster_id = per_cpu(lapic_ldr, pcpu_id) & X2APIC_LDR_CLUSTER_ID_MASK;
+
+		icr.value = 0UL;
+		icr.bits.vector = (uint8_t)vector;
+		icr.bits.delivery_mode = INTR_LAPIC_ICR_FIXED;
+		icr.bits.destination_mode = INTR_LAPIC_ICR_LOGICAL;
+		icr.bits.dest_field = cluster_id;
+
+		for (i = pcpu_id; i < MAX_PCPU_NUM; i++) {
+			if (bitmap_test(i, &mask) &&
+				((per_cpu(lapic_ldr, i) & X2APIC_LDR_CLUSTER_ID_MASK) == cluster_id)) {
+				bitmap_clear_nolock(i, &mask);
+				if (is_pcpu_active(i)) {
+					icr.bits.dest_field |= per_cpu(lapic_ldr, i) & X2APIC_LDR_LOGICAL_ID_MASK;
+				} else {
+					pr_err("pcpu_id %d not in active!", i);
+				}
+			}
+		}
+
+		if ((icr.bits.dest_field & X2APIC_LDR_LOGICAL_ID_MASK) != 0U) {
+			msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
+		}
 		pcpu_id = ffs64(mask);
 	}
 }
@@ -302,3 +325,22 @@ void kick_pcpu(uint16_t pcpu_id)
 		send_single_ipi(pcpu_id, NOTIFY_VCPU_VECTOR);
 	}
 }
+
+void kick_pcpus(uint64_t pcpu_mask)
+{
+	uint16_t pcpu_id;
+	uint64_t mask = pcpu_mask, ipi_mask = 0UL;
+
+	pcpu_id = ffs64(mask);
+	while (pcpu_id < MAX_PCPU_NUM) {
+		bitmap_clear_nolock(pcpu_id, &mask);
+		if (per_cpu(mode_to_kick_pcpu, pcpu_id) == DEL_MODE_INIT) {
+			send_single_init(pcpu_id);
+		} else {
+			bitmap_set_nolock(pcpu_id, &ipi_mask);
+		}
+		pcpu_id = ffs64(mask);
+	}
+
+	send_dest_ipi_mask(ipi_mask, NOTIFY_VCPU_VECTOR);
+}
@@ -11,6 +11,7 @@
 #include <asm/guest/virq.h>
 #include <schedule.h>
 #include <profiling.h>
+#include <vmexit_stat.h>
 #include <sprintf.h>
 #include <trace.h>
 #include <logmsg.h>
@@ -43,6 +44,7 @@ void vcpu_thread(struct thread_object *obj)
 
 		reset_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
 		profiling_vmenter_handler(vcpu);
+		vmexit_stat_on_entry(vcpu);
 
 		TRACE_2L(TRACE_VM_ENTER, 0UL, 0UL);
 		ret = run_vcpu(vcpu);
@@ -55,6 +57,7 @@ void vcpu_thread(struct thread_object *obj)
 			continue;
 		}
 		TRACE_2L(TRACE_VM_EXIT, vcpu->arch.exit_reason, vcpu_get_rip(vcpu));
+		vmexit_stat_on_exit(vcpu);
 
 		profiling_pre_vmexit_handler(vcpu);
 
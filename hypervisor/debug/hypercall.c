@@ -12,6 +12,7 @@
 #include <npk_log.h>
 #include <asm/guest/vm.h>
 #include <logmsg.h>
+#include <vmexit_stat.h>
 
 #ifdef PROFILING_ON
 /**
@@ -116,3 +117,41 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, __unused struct acrn_vm *targe
 	hw_info.cpu_num = get_pcpu_nums();
 	return copy_to_gpa(vcpu->vm, &hw_info, param1, sizeof(hw_info));
 }
+
+/**
+ * @brief Control and query the VM exit statistics
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param param1 VMEXIT_STAT_* command to be executed
+ * @param param2 guest physical address pointing to struct acrn_vmexit_stat,
+ *              only used by VMEXIT_STAT_GET
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vmexit_stat_ops(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2)
+{
+	int32_t ret = 0;
+
+	switch (param1) {
+	case VMEXIT_STAT_DISABLE:
+		vmexit_stat_set_enable(false);
+		break;
+	case VMEXIT_STAT_ENABLE:
+		vmexit_stat_set_enable(true);
+		break;
+	case VMEXIT_STAT_RESET:
+		vmexit_stat_reset();
+		break;
+	case VMEXIT_STAT_GET:
+		ret = vmexit_stat_copy_to_guest(vcpu->vm, param2);
+		break;
+	default:
+		pr_err("%s: invalid vmexit stat command %lu\n", __func__, param1);
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
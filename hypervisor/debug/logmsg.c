@@ -12,15 +12,35 @@
 #include <npk_log.h>
 #include <logmsg.h>
 #include <ticks.h>
+#include <asm/tsc.h>
 
 /* buf size should be identical to the size in hvlog option, which is
  * transfered to Service VM:
  * bsp/uefi/clearlinux/acrn.conf: hvlog=2M@0x1FE00000
  */
 
+/* Formats logged to memory in binary, see struct log_bin_hdr */
+#define LOG_FMT_MAX_ARGS	12U
+#define LOG_FMT_TEXT		0xFFU	/* nr_args of a format that is logged as text */
+
+#define LOG_ARG_U32		1U
+#define LOG_ARG_U64		2U
+#define LOG_ARG_STR		3U
+
+struct logmsg_fmt {
+	const char *fmt;	/* set last, once the entry is complete */
+	uint16_t id;
+	uint8_t nr_args;
+	uint8_t arg_type[LOG_FMT_MAX_ARGS];
+};
+
 struct acrn_logmsg_ctl {
 	int32_t seq;
 	spinlock_t lock;
+
+	spinlock_t fmt_lock;
+	uint16_t nr_fmts;
+	struct logmsg_fmt fmts[LOG_FMT_TABLE_SIZE];
 };
 
 static struct acrn_logmsg_ctl logmsg_ctl;
@@ -30,6 +50,245 @@ void init_logmsg()
 	logmsg_ctl.seq = 0;
 
 	spinlock_init(&(logmsg_ctl.lock));
+	spinlock_init(&(logmsg_ctl.fmt_lock));
+}
+
+/*
+ * Get the type of the arguments of fmt, following the conversions supported
+ * by do_print(). Return false if fmt can't be logged in binary.
+ */
+static bool parse_log_fmt(const char *fmt_arg, struct logmsg_fmt *entry)
+{
+	const char *fmt = fmt_arg;
+	bool is_long, ret = true;
+	uint8_t type;
+	char ch;
+
+	entry->nr_args = 0U;
+	while ((*fmt != '\0') && ret) {
+		if (*fmt != '%') {
+			fmt++;
+			continue;
+		}
+		fmt++;
+
+		/* flags, width and precision */
+		while ((*fmt == '#') || (*fmt == '0') || (*fmt == '-') || (*fmt == ' ') || (*fmt == '+')) {
+			fmt++;
+		}
+		while (((*fmt >= '0') && (*fmt <= '9')) || (*fmt == '.')) {
+			fmt++;
+		}
+
+		/* length modifier, 'h' and 'hh' still pass 32-bit arguments */
+		is_long = (*fmt == 'l');
+		while ((*fmt == 'h') || (*fmt == 'l')) {
+			fmt++;
+		}
+
+		ch = *fmt;
+		if (ch != '\0') {
+			fmt++;
+		}
+
+		if ((ch == 'd') || (ch == 'i') || (ch == 'u') || (ch == 'x') || (ch == 'X')) {
+			type = is_long ? LOG_ARG_U64 : LOG_ARG_U32;
+		} else if (ch == 'c') {
+			type = LOG_ARG_U32;
+		} else if (ch == 's') {
+			type = LOG_ARG_STR;
+		} else {
+			/* '%%' or a specifier printed as it is */
+			type = 0U;
+		}
+
+		if (type != 0U) {
+			if (entry->nr_args < LOG_FMT_MAX_ARGS) {
+				entry->arg_type[entry->nr_args] = type;
+				entry->nr_args++;
+			} else {
+				ret = false;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static void fill_log_bin_hdr(struct log_bin_hdr *hdr, uint8_t type, uint32_t severity, uint16_t pcpu_id,
+		uint32_t seq, uint64_t tsc, const struct thread_object *current)
+{
+	hdr->magic = LOG_BIN_MAGIC;
+	hdr->type = type;
+	hdr->severity = (uint8_t)severity;
+	hdr->reserved = 0U;
+	hdr->pcpu_id = pcpu_id;
+	hdr->seq = seq;
+	hdr->tsc = tsc;
+	hdr->tsc_khz = get_tsc_khz();
+	hdr->reserved2 = 0U;
+	(void)memcpy_s(hdr->thread, sizeof(hdr->thread), current->name, sizeof(hdr->thread));
+	hdr->thread[sizeof(hdr->thread) - 1U] = '\0';
+}
+
+/*
+ * Put size bytes of buffer to the hvlog sbuf of pcpu_id and account them in
+ * its write position. Return true if all of them were put.
+ */
+static bool put_log_sbuf(uint16_t pcpu_id, struct shared_buf *sbuf, char *buffer, uint32_t size)
+{
+	uint32_t sent = sbuf_put_many(sbuf, LOG_ENTRY_SIZE, (uint8_t *)buffer, size);
+
+	if (sent != UINT32_MAX) {
+		per_cpu(log_wr, pcpu_id) += sent;
+	}
+	return (sent == size);
+}
+
+/* Put the record of buffer, made of a struct log_bin_hdr and its payload, to sbuf */
+static bool put_log_bin(uint16_t pcpu_id, struct shared_buf *sbuf, char *buffer)
+{
+	struct log_bin_hdr *hdr = (struct log_bin_hdr *)buffer;
+	uint32_t size = INT_DIV_ROUNDUP(sizeof(*hdr) + hdr->payload_len, LOG_ENTRY_SIZE) * LOG_ENTRY_SIZE;
+
+	hdr->nr_entries = (uint8_t)(size / LOG_ENTRY_SIZE);
+	return put_log_sbuf(pcpu_id, sbuf, buffer, size);
+}
+
+/*
+ * Find the entry of fmt and register it if it is new. Return NULL if the
+ * message has to be logged as text.
+ *
+ * Lookups are lock free: an entry is published by setting its fmt, after
+ * the entry is complete.
+ */
+static const struct logmsg_fmt *get_log_fmt(const char *fmt)
+{
+	struct logmsg_fmt *entry, *found = NULL;
+	uint32_t idx, i;
+	size_t len;
+	uint64_t rflags;
+
+	idx = (uint32_t)(((uint64_t)fmt * 0x9E3779B97F4A7C15UL) >> 55U);
+	for (i = 0U; i < LOG_FMT_TABLE_SIZE; i++) {
+		entry = &logmsg_ctl.fmts[(idx + i) % LOG_FMT_TABLE_SIZE];
+		if (entry->fmt == NULL) {
+			spinlock_irqsave_obtain(&(logmsg_ctl.fmt_lock), &rflags);
+			/* recheck, it might be registered by another pcpu meanwhile */
+			if (entry->fmt == NULL) {
+				len = strnlen_s(fmt, LOG_BIN_PAYLOAD_MAX);
+				if (!parse_log_fmt(fmt, entry) || (len >= LOG_BIN_PAYLOAD_MAX)) {
+					entry->nr_args = LOG_FMT_TEXT;
+				} else {
+					entry->id = logmsg_ctl.nr_fmts;
+					logmsg_ctl.nr_fmts++;
+				}
+				cpu_compiler_barrier();
+				entry->fmt = fmt;
+			}
+			spinlock_irqrestore_release(&(logmsg_ctl.fmt_lock), rflags);
+		}
+
+		if (entry->fmt == fmt) {
+			found = entry;
+			break;
+		}
+		/* collision, probe the next entry */
+	}
+
+	return ((found != NULL) && (found->nr_args != LOG_FMT_TEXT)) ? found : NULL;
+}
+
+/*
+ * Make sure the LOG_REC_FMT record of entry is in sbuf ahead of the message
+ * about to be put. It is put again whenever the reader consumed the previous
+ * one (sbuf head moved past it) or it was overwritten: a restarted acrnlog,
+ * or the dump of the last boot, then still finds the format of every message
+ * left in the sbuf. Return false if the record couldn't be put.
+ */
+static bool put_log_fmt(const struct logmsg_fmt *entry, struct shared_buf *sbuf, char *buffer,
+		uint32_t severity, uint16_t pcpu_id, uint32_t seq, uint64_t tsc, const struct thread_object *current)
+{
+	struct log_bin_hdr *hdr = (struct log_bin_hdr *)buffer;
+	uint64_t *pos = &per_cpu(log_fmt_pos, pcpu_id)[entry->id];
+	uint64_t wr = per_cpu(log_wr, pcpu_id);
+	uint32_t used;
+	size_t len;
+	bool ret = true;
+
+	/* the reader moves head concurrently, it only goes forward */
+	stac();
+	used = (sbuf->tail + sbuf->size - sbuf->head) % sbuf->size;
+	clac();
+
+	/* pos is 1 + the position of the last record, 0 if there is none */
+	if (*pos <= (wr - used)) {
+		len = strnlen_s(entry->fmt, LOG_BIN_PAYLOAD_MAX);
+		fill_log_bin_hdr(hdr, LOG_REC_FMT, severity, pcpu_id, seq, tsc, current);
+		hdr->fmt_id = entry->id;
+		hdr->payload_len = (uint16_t)(len + 1U);
+		(void)memcpy_s(buffer + sizeof(*hdr), LOG_BIN_PAYLOAD_MAX, entry->fmt, len + 1U);
+		ret = put_log_bin(pcpu_id, sbuf, buffer);
+		*pos = ret ? (wr + 1UL) : 0UL;
+	}
+
+	return ret;
+}
+
+/* Encode args to the payload of a LOG_REC_MSG, drop the arguments that don't fit */
+static uint16_t encode_log_args(const struct logmsg_fmt *entry, char *payload, va_list args)
+{
+	uint32_t len = 0U, i, v32;
+	uint64_t v64;
+	const char *str;
+	size_t slen;
+
+	for (i = 0U; i < entry->nr_args; i++) {
+		if (entry->arg_type[i] == LOG_ARG_U32) {
+			v32 = __builtin_va_arg(args, uint32_t);
+			if ((len + sizeof(v32)) > LOG_BIN_PAYLOAD_MAX) {
+				break;
+			}
+			(void)memcpy_s(payload + len, sizeof(v32), &v32, sizeof(v32));
+			len += sizeof(v32);
+		} else if (entry->arg_type[i] == LOG_ARG_U64) {
+			v64 = __builtin_va_arg(args, uint64_t);
+			if ((len + sizeof(v64)) > LOG_BIN_PAYLOAD_MAX) {
+				break;
+			}
+			(void)memcpy_s(payload + len, sizeof(v64), &v64, sizeof(v64));
+			len += sizeof(v64);
+		} else {
+			str = __builtin_va_arg(args, const char *);
+			if (str == NULL) {
+				str = "(null)";
+			}
+			if (len >= LOG_BIN_PAYLOAD_MAX) {
+				break;
+			}
+			/* truncate the string to the room left */
+			slen = strnlen_s(str, LOG_BIN_PAYLOAD_MAX - len - 1U);
+			(void)memcpy_s(payload + len, slen, str, slen);
+			payload[len + slen] = '\0';
+			len += slen + 1U;
+		}
+	}
+
+	return (uint16_t)len;
+}
+
+static void format_log_text(char *buffer, uint32_t severity, uint16_t pcpu_id, int32_t seq, uint64_t tsc,
+		const struct thread_object *current, const char *fmt, va_list args)
+{
+	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
+	/* Put time-stamp, CPU ID and severity into buffer */
+	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%luus][cpu=%hu][%s][sev=%u][seq=%u]:",
+			ticks_to_us(tsc), pcpu_id, current->name, severity, seq);
+
+	/* Put message into remaining portion of local buffer */
+	vsnprintf(buffer + strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE),
+		LOG_MESSAGE_MAX_SIZE
+		- strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), fmt, args);
 }
 
 void do_logmsg(uint32_t severity, const char *fmt, ...)
@@ -37,9 +296,11 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	va_list args;
 	uint64_t timestamp, rflags;
 	uint16_t pcpu_id;
+	int32_t seq;
 	bool do_console_log;
 	bool do_mem_log;
 	bool do_npk_log;
+	bool text_ready = false;
 	char *buffer;
 	struct thread_object *current;
 
@@ -54,25 +315,18 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	/* Get time-stamp value */
 	timestamp = cpu_ticks();
 
-	/* Scale time-stamp appropriately */
-	timestamp = ticks_to_us(timestamp);
-
 	/* Get CPU ID */
 	pcpu_id = get_pcpu_id();
 	buffer = per_cpu(logbuf, pcpu_id);
 	current = sched_get_current(pcpu_id);
+	seq = atomic_inc_return(&logmsg_ctl.seq);
 
-	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
-	/* Put time-stamp, CPU ID and severity into buffer */
-	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%luus][cpu=%hu][%s][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, current->name, severity, atomic_inc_return(&logmsg_ctl.seq));
-
-	/* Put message into remaining portion of local buffer */
-	va_start(args, fmt);
-	vsnprintf(buffer + strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE),
-		LOG_MESSAGE_MAX_SIZE
-		- strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), fmt, args);
-	va_end(args);
+	if (do_npk_log || do_console_log) {
+		va_start(args, fmt);
+		format_log_text(buffer, severity, pcpu_id, seq, timestamp, current, fmt, args);
+		va_end(args);
+		text_ready = true;
+	}
 
 	/* Check whether output to NPK */
 	if (do_npk_log) {
@@ -93,12 +347,37 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	if (do_mem_log) {
 		uint32_t msg_len;
 		struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+		const struct logmsg_fmt *entry;
+		struct log_bin_hdr *hdr = (struct log_bin_hdr *)buffer;
 
 		/* If sbuf is not ready, we just drop the massage */
 		if (sbuf != NULL) {
-			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
-			(void)sbuf_put_many(sbuf, LOG_ENTRY_SIZE, (uint8_t *)buffer,
-				LOG_ENTRY_SIZE * (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1));
+			/* none of the formats is in a new sbuf yet */
+			if (per_cpu(log_sbuf, pcpu_id) != sbuf) {
+				(void)memset(per_cpu(log_fmt_pos, pcpu_id), 0U, sizeof(per_cpu(log_fmt_pos, pcpu_id)));
+				per_cpu(log_sbuf, pcpu_id) = sbuf;
+			}
+
+			entry = get_log_fmt(fmt);
+			if ((entry != NULL) &&
+					put_log_fmt(entry, sbuf, buffer, severity, pcpu_id, seq, timestamp, current)) {
+				fill_log_bin_hdr(hdr, LOG_REC_MSG, severity, pcpu_id, seq, timestamp, current);
+				hdr->fmt_id = entry->id;
+				va_start(args, fmt);
+				hdr->payload_len = encode_log_args(entry, buffer + sizeof(*hdr), args);
+				va_end(args);
+				(void)put_log_bin(pcpu_id, sbuf, buffer);
+			} else {
+				/* the buffer is also used to put the LOG_REC_FMT record */
+				if (!text_ready || (hdr->magic == LOG_BIN_MAGIC)) {
+					va_start(args, fmt);
+					format_log_text(buffer, severity, pcpu_id, seq, timestamp, current, fmt, args);
+					va_end(args);
+				}
+				msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
+				(void)put_log_sbuf(pcpu_id, sbuf, buffer,
+					LOG_ENTRY_SIZE * (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1));
+			}
 		}
 	}
 }
@@ -22,6 +22,7 @@
 #include <shell.h>
 #include <asm/guest/vmcs.h>
 #include <asm/host_pm.h>
+#include <vmexit_stat.h>
 
 #define TEMP_STR_SIZE		60U
 #define MAX_STR_SIZE		256U
@@ -51,6 +52,9 @@ static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_reboot(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+static int32_t shell_vmexit_stat(int32_t argc, char **argv);
+static int32_t shell_msr_stat(int32_t argc, char **argv);
+static int32_t shell_vpci_stat(int32_t argc, char **argv);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -155,6 +159,24 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+	{
+		.str		= SHELL_CMD_VMEXIT_STAT,
+		.cmd_param	= SHELL_CMD_VMEXIT_STAT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_STAT_HELP,
+		.fcn		= shell_vmexit_stat,
+	},
+	{
+		.str		= SHELL_CMD_MSR_STAT,
+		.cmd_param	= SHELL_CMD_MSR_STAT_PARAM,
+		.help_str	= SHELL_CMD_MSR_STAT_HELP,
+		.fcn		= shell_msr_stat,
+	},
+	{
+		.str		= SHELL_CMD_VPCI_STAT,
+		.cmd_param	= SHELL_CMD_VPCI_STAT_PARAM,
+		.help_str	= SHELL_CMD_VPCI_STAT_HELP,
+		.fcn		= shell_vpci_stat,
+	},
 };
 
 /* for function key: up/down/right/left/home/end and delete key */
@@ -911,6 +933,15 @@ static void dump_vcpu_reg(void *data)
 	size -= len;
 	str += len;
 
+	len = snprintf(str, size, "=  Instruction decode cache: hit %lu miss %lu (invalidated %lu)\r\n",
+		vcpu->inst_ctxt.vie_cache.hit, vcpu->inst_ctxt.vie_cache.miss,
+		vcpu->inst_ctxt.vie_cache.invalidated);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
 	/* dump sp */
 	status = copy_from_gva(vcpu, tmp, vcpu_get_gpreg(vcpu, CPU_REG_RSP),
 			DUMPREG_SP_SIZE*sizeof(uint64_t), &err_code,
@@ -1615,3 +1646,317 @@ static int32_t shell_wrmsr(int32_t argc, char **argv)
 
 	return ret;
 }
+
+static struct acrn_vmexit_stat shell_vmexit_stat_buf;
+
+static const char *vmexit_sub_type_str(uint8_t type)
+{
+	const char *str;
+
+	switch (type) {
+	case ACRN_VMEXIT_SUB_PIO:
+		str = "pio";
+		break;
+	case ACRN_VMEXIT_SUB_MMIO:
+		str = "mmio";
+		break;
+	case ACRN_VMEXIT_SUB_MSR:
+		str = "msr";
+		break;
+	case ACRN_VMEXIT_SUB_CPUID:
+		str = "cpuid";
+		break;
+	default:
+		str = "unknown";
+		break;
+	}
+
+	return str;
+}
+
+static void get_vmexit_stat_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vmexit_stat *stat = &shell_vmexit_stat_buf;
+	uint64_t key;
+	uint32_t i;
+
+	(void)vmexit_stat_get(vmid, stat);
+
+	len = snprintf(str, size, "\r\nVM exit statistics of VM %hu (collection %s)"
+			"\r\nREASON\tCOUNT\t\tAVG_CYCLES", vmid, (stat->enabled != 0U) ? "on" : "off");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < ACRN_VMEXIT_STAT_REASONS; i++) {
+		if (stat->count[i] != 0UL) {
+			len = snprintf(str, size, "\r\n0x%02x\t%-16lu%lu", i, stat->count[i],
+					stat->cycles[i] / stat->count[i]);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	len = snprintf(str, size, "\r\n\r\nEXIT->ENTRY CYCLES\tCOUNT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < ACRN_VMEXIT_STAT_HIST_BUCKETS; i++) {
+		if (stat->hist[i] != 0UL) {
+			len = snprintf(str, size, "\r\n[2^%u, 2^%u)\t\t%lu", i, i + 1U, stat->hist[i]);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	len = snprintf(str, size, "\r\n\r\nTYPE\tKEY\t\tCOUNT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < stat->nr_subs; i++) {
+		key = stat->subs[i].key;
+		if (stat->subs[i].type == ACRN_VMEXIT_SUB_MMIO) {
+			key <<= PAGE_SHIFT;
+		}
+		len = snprintf(str, size, "\r\n%s\t0x%-14lx%lu", vmexit_sub_type_str(stat->subs[i].type),
+				key, stat->subs[i].count);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	if (stat->sub_dropped != 0UL) {
+		len = snprintf(str, size, "\r\n(%lu exits not tracked by sub-reason)", stat->sub_dropped);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_vmexit_stat(int32_t argc, char **argv)
+{
+	int32_t ret = 0;
+
+	if (argc != 2) {
+		ret = -EINVAL;
+	} else if (strcmp(argv[1], "on") == 0) {
+		vmexit_stat_set_enable(true);
+	} else if (strcmp(argv[1], "off") == 0) {
+		vmexit_stat_set_enable(false);
+	} else if (strcmp(argv[1], "reset") == 0) {
+		vmexit_stat_reset();
+	} else {
+		ret = strtol_deci(argv[1]);
+		if ((ret >= 0) && (ret < (int32_t)CONFIG_MAX_VM_NUM)) {
+			get_vmexit_stat_info(shell_log_buf, SHELL_LOG_BUF_SIZE, (uint16_t)ret);
+			shell_puts(shell_log_buf);
+			ret = 0;
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+static void get_msr_stat_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	const struct msr_exit_stat *stat;
+	uint16_t idx;
+	uint32_t i;
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nVCPU\tMSR\t\tRDMSR\t\tWRMSR\t\tREAD");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	foreach_vcpu(idx, vm, vcpu) {
+		for (i = 0U; i < MSR_EXIT_STAT_ENTRIES; i++) {
+			stat = &vcpu->arch.msr_prof.entries[i];
+			if (!stat->used) {
+				continue;
+			}
+			len = snprintf(str, size, "\r\n%hu\t0x%-8x\t%-16lu%-16lu%s", vcpu->vcpu_id, stat->msr,
+					stat->rd_cnt, stat->wr_cnt, stat->read_relaxed ? "passthru" : "intercept");
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+
+		if (vcpu->arch.msr_prof.untracked != 0UL) {
+			len = snprintf(str, size, "\r\n%hu\t(untracked)\t%lu", vcpu->vcpu_id,
+					vcpu->arch.msr_prof.untracked);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_msr_stat(int32_t argc, char **argv)
+{
+	int32_t ret = -EINVAL;
+
+	if (argc == 2) {
+		ret = strtol_deci(argv[1]);
+		if (ret >= 0) {
+			get_msr_stat_info(shell_log_buf, SHELL_LOG_BUF_SIZE, sanitize_vmid((uint16_t)ret));
+			shell_puts(shell_log_buf);
+			ret = 0;
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+static void get_vpci_stat_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	const struct pci_vdev *vdev;
+	union pci_bdf pbdf;
+	uint32_t i;
+
+	if (is_poweroff_vm(vm)) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nVBDF\t\tPBDF\t\tCFG_READ\tCFG_WRITE\tPHYS_READ\tPHYS_READ_AVOIDED");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < CONFIG_MAX_PCI_DEV_NUM; i++) {
+		if (!bitmap_test((uint16_t)(i & 0x3FU), &vm->vpci.vdev_bitmaps[i >> 6U])) {
+			continue;
+		}
+		vdev = &vm->vpci.pci_vdevs[i];
+		pbdf.value = (vdev->pdev != NULL) ? vdev->pdev->bdf.value : 0xFFFFU;
+		len = snprintf(str, size, "\r\n%02x:%02x.%x\t\t%02x:%02x.%x\t\t%-16lu%-16lu%-16lu%lu",
+				vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f,
+				pbdf.bits.b, pbdf.bits.d, pbdf.bits.f,
+				vdev->stat.cfg_reads, vdev->stat.cfg_writes,
+				vdev->stat.pdev_reads, vdev->stat.pdev_reads_avoided);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	len = snprintf(str, size, "\r\n\r\nVBDF\t\tMSIX_READ\tMSIX_WRITE\tMASK_ONLY\tDEFERRED\tREMAP");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (i = 0U; i < CONFIG_MAX_PCI_DEV_NUM; i++) {
+		if (!bitmap_test((uint16_t)(i & 0x3FU), &vm->vpci.vdev_bitmaps[i >> 6U])) {
+			continue;
+		}
+		vdev = &vm->vpci.pci_vdevs[i];
+		if ((vdev->pdev == NULL) || (vdev->msix.table_count == 0U)) {
+			continue;
+		}
+		len = snprintf(str, size, "\r\n%02x:%02x.%x\t\t%-16lu%-16lu%-16lu%-16lu%lu",
+				vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f,
+				vdev->stat.msix_table_reads, vdev->stat.msix_table_writes,
+				vdev->stat.msix_mask_only, vdev->stat.msix_deferred,
+				vdev->stat.msix_remaps);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_vpci_stat(int32_t argc, char **argv)
+{
+	int32_t ret = -EINVAL;
+
+	if (argc == 2) {
+		ret = strtol_deci(argv[1]);
+		if (ret >= 0) {
+			get_vpci_stat_info(shell_log_buf, SHELL_LOG_BUF_SIZE, sanitize_vmid((uint16_t)ret));
+			shell_puts(shell_log_buf);
+			ret = 0;
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	return ret;
+}
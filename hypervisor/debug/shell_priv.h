@@ -113,4 +113,19 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_VMEXIT_STAT		"vmexit_stat"
+#define SHELL_CMD_VMEXIT_STAT_PARAM	"<on | off | reset | vm id>"
+#define SHELL_CMD_VMEXIT_STAT_HELP	"Enable, disable or reset VM exit statistics, or show the VM exit counts, "\
+					"exit->entry latency histogram and top sub-reasons of a specific VM"
+
+#define SHELL_CMD_MSR_STAT		"msr_stat"
+#define SHELL_CMD_MSR_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_MSR_STAT_HELP		"Show the RDMSR/WRMSR VM exit counts per MSR for each vCPU of a specific VM"
+
+#define SHELL_CMD_VPCI_STAT		"vpci_stat"
+#define SHELL_CMD_VPCI_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_VPCI_STAT_HELP	"Show the config space accesses of each vPCI device of a specific VM and the"\
+					" physical config reads avoided by the config shadow, then the MSI-X table"\
+					" exits of each passthrough device"
 #endif /* SHELL_PRIV_H */
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <asm/lib/bits.h>
+#include <asm/lib/spinlock.h>
+#include <asm/cpu.h>
+#include <asm/vmx.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/guest_memory.h>
+#include <acrn_hv_defs.h>
+#include <ticks.h>
+#include <vmexit_stat.h>
+
+/*
+ * VM exit statistics are kept per physical CPU so that the exit path never
+ * takes a lock or an atomic operation; readers sum the per-pCPU copies. The
+ * counters are read without synchronization, so a snapshot taken while VMs
+ * run may be off by the exits in flight.
+ */
+
+#define VMEXIT_STAT_SUB_SLOTS		256U
+#define VMEXIT_STAT_SUB_PROBES		8U
+
+#define VMEXIT_STAT_SUB_TAG(vm_id, type, key)	\
+	(((uint64_t)(vm_id) << 40U) | ((uint64_t)(type) << 32U) | (uint64_t)(key))
+#define VMEXIT_STAT_SUB_TAG_VMID(tag)	((uint16_t)((tag) >> 40U))
+#define VMEXIT_STAT_SUB_TAG_TYPE(tag)	((uint8_t)((tag) >> 32U))
+#define VMEXIT_STAT_SUB_TAG_KEY(tag)	((uint32_t)(tag))
+
+struct vmexit_stat_sub {
+	uint64_t tag;	/* VMEXIT_STAT_SUB_TAG(), 0 for a free slot */
+	uint64_t count;
+};
+
+struct vmexit_stat_pcpu {
+	uint64_t count[CONFIG_MAX_VM_NUM][ACRN_VMEXIT_STAT_REASONS];
+	uint64_t cycles[CONFIG_MAX_VM_NUM][ACRN_VMEXIT_STAT_REASONS];
+	uint64_t hist[CONFIG_MAX_VM_NUM][ACRN_VMEXIT_STAT_HIST_BUCKETS];
+	uint64_t sub_dropped[CONFIG_MAX_VM_NUM];
+	struct vmexit_stat_sub subs[VMEXIT_STAT_SUB_SLOTS];
+
+	/* the last VM exit on this pCPU, waiting for the VM entry of the same vCPU */
+	const struct acrn_vcpu *pending_vcpu;
+	uint64_t pending_tsc;
+	uint32_t pending_reason;
+};
+
+static struct vmexit_stat_pcpu vmexit_stats[MAX_PCPU_NUM];
+static volatile bool vmexit_stat_enabled = false;
+
+/* protects merged_subs and guest_stat */
+static spinlock_t vmexit_stat_lock = { .head = 0U, .tail = 0U };
+static struct vmexit_stat_sub merged_subs[VMEXIT_STAT_SUB_SLOTS];
+static struct acrn_vmexit_stat guest_stat;
+
+static inline uint32_t sub_slot_hash(uint64_t tag)
+{
+	/* Fibonacci hashing, the top 8 bits index the 256 slots */
+	return (uint32_t)((tag * 0x9E3779B97F4A7C15UL) >> 56U);
+}
+
+/*
+ * Add one exit to the slot of tag in subs[]. Return false if no free slot
+ * is found within VMEXIT_STAT_SUB_PROBES probes.
+ */
+static bool sub_account(struct vmexit_stat_sub *subs, uint64_t tag, uint64_t count)
+{
+	uint32_t i, idx = sub_slot_hash(tag);
+	bool accounted = false;
+
+	for (i = 0U; i < VMEXIT_STAT_SUB_PROBES; i++) {
+		struct vmexit_stat_sub *sub = &subs[(idx + i) & (VMEXIT_STAT_SUB_SLOTS - 1U)];
+
+		if (sub->tag == tag) {
+			sub->count += count;
+			accounted = true;
+			break;
+		} else if (sub->tag == 0UL) {
+			sub->tag = tag;
+			sub->count = count;
+			accounted = true;
+			break;
+		} else {
+			/* slot used by another tag, probe the next one */
+		}
+	}
+
+	return accounted;
+}
+
+static void record_sub_reason(struct vmexit_stat_pcpu *stat, struct acrn_vcpu *vcpu, uint32_t reason)
+{
+	uint16_t vm_id = vcpu->vm->vm_id;
+	uint8_t type;
+	uint32_t key;
+
+	switch (reason) {
+	case VMX_EXIT_REASON_IO_INSTRUCTION:
+		type = ACRN_VMEXIT_SUB_PIO;
+		key = (uint32_t)((exec_vmread(VMX_EXIT_QUALIFICATION) >> 16U) & 0xFFFFUL);
+		break;
+	case VMX_EXIT_REASON_EPT_VIOLATION:
+	case VMX_EXIT_REASON_EPT_MISCONFIGURATION:
+		type = ACRN_VMEXIT_SUB_MMIO;
+		key = (uint32_t)(exec_vmread64(VMX_GUEST_PHYSICAL_ADDR_FULL) >> PAGE_SHIFT);
+		break;
+	case VMX_EXIT_REASON_RDMSR:
+	case VMX_EXIT_REASON_WRMSR:
+		type = ACRN_VMEXIT_SUB_MSR;
+		key = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+		break;
+	case VMX_EXIT_REASON_CPUID:
+		type = ACRN_VMEXIT_SUB_CPUID;
+		key = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RAX);
+		break;
+	default:
+		type = 0U;
+		key = 0U;
+		break;
+	}
+
+	if (type != 0U) {
+		if (!sub_account(stat->subs, VMEXIT_STAT_SUB_TAG(vm_id, type, key), 1UL)) {
+			stat->sub_dropped[vm_id]++;
+		}
+	}
+}
+
+void vmexit_stat_on_exit(struct acrn_vcpu *vcpu)
+{
+	struct vmexit_stat_pcpu *stat;
+	uint32_t reason;
+	uint64_t tsc;
+
+	if (vmexit_stat_enabled) {
+		tsc = cpu_ticks();
+		stat = &vmexit_stats[get_pcpu_id()];
+		reason = vcpu->arch.exit_reason & 0xFFFFU;
+		if (reason < ACRN_VMEXIT_STAT_REASONS) {
+			stat->count[vcpu->vm->vm_id][reason]++;
+			record_sub_reason(stat, vcpu, reason);
+
+			stat->pending_vcpu = vcpu;
+			stat->pending_tsc = tsc;
+			stat->pending_reason = reason;
+		}
+	}
+}
+
+void vmexit_stat_on_entry(struct acrn_vcpu *vcpu)
+{
+	struct vmexit_stat_pcpu *stat;
+	uint64_t delta;
+	uint16_t bucket, vm_id;
+
+	if (vmexit_stat_enabled) {
+		stat = &vmexit_stats[get_pcpu_id()];
+		/*
+		 * If another vCPU ran on this pCPU in between, its exit replaced ours
+		 * and the latency of our exit is not accounted.
+		 */
+		if (stat->pending_vcpu == vcpu) {
+			vm_id = vcpu->vm->vm_id;
+			delta = cpu_ticks() - stat->pending_tsc;
+			bucket = fls64(delta);
+			if (bucket == INVALID_BIT_INDEX) {
+				bucket = 0U;
+			} else if (bucket >= ACRN_VMEXIT_STAT_HIST_BUCKETS) {
+				bucket = ACRN_VMEXIT_STAT_HIST_BUCKETS - 1U;
+			} else {
+				/* bucket is the log2 of delta */
+			}
+
+			stat->cycles[vm_id][stat->pending_reason] += delta;
+			stat->hist[vm_id][bucket]++;
+			stat->pending_vcpu = NULL;
+		}
+	}
+}
+
+void vmexit_stat_set_enable(bool enable)
+{
+	uint16_t pcpu_id;
+
+	if (enable && !vmexit_stat_enabled) {
+		/* drop exits left over from a previous run, their timestamps are stale */
+		for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+			vmexit_stats[pcpu_id].pending_vcpu = NULL;
+		}
+	}
+	vmexit_stat_enabled = enable;
+}
+
+bool vmexit_stat_is_enabled(void)
+{
+	return vmexit_stat_enabled;
+}
+
+void vmexit_stat_reset(void)
+{
+	(void)memset((void *)vmexit_stats, 0U, sizeof(vmexit_stats));
+}
+
+/*
+ * @pre vm_id < CONFIG_MAX_VM_NUM
+ * @pre vmexit_stat_lock is held
+ */
+static void collect_vmexit_stat(uint16_t vm_id, struct acrn_vmexit_stat *stat)
+{
+	uint16_t pcpu_id;
+	uint32_t i, j, best;
+	uint64_t dropped = 0UL;
+
+	(void)memset((void *)stat->count, 0U, sizeof(stat->count));
+	(void)memset((void *)stat->cycles, 0U, sizeof(stat->cycles));
+	(void)memset((void *)stat->hist, 0U, sizeof(stat->hist));
+	(void)memset((void *)stat->subs, 0U, sizeof(stat->subs));
+	(void)memset((void *)merged_subs, 0U, sizeof(merged_subs));
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		const struct vmexit_stat_pcpu *pstat = &vmexit_stats[pcpu_id];
+
+		for (i = 0U; i < ACRN_VMEXIT_STAT_REASONS; i++) {
+			stat->count[i] += pstat->count[vm_id][i];
+			stat->cycles[i] += pstat->cycles[vm_id][i];
+		}
+		for (i = 0U; i < ACRN_VMEXIT_STAT_HIST_BUCKETS; i++) {
+			stat->hist[i] += pstat->hist[vm_id][i];
+		}
+		dropped += pstat->sub_dropped[vm_id];
+
+		for (i = 0U; i < VMEXIT_STAT_SUB_SLOTS; i++) {
+			const struct vmexit_stat_sub *sub = &pstat->subs[i];
+
+			if ((sub->tag != 0UL) && (VMEXIT_STAT_SUB_TAG_VMID(sub->tag) == vm_id)) {
+				if (!sub_account(merged_subs, sub->tag, sub->count)) {
+					dropped += sub->count;
+				}
+			}
+		}
+	}
+
+	/* partial selection sort: move the most frequent sub-reasons to stat->subs */
+	stat->nr_subs = 0U;
+	for (j = 0U; j < ACRN_VMEXIT_STAT_MAX_SUBS; j++) {
+		best = VMEXIT_STAT_SUB_SLOTS;
+		for (i = 0U; i < VMEXIT_STAT_SUB_SLOTS; i++) {
+			if ((merged_subs[i].count != 0UL) &&
+				((best == VMEXIT_STAT_SUB_SLOTS) || (merged_subs[i].count > merged_subs[best].count))) {
+				best = i;
+			}
+		}
+		if (best == VMEXIT_STAT_SUB_SLOTS) {
+			break;
+		}
+		stat->subs[j].type = VMEXIT_STAT_SUB_TAG_TYPE(merged_subs[best].tag);
+		stat->subs[j].key = VMEXIT_STAT_SUB_TAG_KEY(merged_subs[best].tag);
+		stat->subs[j].count = merged_subs[best].count;
+		merged_subs[best].count = 0UL;
+		stat->nr_subs++;
+	}
+
+	stat->sub_dropped = dropped;
+	stat->enabled = vmexit_stat_enabled ? 1U : 0U;
+}
+
+/**
+ * @brief Sum up the VM exit statistics of a VM over all pCPUs
+ *
+ * @param[in] vm_id absolute ID of the VM
+ * @param[out] stat the summed statistics; stat->vmid is left unchanged
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if vm_id is out of range
+ */
+int32_t vmexit_stat_get(uint16_t vm_id, struct acrn_vmexit_stat *stat)
+{
+	int32_t ret = -EINVAL;
+
+	if (vm_id < CONFIG_MAX_VM_NUM) {
+		spinlock_obtain(&vmexit_stat_lock);
+		collect_vmexit_stat(vm_id, stat);
+		spinlock_release(&vmexit_stat_lock);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Copy the VM exit statistics of a VM to the Service VM
+ *
+ * @param[in] vm the Service VM
+ * @param[in] gpa guest physical address of struct acrn_vmexit_stat, whose
+ *		vmid field holds the relative ID of the VM to query
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the VM ID is out of range or the gpa is invalid
+ */
+int32_t vmexit_stat_copy_to_guest(struct acrn_vm *vm, uint64_t gpa)
+{
+	uint16_t rel_vmid, vm_id;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &rel_vmid, gpa, sizeof(rel_vmid)) == 0) {
+		vm_id = rel_vmid_2_vmid(vm->vm_id, rel_vmid);
+		if (vm_id < CONFIG_MAX_VM_NUM) {
+			spinlock_obtain(&vmexit_stat_lock);
+			collect_vmexit_stat(vm_id, &guest_stat);
+			guest_stat.vmid = rel_vmid;
+			ret = copy_to_gpa(vm, &guest_stat, gpa, sizeof(guest_stat));
+			spinlock_release(&vmexit_stat_lock);
+		}
+	}
+
+	return ret;
+}
@@ -47,6 +47,14 @@ static inline struct msix_table_entry *get_msix_table_entry(const struct pci_vde
 	return ((struct msix_table_entry *)hva + index);
 }
 
+/**
+ * @pre vdev != NULL
+ */
+static void invalidate_msix_shadow(struct pci_vdev *vdev)
+{
+	(void)memset((void *)&vdev->msix.table_shadow, 0U, sizeof(vdev->msix.table_shadow));
+}
+
 /**
  * @brief Reading MSI-X Capability Structure
  *
@@ -79,6 +87,11 @@ void write_pt_vmsix_cap_reg(struct pci_vdev *vdev, uint32_t offset, uint32_t byt
 			enable_disable_pci_intx(vdev->pdev->bdf, false);
 		}
 		pci_pdev_write_cfg(vdev->pdev->bdf, vdev->msix.capoff + PCIR_MSIX_CTRL, 2U, msgctrl);
+		/*
+		 * Drivers rewrite Message Control after a function reset, which
+		 * also resets the physical table: forget what it was programmed with.
+		 */
+		invalidate_msix_shadow(vdev);
 	}
 }
 
@@ -98,22 +111,61 @@ static void mask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
 
 
 /**
+ * @pre vdev != NULL
+ */
+static void unmask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
+{
+	struct msix_table_entry *pentry = get_msix_table_entry(vdev, index);
+
+	stac();
+	mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
+	clac();
+}
+
+/**
+ * Apply the virtual table entry 'index' to the physical one.
+ *
+ * The physical entry is only rewritten when the guest unmasks a vector whose
+ * address/data differ from the ones behind the current remapping. Writes to
+ * a masked vector stay in the virtual table until then, and a mask or unmask
+ * of an unchanged vector only flips the physical mask bit.
+ *
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  * @pre vdev->pdev != NULL
  */
-static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
+static void remap_one_vmsix_entry(struct pci_vdev *vdev, uint32_t index)
 {
 	const struct msix_table_entry *ventry;
+	struct msix_entry_shadow *shadow;
 	struct msix_table_entry *pentry;
 	struct msi_info info = {};
 	int32_t ret;
 
-	mask_one_msix_vector(vdev, index);
 	ventry = &vdev->msix.table_entries[index];
-	if ((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) {
-		info.addr.full = vdev->msix.table_entries[index].addr;
-		info.data.full = vdev->msix.table_entries[index].data;
+	shadow = &vdev->msix.table_shadow[index];
+	if ((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) != 0U) {
+		if (shadow->masked) {
+			vdev->stat.msix_deferred++;
+		} else {
+			mask_one_msix_vector(vdev, index);
+			shadow->masked = true;
+			vdev->stat.msix_mask_only++;
+		}
+	} else if (shadow->remapped && (shadow->addr == ventry->addr) && (shadow->data == ventry->data)) {
+		if (shadow->masked) {
+			unmask_one_msix_vector(vdev, index);
+			shadow->masked = false;
+		}
+		vdev->stat.msix_mask_only++;
+	} else {
+		mask_one_msix_vector(vdev, index);
+		shadow->masked = true;
+		shadow->remapped = false;
+		vdev->stat.msix_remaps++;
+
+		info.addr.full = ventry->addr;
+		info.data.full = ventry->data;
 
 		ret = ptirq_prepare_msix_remap(vpci2vm(vdev->vpci), vdev->bdf.value, vdev->pdev->bdf.value,
 					       (uint16_t)index, &info, INVALID_IRTE_ID);
@@ -131,11 +183,15 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 			mmio_write32((uint32_t)(info.addr.full >> 32U), (void *)((char *)&(pentry->addr) + 4U));
 
 			mmio_write32(info.data.full, (void *)&(pentry->data));
-			mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
+			mmio_write32(ventry->vector_control, (void *)&(pentry->vector_control));
 			clac();
+
+			shadow->addr = ventry->addr;
+			shadow->data = ventry->data;
+			shadow->remapped = true;
+			shadow->masked = false;
 		}
 	}
-
 }
 
 /**
@@ -151,6 +207,11 @@ static int32_t pt_vmsix_handle_table_mmio_access(struct io_request *io_req, void
 
 	vdev = (struct pci_vdev *)priv_data;
 	if (vdev->user == vdev) {
+		if (mmio->direction == ACRN_IOREQ_DIR_READ) {
+			vdev->stat.msix_table_reads++;
+		} else {
+			vdev->stat.msix_table_writes++;
+		}
 		index = rw_vmsix_table(vdev, io_req);
 
 		if ((mmio->direction == ACRN_IOREQ_DIR_WRITE) && (index < vdev->msix.table_count)) {
@@ -183,6 +244,7 @@ static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
 		msix->table_entries[i].addr = 0U;
 		msix->table_entries[i].data = 0U;
 	}
+	invalidate_msix_shadow(vdev);
 
 	if (msix->mmio_gpa != 0UL) {
 		addr_lo = msix->mmio_gpa + msix->table_offset;
@@ -545,6 +607,7 @@ void deinit_vmsix_pt(struct pci_vdev *vdev)
 		if (vdev->msix.table_count != 0U) {
 			ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->pdev->bdf.value, vdev->msix.table_count);
 			(void)memset((void *)&vdev->msix.table_entries, 0U, sizeof(vdev->msix.table_entries));
+			invalidate_msix_shadow(vdev);
 			vdev->msix.is_vmsix_on_msi_programmed = false;
 		}
 	}
@@ -587,6 +650,56 @@ void passthru_gpu_opregion(struct pci_vdev *vdev)
 	pci_vdev_write_vcfg(vdev, PCIR_ASLS_CTL, 4U, gpu_opregion_gpa | (gpu_asls_phys & ~PCIM_ASLS_OPREGION_MASK));
 }
 
+/*
+ * Mark the read-only dwords of the PCI Power Management and PCI Express
+ * capabilities for shadowing: the PM capabilities (PMC) and the device,
+ * link and slot capabilities. Drivers poll them but they only change on a
+ * device reset or link retraining, both started by a config write, which
+ * drops the shadow (see write_pt_dev_cfg()).
+ */
+static void init_vdev_cfg_shadow(struct pci_vdev *vdev)
+{
+	static const uint32_t pcie_ro_regs[] = {
+		0U, PCIR_PCIE_DEVCAP, PCIR_PCIE_LINKCAP, PCIR_PCIE_SLOTCAP,
+		PCIR_PCIE_DEVCAP2, PCIR_PCIE_LINKCAP2, PCIR_PCIE_SLOTCAP2,
+	};
+	union pci_bdf pbdf = vdev->pdev->bdf;
+	uint32_t pos, cap, i, loops = 0U;
+
+	vdev->cfg_shadow_ro = 0UL;
+	vdev->cfg_shadow_valid = 0UL;
+
+	if ((pci_pdev_read_cfg(pbdf, PCIR_STATUS, 2U) & PCIM_STATUS_CAPPRESENT) != 0U) {
+		pos = pci_pdev_read_cfg(pbdf, PCIR_CAP_PTR, 1U);
+
+		/* 48 capabilities at most fit between 0x40 and 0xFF, guard against looped lists */
+		while ((pos >= PCI_CFG_HEADER_LENGTH) && (pos != 0xFFU) && (loops < 48U)) {
+			pos &= ~0x3U;
+			cap = pci_pdev_read_cfg(pbdf, pos + PCICAP_ID, 1U);
+
+			if (cap == PCIY_PMC) {
+				bitmap_set_nolock((uint16_t)(pos >> 2U), &vdev->cfg_shadow_ro);
+			} else if (cap == PCIY_PCIE) {
+				for (i = 0U; i < ARRAY_SIZE(pcie_ro_regs); i++) {
+					if ((pos + pcie_ro_regs[i]) < 0x100U) {
+						bitmap_set_nolock((uint16_t)((pos + pcie_ro_regs[i]) >> 2U), &vdev->cfg_shadow_ro);
+					}
+				}
+			} else {
+				/* other capabilities are not shadowed */
+			}
+
+			pos = pci_pdev_read_cfg(pbdf, pos + PCICAP_NEXTPTR, 1U);
+			loops++;
+		}
+	}
+
+	/* never shadow registers that are virtualized or emulated elsewhere */
+	if (vdev->pdev->bdf.value == CONFIG_IGD_SBDF) {
+		bitmap_clear_nolock((uint16_t)(PCIR_ASLS_CTL >> 2U), &vdev->cfg_shadow_ro);
+	}
+}
+
 /**
  * @brief Initialize a specified passthrough vdev structure.
  *
@@ -610,6 +723,7 @@ void init_vdev_pt(struct pci_vdev *vdev, bool is_pf_vdev)
 	for (offset = 0U; offset < PCI_CFG_HEADER_LENGTH; offset += 4U) {
 		pci_vdev_write_vcfg(vdev, offset, 4U, pci_pdev_read_cfg(vdev->pdev->bdf, offset, 4U));
 	}
+	init_vdev_cfg_shadow(vdev);
 
 	/* Initialize the vdev BARs except SRIOV VF, VF BARs are initialized directly from create_vf function */
 	if (vdev->phyfun == NULL) {
@@ -360,17 +360,31 @@ static void remove_vdev_pt_iommu_domain(const struct pci_vdev *vdev)
  */
 static struct pci_vdev *find_available_vdev(struct acrn_vpci *vpci, union pci_bdf bdf)
 {
-	struct pci_vdev *vdev = pci_find_vdev(vpci, bdf);
+	uint16_t pcpu_id = get_pcpu_id();
+	struct pci_vdev *vdev = vpci->last_vdev[pcpu_id];
 
-	if ((vdev != NULL) && (vdev->user != vdev)) {
-		if (vdev->user != NULL) {
-			/* the Service VM is able to access, if and only if the Service VM has higher severity than the User VM. */
-			if (get_vm_severity(vpci2vm(vpci)->vm_id) <
-					get_vm_severity(vpci2vm(vdev->user->vpci)->vm_id)) {
+	/*
+	 * Fast path: the vdev last found on this pCPU is still initialized, has
+	 * the same BDF and is used by this VM itself.
+	 */
+	if ((vdev == NULL) || (vdev->bdf.value != bdf.value) || (vdev->user != vdev) ||
+			!bitmap_test((uint16_t)(vdev->id & 0x3FU), &vpci->vdev_bitmaps[vdev->id >> 6U])) {
+		vdev = pci_find_vdev(vpci, bdf);
+
+		if ((vdev != NULL) && (vdev->user != vdev)) {
+			if (vdev->user != NULL) {
+				/* the Service VM is able to access, if and only if the Service VM has higher severity than the User VM. */
+				if (get_vm_severity(vpci2vm(vpci)->vm_id) <
+						get_vm_severity(vpci2vm(vdev->user->vpci)->vm_id)) {
+					vdev = NULL;
+				}
+			} else {
 				vdev = NULL;
 			}
+		} else if (vdev != NULL) {
+			vpci->last_vdev[pcpu_id] = vdev;
 		} else {
-			vdev = NULL;
+			/* no vdev with this BDF */
 		}
 	}
 
@@ -455,7 +469,7 @@ static const struct cfg_header_perm cfg_hdr_perm = {
 /*
  * @pre offset + bytes < PCI_CFG_HEADER_LENGTH
  */
-static int32_t read_cfg_header(const struct pci_vdev *vdev,
+static int32_t read_cfg_header(struct pci_vdev *vdev,
 		uint32_t offset, uint32_t bytes, uint32_t *val)
 {
 	int32_t ret = 0;
@@ -480,6 +494,7 @@ static int32_t read_cfg_header(const struct pci_vdev *vdev,
 
 		if (bitmap32_test(((uint16_t)offset) >> 2U, &pt_mask)) {
 			*val = pci_pdev_read_cfg(vdev->pdev->bdf, offset, bytes);
+			vdev->stat.pdev_reads++;
 
 			/* MSE(Memory Space Enable) bit always be set for an assigned VF */
 			if ((vdev->phyfun != NULL) && (offset == PCIR_COMMAND) &&
@@ -575,6 +590,13 @@ static int32_t write_pt_dev_cfg(struct pci_vdev *vdev, uint32_t offset,
 {
 	int32_t ret = 0;
 
+	/*
+	 * Any write may reset the device or change its link state (e.g. a
+	 * PMCSR D3hot->D0 transition or an FLR), drop the shadowed read-only
+	 * registers and read them again from the device.
+	 */
+	vdev->cfg_shadow_valid = 0UL;
+
 	if (cfg_header_access(offset)) {
 		ret = write_cfg_header(vdev, offset, bytes, val);
 	} else if (msicap_access(vdev, offset)) {
@@ -603,6 +625,36 @@ static int32_t write_pt_dev_cfg(struct pci_vdev *vdev, uint32_t offset,
 	return ret;
 }
 
+/*
+ * Read a passthrough register that is not virtualized. Dwords marked in
+ * cfg_shadow_ro are read from the device once and then served from cfgdata.
+ */
+static uint32_t read_pt_dev_cfg_shadowed(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes)
+{
+	uint16_t idx = (uint16_t)(offset >> 2U);
+	uint32_t val, dword;
+
+	if ((idx < 64U) && bitmap_test(idx, &vdev->cfg_shadow_ro)) {
+		if (!bitmap_test(idx, &vdev->cfg_shadow_valid)) {
+			dword = pci_pdev_read_cfg(vdev->pdev->bdf, offset & ~0x3U, 4U);
+			pci_vdev_write_vcfg(vdev, offset & ~0x3U, 4U, dword);
+			/* a device in reset or D3cold reads all ones, don't keep that */
+			if (dword != ~0U) {
+				bitmap_set_nolock(idx, &vdev->cfg_shadow_valid);
+			}
+			vdev->stat.pdev_reads++;
+		} else {
+			vdev->stat.pdev_reads_avoided++;
+		}
+		val = pci_vdev_read_vcfg(vdev, offset, bytes);
+	} else {
+		val = pci_pdev_read_cfg(vdev->pdev->bdf, offset, bytes);
+		vdev->stat.pdev_reads++;
+	}
+
+	return val;
+}
+
 static int32_t read_pt_dev_cfg(struct pci_vdev *vdev, uint32_t offset,
 		uint32_t bytes, uint32_t *val)
 {
@@ -621,7 +673,7 @@ static int32_t read_pt_dev_cfg(struct pci_vdev *vdev, uint32_t offset,
 			*val = pci_vdev_read_vcfg(vdev, offset, bytes);
 		} else if (!is_quirk_ptdev(vdev)) {
 			/* passthru to physical device */
-			*val = pci_pdev_read_cfg(vdev->pdev->bdf, offset, bytes);
+			*val = read_pt_dev_cfg_shadowed(vdev, offset, bytes);
 			if ((vdev->pdev->bdf.value == CONFIG_IGD_SBDF) && (offset == PCIR_ASLS_CTL)) {
 				*val = pci_vdev_read_vcfg(vdev, offset, bytes);
 			}
@@ -652,6 +704,7 @@ static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 	spinlock_obtain(&vpci->lock);
 	vdev = find_available_vdev(vpci, bdf);
 	if (vdev != NULL) {
+		vdev->stat.cfg_reads++;
 		ret = vdev->vdev_ops->read_vdev_cfg(vdev, offset, bytes, val);
 	} else {
 		if (is_postlaunched_vm(vpci2vm(vpci))) {
@@ -679,6 +732,7 @@ static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 	spinlock_obtain(&vpci->lock);
 	vdev = find_available_vdev(vpci, bdf);
 	if (vdev != NULL) {
+		vdev->stat.cfg_writes++;
 		ret = vdev->vdev_ops->write_vdev_cfg(vdev, offset, bytes, val);
 	} else {
 		if (is_postlaunched_vm(vpci2vm(vpci))) {
@@ -86,8 +86,29 @@ struct instr_emul_vie {
 	uint64_t	gva;		/* saved gva for instruction emulation */
 };
 
+/*
+ * Per-vCPU cache of decoded instructions. The decoding only depends on the
+ * instruction bytes, the CPU mode and CS.D, so an entry is reused when the
+ * bytes fetched at the same RIP are unchanged, and replaced otherwise.
+ */
+#define VIE_CACHE_ENTRIES	8U
+struct instr_emul_vie_cache_entry {
+	uint64_t	rip;
+	uint8_t		cpu_mode;	/* enum vm_cpu_mode */
+	bool		cs_d;
+	struct instr_emul_vie vie;	/* vie.decoded is 0 if the entry is empty */
+};
+
+struct instr_emul_vie_cache {
+	struct instr_emul_vie_cache_entry entries[VIE_CACHE_ENTRIES];
+	uint64_t	hit;
+	uint64_t	miss;
+	uint64_t	invalidated;	/* misses caused by modified instruction bytes */
+};
+
 struct instr_emul_ctxt {
 	struct instr_emul_vie vie;
+	struct instr_emul_vie_cache vie_cache;
 };
 
 int32_t emulate_instruction(struct acrn_vcpu *vcpu);
@@ -223,6 +223,22 @@ struct msr_store_area {
 	uint32_t count;	/* actual count of entries to be loaded/restored during VMEntry/VMExit */
 };
 
+#define MSR_EXIT_STAT_ENTRIES	32U	/* must be a power of 2 */
+
+/* RDMSR/WRMSR VM exits of one MSR on one vCPU */
+struct msr_exit_stat {
+	uint32_t msr;
+	bool used;
+	bool read_relaxed;	/* read interception dropped at runtime */
+	uint64_t rd_cnt;
+	uint64_t wr_cnt;
+};
+
+struct msr_exit_profile {
+	struct msr_exit_stat entries[MSR_EXIT_STAT_ENTRIES];
+	uint64_t untracked;	/* exits of MSRs that found no free entry */
+};
+
 struct iwkey {
 	/* 256bit encryption key */
 	uint64_t encryption_key[4];
@@ -288,6 +304,9 @@ struct acrn_vcpu_arch {
 	/* List of MSRS to be stored and loaded on VM exits or VM entries */
 	struct msr_store_area msr_area;
 
+	/* MSR exit profiler, drives the runtime relaxation of MSR interception */
+	struct msr_exit_profile msr_prof;
+
 	/* EOI_EXIT_BITMAP buffer, for the bitmap update */
 	uint64_t eoi_exit_bitmap[EOI_EXIT_BITMAP_SIZE >> 6U];
 
@@ -687,6 +706,17 @@ void launch_vcpu(struct acrn_vcpu *vcpu);
  */
 void kick_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief kick a set of vcpus of one vm and let them handle pending events
+ *
+ * Kick the vCPUs selected by vdmask, sending at most one notification
+ * per pCPU cluster.
+ *
+ * @param[in] vm pointer to vm data structure
+ * @param[in] vdmask virtual destination cpu mask
+ */
+void kick_vcpus(struct acrn_vm *vm, uint64_t vdmask);
+
 /**
  * @brief create a vcpu for the vm and mapped to the pcpu.
  *
@@ -49,6 +49,20 @@ struct vlapic_timer {
 	uint32_t divisor_shift;
 };
 
+/*
+ * Logical destination of a vLAPIC, decoded from LDR/DFR whenever they
+ * change. A message destination address 'dest' matches when
+ * ((dest >> cluster_shift) & cluster_mask) == cluster_id and
+ * (dest & logical_mask & logical_id) != 0.
+ */
+struct vlapic_ldest {
+	uint32_t logical_id;
+	uint32_t logical_mask;
+	uint32_t cluster_id;
+	uint32_t cluster_mask;
+	uint32_t cluster_shift;
+};
+
 struct acrn_vlapic {
 	/*
 	 * Please keep 'apic_page' as the first field in
@@ -73,6 +87,8 @@ struct acrn_vlapic {
 
 	uint64_t	msr_apicbase;
 
+	struct vlapic_ldest	ldest;
+
 	const struct acrn_apicv_ops *ops;
 
 	/*
@@ -87,8 +103,11 @@ struct acrn_vlapic {
 
 
 struct acrn_vcpu;
+struct acrn_vm;
 struct acrn_apicv_ops {
-	void (*accept_intr)(struct acrn_vlapic *vlapic, uint32_t vector, bool level);
+	/* returns true if the pCPU hosting the vCPU has to be notified */
+	bool (*accept_intr)(struct acrn_vlapic *vlapic, uint32_t vector, bool level);
+	void (*notify_intr)(struct acrn_vm *vm, uint64_t vdmask);
 	void (*inject_intr)(struct acrn_vlapic *vlapic, bool guest_irq_enabled, bool injected);
 	bool (*has_pending_delivery_intr)(struct acrn_vcpu *vcpu);
 	bool (*has_pending_intr)(struct acrn_vcpu *vcpu);
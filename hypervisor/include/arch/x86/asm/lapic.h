@@ -99,10 +99,13 @@ void send_startup_ipi(uint16_t dest_pcpu_id, uint64_t cpu_startup_start_address)
 /**
  * @brief Send an IPI to multiple pCPUs
  *
+ * Destinations sharing an x2APIC cluster receive the IPI through a single
+ * logical destination mode ICR write.
+ *
  * @param[in]	dest_mask The mask of destination physical cpus
  * @param[in]	vector The vector of interrupt
  */
-void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector);
+void send_dest_ipi_mask(uint64_t dest_mask, uint32_t vector);
 
 /**
  * @brief Send an IPI to a single pCPU
@@ -126,4 +129,11 @@ void send_single_init(uint16_t pcpu_id);
 
 void kick_pcpu(uint16_t pcpu_id);
 
+/**
+ * @brief Kick multiple pCPUs, batching the notification IPIs per x2APIC cluster
+ *
+ * @param[in] pcpu_mask The mask of destination physical cpus
+ */
+void kick_pcpus(uint64_t pcpu_mask);
+
 #endif /* ARCH_X86_LAPIC_H */
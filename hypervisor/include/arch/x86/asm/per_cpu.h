@@ -26,7 +26,11 @@ struct per_cpu_region {
 	void *vmcs_run;
 #ifdef HV_DEBUG
 	struct shared_buf *sbuf[ACRN_SBUF_PER_PCPU_ID_MAX];
-	char logbuf[LOG_MESSAGE_MAX_SIZE];
+	char logbuf[LOG_MESSAGE_MAX_SIZE] __aligned(8);
+	/* hvlog sbuf position, see put_log_fmt() */
+	struct shared_buf *log_sbuf;
+	uint64_t log_wr;
+	uint64_t log_fmt_pos[LOG_FMT_TABLE_SIZE];
 	uint32_t npk_log_ref;
 #endif
 	uint64_t irq_count[NR_IRQS];
@@ -595,6 +595,20 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uin
  */
 int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Control and query the VM exit statistics
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 VMEXIT_STAT_* command to be executed
+ * @param param2 guest physical address pointing to struct acrn_vmexit_stat,
+ *             only used by VMEXIT_STAT_GET
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vmexit_stat_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 int32_t hcall_create_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 /**
  * @}
@@ -23,6 +23,47 @@
  */
 #define LOG_MESSAGE_MAX_SIZE	(4U * LOG_ENTRY_SIZE)
 
+/*
+ * Binary log record written to the hvlog sbuf, formatted by acrnlog in the
+ * Service VM. A record occupies nr_entries LOG_ENTRY_SIZE elements: this
+ * header followed by payload_len bytes of payload.
+ *  - LOG_REC_FMT: defines fmt_id, the payload is the NUL terminated format
+ *    string. It is put to the sbuf of a pcpu before the first LOG_REC_MSG
+ *    using fmt_id and carries the seq of that message. It is put again
+ *    once the reader consumed it or it got overwritten, so every LOG_REC_MSG
+ *    in an sbuf is preceded by the definition of its format in that sbuf.
+ *  - LOG_REC_MSG: the payload is the arguments of the format: 4 bytes for
+ *    %c and 32-bit integers, 8 bytes for 64-bit (l/ll) integers and a NUL
+ *    terminated string for %s.
+ * Messages whose format can't be described this way are put as text, which
+ * always starts with '['.
+ * Keep in sync with misc/debug_tools/acrn_log/acrnlog.c
+ */
+#define LOG_BIN_MAGIC		0x4e49424cU	/* "LBIN" */
+#define LOG_REC_MSG		1U
+#define LOG_REC_FMT		2U
+
+struct log_bin_hdr {
+	uint32_t magic;
+	uint8_t type;
+	uint8_t nr_entries;
+	uint8_t severity;
+	uint8_t reserved;
+	uint16_t pcpu_id;
+	uint16_t fmt_id;
+	uint32_t seq;
+	uint64_t tsc;
+	uint32_t tsc_khz;
+	uint16_t payload_len;
+	uint16_t reserved2;
+	char thread[16];
+};
+
+#define LOG_BIN_PAYLOAD_MAX	(LOG_MESSAGE_MAX_SIZE - sizeof(struct log_bin_hdr))
+
+/* Max number of formats logged in binary */
+#define LOG_FMT_TABLE_SIZE	512U
+
 #define DBG_LEVEL_LAPICPT	5U
 #if defined(HV_DEBUG)
 
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VMEXIT_STAT_H
+#define VMEXIT_STAT_H
+
+#include <types.h>
+
+struct acrn_vcpu;
+struct acrn_vm;
+struct acrn_vmexit_stat;
+
+/*
+ * Hooks of the vCPU thread loop: on_exit right after the VM exit, on_entry
+ * right before the next VM entry. Both return immediately unless collection
+ * is enabled; release builds compile them to empty functions.
+ */
+void vmexit_stat_on_exit(struct acrn_vcpu *vcpu);
+void vmexit_stat_on_entry(struct acrn_vcpu *vcpu);
+
+void vmexit_stat_set_enable(bool enable);
+bool vmexit_stat_is_enabled(void);
+void vmexit_stat_reset(void);
+int32_t vmexit_stat_get(uint16_t vm_id, struct acrn_vmexit_stat *stat);
+int32_t vmexit_stat_copy_to_guest(struct acrn_vm *vm, uint64_t gpa);
+
+#endif /* VMEXIT_STAT_H */
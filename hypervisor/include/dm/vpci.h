@@ -33,6 +33,7 @@
 #include <lib/util.h>
 #include <pci.h>
 #include <list.h>
+#include <board_info.h>
 
 #define VDEV_LIST_HASHBITS 4U
 #define VDEV_LIST_HASHSIZE (1U << VDEV_LIST_HASHBITS)
@@ -53,6 +54,17 @@ struct msix_table_entry {
 	uint32_t	vector_control;
 };
 
+/*
+ * State of a physical MSI-X table entry as last programmed by the vdev, so
+ * that mask-bit-only writes need neither a remap nor a physical re-mask.
+ */
+struct msix_entry_shadow {
+	uint64_t	addr;		/* guest message address behind the remapping */
+	uint32_t	data;		/* guest message data behind the remapping */
+	bool		remapped;	/* remapping and physical address/data are valid */
+	bool		masked;		/* physical vector is known to be masked */
+};
+
 /* MSI capability structure */
 struct pci_msi {
 	bool      is_64bit;
@@ -71,6 +83,7 @@ struct msixcap {
 
 struct pci_msix {
 	struct msix_table_entry table_entries[CONFIG_MAX_MSIX_TABLE_NUM];
+	struct msix_entry_shadow table_shadow[CONFIG_MAX_MSIX_TABLE_NUM];
 	uint64_t  mmio_gpa;
 	uint64_t  mmio_hpa;
 	uint64_t  mmio_size;
@@ -109,6 +122,19 @@ struct pci_vdev_ops {
        int32_t (*read_vdev_cfg)(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t *val);
 };
 
+/* Config space access counters of a vdev */
+struct pci_vdev_stat {
+	uint64_t cfg_reads;		/* config reads by the guest */
+	uint64_t cfg_writes;		/* config writes by the guest */
+	uint64_t pdev_reads;		/* reads forwarded to the physical device */
+	uint64_t pdev_reads_avoided;	/* reads served from the config shadow */
+	uint64_t msix_table_reads;	/* trapped reads of the MSI-X table pages */
+	uint64_t msix_table_writes;	/* trapped writes to the MSI-X table pages */
+	uint64_t msix_mask_only;	/* writes applied by flipping the physical mask bit only */
+	uint64_t msix_deferred;		/* writes to masked vectors kept away from the device */
+	uint64_t msix_remaps;		/* writes that remapped the vector and rewrote the entry */
+};
+
 struct pci_vdev {
 	uint32_t id;
 	struct acrn_vpci *vpci;
@@ -119,6 +145,14 @@ struct pci_vdev {
 
 	union pci_cfgdata cfgdata;
 
+	/*
+	 * Dwords of the first 256 bytes of the physical config space that are
+	 * read-only and shadowed in cfgdata once read (cfg_shadow_valid).
+	 */
+	uint64_t cfg_shadow_ro;
+	uint64_t cfg_shadow_valid;
+	struct pci_vdev_stat stat;
+
 	uint32_t flags;
 
 	/* The bar info of the virtual PCI device. */
@@ -180,6 +214,12 @@ struct acrn_vpci {
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
 	uint64_t vdev_bitmaps[INT_DIV_ROUNDUP(CONFIG_MAX_PCI_DEV_NUM, 64U)];
 	struct hlist_head vdevs_hlist_heads [VDEV_LIST_HASHSIZE];
+
+	/*
+	 * The vdev last found by each pCPU. vCPUs of a VM never share a pCPU,
+	 * so this is a per-vCPU cache of the last accessed BDF.
+	 */
+	struct pci_vdev *last_vdev[MAX_PCPU_NUM];
 };
 
 struct acrn_vm;
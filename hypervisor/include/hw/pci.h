@@ -194,6 +194,8 @@
 #define PCIM_PCIE_DEV_CTRL_MAX_PAYLOAD    0x00E0U
 #define PCIM_PCIE_FLRCAP      (0x1U << 28U)
 #define PCIM_PCIE_FLR         (0x1U << 15U)
+#define PCIR_PCIE_LINKCAP     0x0CU
+#define PCIR_PCIE_SLOTCAP     0x14U
 
 /* PCI Express Device Type definitions */
 #define PCIER_FLAGS                    0x2U
@@ -206,6 +208,8 @@
 #define PCIM_PCIE_DEVCAP2_ARI (0x1U << 5U)
 #define PCIR_PCIE_DEVCTL2     0x28U
 #define PCIM_PCIE_DEVCTL2_ARI (0x1U << 5U)
+#define PCIR_PCIE_LINKCAP2    0x2CU
+#define PCIR_PCIE_SLOTCAP2    0x34U
 
 /* Conventional PCI Advanced Features Capability */
 #define PCIY_AF               0x13U
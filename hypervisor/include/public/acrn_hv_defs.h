@@ -80,6 +80,7 @@
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
 #define HC_GET_HW_INFO              BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_VMEXIT_STAT_OPS          BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
@@ -233,6 +234,72 @@ struct acrn_hw_info {
 	uint16_t reserved[3];
 } __aligned(8);
 
+/* Commands of HC_VMEXIT_STAT_OPS hypercall */
+#define VMEXIT_STAT_DISABLE		0UL
+#define VMEXIT_STAT_ENABLE		1UL
+#define VMEXIT_STAT_RESET		2UL
+#define VMEXIT_STAT_GET			3UL
+
+/* Number of VMX basic exit reasons reported by VMEXIT_STAT_GET */
+#define ACRN_VMEXIT_STAT_REASONS	70U
+/* Bucket n counts VM exits whose exit->entry latency is in [2^n, 2^(n+1)) TSC cycles */
+#define ACRN_VMEXIT_STAT_HIST_BUCKETS	32U
+#define ACRN_VMEXIT_STAT_MAX_SUBS	64U
+
+/* Sub-reason types of struct acrn_vmexit_sub_stat */
+#define ACRN_VMEXIT_SUB_PIO		1U	/* key: I/O port */
+#define ACRN_VMEXIT_SUB_MMIO		2U	/* key: faulting GPA >> 12 */
+#define ACRN_VMEXIT_SUB_MSR		3U	/* key: MSR index */
+#define ACRN_VMEXIT_SUB_CPUID		4U	/* key: CPUID leaf */
+
+/**
+ * @brief Exit count of one I/O port, MMIO page, MSR or CPUID leaf
+ */
+struct acrn_vmexit_sub_stat {
+	/** one of ACRN_VMEXIT_SUB_* */
+	uint8_t type;
+
+	/** Reserved */
+	uint8_t reserved[3];
+
+	/** the port, page frame, MSR index or CPUID leaf */
+	uint32_t key;
+
+	/** number of VM exits */
+	uint64_t count;
+} __aligned(8);
+
+/**
+ * @brief VM exit statistics of one VM, summed over all physical CPUs
+ *
+ * the parameter for VMEXIT_STAT_GET command of HC_VMEXIT_STAT_OPS hypercall
+ */
+struct acrn_vmexit_stat {
+	/** [in] relative VM ID of the VM to query */
+	uint16_t vmid;
+
+	/** [out] 1 if statistics collection is enabled */
+	uint16_t enabled;
+
+	/** [out] number of valid entries in subs[] */
+	uint32_t nr_subs;
+
+	/** [out] sub-reason exits not tracked because the hypervisor table was full */
+	uint64_t sub_dropped;
+
+	/** [out] number of VM exits per basic exit reason */
+	uint64_t count[ACRN_VMEXIT_STAT_REASONS];
+
+	/** [out] TSC cycles spent from VM exit to the next VM entry, per basic exit reason */
+	uint64_t cycles[ACRN_VMEXIT_STAT_REASONS];
+
+	/** [out] log2 histogram of the exit->entry latency in TSC cycles */
+	uint64_t hist[ACRN_VMEXIT_STAT_HIST_BUCKETS];
+
+	/** [out] most frequent sub-reasons, sorted by descending count */
+	struct acrn_vmexit_sub_stat subs[ACRN_VMEXIT_STAT_MAX_SUBS];
+} __aligned(8);
+
 /**
  * Gpa to hpa translation parameter, used for HC_VM_GPA2HPA hypercall
  */
@@ -0,0 +1,11 @@
+/*
+ * Copyright (C) 2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/guest/vcpu.h>
+
+void vmexit_stat_on_exit(__unused struct acrn_vcpu *vcpu) {}
+void vmexit_stat_on_entry(__unused struct acrn_vcpu *vcpu) {}
@@ -5,6 +5,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -12,40 +13,475 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include "load_conf.h"
 #include "fsutils.h"
 #include "strutils.h"
 #include "log_sys.h"
+#include "channels.h"
 #include "crash_reclassify.h"
 
+/*
+ * All the content and mightcontent strings of all crashes are matched in a
+ * single pass over a file, with an Aho-Corasick automaton built at
+ * init_crash_reclassify(). The automaton is read-only afterwards, so files
+ * are scanned in parallel by a pool of workers.
+ */
+#define AC_ALPHABET		256
+#define AC_ALWAYS		(-2)	/* pattern id of "", which is always found */
+#define RECLASSIFY_WORKERS	4
+
+static struct {
+	int nr_states;
+	int *trans;		/* nr_states * AC_ALPHABET, failures resolved */
+	int *out;		/* pattern ending at the state, or -1 */
+	int *dict;		/* nearest state with an output on the fail chain, or 0 */
+	int nr_patterns;
+	const char **patterns;
+	size_t *pattern_len;
+} ac;
+
+/* pattern ids of crash strings, indexed by crash->id */
+static int content_pid[CRASH_MAX][CONTENT_MAX];
+static int mightcontent_pid[CRASH_MAX][EXPRESSION_MAX][CONTENT_MAX];
+
+/* the result of scanning a file: first offset of each pattern, or -1 */
+struct match_result {
+	char *path;
+	ssize_t *first;
+};
+
+/* the files scanned for a reclassification */
+struct match_set {
+	int count;
+	struct match_result *res;
+};
+
+struct scan_batch {
+	pthread_mutex_t mtx;
+	pthread_cond_t done;
+	int pending;
+};
+
+struct scan_job {
+	struct match_result *res;
+	struct scan_batch *batch;
+	struct scan_job *next;
+};
+
+static struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct scan_job *head;
+	int workers;
+} pool = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int ac_new_state(void)
+{
+	int *trans, *out, *dict;
+	int s = ac.nr_states;
+
+	trans = realloc(ac.trans, (s + 1) * AC_ALPHABET * sizeof(int));
+	if (!trans)
+		return -1;
+	ac.trans = trans;
+	out = realloc(ac.out, (s + 1) * sizeof(int));
+	if (!out)
+		return -1;
+	ac.out = out;
+	dict = realloc(ac.dict, (s + 1) * sizeof(int));
+	if (!dict)
+		return -1;
+	ac.dict = dict;
+
+	memset(&ac.trans[s * AC_ALPHABET], 0xff, AC_ALPHABET * sizeof(int));
+	ac.out[s] = -1;
+	ac.dict[s] = 0;
+	ac.nr_states++;
+	return s;
+}
+
 /**
- * Check if file contains content or not.
- * This function couldn't use for binary file.
+ * Add a pattern to the trie of the automaton.
  *
- * @param file Starting address of file cache.
- * @param content String to be searched.
+ * @param str String to be searched.
  *
- * @return 1 if find the same string, or 0 if not.
+ * @return pattern id, AC_ALWAYS for an empty string or -1 on failure.
  */
-static int has_content(const char *file, const char *content)
+static int ac_add_pattern(const char *str)
 {
-	if (content && strstr(file, content))
-		return 1;
+	const char **patterns;
+	size_t *pattern_len;
+	int i, s, next;
+	const unsigned char *c;
+
+	if (!*str)
+		return AC_ALWAYS;
+
+	for (i = 0; i < ac.nr_patterns; i++)
+		if (!strcmp(ac.patterns[i], str))
+			return i;
+
+	patterns = realloc(ac.patterns, (ac.nr_patterns + 1) * sizeof(*patterns));
+	if (!patterns)
+		return -1;
+	ac.patterns = patterns;
+	pattern_len = realloc(ac.pattern_len, (ac.nr_patterns + 1) * sizeof(*pattern_len));
+	if (!pattern_len)
+		return -1;
+	ac.pattern_len = pattern_len;
+
+	s = 0;
+	for (c = (const unsigned char *)str; *c; c++) {
+		next = ac.trans[s * AC_ALPHABET + *c];
+		if (next < 0) {
+			next = ac_new_state();
+			if (next < 0)
+				return -1;
+			ac.trans[s * AC_ALPHABET + *c] = next;
+		}
+		s = next;
+	}
+
+	ac.patterns[ac.nr_patterns] = str;
+	ac.pattern_len[ac.nr_patterns] = strlen(str);
+	ac.out[s] = ac.nr_patterns;
+	return ac.nr_patterns++;
+}
+
+/**
+ * Compute the failure links in BFS order and resolve them into the
+ * transitions, so that scanning takes exactly one transition per byte.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int ac_build(void)
+{
+	int *queue, *fail;
+	int head = 0, tail = 0;
+	int s, t, c, f;
+
+	queue = malloc(ac.nr_states * sizeof(int));
+	fail = calloc(ac.nr_states, sizeof(int));
+	if (!queue || !fail) {
+		free(queue);
+		free(fail);
+		return -1;
+	}
+
+	for (c = 0; c < AC_ALPHABET; c++) {
+		t = ac.trans[c];
+		if (t < 0) {
+			ac.trans[c] = 0;
+		} else {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+
+	while (head < tail) {
+		s = queue[head++];
+		f = fail[s];
+		ac.dict[s] = (ac.out[f] >= 0) ? f : ac.dict[f];
+		for (c = 0; c < AC_ALPHABET; c++) {
+			t = ac.trans[s * AC_ALPHABET + c];
+			if (t < 0) {
+				ac.trans[s * AC_ALPHABET + c] =
+					ac.trans[f * AC_ALPHABET + c];
+			} else {
+				fail[t] = ac.trans[f * AC_ALPHABET + c];
+				queue[tail++] = t;
+			}
+		}
+	}
+
+	free(queue);
+	free(fail);
+	return 0;
+}
+
+/**
+ * Find the first offset of every pattern in buf.
+ * Like strstr(), the scan stops at the first '\0'.
+ *
+ * @param buf Starting address of file cache.
+ * @param size Size of buf.
+ * @param[out] first First offset of each pattern, or -1 if not found.
+ */
+static void ac_scan(const char *buf, size_t size, ssize_t *first)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	int found = 0;
+	int state = 0;
+	int s, pid;
+	size_t i;
+
+	for (pid = 0; pid < ac.nr_patterns; pid++)
+		first[pid] = -1;
+
+	for (i = 0; i < size && p[i] && found < ac.nr_patterns; i++) {
+		state = ac.trans[state * AC_ALPHABET + p[i]];
+		for (s = (ac.out[state] >= 0) ? state : ac.dict[state];
+		     s > 0; s = ac.dict[s]) {
+			pid = ac.out[s];
+			if (first[pid] < 0) {
+				first[pid] = i + 1 - ac.pattern_len[pid];
+				found++;
+			}
+		}
+	}
+}
+
+/**
+ * Read a regular file of st_size bytes through fd. A file that is
+ * truncated meanwhile only gives what is left of it.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int read_reg_file(int fd, size_t st_size, unsigned long *size,
+			void **data)
+{
+	char *buf;
+	size_t len = 0;
+	ssize_t n;
+
+	buf = malloc(st_size);
+	if (!buf)
+		return -1;
+
+	while (len < st_size) {
+		n = read(fd, buf + len, st_size - len);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -1;
+		}
+		len += n;
+	}
+
+	*data = buf;
+	*size = len;
+	return 0;
+}
+
+/**
+ * Scan a file. Regular files are read at once into a buffer of the size
+ * they report, the others (e.g. nodes of sysfs or procfs, which report a
+ * zero size) are read in pieces.
+ *
+ * @param res Result with the path of the file to be scanned.
+ */
+static void scan_file(struct match_result *res)
+{
+	struct stat st;
+	unsigned long size;
+	void *cnt;
+	int fd;
+	int pid;
+	int ret;
+
+	res->first = malloc(sizeof(ssize_t) * (ac.nr_patterns ? ac.nr_patterns : 1));
+	if (!res->first) {
+		LOGE("malloc failed, error (%s)\n", strerror(errno));
+		return;
+	}
+
+	fd = open(res->path, O_RDONLY);
+	if (fd < 0) {
+		LOGE("open %s failed, error (%s)\n", res->path, strerror(errno));
+		goto fail;
+	}
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		ret = read_reg_file(fd, st.st_size, &size, &cnt);
+		close(fd);
+	} else {
+		close(fd);
+		ret = read_file(res->path, &size, &cnt);
+	}
+	if (ret == -1) {
+		LOGE("read %s failed, error (%s)\n", res->path,
+		     strerror(errno));
+		goto fail;
+	}
+	if (!size) {
+		free(cnt);
+		goto fail;
+	}
+	ac_scan(cnt, size, res->first);
+	free(cnt);
+
+	for (pid = 0; pid < ac.nr_patterns; pid++)
+		if (res->first[pid] >= 0)
+			LOGD("%s: found \"%s\" at %zd\n", res->path,
+			     ac.patterns[pid], res->first[pid]);
+	return;
+fail:
+	/* an empty or unreadable file matches nothing */
+	free(res->first);
+	res->first = NULL;
+}
+
+static void *scan_worker(void *arg __attribute__((unused)))
+{
+	struct scan_job *job;
+
+	while (1) {
+		pthread_mutex_lock(&pool.mtx);
+		while (!pool.head)
+			pthread_cond_wait(&pool.cond, &pool.mtx);
+		job = pool.head;
+		pool.head = job->next;
+		pthread_mutex_unlock(&pool.mtx);
+
+		scan_file(job->res);
+
+		pthread_mutex_lock(&job->batch->mtx);
+		if (--job->batch->pending == 0)
+			pthread_cond_signal(&job->batch->done);
+		pthread_mutex_unlock(&job->batch->mtx);
+	}
+
+	return NULL;
+}
+
+/**
+ * Scan results[0..count) on the worker pool and wait for them.
+ * Files are scanned by the caller if there is no worker.
+ */
+static void scan_files(struct match_result *res, int count)
+{
+	struct scan_batch batch;
+	struct scan_job *jobs;
+	int i;
+
+	jobs = (pool.workers && count > 1) ? calloc(count, sizeof(*jobs)) : NULL;
+	if (!jobs) {
+		for (i = 0; i < count; i++)
+			scan_file(&res[i]);
+		return;
+	}
+
+	pthread_mutex_init(&batch.mtx, NULL);
+	pthread_cond_init(&batch.done, NULL);
+	batch.pending = count;
+
+	pthread_mutex_lock(&pool.mtx);
+	for (i = 0; i < count; i++) {
+		jobs[i].res = &res[i];
+		jobs[i].batch = &batch;
+		jobs[i].next = pool.head;
+		pool.head = &jobs[i];
+	}
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mtx);
+
+	pthread_mutex_lock(&batch.mtx);
+	while (batch.pending)
+		pthread_cond_wait(&batch.done, &batch.mtx);
+	pthread_mutex_unlock(&batch.mtx);
+
+	pthread_cond_destroy(&batch.done);
+	pthread_mutex_destroy(&batch.mtx);
+	free(jobs);
+}
+
+static void free_match_set(struct match_set *set)
+{
+	int i;
+
+	for (i = 0; i < set->count; i++) {
+		free(set->res[i].path);
+		free(set->res[i].first);
+	}
+	free(set->res);
+	set->res = NULL;
+	set->count = 0;
+}
+
+/**
+ * Add files to the set, skipping the ones already in.
+ * Added files are not scanned yet.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int match_set_add_files(struct match_set *set, char **files, int count)
+{
+	struct match_result *res;
+	char *path;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < set->count; j++)
+			if (!strcmp(set->res[j].path, files[i]))
+				break;
+		if (j < set->count)
+			continue;
+
+		path = strdup(files[i]);
+		res = path ? realloc(set->res, (set->count + 1) * sizeof(*res))
+			   : NULL;
+		if (!res) {
+			LOGE("failed to add %s\n", files[i]);
+			free(path);
+			return -1;
+		}
+		set->res = res;
+		set->res[set->count].path = path;
+		set->res[set->count].first = NULL;
+		set->count++;
+	}
 
 	return 0;
 }
 
+static void free_files(char **files, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		free(files[i]);
+	free(files);
+}
+
+/**
+ * Add the files of a path fmt to the set, see match_set_add_files().
+ */
+static void match_set_add_fmt(struct match_set *set, const char *filefmt)
+{
+	char **files;
+	int count;
+
+	count = config_fmt_to_files(filefmt, &files);
+	if (count <= 0)
+		return;
+
+	match_set_add_files(set, files, count);
+	free_files(files, count);
+}
+
+static int is_found(const struct match_result *res, int pid)
+{
+	if (pid == AC_ALWAYS)
+		return 1;
+	return res->first && pid >= 0 && res->first[pid] >= 0;
+}
+
 /**
  * Check if file contains all configured contents or not.
- * This function couldn't use for binary file.
  *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param res Scan result of the file.
  *
  * @return 1 if all configured strings were found, or 0 if not.
  */
 static int crash_has_all_contents(const struct crash_t *crash,
-				const char *file)
+				const struct match_result *res)
 {
 	int id;
 	int ret = 1;
@@ -55,7 +491,7 @@ static int crash_has_all_contents(const struct crash_t *crash,
 		if (!content)
 			continue;
 
-		if (!has_content(file, content)) {
+		if (!is_found(res, content_pid[crash->id][id])) {
 			ret = 0;
 			break;
 		}
@@ -71,15 +507,13 @@ static int crash_has_all_contents(const struct crash_t *crash,
  * r_mc[exp] = has_content(mc[exp][0]) || has_content(mc[exp][1]) || ...
  * result = r_mc[0] && r_mc[1] && ...
  *
- * This function couldn't use for binary file.
- *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param res Scan result of the file.
  *
  * @return 1 if result is true, or 0 if false.
  */
 static int crash_has_mightcontents(const struct crash_t *crash,
-				const char *file)
+				const struct match_result *res)
 {
 	int ret = 1;
 	int ret_exp;
@@ -96,7 +530,7 @@ static int crash_has_mightcontents(const struct crash_t *crash,
 			if (!content)
 				continue;
 
-			if (has_content(file, content)) {
+			if (is_found(res, mightcontent_pid[crash->id][expid][cntid])) {
 				ret_exp = 1;
 				break;
 			}
@@ -115,14 +549,19 @@ static int crash_has_mightcontents(const struct crash_t *crash,
  * This function couldn't use for binary file.
  *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param res Scan result of the file.
  *
  * @return 1 if file matches these strings configured in crash, or 0 if not.
  */
-static int crash_match_content(const struct crash_t *crash, const char *file)
+static int crash_match_content(const struct crash_t *crash,
+				const struct match_result *res)
 {
-	return crash_has_all_contents(crash, file) &&
-		crash_has_mightcontents(crash, file);
+	/* an empty or unreadable file matches nothing */
+	if (!res->first)
+		return 0;
+
+	return crash_has_all_contents(crash, res) &&
+		crash_has_mightcontents(crash, res);
 }
 
 static int _get_data(const char *file, const struct crash_t *crash,
@@ -209,49 +648,85 @@ fail:
 	return -1;
 }
 
-static int crash_match_file(const struct crash_t *crash, const char *filename)
+/**
+ * Check if any file of filefmt matches the crash's content, scanning the
+ * files of filefmt that aren't in the set yet.
+ *
+ * @return 1 if matched, or 0 if not.
+ */
+static int crash_match_set(const struct crash_t *crash, const char *filefmt,
+			struct match_set *set)
 {
-	size_t size;
-	void *cnt;
+	char **files;
+	int count;
+	int scanned;
+	int i, j;
+	int ret = 0;
 
-	if (read_file(filename, &size, &cnt) == -1) {
-		LOGE("read %s failed, error (%s)\n", filename, strerror(errno));
-		return 0;
-	}
-	if (!size)
+	/* the files of filefmt may change, get them once for scan and match */
+	count = config_fmt_to_files(filefmt, &files);
+	if (count <= 0)
 		return 0;
-	if (crash_match_content(crash, cnt)) {
-		free(cnt);
-		return 1;
+
+	scanned = set->count;
+	if (match_set_add_files(set, files, count) == -1)
+		goto out;
+	scan_files(&set->res[scanned], set->count - scanned);
+
+	for (i = 0; i < count && !ret; i++) {
+		for (j = 0; j < set->count; j++) {
+			if (!strcmp(set->res[j].path, files[i])) {
+				ret = crash_match_content(crash, &set->res[j]);
+				break;
+			}
+		}
 	}
-	free(cnt);
-	return 0;
+out:
+	free_files(files, count);
+	return ret;
 }
 
 int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
 {
-	int count;
-	int i;
-	int ret = 0;
-	char **files;
+	struct match_set set = { 0, NULL };
+	int ret;
 
-	count = config_fmt_to_files(filefmt, &files);
-	if (count <= 0)
-		return ret;
-	for (i = 0; i < count; i++) {
-		if (crash_match_file(crash, files[i])) {
-			ret = 1;
-			break;
+	ret = crash_match_set(crash, filefmt, &set);
+	free_match_set(&set);
+	return ret;
+}
+
+static const char *crash_trfile_fmt(const struct crash_t *crash,
+				const char *rtrfmt)
+{
+	if (!strcmp(crash->trigger->type, "dir"))
+		return rtrfmt;
+	return crash->trigger->path;
+}
+
+/**
+ * Add the trigger files of all the descendants of crash to the set, so that
+ * they are all scanned at once on the worker pool.
+ */
+static void match_set_add_children(struct match_set *set,
+				const struct crash_t *crash, const char *rtrfmt)
+{
+	struct crash_t *child;
+	const char *trfile_fmt;
+
+	for_crash_children(child, crash) {
+		if (child->trigger) {
+			trfile_fmt = crash_trfile_fmt(child, rtrfmt);
+			if (trfile_fmt)
+				match_set_add_fmt(set, trfile_fmt);
 		}
+		match_set_add_children(set, child, rtrfmt);
 	}
-	for (i = 0; i < count; i++)
-		free(files[i]);
-	free(files);
-	return ret;
 }
 
 static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
-						const char *rtrfmt)
+						const char *rtrfmt,
+						struct match_set *set)
 {
 	struct crash_t *child;
 	struct crash_t *matched_child = NULL;
@@ -264,12 +739,11 @@ static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
 		if (!child->trigger)
 			continue;
 
-		if (!strcmp(child->trigger->type, "dir"))
-			trfile_fmt = rtrfmt;
-		else
-			trfile_fmt = child->trigger->path;
+		trfile_fmt = crash_trfile_fmt(child, rtrfmt);
+		if (!trfile_fmt)
+			continue;
 
-		if (crash_match_filefmt(child, trfile_fmt)) {
+		if (crash_match_set(child, trfile_fmt, set)) {
 			matched_child = child;
 			break;
 		}
@@ -303,25 +777,28 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 	char **trfiles;
 	void *content;
 	unsigned long size;
+	struct match_set set = { 0, NULL };
 	int i;
 
 	if (!rcrash || !data || !dsize)
 		return NULL;
 
+	/* scan all the candidate files at once */
+	match_set_add_children(&set, rcrash, rtrfile_fmt);
+	scan_files(set.res, set.count);
+
 	crash = rcrash;
 
 	while (1) {
-		crash = crash_find_matched_child(crash, rtrfile_fmt);
+		crash = crash_find_matched_child(crash, rtrfile_fmt, &set);
 		if (!crash)
 			break;
 
 		ret_crash = crash;
 	}
+	free_match_set(&set);
 
-	if (!strcmp(ret_crash->trigger->type, "dir"))
-		trfile_fmt = rtrfile_fmt;
-	else
-		trfile_fmt = ret_crash->trigger->path;
+	trfile_fmt = crash_trfile_fmt(ret_crash, rtrfile_fmt);
 
 	/* trfile may not be specified */
 	if (!trfile_fmt)
@@ -353,6 +830,38 @@ free_files:
 	return (struct crash_t *)ret_crash;
 }
 
+/**
+ * Add the content and mightcontent strings of a crash to the automaton.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int ac_add_crash(const struct crash_t *crash)
+{
+	int id, expid, cntid;
+	const char * const *exp;
+	const char *content;
+
+	for_each_content_crash(id, content, crash) {
+		content_pid[crash->id][id] = ac_add_pattern(content);
+		if (content_pid[crash->id][id] == -1)
+			return -1;
+	}
+
+	for_each_expression_crash(expid, exp, crash) {
+		if (!exp || !exp_valid(exp))
+			continue;
+
+		for_each_content_expression(cntid, content, exp) {
+			mightcontent_pid[crash->id][expid][cntid] =
+						ac_add_pattern(content);
+			if (mightcontent_pid[crash->id][expid][cntid] == -1)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * Initailize crash reclassify, we only got a root crash from channel,
  * sometimes, we need to get a more specific type.
@@ -361,11 +870,31 @@ void init_crash_reclassify(void)
 {
 	int id;
 	struct crash_t *crash;
+	pthread_t pid;
+
+	if (ac_new_state() == -1)
+		goto ac_fail;
 
 	for_each_crash(id, crash, conf) {
 		if (!crash)
 			continue;
 
+		if (ac_add_crash(crash) == -1)
+			goto ac_fail;
 		crash->reclassify = crash_reclassify_by_content;
 	}
+
+	if (ac_build() == -1)
+		goto ac_fail;
+
+	for (id = 0; id < RECLASSIFY_WORKERS; id++) {
+		if (create_detached_thread(&pid, &scan_worker, NULL))
+			break;
+		pool.workers++;
+	}
+	return;
+
+ac_fail:
+	LOGE("failed to build content matcher\n");
+	exit(EXIT_FAILURE);
 }
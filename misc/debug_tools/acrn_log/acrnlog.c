@@ -23,6 +23,40 @@
 #define LOG_INCOMPLETE_WARNING	"WARNING: logs missing here! "\
 				"Try reducing polling interval"
 
+/*
+ * Binary log record of the hypervisor, see struct log_bin_hdr in
+ * hypervisor/include/debug/logmsg.h. Keep in sync with it.
+ */
+#define HVLOG_BIN_MAGIC		0x4e49424cU	/* "LBIN" */
+#define HVLOG_REC_MSG		1U
+#define HVLOG_REC_FMT		2U
+#define HVLOG_BIN_MAX_SIZE	(4 * LOG_ELEMENT_SIZE)
+#define HVLOG_FMT_MAX		512	/* LOG_FMT_TABLE_SIZE of the hypervisor */
+/* retries to read the rest of a binary record the hypervisor is putting */
+#define HVLOG_BIN_RETRY		10
+#define HVLOG_BIN_RETRY_US	1000
+
+struct hvlog_bin_hdr {
+	__u32 magic;
+	__u8 type;
+	__u8 nr_entries;
+	__u8 severity;
+	__u8 reserved;
+	__u16 pcpu_id;
+	__u16 fmt_id;
+	__u32 seq;
+	__u64 tsc;
+	__u32 tsc_khz;
+	__u16 payload_len;
+	__u16 reserved2;
+	char thread[16];
+};
+
+/* format strings defined by the LOG_REC_FMT records, per hypervisor boot */
+struct hvlog_fmts {
+	char *fmt[HVLOG_FMT_MAX];
+};
+
 /* Count of /dev/acrn_hvlog_cur_xxx */
 static int cur_cnt,last_cnt;
 static unsigned long interval = DEFAULT_POLL_INTERVAL;
@@ -63,6 +97,7 @@ struct hvlog_msg {
 	int cpu;		/* which physical cpu output the log */
 	int sev;		/* log severity level */
 	__u64 seq;		/* sequence num, used to reorder logs */
+	int bin;		/* 1 if raw is a binary record to be formatted */
 
 	size_t len;		/* length of message raw string */
 	char raw[0];		/* raw log string, end with '\0' */
@@ -75,6 +110,7 @@ struct hvlog_msg {
 struct hvlog_dev {
 	int fd;
 	struct hvlog_msg *msg;	/* pointer to msg */
+	struct hvlog_fmts *fmts;	/* shared by the devices of a hypervisor boot */
 
 	int latched;		/* 1 if an sbuf element latched */
 	char entry_latch[LOG_ELEMENT_SIZE];	/* latch for an sbuf element */
@@ -107,6 +143,203 @@ static int get_dev_cnt(char *prefix)
 	return cnt;
 }
 
+static struct hvlog_fmts cur_fmts, last_fmts;
+
+static int hvlog_is_bin(const char *entry)
+{
+	__u32 magic;
+
+	memcpy(&magic, entry, sizeof(magic));
+	return magic == HVLOG_BIN_MAGIC;
+}
+
+/*
+ * Read the rest of the binary record whose first sbuf element is first.
+ * A format definition is recorded in dev->fmts. Return 1 if msg holds a
+ * message to be formatted by hvlog_format_msg(), 0 otherwise.
+ */
+static int hvlog_read_bin(struct hvlog_dev *dev, const char *first, struct hvlog_msg *msg)
+{
+	struct hvlog_bin_hdr hdr;
+	char *entry;
+	int i, ret, retry;
+
+	memcpy(&hdr, first, sizeof(hdr));
+	if (!hdr.nr_entries || hdr.nr_entries * LOG_ELEMENT_SIZE > HVLOG_BIN_MAX_SIZE ||
+			sizeof(hdr) + hdr.payload_len > hdr.nr_entries * LOG_ELEMENT_SIZE)
+		return 0;
+
+	memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+	memcpy(msg->raw, first, LOG_ELEMENT_SIZE);
+	for (i = 1; i < hdr.nr_entries; i++) {
+		entry = &msg->raw[i * LOG_ELEMENT_SIZE];
+		retry = 0;
+		while ((ret = read(dev->fd, entry, LOG_ELEMENT_SIZE)) == 0 &&
+				retry++ < HVLOG_BIN_RETRY)
+			usleep(HVLOG_BIN_RETRY_US);
+		if (ret != LOG_ELEMENT_SIZE)
+			return 0;
+
+		/* the rest of the record is lost, keep the next one */
+		if (hvlog_is_bin(entry)) {
+			dev->latched = 1;
+			memcpy(dev->entry_latch, entry, LOG_ELEMENT_SIZE);
+			return 0;
+		}
+	}
+
+	if (hdr.type == HVLOG_REC_FMT) {
+		if (hdr.fmt_id < HVLOG_FMT_MAX) {
+			free(dev->fmts->fmt[hdr.fmt_id]);
+			dev->fmts->fmt[hdr.fmt_id] = strndup(&msg->raw[sizeof(hdr)], hdr.payload_len);
+		}
+		return 0;
+	}
+
+	if (hdr.type != HVLOG_REC_MSG)
+		return 0;
+
+	msg->bin = 1;
+	msg->seq = hdr.seq;
+	msg->len = hdr.nr_entries * LOG_ELEMENT_SIZE;
+	return 1;
+}
+
+/*
+ * Format the arguments of a binary record with fmt, as the hypervisor's
+ * vsnprintf() would: only the d, i, u, x, X, c and s conversions take an
+ * argument. Missing arguments are printed as 0 or an empty string.
+ */
+static size_t hvlog_format_args(const char *fmt, const char *args, size_t args_len,
+				char *out, size_t size)
+{
+	const char *start;
+	char spec[32];
+	size_t len = 0, off = 0, arg_size;
+	__u64 v64;
+	__u32 v32;
+	int is_long, n;
+	char ch;
+
+	while (*fmt && len < size - 1) {
+		if (*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+
+		start = fmt++;
+		while (*fmt && strchr("#0- +", *fmt))
+			fmt++;
+		while ((*fmt >= '0' && *fmt <= '9') || *fmt == '.')
+			fmt++;
+		is_long = (*fmt == 'l');
+		while (*fmt == 'h' || *fmt == 'l')
+			fmt++;
+		ch = *fmt;
+		if (ch)
+			fmt++;
+
+		if ((size_t)(fmt - start) >= sizeof(spec)) {
+			/* not a valid specifier, printed as it is */
+			ch = '\0';
+		} else {
+			memcpy(spec, start, fmt - start);
+			spec[fmt - start] = '\0';
+		}
+
+		arg_size = is_long ? sizeof(v64) : sizeof(v32);
+		switch (ch) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'c':
+			if (ch == 'c')
+				arg_size = sizeof(v32);
+			v64 = 0;
+			v32 = 0;
+			if (off + arg_size <= args_len) {
+				if (arg_size == sizeof(v64))
+					memcpy(&v64, &args[off], sizeof(v64));
+				else
+					memcpy(&v32, &args[off], sizeof(v32));
+				off += arg_size;
+			}
+			if (arg_size == sizeof(v64))
+				n = snprintf(&out[len], size - len, spec, v64);
+			else
+				n = snprintf(&out[len], size - len, spec, v32);
+			break;
+		case 's':
+			if (off < args_len) {
+				n = snprintf(&out[len], size - len, spec, &args[off]);
+				off += strnlen(&args[off], args_len - off) + 1;
+			} else {
+				n = snprintf(&out[len], size - len, spec, "");
+			}
+			break;
+		case '%':
+			n = snprintf(&out[len], size - len, "%%");
+			break;
+		default:
+			/* print the format specifier as it is */
+			n = snprintf(&out[len], size - len, "%.*s", (int)(fmt - start), start);
+			break;
+		}
+
+		if (n < 0)
+			break;
+		len += n;
+	}
+
+	if (len >= size)
+		len = size - 1;
+	out[len] = '\0';
+	return len;
+}
+
+/* Replace the binary record of msg with its text */
+static void hvlog_format_msg(struct hvlog_msg *msg, struct hvlog_fmts *fmts)
+{
+	struct hvlog_bin_hdr hdr;
+	char text[LOG_MSG_SIZE];
+	const char *fmt;
+	char *args;
+	size_t len;
+	__u64 usec;
+
+	if (!msg->bin)
+		return;
+
+	memcpy(&hdr, msg->raw, sizeof(hdr));
+	hdr.thread[sizeof(hdr.thread) - 1] = '\0';
+	usec = hdr.tsc_khz ? (hdr.tsc / hdr.tsc_khz) * 1000 + (hdr.tsc % hdr.tsc_khz) * 1000 / hdr.tsc_khz : 0;
+	len = snprintf(text, sizeof(text), "[%lluus][cpu=%hu][%s][sev=%u][seq=%u]:",
+		       usec, hdr.pcpu_id, hdr.thread, hdr.severity, hdr.seq);
+
+	/* the payload always fits in raw, terminate its last string */
+	args = &msg->raw[sizeof(hdr)];
+	args[hdr.payload_len] = '\0';
+	fmt = (hdr.fmt_id < HVLOG_FMT_MAX) ? fmts->fmt[hdr.fmt_id] : NULL;
+	if (fmt)
+		len += hvlog_format_args(fmt, args, hdr.payload_len, &text[len], sizeof(text) - len);
+	else
+		len += snprintf(&text[len], sizeof(text) - len, "<format %u is lost>",
+				hdr.fmt_id);
+	if (len >= sizeof(text))
+		len = sizeof(text) - 1;
+
+	/* keep room for the ending '\n' as hvlog_read_dev() does */
+	if (len > LOG_MSG_SIZE - 2)
+		len = LOG_MSG_SIZE - 2;
+	memcpy(msg->raw, text, len);
+	msg->raw[len] = '\n';
+	msg->raw[len + 1] = '\0';
+	msg->len = len + 1;
+	msg->bin = 0;
+}
+
 /*
  * The function read a complete msg from acrnlog dev.
  * read one more sbuf entry if read an entry doesn't end with '\0'
@@ -121,6 +354,7 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	struct hvlog_msg *msg[2];
 	int msg_num;
 	char warn_msg[LOG_MSG_SIZE] = {0};
+	char entry[LOG_ELEMENT_SIZE];
 
 	msg[0] = dev->msg;
 	msg[1] = &dev->latched_msg;
@@ -129,7 +363,18 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	msg_num = 0;
 
 	do {
-		if (dev->latched) {
+		if (dev->latched && hvlog_is_bin(dev->entry_latch)) {
+			if (msg_num)
+				break;
+			dev->latched = 0;
+			memcpy(entry, dev->entry_latch, LOG_ELEMENT_SIZE);
+			if (hvlog_read_bin(dev, entry, msg[0]))
+				return msg[0];
+			/* a format definition or a broken record, go on reading */
+			memset(msg[0], 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+			len = LOG_ELEMENT_SIZE;
+			continue;
+		} else if (dev->latched) {
 			/* handle the latched msg first */
 			dev->latched = 0;
 			memcpy(&msg[0]->raw[msg[0]->len], dev->entry_latch,
@@ -142,6 +387,15 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 				 LOG_ELEMENT_SIZE);
 			if (!ret)
 				break;
+			/* a binary record, handle it as a new message */
+			if (hvlog_is_bin(&msg[0]->raw[msg[0]->len])) {
+				dev->latched = 1;
+				memcpy(dev->entry_latch, &msg[0]->raw[msg[0]->len],
+				       LOG_ELEMENT_SIZE);
+				memset(&msg[0]->raw[msg[0]->len], 0, LOG_ELEMENT_SIZE);
+				len = LOG_ELEMENT_SIZE;
+				continue;
+			}
 			/* do we read a new meaasge?
 			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
 			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
@@ -192,7 +446,7 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	return msg[0];
 }
 
-struct hvlog_dev *hvlog_open_dev(const char *path)
+struct hvlog_dev *hvlog_open_dev(const char *path, struct hvlog_fmts *fmts)
 {
 	struct hvlog_dev *dev;
 
@@ -202,6 +456,7 @@ struct hvlog_dev *hvlog_open_dev(const char *path)
 		goto open_dev;
 	}
 
+	dev->fmts = fmts;
 	dev->fd = open(path, O_RDONLY);
 	if (dev->fd < 0) {
 		printf("%s %d\n", __FUNCTION__, __LINE__);
@@ -373,6 +628,7 @@ static void *cur_read_func(void *arg)
 
 		last_seq = msg->seq;
 
+		hvlog_format_msg(msg, &cur_fmts);
 		write_log_file(&cur_log, msg->raw, msg->len);
 	}
 
@@ -532,7 +788,7 @@ int main(int argc, char *argv[])
 			printf("ERROR: cur hvlog path is truncated\n");
 			return -1;
 		}
-		cur[i].dev = hvlog_open_dev(name);
+		cur[i].dev = hvlog_open_dev(name, &cur_fmts);
 		if (!cur[i].dev)
 			perror(name);
 		else
@@ -547,7 +803,7 @@ int main(int argc, char *argv[])
 				printf("ERROR: last hvlog path is truncated\n");
 				return -1;
 			}
-			last[i].dev = hvlog_open_dev(name);
+			last[i].dev = hvlog_open_dev(name, &last_fmts);
 			if (!last[i].dev)
 				perror(name);
 			else
@@ -573,6 +829,7 @@ int main(int argc, char *argv[])
 			msg = get_min_seq_msg(last, cur_cnt);
 			if (!msg)
 				break;
+			hvlog_format_msg(msg, &last_fmts);
 			write_log_file(&last_log, msg->raw, msg->len);
 		}
 	}
@@ -0,0 +1,702 @@
+/*
+ * Copyright (C) 2018-2022 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrnalyze: offline analyzer of the trace files captured by acrntrace.
+ *
+ * The per-CPU trace files are memory mapped and merged by TSC with a
+ * k-way heap, so all the requested reports (vm_exit, irq, cpu_usage) are
+ * computed in one streaming pass with memory bounded by the number of
+ * input files. The reports and the CSV files have the same layout as the
+ * ones of acrnalyze.py.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define pr_fmt(fmt)		"acrnalyze: " fmt
+#define pr_err(fmt, ...)	fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+
+/* Keep in sync with hypervisor/include/debug/trace.h */
+#define TRACE_VM_EXIT			0x10U
+#define TRACE_VM_ENTER			0x11U
+#define TRACE_SCHED_NEXT		0x20U
+#define TRACE_VMEXIT_ENTRY		0x10000U
+#define TRACE_VMEXIT_EXTERNAL_INTERRUPT	(TRACE_VMEXIT_ENTRY + 0x00000001U)
+#define TRACE_VMEXIT_UNHANDLED		0x20000U
+
+#define TRACE_EVENT_MASK	0xffffffffffffUL
+#define TRACE_CPU_SHIFT		56U
+
+/* max number of vm is 16, another 1 is for hv idle */
+#define VM_NUM			16U
+
+#define DEFAULT_FREQ		"1881.6"	/* default TSC frequency of MRB in MHz */
+
+#define REPORT_VM_EXIT		(1U << 0)
+#define REPORT_IRQ		(1U << 1)
+#define REPORT_CPU_USAGE	(1U << 2)
+#define REPORT_MAX		3U
+
+/* Same layout as struct trace_entry of the hypervisor: 4 x 64bit */
+struct trace_rec {
+	uint64_t tsc;
+	uint64_t event;		/* event id in bits 0-47, pcpu id in bits 56-63 */
+	union {
+		struct {
+			uint64_t d1;
+			uint64_t d2;
+		} data;
+		char str[16];
+	} payload;
+};
+
+/* VM exit reasons in the report order of vmexit_analyze.py */
+static const struct {
+	const char *name;
+	uint64_t event;
+} vmexit_events[] = {
+	{"VMEXIT_EXCEPTION_OR_NMI",	TRACE_VMEXIT_ENTRY + 0x00U},
+	{"VMEXIT_EXTERNAL_INTERRUPT",	TRACE_VMEXIT_ENTRY + 0x01U},
+	{"VMEXIT_INTERRUPT_WINDOW",	TRACE_VMEXIT_ENTRY + 0x02U},
+	{"VMEXIT_CPUID",		TRACE_VMEXIT_ENTRY + 0x04U},
+	{"VMEXIT_RDTSC",		TRACE_VMEXIT_ENTRY + 0x10U},
+	{"VMEXIT_VMCALL",		TRACE_VMEXIT_ENTRY + 0x12U},
+	{"VMEXIT_CR_ACCESS",		TRACE_VMEXIT_ENTRY + 0x1CU},
+	{"VMEXIT_IO_INSTRUCTION",	TRACE_VMEXIT_ENTRY + 0x1EU},
+	{"VMEXIT_RDMSR",		TRACE_VMEXIT_ENTRY + 0x1FU},
+	{"VMEXIT_WRMSR",		TRACE_VMEXIT_ENTRY + 0x20U},
+	{"VMEXIT_EPT_VIOLATION",	TRACE_VMEXIT_ENTRY + 0x30U},
+	{"VMEXIT_EPT_MISCONFIGURATION",	TRACE_VMEXIT_ENTRY + 0x31U},
+	{"VMEXIT_RDTSCP",		TRACE_VMEXIT_ENTRY + 0x33U},
+	{"VMEXIT_APICV_WRITE",		TRACE_VMEXIT_ENTRY + 0x38U},
+	{"VMEXIT_APICV_ACCESS",		TRACE_VMEXIT_ENTRY + 0x39U},
+	{"VMEXIT_APICV_VIRT_EOI",	TRACE_VMEXIT_ENTRY + 0x3AU},
+	{"VMEXIT_UNHANDLED",		TRACE_VMEXIT_UNHANDLED},
+};
+
+#define NR_VMEXIT_EVENTS	(sizeof(vmexit_events) / sizeof(vmexit_events[0]))
+/* (event - TRACE_VMEXIT_ENTRY) -> index in vmexit_events + 1, 0 if not reported */
+#define VMEXIT_LOOKUP_SIZE	0x40U
+
+/* per input file (i.e. per pcpu) state of the streaming pass */
+struct trace_input {
+	const char *name;
+	const struct trace_rec *recs;
+	size_t map_size;
+	size_t nr_recs;
+	size_t pos;
+
+	/* vm_exit */
+	bool exit_seen;
+	uint64_t tsc_exit;
+	int last_exit;
+
+	/* cpu_usage */
+	bool usage_err;
+	uint64_t cpu_id;
+	uint64_t tsc_begin;
+	uint64_t tsc_end;
+	uint64_t tsc_last_sched;
+	uint64_t nr_recs_read;
+	uint64_t nr_sched;
+	uint64_t time_ambiguous;
+	uint32_t vm_prev_last;
+	uint32_t vm_next;
+	uint64_t time_vm_running[VM_NUM + 1U];
+};
+
+struct irq_count {
+	uint64_t vec;
+	uint64_t count;
+};
+
+static struct trace_input *inputs;
+static uint32_t nr_inputs;
+
+/* min-heap of input indexes, ordered by the TSC of their current record */
+static uint32_t *heap;
+static uint32_t heap_len;
+
+static uint8_t vmexit_lookup[VMEXIT_LOOKUP_SIZE];
+
+/* vm_exit report */
+static uint64_t exit_tsc_begin, exit_tsc_end, total_nr_exits;
+static uint64_t nr_exits[NR_VMEXIT_EVENTS];
+static uint64_t time_in_exit[NR_VMEXIT_EVENTS];
+
+/* irq report, vectors kept in the order of their first appearance */
+static uint64_t irq_tsc_begin, irq_tsc_end;
+static struct irq_count *irqs;
+static uint32_t nr_irqs, irqs_size;
+static uint32_t *irq_hash;	/* open addressing, index in irqs + 1 */
+static uint32_t irq_hash_size;
+
+static const char optString[] = "hi:o:f:";
+static const struct option long_opts[] = {
+	{"ifile", required_argument, NULL, 'i'},
+	{"ofile", required_argument, NULL, 'o'},
+	{"frequency", required_argument, NULL, 'f'},
+	{"vm_exit", no_argument, NULL, 'v'},
+	{"irq", no_argument, NULL, 'q'},
+	{"cpu_usage", no_argument, NULL, 'u'},
+	{NULL, 0, NULL, 0}
+};
+
+static void display_usage(void)
+{
+	printf("acrnalyze - analyze the trace data captured by acrntrace\n"
+	       "[Usage] acrnalyze [options] [value] ...\n\n"
+	       "[options]\n"
+	       "\t-h: print this message\n"
+	       "\t-i, --ifile=[string]: input file, can be given once per pcpu trace file\n"
+	       "\t-o, --ofile=[string]: output file\n"
+	       "\t-f, --frequency=[unsigned int]: TSC frequency in MHz\n"
+	       "\t--vm_exit: to generate vm_exit report\n"
+	       "\t--irq: to generate irq related report\n"
+	       "\t--cpu_usage: to generate cpu_usage report\n");
+}
+
+static int map_input(struct trace_input *in)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(in->name, O_RDONLY);
+	if (fd < 0) {
+		pr_err("Failed to open %s, errno %d\n", in->name, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		pr_err("Failed to stat %s, errno %d\n", in->name, errno);
+		close(fd);
+		return -1;
+	}
+
+	/* a trailing partial record is ignored */
+	in->nr_recs = st.st_size / sizeof(struct trace_rec);
+	if (in->nr_recs > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			pr_err("Failed to mmap %s, errno %d\n", in->name, errno);
+			close(fd);
+			return -1;
+		}
+		/* start the readahead of all the inputs at once */
+		(void)madvise(map, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+		in->recs = map;
+		in->map_size = st.st_size;
+	}
+	close(fd);
+
+	return 0;
+}
+
+static void unmap_inputs(void)
+{
+	uint32_t i;
+
+	for (i = 0U; i < nr_inputs; i++) {
+		if (inputs[i].recs)
+			munmap((void *)inputs[i].recs, inputs[i].map_size);
+	}
+}
+
+/*
+ * A record with TSC 0 terminates a trace file, e.g. the unused tail of a
+ * preallocated one.
+ */
+static inline bool input_done(const struct trace_input *in)
+{
+	return (in->pos >= in->nr_recs) || (in->recs[in->pos].tsc == 0UL);
+}
+
+/* order by TSC, then by input index so that equal TSCs stay stable */
+static inline bool heap_less(uint32_t a, uint32_t b)
+{
+	uint64_t tsc_a = inputs[a].recs[inputs[a].pos].tsc;
+	uint64_t tsc_b = inputs[b].recs[inputs[b].pos].tsc;
+
+	return (tsc_a < tsc_b) || ((tsc_a == tsc_b) && (a < b));
+}
+
+static void heap_sift_down(uint32_t i)
+{
+	uint32_t l, r, min, tmp;
+
+	while (1) {
+		l = 2U * i + 1U;
+		r = l + 1U;
+		min = i;
+		if ((l < heap_len) && heap_less(heap[l], heap[min]))
+			min = l;
+		if ((r < heap_len) && heap_less(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+static void heap_init(void)
+{
+	uint32_t i;
+
+	heap_len = 0U;
+	for (i = 0U; i < nr_inputs; i++) {
+		if (!input_done(&inputs[i]))
+			heap[heap_len++] = i;
+	}
+
+	for (i = heap_len / 2U; i > 0U; i--)
+		heap_sift_down(i - 1U);
+}
+
+static int irq_grow(void)
+{
+	uint32_t i, h, new_size = irq_hash_size ? irq_hash_size * 2U : 256U;
+	struct irq_count *new_irqs;
+	uint32_t *new_hash;
+
+	new_irqs = realloc(irqs, (new_size / 2U) * sizeof(*irqs));
+	new_hash = calloc(new_size, sizeof(*new_hash));
+	if (!new_irqs || !new_hash) {
+		free(new_hash);
+		if (new_irqs)
+			irqs = new_irqs;
+		return -1;
+	}
+
+	for (i = 0U; i < nr_irqs; i++) {
+		h = (uint32_t)(new_irqs[i].vec * 0x9E3779B97F4A7C15UL >> 32) & (new_size - 1U);
+		while (new_hash[h])
+			h = (h + 1U) & (new_size - 1U);
+		new_hash[h] = i + 1U;
+	}
+
+	free(irq_hash);
+	irqs = new_irqs;
+	irq_hash = new_hash;
+	irq_hash_size = new_size;
+	irqs_size = new_size / 2U;
+	return 0;
+}
+
+static int irq_account(uint64_t vec)
+{
+	uint32_t h, idx;
+
+	if ((nr_irqs == irqs_size) && (irq_grow() < 0))
+		return -1;
+
+	h = (uint32_t)(vec * 0x9E3779B97F4A7C15UL >> 32) & (irq_hash_size - 1U);
+	while ((idx = irq_hash[h]) != 0U) {
+		if (irqs[idx - 1U].vec == vec) {
+			irqs[idx - 1U].count++;
+			return 0;
+		}
+		h = (h + 1U) & (irq_hash_size - 1U);
+	}
+
+	irqs[nr_irqs].vec = vec;
+	irqs[nr_irqs].count = 1UL;
+	irq_hash[h] = ++nr_irqs;
+	return 0;
+}
+
+/* parse "vmN:", "vmNN" or "idle" of a TRACE_SCHED_NEXT name, -1 if invalid */
+static int parse_sched_name(const char *s)
+{
+	int vm;
+
+	if ((s[0] == 'v') && (s[1] == 'm') && (s[2] >= '0') && (s[2] <= '9')) {
+		vm = s[2] - '0';
+		if (s[3] != ':') {
+			if ((s[3] < '0') || (s[3] > '9'))
+				return -1;
+			vm = vm * 10 + (s[3] - '0');
+		}
+		return (vm < (int)VM_NUM) ? vm : -1;
+	}
+
+	if (strncmp(s, "idle", 4) == 0)
+		return VM_NUM;
+
+	return -1;
+}
+
+static void account_sched_next(struct trace_input *in, const struct trace_rec *rec)
+{
+	int vm_prev, vm_next;
+
+	in->nr_sched++;
+	vm_prev = parse_sched_name(rec->payload.str);
+	vm_next = parse_sched_name(rec->payload.str + 4);
+	if ((vm_prev < 0) || (vm_next < 0)) {
+		printf("%s: Error: trace data is not correct!\n", in->name);
+		in->usage_err = true;
+		return;
+	}
+
+	if ((in->nr_sched == 1UL) || ((uint32_t)vm_prev == in->vm_prev_last)) {
+		in->time_vm_running[vm_prev] += rec->tsc - in->tsc_last_sched;
+	} else {
+		printf("%s: record %lu: last_next =vm%u, current_prev=vm%d\n",
+			in->name, in->nr_recs_read, in->vm_prev_last, vm_prev);
+		printf("Warning: last schedule next is not the current task. Trace log is lost.\n");
+		in->time_ambiguous += rec->tsc - in->tsc_last_sched;
+	}
+
+	in->tsc_last_sched = rec->tsc;
+	in->vm_prev_last = vm_next;
+	in->vm_next = vm_next;
+}
+
+static void process_rec(uint32_t reports, struct trace_input *in, const struct trace_rec *rec)
+{
+	uint64_t event = rec->event & TRACE_EVENT_MASK;
+	uint8_t idx;
+
+	if (reports & REPORT_VM_EXIT) {
+		/* the duration of one vmexit is tsc_enter - tsc_exit, start from the first vmexit */
+		if (event == TRACE_VM_EXIT) {
+			if (exit_tsc_begin == 0UL)
+				exit_tsc_begin = rec->tsc;
+			in->exit_seen = true;
+			in->tsc_exit = rec->tsc;
+			total_nr_exits++;
+		} else if (in->exit_seen) {
+			if (event == TRACE_VM_ENTER) {
+				exit_tsc_end = rec->tsc;
+				if (in->last_exit >= 0)
+					time_in_exit[in->last_exit] += rec->tsc - in->tsc_exit;
+			} else if (event == TRACE_VMEXIT_UNHANDLED) {
+				in->last_exit = NR_VMEXIT_EVENTS - 1U;
+				nr_exits[in->last_exit]++;
+			} else if ((event >= TRACE_VMEXIT_ENTRY) &&
+					(event < TRACE_VMEXIT_ENTRY + VMEXIT_LOOKUP_SIZE)) {
+				idx = vmexit_lookup[event - TRACE_VMEXIT_ENTRY];
+				if (idx != 0U) {
+					in->last_exit = idx - 1U;
+					nr_exits[in->last_exit]++;
+				}
+			}
+		}
+	}
+
+	if (reports & REPORT_IRQ) {
+		if (irq_tsc_begin == 0UL)
+			irq_tsc_begin = rec->tsc;
+		irq_tsc_end = rec->tsc;
+		if ((event == TRACE_VMEXIT_EXTERNAL_INTERRUPT) &&
+				(irq_account(rec->payload.data.d1) < 0)) {
+			pr_err("Out of memory, irq report is incomplete\n");
+		}
+	}
+
+	if ((reports & REPORT_CPU_USAGE) && !in->usage_err) {
+		in->nr_recs_read++;
+		if (in->nr_recs_read == 1UL) {
+			in->tsc_begin = rec->tsc;
+			in->tsc_last_sched = rec->tsc;
+		}
+		in->tsc_end = rec->tsc;
+		in->cpu_id = rec->event >> TRACE_CPU_SHIFT;
+		if (event == TRACE_SCHED_NEXT)
+			account_sched_next(in, rec);
+	}
+}
+
+/* the single streaming pass: merge all the inputs by TSC and feed the reports */
+static void analyze(uint32_t reports)
+{
+	struct trace_input *in;
+	uint32_t i;
+
+	for (i = 0U; i < NR_VMEXIT_EVENTS - 1U; i++)
+		vmexit_lookup[vmexit_events[i].event - TRACE_VMEXIT_ENTRY] = i + 1U;
+	for (i = 0U; i < nr_inputs; i++)
+		inputs[i].last_exit = -1;
+
+	heap_init();
+	while (heap_len > 0U) {
+		in = &inputs[heap[0]];
+		process_rec(reports, in, &in->recs[in->pos]);
+		in->pos++;
+
+		if (input_done(in))
+			heap[0] = heap[--heap_len];
+		heap_sift_down(0U);
+	}
+}
+
+static void print_input_names(void)
+{
+	uint32_t i;
+
+	for (i = 0U; i < nr_inputs; i++)
+		printf("%s%s", (i == 0U) ? "" : " ", inputs[i].name);
+}
+
+static void report_vm_exit(FILE *csv, const char *ofile, const char *freq_str, double freq)
+{
+	uint64_t rt_cycle = exit_tsc_end - exit_tsc_begin;
+	uint64_t total_exit_time = 0UL;
+	double rt_sec, ev_freq, pct;
+	uint32_t i;
+
+	printf("VM exits analysis started... \n\tinput file: ");
+	print_input_names();
+	printf("\n\toutput file: %s.csv\n", ofile);
+
+	if (rt_cycle == 0UL) {
+		pr_err("total_run_time in cycle is 0, tsc_end %lu, tsc_begin %lu\n",
+			exit_tsc_end, exit_tsc_begin);
+		return;
+	}
+	rt_sec = (double)rt_cycle / (freq * 1000 * 1000);
+
+	for (i = 0U; i < NR_VMEXIT_EVENTS; i++)
+		total_exit_time += time_in_exit[i];
+
+	printf("Total run time: %lu cycles\n", rt_cycle);
+	printf("TSC Freq: %s MHz\n", freq_str);
+	printf("Total run time: %.6f sec\n", rt_sec);
+
+	fprintf(csv, "Run time(cycles),Run time(Sec),Freq(MHz)\r\n");
+	fprintf(csv, "%lu,%.3f,%s\r\n", rt_cycle, rt_sec, freq_str);
+
+	printf("%-28s\t%-12s\t%-12s\t%-24s\t%-16s\n", "Event", "NR_Exit",
+		"NR_Exit/Sec", "Time Consumed(cycles)", "Time percentage");
+	fprintf(csv, "Exit_Reason,NR_Exit,NR_Exit/Sec,Time Consumed(cycles),Time Percentage\r\n");
+
+	for (i = 0U; i < NR_VMEXIT_EVENTS; i++) {
+		ev_freq = (double)nr_exits[i] / rt_sec;
+		pct = (double)time_in_exit[i] * 100 / (double)rt_cycle;
+		printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n", vmexit_events[i].name,
+			nr_exits[i], ev_freq, time_in_exit[i], pct);
+		fprintf(csv, "%s,%lu,%.2f,%lu,%2.2f\r\n", vmexit_events[i].name,
+			nr_exits[i], ev_freq, time_in_exit[i], pct);
+	}
+
+	ev_freq = (double)total_nr_exits / rt_sec;
+	pct = (double)total_exit_time * 100 / (double)rt_cycle;
+	printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n", "Total",
+		total_nr_exits, ev_freq, total_exit_time, pct);
+	fprintf(csv, "Total,%lu,%.2f,%lu,%2.2f\r\n", total_nr_exits, ev_freq, total_exit_time, pct);
+}
+
+static void report_irq(FILE *csv, const char *ofile, double freq)
+{
+	uint64_t rt_cycle = irq_tsc_end - irq_tsc_begin;
+	double rt_sec, pct;
+	uint32_t i;
+
+	printf("IRQ analysis started... \n\tinput file: ");
+	print_input_names();
+	printf("\n\toutput file: %s.csv\n", ofile);
+
+	if (rt_cycle == 0UL) {
+		pr_err("Total run time in cycle is 0, TSC end %lu, TSC begin %lu\n",
+			irq_tsc_end, irq_tsc_begin);
+		return;
+	}
+	rt_sec = (double)rt_cycle / (freq * 1000 * 1000);
+
+	printf("%-8s\t%-8s\t%-8s\n", "Vector", "Count", "NR_Exit/Sec");
+	fprintf(csv, "Vector,NR_Exit,NR_Exit/Sec\r\n");
+	for (i = 0U; i < nr_irqs; i++) {
+		pct = (double)irqs[i].count / rt_sec;
+		printf("0x%08lx\t%-8lu\t%-8.2f\n", irqs[i].vec, irqs[i].count, pct);
+		fprintf(csv, "0x%08lx,%lu,%.2f\r\n", irqs[i].vec, irqs[i].count, pct);
+	}
+}
+
+static void report_cpu_usage(FILE *csv, const char *ofile, const char *freq_str, double freq,
+		struct trace_input *in)
+{
+	uint64_t stat_tsc, run_tsc;
+	double stat_sec, run_sec, run_per;
+	uint32_t vmid;
+
+	printf("VM CPU usage analysis started... \n\tinput file: %s\n"
+	       "\toutput file: %s.csv\n", in->name, ofile);
+
+	if (in->nr_recs_read == 0UL) {
+		printf("The input trace file is empty. The corresponding CPU may be offline.\n");
+		return;
+	}
+	if (in->usage_err)
+		return;
+
+	printf("Start trace %lu tsc cycle\n", in->tsc_begin);
+	printf("End trace %lu tsc cycle\n", in->tsc_end);
+	stat_tsc = in->tsc_end - in->tsc_begin;
+	if (stat_tsc == 0UL) {
+		pr_err("total_run_time in statistic is 0, tsc_end %lu, tsc_begin %lu\n",
+			in->tsc_end, in->tsc_begin);
+		return;
+	}
+
+	if (in->nr_sched == 0UL) {
+		printf("There is no context switch in HV scheduling during this period. "
+		       "This CPU may be exclusively owned by one vm.\n"
+		       "The CPU usage is 100%%\n");
+		return;
+	}
+	if (in->time_ambiguous > 0UL)
+		printf("Warning: ambiguous running time: %lu tsc cycle, occupying %2.2f%% cpu.\n",
+			in->time_ambiguous, (double)in->time_ambiguous * 100 / (double)stat_tsc);
+
+	/* the last time */
+	in->time_vm_running[in->vm_next] += in->tsc_end - in->tsc_last_sched;
+
+	stat_sec = (double)stat_tsc / (freq * 1000 * 1000);
+	printf("Total run time: %lu cpu cycles\n", stat_tsc);
+	printf("TSC Freq: %s MHz\n", freq_str);
+	printf("Total run time: %.2f sec\n", stat_sec);
+	printf("Total trace items: %lu\n", in->nr_recs_read);
+	printf("Total scheduling trace: %lu\n", in->nr_sched);
+
+	fprintf(csv, "Total run time(tsc cycles),Total run time(sec),Freq(MHz)\r\n");
+	fprintf(csv, "%lu,%.2f,%s\r\n", stat_tsc, stat_sec, freq_str);
+
+	printf("%-28s\t%-12s\t%-12s\t%-24s\t%-16s\n", "PCPU ID", "VM ID",
+		"VM Running/sec", "VM Running(tsc cycles)", "CPU Usage");
+	fprintf(csv, "PCPU ID,VM_ID,Time Consumed/sec,Time Consumed(tsc cycles),CPU Usage%%\r\n");
+
+	for (vmid = 0U; vmid <= VM_NUM; vmid++) {
+		run_tsc = in->time_vm_running[vmid];
+		run_per = (double)run_tsc * 100 / (double)stat_tsc;
+		run_sec = (double)run_tsc / (freq * 1000 * 1000);
+		if (vmid != VM_NUM) {
+			printf("%-28lu\t%-12u\t%-10.2f\t%-24lu\t%-2.2f%%\n",
+				in->cpu_id, vmid, run_sec, run_tsc, run_per);
+			fprintf(csv, "%lu,%u,%.2f,%lu,%2.2f\r\n",
+				in->cpu_id, vmid, run_sec, run_tsc, run_per);
+		} else {
+			printf("%-28lu\t%-12s\t%-10.2f\t%-24lu\t%-2.2f%%\n",
+				in->cpu_id, "Idle", run_sec, run_tsc, run_per);
+			fprintf(csv, "%lu,Idle,%.2f,%lu,%2.2f\r\n",
+				in->cpu_id, run_sec, run_tsc, run_per);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ofile = NULL, *freq_str = DEFAULT_FREQ;
+	uint32_t order[REPORT_MAX], nr_order = 0U, reports = 0U, report, i, j;
+	char csv_name[PATH_MAX];
+	double freq;
+	FILE *csv;
+	int opt, ret = 0;
+
+	inputs = calloc(argc, sizeof(*inputs));
+	heap = calloc(argc, sizeof(*heap));
+	if (!inputs || !heap) {
+		pr_err("Out of memory\n");
+		return ENOMEM;
+	}
+
+	while ((opt = getopt_long(argc, argv, optString, long_opts, NULL)) != -1) {
+		report = 0U;
+		switch (opt) {
+		case 'i':
+			inputs[nr_inputs++].name = optarg;
+			break;
+		case 'o':
+			ofile = optarg;
+			break;
+		case 'f':
+			freq_str = optarg;
+			break;
+		case 'v':
+			report = REPORT_VM_EXIT;
+			break;
+		case 'q':
+			report = REPORT_IRQ;
+			break;
+		case 'u':
+			report = REPORT_CPU_USAGE;
+			break;
+		case 'h':
+			display_usage();
+			return 0;
+		default:
+			display_usage();
+			return EINVAL;
+		}
+
+		/* reports are generated in the order they are requested */
+		if (report && !(reports & report)) {
+			reports |= report;
+			order[nr_order++] = report;
+		}
+	}
+
+	for (; optind < argc; optind++)
+		inputs[nr_inputs++].name = argv[optind];
+
+	freq = strtod(freq_str, NULL);
+	if ((nr_inputs == 0U) || !ofile || (reports == 0U) || !(freq > 0)) {
+		pr_err("input file, output file, a valid frequency and one report are required\n");
+		display_usage();
+		return EINVAL;
+	}
+
+	for (i = 0U; i < nr_inputs; i++) {
+		if (map_input(&inputs[i]) < 0) {
+			ret = EIO;
+			goto out;
+		}
+	}
+
+	analyze(reports);
+
+	snprintf(csv_name, sizeof(csv_name), "%s.csv", ofile);
+	csv = fopen(csv_name, "a");
+	if (!csv) {
+		printf("Output File Error: %s\n", strerror(errno));
+		ret = EIO;
+		goto out;
+	}
+
+	for (i = 0U; i < nr_order; i++) {
+		if (order[i] == REPORT_VM_EXIT) {
+			report_vm_exit(csv, ofile, freq_str, freq);
+		} else if (order[i] == REPORT_IRQ) {
+			report_irq(csv, ofile, freq);
+		} else {
+			for (j = 0U; j < nr_inputs; j++)
+				report_cpu_usage(csv, ofile, freq_str, freq, &inputs[j]);
+		}
+	}
+	fclose(csv);
+
+out:
+	unmap_inputs();
+	free(irq_hash);
+	free(irqs);
+	free(heap);
+	free(inputs);
+	return ret;
+}
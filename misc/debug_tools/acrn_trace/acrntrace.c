@@ -30,10 +30,12 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hcrt:a:";
+static const char optString[] = "i:hcrt:a:m:";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags = FLAG_CLEAR_BUF;
+/* growth step of the memory mapped trace files, 0 to write() the trace files */
+static size_t mmap_out_step = 0;
 static char trace_file_dir[TRACE_FILE_DIR_LEN];
 
 static reader_struct *reader;
@@ -44,14 +46,16 @@ static struct bitmask *cpu_bitmask = NULL;
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-m size] [-ch]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
 	       "\t-c: clear the buffered old data (deprecated)\n"
 	       "\t-r: capture the buffered old data instead of clearing it\n"
-	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n");
+	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n"
+	       "\t-m: size_in_MB: copy trace data into memory mapped trace files growing by\n"
+	       "\t    size_in_MB [1-%d] instead of writing them\n", MMAP_OUT_MAX_MB);
 }
 
 static void timer_handler(union sigval sv)
@@ -130,6 +134,15 @@ static int parse_opt(int argc, char *argv[])
 		case 'a':
 			cpu_bitmask = numa_parse_cpustring_all(optarg);
 			break;
+		case 'm':
+			ret = strtol(optarg, NULL, 10);
+			if (ret <= 0 || ret > MMAP_OUT_MAX_MB) {
+				pr_err("'-m' require integer between [1-%d]\n", MMAP_OUT_MAX_MB);
+				return -EINVAL;
+			}
+			mmap_out_step = (size_t)ret << 20;
+			pr_dbg("Memory mapped trace files grow by %dMB\n", ret);
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -217,11 +230,62 @@ static int create_trace_file_dir(char *dir)
 	return err;
 }
 
+/* grow the memory mapped trace file by mmap_out_step bytes */
+static int grow_out_map(param_t *param)
+{
+	size_t new_size = param->out_map_size + mmap_out_step;
+	void *map;
+
+	if (ftruncate(param->trace_fd, new_size) < 0) {
+		pr_err("Failed to grow trace file of cpu %u, errno %d\n", param->devid, errno);
+		return -1;
+	}
+
+	if (param->out_map)
+		map = mremap(param->out_map, param->out_map_size, new_size, MREMAP_MAYMOVE);
+	else
+		map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, param->trace_fd, 0);
+	if (map == MAP_FAILED) {
+		pr_err("Failed to map trace file of cpu %u, errno %d\n", param->devid, errno);
+		return -1;
+	}
+
+	param->out_map = map;
+	param->out_map_size = new_size;
+	return 0;
+}
+
+/*
+ * Move all readable trace data of the sbuf to the trace file: either one
+ * writev() of the (at most two) readable spans, or a copy into the memory
+ * mapped trace file.
+ */
+static int export_trace_data(param_t *param)
+{
+	size_t copied;
+	int ret = 0;
+
+	if (mmap_out_step == 0)
+		return sbuf_write_bulk(param->trace_fd, param->sbuf);
+
+	do {
+		if (param->out_len == param->out_map_size) {
+			ret = grow_out_map(param);
+			if (ret < 0)
+				break;
+		}
+		copied = sbuf_copy_bulk(param->sbuf, param->out_map + param->out_len,
+				param->out_map_size - param->out_len);
+		param->out_len += copied;
+		ret += copied;
+	} while ((copied > 0) && (param->out_len == param->out_map_size));
+
+	return ret;
+}
+
 /* function executed in each consumer thread */
 static void reader_fn(param_t * param)
 {
-	int ret;
-	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
@@ -235,10 +299,7 @@ static void reader_fn(param_t * param)
 		sbuf_clear_buffered(sbuf);
 
 	while (1) {
-		do {
-			ret = sbuf_write(fd, sbuf);
-		} while (ret > 0);
-
+		(void)export_trace_data(param);
 		usleep(period);
 	}
 }
@@ -272,12 +333,13 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 	pr_dbg("sbuf[%d]:\nmagic_num: %lx\nele_num: %u\n ele_size: %u\n",
 	       dev_id, reader->param.sbuf->magic, reader->param.sbuf->ele_num,
 	       reader->param.sbuf->ele_size);
+	reader->param.overrun_base = reader->param.sbuf->overrun_cnt;
 
 	if(snprintf(trace_file_name, TRACE_FILE_NAME_LEN, "%s/%d", trace_file_dir,
 		 dev_id) >= TRACE_FILE_NAME_LEN)
 		printf("WARN: trace file name is truncated\n");
 	reader->param.trace_fd = open(trace_file_name,
-					O_WRONLY | O_CREAT | O_TRUNC, 0644);
+					O_RDWR | O_CREAT | O_TRUNC, 0644);
 	if (!reader->param.trace_fd) {
 		pr_err("Failed to open %s, err %d\n", trace_file_name, errno);
 		return -3;
@@ -295,6 +357,15 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 	return 0;
 }
 
+/* Return the number of trace events the hypervisor overwrote since the reader started */
+static uint32_t reader_lost_events(const reader_struct *reader)
+{
+	if (!reader->param.sbuf)
+		return 0;
+
+	return reader->param.sbuf->overrun_cnt - reader->param.overrun_base;
+}
+
 static void destory_reader(reader_struct * reader)
 {
 	if (reader->thrd) {
@@ -305,6 +376,18 @@ static void destory_reader(reader_struct * reader)
 			reader->thrd = 0;
 	}
 
+	/* drain what was traced since the last poll */
+	if (!reader->thrd && reader->param.sbuf && reader->param.trace_fd > 0)
+		(void)export_trace_data(&reader->param);
+
+	if (reader->param.out_map) {
+		munmap(reader->param.out_map, reader->param.out_map_size);
+		reader->param.out_map = NULL;
+		if (ftruncate(reader->param.trace_fd, reader->param.out_len) < 0)
+			pr_err("Failed to truncate trace file of cpu %u, errno %d\n",
+				reader->param.devid, errno);
+	}
+
 	if (reader->param.sbuf) {
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
@@ -320,20 +403,33 @@ static void destory_reader(reader_struct * reader)
 	}
 }
 
-static void handle_on_exit(void)
+static void destory_readers(void)
 {
-	uint32_t dev_id;
+	uint32_t dev_id, lost;
+	uint64_t total_lost = 0;
+
+	foreach_dev(dev_id) {
+		if (numa_bitmask_isbitset(cpu_bitmask, dev_id)) {
+			lost = reader_lost_events(&reader[dev_id]);
+			if (lost)
+				pr_info("cpu %u: %u trace events lost (sbuf overrun)\n", dev_id, lost);
+			total_lost += lost;
+			destory_reader(&reader[dev_id]);
+		}
+	}
 
+	pr_info("%lu trace events lost in total\n", total_lost);
+}
+
+static void handle_on_exit(void)
+{
 	/* if nothing to release */
 	if (!(flags & FLAG_TO_REL))
 		return;
 
 	pr_info("exiting - to release resources...\n");
 
-	foreach_dev(dev_id) {
-		if (numa_bitmask_isbitset(cpu_bitmask, dev_id))
-			destory_reader(&reader[dev_id]);
-	}
+	destory_readers();
 }
 
 static void signal_exit_handler(int sig)
@@ -406,10 +502,7 @@ int main(int argc, char *argv[])
 		printf("q <enter> to quit:\n");
 
  out_free:
-	foreach_dev(dev_id) {
-		if (numa_bitmask_isbitset(cpu_bitmask, dev_id))
-			destory_reader(&reader[dev_id]);
-	}
+	destory_readers();
 
 	free(reader);
 	flags &= ~FLAG_TO_REL;
@@ -23,6 +23,7 @@
 #define DEV_PATH_LEN		20
 #define TIME_STR_LEN		16
 #define CMD_MAX_LEN		48
+#define MMAP_OUT_MAX_MB		1024	/* max growth step of memory mapped trace files */
 
 #define pr_fmt(fmt)             "acrntrace: " fmt
 #define pr_info(fmt, ...)       printf(pr_fmt(fmt), ##__VA_ARGS__)
@@ -76,6 +77,10 @@ typedef struct {
 	int trace_fd;
 	shared_buf_t *sbuf;
 	pthread_mutex_t *sbuf_lock;
+	uint32_t overrun_base;	/* sbuf->overrun_cnt when the reader started */
+	uint8_t *out_map;	/* memory mapped trace file, NULL if not used */
+	size_t out_map_size;
+	size_t out_len;		/* bytes of trace data in out_map */
 } param_t;
 
 typedef struct {
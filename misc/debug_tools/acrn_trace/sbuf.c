@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 #include "sbuf.h"
 #include <errno.h>
 
@@ -71,6 +72,122 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 	return sbuf->ele_size;
 }
 
+/*
+ * Describe the readable data of sbuf: one span from head to tail, or two
+ * spans when the data wraps around the end of the ring. At most max_bytes
+ * (rounded down to whole elements) are described. The tail is sampled once
+ * with acquire semantics so the elements before it are fully written.
+ *
+ * Return the number of spans, the new head is returned in *new_head.
+ */
+static int sbuf_get_spans(shared_buf_t *sbuf, struct iovec iov[2],
+		size_t max_bytes, uint32_t *new_head)
+{
+	void *base = (void *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t head = sbuf->head;
+	uint32_t tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	size_t len, budget;
+	int cnt = 0;
+
+	*new_head = head;
+	if ((head == tail) || (sbuf->ele_size == 0))
+		return 0;
+
+	budget = max_bytes - (max_bytes % sbuf->ele_size);
+	len = (tail > head) ? (tail - head) : (sbuf->size - head);
+	if (len > budget)
+		len = budget;
+	if (len > 0) {
+		iov[cnt].iov_base = base + head;
+		iov[cnt].iov_len = len;
+		cnt++;
+		budget -= len;
+		*new_head = sbuf_next_ptr(head, len, sbuf->size);
+	}
+
+	if ((tail < head) && (*new_head == 0) && (tail > 0) && (budget > 0)) {
+		len = (tail > budget) ? budget : tail;
+		iov[cnt].iov_base = base;
+		iov[cnt].iov_len = len;
+		cnt++;
+		*new_head = len;
+	}
+
+	return cnt;
+}
+
+/*
+ * Write all readable elements of sbuf to fd with a single writev() in the
+ * common case, instead of one write() per element as sbuf_write() does.
+ *
+ * Return the number of bytes written, 0 if sbuf is empty, or a negative
+ * value on error.
+ */
+int sbuf_write_bulk(int fd, shared_buf_t *sbuf)
+{
+	struct iovec iov[2], *cur = iov;
+	uint32_t new_head;
+	ssize_t ret;
+	size_t total = 0;
+	int cnt;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	cnt = sbuf_get_spans(sbuf, iov, sbuf->size, &new_head);
+	while (cnt > 0) {
+		ret = writev(fd, cur, cnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("Failed to write: errno %d\n", errno);
+			return -1;
+		}
+
+		total += ret;
+		/* skip what a short write has already consumed */
+		while ((cnt > 0) && ((size_t)ret >= cur->iov_len)) {
+			ret -= cur->iov_len;
+			cur++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			cur->iov_base += ret;
+			cur->iov_len -= ret;
+		}
+	}
+
+	__atomic_store_n(&sbuf->head, new_head, __ATOMIC_RELEASE);
+
+	return total;
+}
+
+/*
+ * Copy readable elements of sbuf to dst, at most room bytes.
+ *
+ * Return the number of bytes copied.
+ */
+size_t sbuf_copy_bulk(shared_buf_t *sbuf, void *dst, size_t room)
+{
+	struct iovec iov[2];
+	uint32_t new_head;
+	size_t total = 0;
+	int i, cnt;
+
+	if (sbuf == NULL)
+		return 0;
+
+	cnt = sbuf_get_spans(sbuf, iov, room, &new_head);
+	for (i = 0; i < cnt; i++) {
+		memcpy(dst + total, iov[i].iov_base, iov[i].iov_len);
+		total += iov[i].iov_len;
+	}
+
+	__atomic_store_n(&sbuf->head, new_head, __ATOMIC_RELEASE);
+
+	return total;
+}
+
 int sbuf_clear_buffered(shared_buf_t *sbuf)
 {
 	if (sbuf == NULL)
@@ -8,6 +8,7 @@
 #define SHARED_BUF_H
 
 #include <linux/types.h>
+#include <stddef.h>
 
 #define SBUF_MAGIC 0x5aa57aa71aa13aa3
 #define SBUF_MAX_SIZE   (1ULL << 22)
@@ -67,5 +68,7 @@ static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
 
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data);
 int sbuf_write(int fd, shared_buf_t *sbuf);
+int sbuf_write_bulk(int fd, shared_buf_t *sbuf);
+size_t sbuf_copy_bulk(shared_buf_t *sbuf, void *dst, size_t room);
 int sbuf_clear_buffered(shared_buf_t *sbuf);
 #endif /* SHARED_BUF_H */
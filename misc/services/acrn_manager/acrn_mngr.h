@@ -27,9 +27,14 @@ header file.
 #define ACRN_DM_BASE_PATH	"/run/acrn"
 #define ACRN_DM_SOCK_PATH	"/run/acrn/mngr"
 
+#define ACRND_NAME		"acrnd"
+
 /* TODO: Revisit PARAM_LEN and see if size can be reduced */
 #define PARAM_LEN	256
 
+/* VMs carried by one ACRND_LIST ack, sized to keep mngr_msg unchanged */
+#define ACRND_LIST_MAX	((PARAM_LEN - 8) / (MAX_VM_NAME_LEN + 1))
+
 struct mngr_msg {
 	unsigned long long magic;	/* Make sure you get a mngr_msg */
 	unsigned int msgid;
@@ -39,6 +44,9 @@ struct mngr_msg {
 		/* Arguments to rescan virtio-blk device */
 		char devargs[PARAM_LEN];
 
+		/* req of DM_BALLOON, memory in MB to take back */
+		unsigned long balloon_mb;
+
 		/* ack of DM_STOP, DM_SUSPEND, DM_RESUME,
 		   ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
 		int err;
@@ -79,6 +87,28 @@ struct mngr_msg {
 			time_t t;
 		} rtc_timer;
 
+		/* req of DM_NOTIFY, no ack */
+		struct req_dm_notify {
+			char name[MAX_VM_NAME_LEN];
+			int state;	/* VM_SUSPEND_* of the DM */
+		} dm_notify;
+
+		/* req of ACRND_LIST */
+		struct req_acrnd_list {
+			unsigned int start;	/* index of the first VM wanted */
+		} acrnd_list;
+
+		/* ack of ACRND_LIST */
+		struct ack_acrnd_list {
+			unsigned int gen;	/* changes whenever the list changes */
+			unsigned short total;	/* VMs known to acrnd */
+			unsigned short nr;	/* VMs in this ack, from start */
+			struct {
+				char name[MAX_VM_NAME_LEN];
+				unsigned char state;	/* enum vm_state */
+			} vms[ACRND_LIST_MAX];
+		} acrnd_list_ack;
+
 	} data;
 };
 
@@ -96,6 +126,7 @@ enum dm_msgid {
 	DM_RESUME,		/* Resume this UOS from suspend state */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_BALLOON,		/* Set the virtio-balloon target of this UOS */
 	DM_MAX,
 };
 
@@ -127,6 +158,11 @@ enum sos_lcs_msgid {
 	REBOOT,
 };
 
+/* Acrnctl -> Acrnd, numbered after the ids above to keep them stable */
+enum acrnctl_msgid {
+	ACRND_LIST = REBOOT + 1,	/* Acrnctl ask names and states of all VMs */
+};
+
 /* helper functions */
 #define MNGR_SERVER	1	/* create a server fd, which you can add handlers onto it */
 #define MNGR_CLIENT	0	/* create a client, just send req and read ack */
@@ -12,7 +12,9 @@
 #include <limits.h>
 #include <pthread.h>
 #include <dirent.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include "acrnctl.h"
 #include "acrn_mngr.h"
 #include "mevent.h"
@@ -28,9 +30,24 @@ const char *state_str[] = {
 
 /* List head of all vm */
 static pthread_mutex_t vmmngr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vmmngr_cond = PTHREAD_COND_INITIALIZER;
 struct vmmngr_list_struct vmmngr_head = { NULL };
 static unsigned long update_count = 0;
 
+/* set in acrnd: vmmngr_head is maintained by vmmngr_watch_func() */
+static int cache_live = 0;
+/* never ask acrnd for the list from within acrnd itself */
+static int query_acrnd = 1;
+/* bumped on each change of the cached list, see ACRND_LIST */
+static unsigned int cache_gen = 0;
+
+/* with vmmngr_mutex held */
+static void _cache_changed(void)
+{
+	cache_gen++;
+	pthread_cond_broadcast(&vmmngr_cond);
+}
+
 struct vmmngr_struct *vmmngr_find(const char *name)
 {
 	struct vmmngr_struct *s;
@@ -277,13 +294,381 @@ static void _remove_dead_vm(void)
 	}
 };
 
+/* Fill vmmngr_head from acrnd's cache, with vmmngr_mutex held */
+static int _query_acrnd_list(void)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_acrnd_list *vms = &ack.data.acrnd_list_ack;
+	struct vmmngr_struct *vm;
+	char name[MAX_VM_NAME_LEN];
+	unsigned int start = 0, gen = 0;
+	int fd, i, retry = 3, ret = -1;
+
+	fd = mngr_open_un(ACRND_NAME, MNGR_CLIENT);
+	if (fd < 0)
+		return -1;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = ACRND_LIST;
+
+	while (1) {
+		req.timestamp = time(NULL);
+		req.data.acrnd_list.start = start;
+
+		if (mngr_send_msg(fd, &req, &ack, 1) != sizeof(ack))
+			goto out;
+
+		if (start == 0) {
+			gen = vms->gen;
+		} else if (vms->gen != gen) {
+			/* list changed between two acks, read it again */
+			if (--retry == 0)
+				goto out;
+			start = 0;
+			update_count++;
+			continue;
+		}
+
+		if (vms->nr > ACRND_LIST_MAX)
+			goto out;
+
+		for (i = 0; i < vms->nr; i++) {
+			memcpy(name, vms->vms[i].name, sizeof(name) - 1);
+			name[sizeof(name) - 1] = '\0';
+
+			vm = vmmngr_find(name);
+			if (!vm) {
+				vm = calloc(1, sizeof(*vm));
+				if (!vm) {
+					printf("%s: Failed to alloc mem for %s\n", __func__, name);
+					goto out;
+				}
+				memcpy(vm->name, name, sizeof(vm->name) - 1);
+				LIST_INSERT_HEAD(&vmmngr_head, vm, list);
+			}
+
+			if (vms->vms[i].state <= VM_UNTRACKED && vms->vms[i].state != VM_PAUSED)
+				vm->state_tmp = vms->vms[i].state;
+			else
+				vm->state_tmp = VM_STATE_UNKNOWN;
+			vm->update = update_count;
+		}
+		start += vms->nr;
+		if (!vms->nr || start >= vms->total)
+			break;
+	}
+
+	ret = 0;
+ out:
+	mngr_close(fd);
+	return ret;
+}
+
 void vmmngr_update(void)
 {
 	pthread_mutex_lock(&vmmngr_mutex);
+	/* acrnd keeps the list current itself */
+	if (!cache_live) {
+		update_count++;
+		/* one round trip to acrnd, fall back to scanning if it's not running */
+		if (!query_acrnd || _query_acrnd_list()) {
+			update_count++;
+			_scan_added_vm();
+			_scan_alive_vm();
+		}
+		_remove_dead_vm();
+	}
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+unsigned int vmmngr_generation(void)
+{
+	unsigned int gen;
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	gen = cache_gen;
+	pthread_mutex_unlock(&vmmngr_mutex);
+
+	return gen;
+}
+
+int vmmngr_wait_change(unsigned int *gen, unsigned int timeout_ms)
+{
+	struct timespec ts;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	while (cache_gen == *gen && ret == 0)
+		ret = pthread_cond_timedwait(&vmmngr_cond, &vmmngr_mutex, &ts);
+	*gen = cache_gen;
+	pthread_mutex_unlock(&vmmngr_mutex);
+
+	return ret ? -1 : 0;
+}
+
+void vmmngr_lock(void)
+{
+	pthread_mutex_lock(&vmmngr_mutex);
+}
+
+void vmmngr_unlock(void)
+{
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+static struct vmmngr_struct *_vmmngr_get(const char *name)
+{
+	struct vmmngr_struct *vm;
+
+	vm = vmmngr_find(name);
+	if (vm)
+		return vm;
+
+	vm = calloc(1, sizeof(*vm));
+	if (!vm) {
+		printf("%s: Failed to alloc mem for %s\n", __func__, name);
+		return NULL;
+	}
+	memcpy(vm->name, name, sizeof(vm->name) - 1);
+	vm->state = VM_STATE_UNKNOWN;
+	LIST_INSERT_HEAD(&vmmngr_head, vm, list);
+
+	return vm;
+}
+
+static void _vmmngr_put(struct vmmngr_struct *vm)
+{
+	LIST_REMOVE(vm, list);
+	printf("%s: Removed dead %s\n", __func__, vm->name);
+	free(vm);
+}
+
+static int _has_launch_script(const char *name)
+{
+	char path[PATH_LEN + sizeof(ACRN_CONF_PATH_ADD) + 4];
+
+	snprintf(path, sizeof(path), "%s/%s.sh", ACRN_CONF_PATH_ADD, name);
+	return !access(path, F_OK);
+}
+
+/* A DM monitor socket came or went under ACRN_DM_SOCK_PATH */
+static void _on_sock_event(const struct inotify_event *ev)
+{
+	struct vmmngr_struct *vm;
+	char name[PATH_LEN] = {};
+	int pid;
+
+	if (_get_vmname_pid(ev->name, name, sizeof(name), &pid) < 0)
+		return;
+	name[MAX_VM_NAME_LEN - 1] = '\0';
+
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		/* a DM has just started, it runs until it tells otherwise */
+		vm = _vmmngr_get(name);
+		if (vm)
+			vm->state = VM_STARTED;
+	} else {
+		vm = vmmngr_find(name);
+		if (!vm)
+			return;
+		if (_has_launch_script(name))
+			vm->state = VM_CREATED;
+		else
+			_vmmngr_put(vm);
+	}
+}
+
+/* A launch script came or went under ACRN_CONF_PATH_ADD */
+static void _on_conf_event(const struct inotify_event *ev)
+{
+	struct vmmngr_struct *vm;
+	char name[PATH_LEN] = {};
+	char suffix[PATH_LEN] = {};
+
+	if (strnlen(ev->name, ev->len) >= sizeof(name))
+		return;
+	if (_get_vmname_suffix(ev->name, name, sizeof(name), suffix, sizeof(suffix)) < 0)
+		return;
+	name[MAX_VM_NAME_LEN - 1] = '\0';
+
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		vm = _vmmngr_get(name);
+		if (vm && vm->state == VM_STATE_UNKNOWN)
+			vm->state = VM_CREATED;
+	} else {
+		/* a running VM stays listed until its DM exits */
+		vm = vmmngr_find(name);
+		if (vm && vm->state == VM_CREATED)
+			_vmmngr_put(vm);
+	}
+}
+
+static void _rescan_all(void)
+{
 	update_count++;
 	_scan_added_vm();
 	_scan_alive_vm();
 	_remove_dead_vm();
+}
+
+static int inotify_fd = -1;
+static int sock_wd = -1;
+static int conf_wd = -1;
+
+static void *vmmngr_watch_func(void *arg)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+
+	while (1) {
+		len = read(inotify_fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Read inotify events");
+			break;
+		}
+
+		pthread_mutex_lock(&vmmngr_mutex);
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				/* events were dropped, the directories tell the truth */
+				_rescan_all();
+				continue;
+			}
+			if (!ev->len)
+				continue;
+
+			if (ev->wd == sock_wd)
+				_on_sock_event(ev);
+			else if (ev->wd == conf_wd)
+				_on_conf_event(ev);
+		}
+		_cache_changed();
+		pthread_mutex_unlock(&vmmngr_mutex);
+	}
+
+	/* lost track of changes, go back to scanning on each update */
+	pthread_mutex_lock(&vmmngr_mutex);
+	cache_live = 0;
+	pthread_mutex_unlock(&vmmngr_mutex);
+	return NULL;
+}
+
+int vmmngr_cache_init(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+	int ret;
+
+	query_acrnd = 0;
+
+	if (check_dir(ACRN_CONF_PATH, CHK_CREAT) || check_dir(ACRN_CONF_PATH_ADD, CHK_CREAT))
+		return -1;
+
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		perror("inotify_init1");
+		return -1;
+	}
+
+	/* watch before the first scan, so nothing happens unseen in between */
+	sock_wd = inotify_add_watch(inotify_fd, ACRN_DM_SOCK_PATH,
+			IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+	conf_wd = inotify_add_watch(inotify_fd, ACRN_CONF_PATH_ADD,
+			IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+	if (sock_wd < 0 || conf_wd < 0) {
+		perror("inotify_add_watch");
+		goto err;
+	}
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	_rescan_all();
+	_cache_changed();
+	cache_live = 1;
+	pthread_mutex_unlock(&vmmngr_mutex);
+
+	ret = pthread_attr_init(&attr);
+	if (ret)
+		goto err_live;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&tid, &attr, vmmngr_watch_func, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret)
+		goto err_live;
+
+	return 0;
+
+ err_live:
+	pthread_mutex_lock(&vmmngr_mutex);
+	cache_live = 0;
+	pthread_mutex_unlock(&vmmngr_mutex);
+ err:
+	close(inotify_fd);
+	inotify_fd = -1;
+	return -1;
+}
+
+/* DM_NOTIFY: a DM reports a change of its VM_SUSPEND_* mode */
+void vmmngr_notify_state(const char *vmname, int dm_state)
+{
+	struct vmmngr_struct *vm;
+	char name[MAX_VM_NAME_LEN];
+
+	memcpy(name, vmname, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	vm = _vmmngr_get(name);
+	if (vm) {
+		switch (dm_state) {
+		case VM_SUSPEND_NONE:
+			vm->state = VM_STARTED;
+			break;
+		case VM_SUSPEND_SUSPEND:
+			vm->state = VM_SUSPENDED;
+			break;
+		default:
+			/* stopping or resetting, the monitor socket tells when it's gone */
+			break;
+		}
+		_cache_changed();
+	}
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+/* ACRND_LIST: copy VMs from index @start onwards into one ack */
+void vmmngr_pack_list(struct ack_acrnd_list *vms, unsigned int start)
+{
+	struct vmmngr_struct *vm;
+	unsigned int i = 0;
+
+	memset(vms, 0, sizeof(*vms));
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	vms->gen = cache_gen;
+	LIST_FOREACH(vm, &vmmngr_head, list) {
+		if (i >= start && vms->nr < ACRND_LIST_MAX) {
+			memcpy(vms->vms[vms->nr].name, vm->name, sizeof(vms->vms[0].name) - 1);
+			vms->vms[vms->nr].state = vm->state;
+			vms->nr++;
+		}
+		i++;
+	}
+	vms->total = i;
 	pthread_mutex_unlock(&vmmngr_mutex);
 }
 
@@ -380,6 +765,8 @@ int stop_vm(const char *vmname, int force)
 	req.timestamp = time(NULL);
 	req.data.acrnd_stop.force = force;
 
+	/* stays an error if the DM can't be reached */
+	ack.data.err = -1;
 	send_msg(vmname, &req, &ack);
 	if (ack.data.err) {
 		printf("Error happens when try to stop vm. errno(%d)\n",
@@ -400,6 +787,8 @@ int resume_vm(const char *vmname, unsigned reason)
 
 	req.data.reason = reason;
 
+	/* stays an error if the DM can't be reached */
+	ack.data.err = -1;
 	send_msg(vmname, &req, &ack);
 
 	if (ack.data.err) {
@@ -428,3 +817,24 @@ int blkrescan_vm(const char *vmname, char *devargs)
 
 	return ack.data.err;
 }
+
+int balloon_vm(const char *vmname, unsigned long target_mb)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BALLOON;
+	req.timestamp = time(NULL);
+	req.data.balloon_mb = target_mb;
+
+	/* stays an error if the DM can't be reached */
+	ack.data.err = -1;
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to set balloon target of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
@@ -10,6 +10,7 @@
  * Author: Tao Yuhong <yuhong.tao@intel.com>
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -34,6 +35,7 @@
 #define ADD_DESC       "Add one virtual machine with SCRIPTS and OPTIONS"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define BALLOON_DESC   "Set the memory in MB virtual machine VM_NAME gives back through virtio-balloon"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -427,6 +429,33 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_balloon(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	unsigned long target_mb;
+	char *end;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for balloon\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	errno = 0;
+	target_mb = strtoul(argv[CMD_ARGS], &end, 10);
+	if (errno || end == argv[CMD_ARGS] || *end != '\0') {
+		printf("invalid size %s\n", argv[CMD_ARGS]);
+		return -1;
+	}
+
+	return balloon_vm(argv[VM_NAME], target_mb);
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -533,6 +562,11 @@ static int acrnctl_do_del(int argc, char *argv[])
 		return -1;
 	}
 	system(cmd);
+	if (snprintf(cmd, sizeof(cmd), "rm -f %s/%s.deps", ACRN_CONF_PATH_ADD, argv[1]) >= sizeof(cmd)) {
+		printf("WARN: cmd is truncated\n");
+		return -1;
+	}
+	system(cmd);
 	if (del_runC(argv[1]) < 0) {
 		printf("ERROR: del runC failed!\n");
 		return -1;
@@ -641,6 +675,18 @@ static int valid_blkrescan_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_balloon_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME size_in_MB";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "launch_scripts options";
@@ -683,6 +729,7 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("add", acrnctl_do_add, ADD_DESC, valid_add_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("balloon", acrnctl_do_balloon, BALLOON_DESC, valid_balloon_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
@@ -45,6 +45,26 @@ int shell_cmd(const char *cmd, char *outbuf, int len);
  */
 void vmmngr_update(void);
 
+/* vmmngr_head may change under a tracking thread once vmmngr_cache_init()
+ * succeeds, so walk it between vmmngr_lock() and vmmngr_unlock()
+ */
+void vmmngr_lock(void);
+void vmmngr_unlock(void);
+
+/* Sleep until the list differs from generation @gen, up to @timeout_ms.
+ * @gen is updated to the current generation, returns -1 on timeout
+ */
+unsigned int vmmngr_generation(void);
+int vmmngr_wait_change(unsigned int *gen, unsigned int timeout_ms);
+
+/* acrnd only: keep vmmngr_head current from inotify events on the socket
+ * and launch script directories plus DM_NOTIFY from each DM, instead of
+ * rescanning on every vmmngr_update()
+ */
+int vmmngr_cache_init(void);
+void vmmngr_notify_state(const char *vmname, int dm_state);
+void vmmngr_pack_list(struct ack_acrnd_list *list, unsigned int start);
+
 struct vmmngr_list_struct {
 	struct vmmngr_struct *lh_first;
 };
@@ -58,5 +78,6 @@ int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
 int blkrescan_vm(const char *vmname, char *devargs);
+int balloon_vm(const char *vmname, unsigned long target_mb);
 
 #endif				/* _ACRNCTL_H_ */
@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -21,10 +22,13 @@
 #include "acrn_mngr.h"
 #include "ioc.h"
 
-#define ACRND_NAME		"acrnd"
 #define SERVICE_VM_LCS_SOCK	"service-vm-lcs"
 #define HW_IOC_PATH		"/dev/cbc-early-signals"
 #define VMS_STOP_TIMEOUT	20U /* Time to wait VMs to stop */
+#define VM_LAUNCH_TIMEOUT	60U /* Time to wait a VM to come up */
+#define MAX_VM_DEPS		8
+#define MAX_VM_JOBS		64
+#define ACRND_TIMING_FILE	ACRN_DM_BASE_PATH "/acrnd_timing"
 #define SOCK_TIMEOUT		2U
 
 /* acrnd worker timer */
@@ -46,8 +50,10 @@ static LIST_HEAD(acrnd_work_list, acrnd_work) work_head;
 static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_mutex_t acrnd_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t acrnd_resume_mutex = PTHREAD_MUTEX_INITIALIZER;
 static unsigned int acrnd_stop_timeout;
 static unsigned char platform_has_hw_ioc;
+static int max_jobs;	/* VMs to start or stop at a time */
 
 static int sigterm = 0; /* Exit acrnd when recevied SIGTERM and stop all vms */
 
@@ -142,10 +148,11 @@ void acrnd_vm_timer_func(struct work_arg *arg)
 	}
 
 	vmmngr_update();
+	vmmngr_lock();
 	vm = vmmngr_find(arg->name);
 	if (!vm) {
 		printf("%s: Can't find %s\n", __func__, arg->name);
-		return;
+		goto out;
 	}
 
 	switch (vm->state) {
@@ -160,6 +167,8 @@ void acrnd_vm_timer_func(struct work_arg *arg)
 	default:
 		printf("%s: Unknown vm state %ld\n", __func__, vm->state);
 	}
+ out:
+	vmmngr_unlock();
 }
 
 static pthread_mutex_t timer_file_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -251,65 +260,388 @@ static void acrnd_run_vm(char *name)
 	exit(0);
 }
 
-static int active_all_vms(void)
+/* VM start/resume/stop jobs, run in parallel up to max_jobs at a time and
+ * ordered by [vmname].deps under ACRN_CONF_PATH_ADD: it lists the VMs
+ * (separated by whitespaces) to be up before [vmname] starts, and to be
+ * stopped only after [vmname] has stopped.
+ */
+enum vm_job_op {
+	JOB_START = 0,
+	JOB_RESUME,
+	JOB_STOP,
+};
+
+enum vm_job_phase {
+	JOB_PENDING = 0,	/* waiting for its dependencies or a free slot */
+	JOB_RUNNING,		/* request issued, waiting for the VM to get there */
+	JOB_DONE,
+	JOB_FAILED,
+};
+
+static const char *job_op_str[] = {
+	[JOB_START] = "start",
+	[JOB_RESUME] = "resume",
+	[JOB_STOP] = "stop",
+};
+
+struct vm_job {
+	char name[MAX_VM_NAME_LEN];
+	int op;
+	int phase;
+	pid_t pid;		/* launch script of JOB_START */
+	char deps[MAX_VM_DEPS][MAX_VM_NAME_LEN];
+	int ndeps;
+
+	/* phase timings */
+	struct timespec queued;
+	struct timespec issued;
+	struct timespec done;
+};
+
+static long ts_diff_ms(const struct timespec *a, const struct timespec *b)
 {
-	struct vmmngr_struct *vm;
-	int ret = 0;
-	pid_t pid;
-	unsigned reason = 0;
+	return (b->tv_sec - a->tv_sec) * 1000L + (b->tv_nsec - a->tv_nsec) / 1000000L;
+}
 
-	vmmngr_update();
+static void load_vm_deps(struct vm_job *job)
+{
+	char path[PATH_LEN + sizeof(ACRN_CONF_PATH_ADD) + 8];
+	char tok[PATH_LEN];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s.deps", ACRN_CONF_PATH_ADD, job->name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		switch (vm->state) {
-		case VM_CREATED:
-			pid = fork();
-			if (!pid)
-				acrnd_run_vm(vm->name);
+	while (fscanf(fp, "%127s", tok) == 1) {
+		if (job->ndeps == MAX_VM_DEPS) {
+			fprintf(stderr, "%s: more than %d dependencies, ignore the rest\n",
+					job->name, MAX_VM_DEPS);
 			break;
-		case VM_SUSPENDED:
-			if (platform_has_hw_ioc) {
-				reason = get_sos_wakeup_reason();
+		}
+		strncpy(job->deps[job->ndeps], tok, MAX_VM_NAME_LEN - 1);
+		job->ndeps++;
+	}
+
+	fclose(fp);
+}
+
+static struct vm_job *find_vm_job(struct vm_job *jobs, int njobs, const char *name)
+{
+	int i;
+
+	for (i = 0; i < njobs; i++)
+		if (!strcmp(jobs[i].name, name))
+			return &jobs[i];
+	return NULL;
+}
+
+static int vm_job_depends_on(struct vm_job *job, const char *name)
+{
+	int i;
+
+	for (i = 0; i < job->ndeps; i++)
+		if (!strcmp(job->deps[i], name))
+			return 1;
+	return 0;
+}
+
+/* 1 if @job can be issued now, 0 if it has to wait, -1 if it never can */
+static int vm_job_ready(struct vm_job *jobs, int njobs, struct vm_job *job)
+{
+	struct vm_job *dep;
+	int i;
+
+	if (job->op == JOB_STOP) {
+		/* whoever depends on us stops first */
+		for (i = 0; i < njobs; i++) {
+			dep = &jobs[i];
+			if (dep != job && dep->phase < JOB_DONE
+					&& vm_job_depends_on(dep, job->name))
+				return 0;
+		}
+		return 1;
+	}
+
+	/* dependencies not in this run are running already, or not ours */
+	for (i = 0; i < job->ndeps; i++) {
+		dep = find_vm_job(jobs, njobs, job->deps[i]);
+		if (!dep || dep == job)
+			continue;
+		if (dep->phase == JOB_FAILED)
+			return -1;
+		if (dep->phase != JOB_DONE)
+			return 0;
+	}
+	return 1;
+}
+
+static void issue_vm_job(struct vm_job *job, unsigned reason)
+{
+	int err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->issued);
+	job->phase = JOB_RUNNING;
+
+	switch (job->op) {
+	case JOB_START:
+		job->pid = fork();
+		if (!job->pid)
+			acrnd_run_vm(job->name);
+		err = (job->pid < 0);
+		break;
+	case JOB_RESUME:
+		err = resume_vm(job->name, reason);
+		break;
+	case JOB_STOP:
+		err = stop_vm(job->name, 0);
+		break;
+	}
+
+	if (err) {
+		fprintf(stderr, "Failed to %s vm %s\n", job_op_str[job->op], job->name);
+		job->done = job->issued;
+		job->phase = JOB_FAILED;
+	}
+}
+
+/* Has the VM of a running job got where it was asked to? */
+static void check_vm_job(struct vm_job *job, const struct timespec *now, unsigned timeout)
+{
+	struct vmmngr_struct *vm;
+	int phase = JOB_RUNNING;
+
+	vmmngr_lock();
+	vm = vmmngr_find(job->name);
+	switch (job->op) {
+	case JOB_START:
+	case JOB_RESUME:
+		if (vm && vm->state == VM_STARTED)
+			phase = JOB_DONE;
+		break;
+	case JOB_STOP:
+		if (!vm || vm->state == VM_CREATED)
+			phase = JOB_DONE;
+		break;
+	}
+	vmmngr_unlock();
+
+	/* the launch script quit before its DM came up */
+	if (phase == JOB_RUNNING && job->op == JOB_START
+			&& waitpid(job->pid, NULL, WNOHANG) == job->pid) {
+		fprintf(stderr, "Launch script of vm %s exited\n", job->name);
+		phase = JOB_FAILED;
+	}
+
+	if (phase == JOB_RUNNING && ts_diff_ms(&job->issued, now) >= timeout * 1000L) {
+		fprintf(stderr, "Timeout(%u sec) to %s vm %s\n", timeout,
+				job_op_str[job->op], job->name);
+		phase = JOB_FAILED;
+	}
+
+	if (phase != JOB_RUNNING) {
+		job->done = *now;
+		job->phase = phase;
+	}
+}
+
+static void report_vm_jobs(struct vm_job *jobs, int njobs)
+{
+	FILE *fp;
+	time_t t = time(NULL);
+	int i;
+
+	fp = fopen(ACRND_TIMING_FILE, "a");
+
+	for (i = 0; i < njobs; i++) {
+		printf("vm %s %s %s: wait %ldms, %s %ldms\n", jobs[i].name,
+			job_op_str[jobs[i].op],
+			jobs[i].phase == JOB_DONE ? "done" : "failed",
+			ts_diff_ms(&jobs[i].queued, &jobs[i].issued),
+			job_op_str[jobs[i].op],
+			ts_diff_ms(&jobs[i].issued, &jobs[i].done));
+		if (fp)
+			fprintf(fp, "%ld\t%s\t%s\t%s\t%ld\t%ld\n", t, jobs[i].name,
+				job_op_str[jobs[i].op],
+				jobs[i].phase == JOB_DONE ? "done" : "failed",
+				ts_diff_ms(&jobs[i].queued, &jobs[i].issued),
+				ts_diff_ms(&jobs[i].issued, &jobs[i].done));
+	}
+
+	if (fp)
+		fclose(fp);
+}
+
+/* Run all @jobs to completion, return the number of failed ones */
+static int run_vm_jobs(struct vm_job *jobs, int njobs, unsigned reason, unsigned timeout)
+{
+	struct timespec now;
+	unsigned int gen = vmmngr_generation();
+	int i, ready, running, pending, failed = 0, issued;
+
+	for (i = 0; i < njobs; i++) {
+		load_vm_deps(&jobs[i]);
+		clock_gettime(CLOCK_MONOTONIC, &jobs[i].queued);
+	}
+
+	while (1) {
+		vmmngr_update();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		running = 0;
+		pending = 0;
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].phase == JOB_RUNNING)
+				check_vm_job(&jobs[i], &now, timeout);
+			if (jobs[i].phase == JOB_RUNNING)
+				running++;
+		}
+
+		issued = 0;
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].phase != JOB_PENDING)
+				continue;
+			ready = vm_job_ready(jobs, njobs, &jobs[i]);
+			if (ready < 0) {
+				fprintf(stderr, "Dependency of vm %s failed\n", jobs[i].name);
+				jobs[i].issued = jobs[i].done = now;
+				jobs[i].phase = JOB_FAILED;
+				issued++;
+			} else if (ready && running < max_jobs) {
+				issue_vm_job(&jobs[i], reason);
+				if (jobs[i].phase == JOB_RUNNING)
+					running++;
+				issued++;
+			} else {
+				pending++;
 			}
-			ret += resume_vm(vm->name, reason);
+		}
+
+		if (!running && !pending)
 			break;
-		default:
-			printf("%s: Unkown vm state %ld\n", __func__, vm->state);
+
+		/* nothing in flight and nothing can go: a dependency cycle */
+		if (!running && !issued) {
+			fprintf(stderr, "Dependency cycle among vms, ignore the order\n");
+			for (i = 0; i < njobs && running < max_jobs; i++) {
+				if (jobs[i].phase != JOB_PENDING)
+					continue;
+				issue_vm_job(&jobs[i], reason);
+				if (jobs[i].phase == JOB_RUNNING)
+					running++;
+			}
+			continue;
 		}
+
+		/* all just issued failed at once, more may be ready now */
+		if (!running)
+			continue;
+
+		/* woken up by VM state changes, or each second to rescan */
+		vmmngr_wait_change(&gen, 1000);
 	}
 
-	return ret ? -1 : 0;
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].phase == JOB_FAILED)
+			failed++;
+
+	report_vm_jobs(jobs, njobs);
+	return failed;
 }
 
-static void stop_all_vms(void)
+/* Queue a job of @op for each VM in one of @states (a bitmap of 1 << state) */
+static struct vm_job *alloc_vm_jobs(unsigned long states, int op, int *njobs)
 {
 	struct vmmngr_struct *vm;
-	int err;
+	struct vm_job *jobs = NULL;
+	int n = 0;
 
 	vmmngr_update();
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		err = stop_vm(vm->name, 0);
-		if (err != 0) {
-			fprintf(stderr, "Fail to send stop cmd to vm %s\n", vm->name);
-		} else {
-			printf("Send stop cmd to vm %s successfully\n", vm->name);
+	vmmngr_lock();
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		n++;
+
+	if (n)
+		jobs = calloc(n, sizeof(*jobs));
+	n = 0;
+	if (jobs) {
+		LIST_FOREACH(vm, &vmmngr_head, list) {
+			if (!(states & (1UL << vm->state)))
+				continue;
+			memcpy(jobs[n].name, vm->name, sizeof(jobs[n].name));
+			jobs[n].op = op;
+			n++;
 		}
 	}
+	vmmngr_unlock();
+
+	*njobs = n;
+	return jobs;
 }
 
-static int wakeup_suspended_vms(unsigned wakeup_reason)
+static int active_all_vms(void)
 {
 	struct vmmngr_struct *vm;
-	int ret = 0;
+	struct vm_job *jobs;
+	int njobs, i, ret = 0;
+	unsigned reason = 0;
 
-	vmmngr_update();
+	jobs = alloc_vm_jobs((1UL << VM_CREATED) | (1UL << VM_SUSPENDED), JOB_START, &njobs);
+	if (!jobs)
+		return 0;
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		if (vm->state == VM_SUSPENDED)
-			ret += resume_vm(vm->name, wakeup_reason);
+	vmmngr_lock();
+	for (i = 0; i < njobs; i++) {
+		vm = vmmngr_find(jobs[i].name);
+		if (vm && vm->state == VM_SUSPENDED)
+			jobs[i].op = JOB_RESUME;
+	}
+	vmmngr_unlock();
+
+	if (platform_has_hw_ioc) {
+		reason = get_sos_wakeup_reason();
 	}
 
+	run_vm_jobs(jobs, njobs, reason, VM_LAUNCH_TIMEOUT);
+
+	/* a VM failing to boot is no reason for acrnd to quit, a failed resume is */
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].op == JOB_RESUME && jobs[i].phase == JOB_FAILED)
+			ret = -1;
+
+	free(jobs);
+	return ret;
+}
+
+static void stop_all_vms(void)
+{
+	struct vm_job *jobs;
+	int njobs;
+
+	jobs = alloc_vm_jobs((1UL << VM_STARTED) | (1UL << VM_SUSPENDED), JOB_STOP, &njobs);
+	if (!jobs)
+		return;
+
+	if (run_vm_jobs(jobs, njobs, 0, VMS_STOP_TIMEOUT))
+		fprintf(stderr, "Not all vms are stopped\n");
+
+	free(jobs);
+}
+
+static int wakeup_suspended_vms(unsigned wakeup_reason)
+{
+	struct vm_job *jobs;
+	int njobs, ret;
+
+	jobs = alloc_vm_jobs(1UL << VM_SUSPENDED, JOB_RESUME, &njobs);
+	if (!jobs)
+		return 0;
+
+	ret = run_vm_jobs(jobs, njobs, wakeup_reason, VM_LAUNCH_TIMEOUT);
+	free(jobs);
+
 	return ret ? -1 : 0;
 }
 
@@ -353,7 +685,9 @@ static void handle_timer_req(struct mngr_msg *msg, int client_fd, void *param)
 	ack.data.err = -1;
 
 	vmmngr_update();
+	vmmngr_lock();
 	vm = vmmngr_find(msg->data.acrnd_timer.name);
+	vmmngr_unlock();
 	if (!vm) {
 		printf("%s: Can't find %s\n", __func__, msg->data.acrnd_timer.name);
 		goto reply_ack;
@@ -456,26 +790,33 @@ static int store_timer_list(void)
 static int check_vms_status(unsigned int status)
 {
 	struct vmmngr_struct *s;
+	int ret = 0;
 
+	vmmngr_lock();
 	LIST_FOREACH(s, &vmmngr_head, list)
-	    if (s->state != status)
-		return -1;
+	    if (s->state != status) {
+		ret = -1;
+		break;
+	    }
+	vmmngr_unlock();
 
-	return 0;
+	return ret;
 }
 
 static int wait_for_stop(unsigned int timeout)
 {
-	unsigned long t = timeout;
+	struct timespec start, now;
+	unsigned int gen = vmmngr_generation();
+	long left;
 
 	/*Let ospm stopping User VMs */
+	printf("Waiting %u seconds for all vms enter S3/S5 state\n", timeout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	/* list and update the vm status */
+	/* list and update the vm status, on each change of it */
 	do {
 		vmmngr_update();
 
-		printf("Waiting %lu seconds for all vms enter S3/S5 state\n", t);
-
 		if (check_vms_status(VM_CREATED) == 0) {
 			printf("All vms have entered S5 state successfully\n");
 			return SHUTDOWN;
@@ -486,9 +827,14 @@ static int wait_for_stop(unsigned int timeout)
 			return SUSPEND;
 		}
 
-		sleep(1);
-	}
-	while (t--);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = timeout * 1000L - ts_diff_ms(&start, &now);
+		if (left <= 0)
+			break;
+
+		/* wake up each second at least, to rescan if acrnd isn't tracking */
+		vmmngr_wait_change(&gen, left > 1000 ? 1000 : left);
+	} while (1);
 
 	return -1;
 }
@@ -584,15 +930,18 @@ static void handle_acrnd_stop(struct mngr_msg *msg, int client_fd, void *param)
 	_handle_acrnd_stop(msg->data.acrnd_stop.timeout);
 }
 
-void handle_acrnd_resume(struct mngr_msg *msg, int client_fd, void *param)
+/* An ACRND_RESUME request, handled on its own thread */
+struct acrnd_resume_work {
+	struct mngr_msg msg;
+	int client_fd;		/* dup of the requester's fd, -1 if none */
+};
+
+/* Wake the User VMs up, return the error to ack */
+static int acrnd_resume_vms(void)
 {
-	struct mngr_msg ack;
 	struct stat st;
 	int wakeup_reason = 0;
-
-	ack.msgid = msg->msgid;
-	ack.timestamp = msg->timestamp;
-	ack.data.err = -1;
+	int err = -1;
 
 	/* acrnd get wakeup_reason from sos lcs */
 	if (platform_has_hw_ioc) {
@@ -604,24 +953,107 @@ void handle_acrnd_resume(struct mngr_msg *msg, int client_fd, void *param)
 		/* wakeup by RTC timer */
 		if (!stat(ACRN_CONF_TIMER_LIST, &st)
 			&& S_ISREG(st.st_mode)) {
-			ack.data.err = load_timer_list();
-			if (ack.data.err == 0) {
+			err = load_timer_list();
+			if (err == 0) {
 				printf("Resumed User VM by RTC timer, try do works!\n");
 				/* load timers successfully */
 				try_do_works();
-				goto reply_ack;
+				goto out;
 			}
 		}
 
 		perror("Error to load timers, wakeup all VMs");
-		ack.data.err = wakeup_suspended_vms(wakeup_reason);	
+		err = wakeup_suspended_vms(wakeup_reason);
 	} else {
 		printf("Resumed User VM, by ignition button\n");
-		ack.data.err = wakeup_suspended_vms(wakeup_reason);
+		err = wakeup_suspended_vms(wakeup_reason);
 	}
 
-reply_ack:
+out:
 	unlink(ACRN_CONF_TIMER_LIST);
+	return err;
+}
+
+static void *acrnd_resume_thread(void *arg)
+{
+	struct acrnd_resume_work *work = arg;
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = work->msg.msgid;
+	ack.timestamp = work->msg.timestamp;
+
+	/* one resume at a time, a second request waits for the first */
+	pthread_mutex_lock(&acrnd_resume_mutex);
+	ack.data.err = acrnd_resume_vms();
+	pthread_mutex_unlock(&acrnd_resume_mutex);
+
+	if (work->client_fd >= 0) {
+		mngr_send_msg(work->client_fd, &ack, NULL, 0);
+		close(work->client_fd);
+	}
+	free(work);
+	return NULL;
+}
+
+/*
+ * Resuming waits for the VMs to report DM_NOTIFY, which comes through the
+ * same poll thread as this request. So the VMs are resumed on a detached
+ * thread that acks the request once they are up.
+ */
+void handle_acrnd_resume(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct acrnd_resume_work *work;
+	struct mngr_msg ack;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int rc = -1;
+
+	work = calloc(1, sizeof(*work));
+	if (work) {
+		work->msg = *msg;
+		/* the requester may hang up meanwhile, keep its socket valid */
+		work->client_fd = (client_fd > 0) ? dup(client_fd) : -1;
+
+		rc = pthread_attr_init(&attr);
+		if (!rc) {
+			rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			if (!rc)
+				rc = pthread_create(&tid, &attr, acrnd_resume_thread, work);
+			pthread_attr_destroy(&attr);
+		}
+		if (rc) {
+			if (work->client_fd >= 0)
+				close(work->client_fd);
+			free(work);
+		}
+	}
+
+	if (rc) {
+		fprintf(stderr, "Failed to invoke handle_acrnd_resume\n");
+		ack.magic = MNGR_MSG_MAGIC;
+		ack.msgid = msg->msgid;
+		ack.timestamp = msg->timestamp;
+		ack.data.err = -1;
+		if (client_fd > 0)
+			mngr_send_msg(client_fd, &ack, NULL, 0);
+	}
+}
+
+static void handle_dm_notify(struct mngr_msg *msg, int client_fd, void *param)
+{
+	/* DM doesn't wait for an ack, it may be gone already */
+	vmmngr_notify_state(msg->data.dm_notify.name, msg->data.dm_notify.state);
+}
+
+static void handle_acrnd_list(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	vmmngr_pack_list(&ack.data.acrnd_list_ack, msg->data.acrnd_list.start);
 
 	if (client_fd > 0)
 		mngr_send_msg(client_fd, &ack, NULL, 0);
@@ -675,18 +1107,19 @@ static void sigterm_handler(int signo)
 	sigterm = 1;
 }
 
-static const char optString[] = "td:h";
+static const char optString[] = "tj:d:h";
 
 static void display_usage(void)
 {
 	printf("acrnd - Daemon for ACRN VM Management\n"
 #ifdef MNGR_DEBUG
-	       "[Usage] acrnd [-t] [-d delay] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-j jobs] [-d delay] [-h]\n\n"
 #else
-	       "[Usage] acrnd [-t] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-j jobs] [-h]\n\n"
 #endif
 	       "[Options]\n"
 	       "\t-t: print messages to stdout\n"
+	       "\t-j: start or stop up to <1-64> VMs at a time, number of CPUs by default\n"
 #ifdef MNGR_DEBUG
 	       "\t-d: delay the autostarting of VMs, <0-60> in second\n"
 #endif
@@ -697,6 +1130,7 @@ static void display_usage(void)
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret = 0;
+	long jobs;
 #ifdef MNGR_DEBUG
 	long delay = 0;
 #endif
@@ -706,6 +1140,15 @@ static int parse_opt(int argc, char *argv[])
 		case 't':
 			logfile = 0;
 			break;
+		case 'j':
+			errno = 0;
+			jobs = strtol(optarg, NULL, 10);
+			if (errno || jobs < 1 || jobs > MAX_VM_JOBS) {
+				printf("'-j' invalid parameter: %s\n", optarg);
+				return -EINVAL;
+			}
+			max_jobs = (int)jobs;
+			break;
 #ifdef MNGR_DEBUG
 		case 'd':
 			delay = strtol(optarg, NULL, 10);
@@ -745,6 +1188,14 @@ int main(int argc, char *argv[])
 
 	if (parse_opt(argc, argv))
 		return -1;
+
+	if (!max_jobs) {
+		max_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (max_jobs < 1)
+			max_jobs = 1;
+		else if (max_jobs > MAX_VM_JOBS)
+			max_jobs = MAX_VM_JOBS;
+	}
 	
 	if (!access(HW_IOC_PATH, F_OK)) {
 		platform_has_hw_ioc = 1;
@@ -771,6 +1222,12 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* VM states are pushed to us from here on, no more rescans */
+	if (vmmngr_cache_init())
+		fprintf(stderr, "Failed to track VM states, rescan them on demand\n");
+	mngr_add_handler(acrnd_fd, DM_NOTIFY, handle_dm_notify, NULL);
+	mngr_add_handler(acrnd_fd, ACRND_LIST, handle_acrnd_list, NULL);
+
 	if (init_vm()) {
 		printf("%s: Failed to init_vm\n", __func__);
 		return -1;
@@ -784,6 +1241,9 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Can not catch signal SIGTERM(%d), err: %s\n", SIGTERM, strerror(errno));
 	}
 
+	/* a requester may be gone by the time its ack is sent */
+	signal(SIGPIPE, SIG_IGN);
+
 	mngr_add_handler(acrnd_fd, ACRND_TIMER, handle_timer_req, NULL);
 	mngr_add_handler(acrnd_fd, ACRND_STOP, handle_acrnd_stop, NULL);
 	mngr_add_handler(acrnd_fd, ACRND_RESUME, handle_acrnd_resume, NULL);